@@ -0,0 +1,453 @@
+/*! \file cs237-bvh.cxx
+ *
+ * Support code for CMSC 23700 Autumn 2017.
+ *
+ * Implementation of the bounding-volume hierarchy.  The tree is built top down by
+ * splitting the items using the surface-area heuristic, which is evaluated over a
+ * fixed number of bins along the longest axis of the items' centers.
+ *
+ * \author John Reppy
+ */
+
+/*
+ * COPYRIGHT (c) 2017 John Reppy (http://cs.uchicago.edu/~jhr)
+ * All rights reserved.
+ */
+
+#include "cs237.hxx"
+#include <algorithm>
+#include <limits>
+
+namespace cs237 {
+
+  // the maximum number of items in a leaf
+    static const uint32_t kMaxLeafSize = 4;
+  // the number of bins used to evaluate the split costs
+    static const int kNumBins = 16;
+  // nodes at or below this depth are split at the median, which bounds the depth of the
+  // tree to kMedianDepth + log2(n / kMaxLeafSize)
+    static const int kMedianDepth = 32;
+  // the size of the traversal stacks, which is larger than the maximum depth
+    static const int kStackSize = 64;
+
+  // the surface area of a box (up to a factor of 2)
+    static inline float HalfArea (AABBf const &bb)
+    {
+        vec3f d = bb.max() - bb.min();
+        return d.x * d.y + d.y * d.z + d.z * d.x;
+    }
+
+  // return the inverse of a ray direction; zero components are mapped to a large
+  // value, instead of infinity, to avoid 0*inf in the slab tests
+    static inline vec3f InvDir (vec3f const &dir)
+    {
+        const float big = 1.0e30f;
+        return vec3f(
+            (dir.x != 0.0f) ? 1.0f / dir.x : std::copysign(big, dir.x),
+            (dir.y != 0.0f) ? 1.0f / dir.y : std::copysign(big, dir.y),
+            (dir.z != 0.0f) ? 1.0f / dir.z : std::copysign(big, dir.z));
+    }
+
+  // intersect a ray with a box; returns true if the ray segment [0..tMax] hits the box
+  // and sets tEnter to the entry point (which may be negative if orig is in the box)
+    static inline bool HitBox (
+        const float lo[3], const float hi[3],
+        vec3f const &orig, vec3f const &invDir, float tMax, float &tEnter)
+    {
+        float t0 = (lo[0] - orig.x) * invDir.x, t1 = (hi[0] - orig.x) * invDir.x;
+        float tNear = std::min(t0, t1), tFar = std::max(t0, t1);
+        t0 = (lo[1] - orig.y) * invDir.y;  t1 = (hi[1] - orig.y) * invDir.y;
+        tNear = std::max(tNear, std::min(t0, t1));  tFar = std::min(tFar, std::max(t0, t1));
+        t0 = (lo[2] - orig.z) * invDir.z;  t1 = (hi[2] - orig.z) * invDir.z;
+        tNear = std::max(tNear, std::min(t0, t1));  tFar = std::min(tFar, std::max(t0, t1));
+        tEnter = tNear;
+        return (tNear <= tFar) && (tFar >= 0.0f) && (tNear <= tMax);
+    }
+
+    void BVH::Build (size_t n, const AABBf *boxes, std::vector<uint32_t> &order)
+    {
+        this->Clear ();
+
+        order.resize (n);
+        if (n == 0) {
+            return;
+        }
+        std::vector<vec3f> centers(n);
+        for (uint32_t i = 0;  i < n;  i++) {
+            order[i] = i;
+            centers[i] = boxes[i].center();
+        }
+
+      // a binary tree with at most ceil(n / kMaxLeafSize) leaves
+        this->_nodes.reserve (2 * ((n + kMaxLeafSize - 1) / kMaxLeafSize));
+        this->_Build (boxes, centers, order.data(), 0, n, 0);
+
+      // copy the item bounds in leaf order
+        this->_minX.resize(n);  this->_minY.resize(n);  this->_minZ.resize(n);
+        this->_maxX.resize(n);  this->_maxY.resize(n);  this->_maxZ.resize(n);
+        for (size_t i = 0;  i < n;  i++) {
+            AABBf const &bb = boxes[order[i]];
+            this->_minX[i] = bb.minX();  this->_minY[i] = bb.minY();  this->_minZ[i] = bb.minZ();
+            this->_maxX[i] = bb.maxX();  this->_maxY[i] = bb.maxY();  this->_maxZ[i] = bb.maxZ();
+        }
+    }
+
+    uint32_t BVH::_Build (
+        const AABBf *boxes,
+        std::vector<vec3f> const &centers,
+        uint32_t *order,
+        uint32_t first,
+        uint32_t count,
+        int depth)
+    {
+        uint32_t id = this->_nodes.size();
+        this->_nodes.push_back (Node());
+
+      // compute the bounds of the items and of their centers
+        AABBf bbox, cbox;
+        for (uint32_t i = first;  i < first + count;  i++) {
+            bbox += boxes[order[i]];
+            cbox += centers[order[i]];
+        }
+        Node &nd = this->_nodes[id];
+        for (int k = 0;  k < 3;  k++) {
+            nd.lo[k] = bbox.min()[k];
+            nd.hi[k] = bbox.max()[k];
+        }
+        nd.first = first;
+        nd.count = count;
+        nd.second = 0;
+
+        if (count <= kMaxLeafSize) {
+            return id;
+        }
+
+      // split along the longest axis of the centers
+        vec3f ext = cbox.max() - cbox.min();
+        int axis = (ext.x >= ext.y) ? ((ext.x >= ext.z) ? 0 : 2) : ((ext.y >= ext.z) ? 1 : 2);
+        float cMin = cbox.min()[axis];
+        float cExt = ext[axis];
+        uint32_t mid = first + count / 2;
+        bool median = true;
+
+        if ((cExt > 0.0f) && (depth < kMedianDepth)) {
+          // bin the items by their centers and pick the split with the lowest cost
+            float scale = float(kNumBins) / cExt;
+            auto binOf = [&](uint32_t item) -> int {
+                int b = static_cast<int>((centers[item][axis] - cMin) * scale);
+                return std::min(b, kNumBins - 1);
+            };
+            AABBf binBox[kNumBins];
+            uint32_t binCount[kNumBins] = { 0 };
+            for (uint32_t i = first;  i < first + count;  i++) {
+                int b = binOf(order[i]);
+                binBox[b] += boxes[order[i]];
+                binCount[b]++;
+            }
+          // sweep from the right to compute the costs of the right-hand sides
+            float rightCost[kNumBins];
+            AABBf acc;
+            uint32_t n = 0;
+            for (int b = kNumBins - 1;  b > 0;  b--) {
+                if (binCount[b] > 0) {
+                    acc += binBox[b];
+                    n += binCount[b];
+                }
+                rightCost[b] = (n > 0) ? float(n) * HalfArea(acc) : 0.0f;
+            }
+          // sweep from the left to find the best split
+            int bestSplit = -1;
+            float bestCost = std::numeric_limits<float>::max();
+            acc.clear();
+            n = 0;
+            for (int b = 0;  b < kNumBins - 1;  b++) {
+                if (binCount[b] > 0) {
+                    acc += binBox[b];
+                    n += binCount[b];
+                }
+                if ((n > 0) && (n < count)) {
+                    float cost = float(n) * HalfArea(acc) + rightCost[b+1];
+                    if (cost < bestCost) {
+                        bestCost = cost;
+                        bestSplit = b;
+                    }
+                }
+            }
+            if (bestSplit >= 0) {
+                uint32_t *p = std::partition (order + first, order + first + count,
+                    [&](uint32_t item) { return binOf(item) <= bestSplit; });
+                mid = p - order;
+                median = false;
+            }
+        }
+        if (median && (cExt > 0.0f)) {
+          // median split
+            std::nth_element (order + first, order + mid, order + first + count,
+                [&](uint32_t a, uint32_t b) { return centers[a][axis] < centers[b][axis]; });
+        }
+
+      // the first child immediately follows this node
+        this->_Build (boxes, centers, order, first, mid - first, depth + 1);
+        uint32_t second = this->_Build (boxes, centers, order, mid, first + count - mid, depth + 1);
+        this->_nodes[id].second = second;
+
+        return id;
+    }
+
+    void BVH::Clear ()
+    {
+        this->_nodes.clear();
+        this->_minX.clear();  this->_minY.clear();  this->_minZ.clear();
+        this->_maxX.clear();  this->_maxY.clear();  this->_maxZ.clear();
+    }
+
+    AABBf BVH::BBox () const
+    {
+        Node const &root = this->_nodes[0];
+        return AABBf(
+            vec3f(root.lo[0], root.lo[1], root.lo[2]),
+            vec3f(root.hi[0], root.hi[1], root.hi[2]));
+    }
+
+    void BVH::FrustumQuery (
+        int nPlanes,
+        const vec3f *norms,
+        const float *dists,
+        std::vector<uint32_t> &items) const
+    {
+        assert ((0 < nPlanes) && (nPlanes <= 32));
+
+        if (this->_nodes.empty()) {
+            return;
+        }
+
+      // each stack entry has a bit mask of the planes that still need to be tested;
+      // the planes that contain a node also contain its children
+        struct Entry { uint32_t node, mask; };
+        Entry stack[kStackSize];
+        int sp = 0;
+        stack[sp++] = Entry{ 0, (nPlanes == 32) ? ~0u : ((1u << nPlanes) - 1) };
+
+        while (sp > 0) {
+            Entry e = stack[--sp];
+            Node const &nd = this->_nodes[e.node];
+          // test the node against the active planes using its nearest and farthest
+          // corners along each normal
+            uint32_t mask = e.mask;
+            bool outside = false;
+            for (int p = 0;  p < nPlanes;  p++) {
+                if ((mask & (1u << p)) == 0) {
+                    continue;
+                }
+                vec3f const &n = norms[p];
+                float far = dists[p]
+                    + n.x * ((n.x > 0.0f) ? nd.hi[0] : nd.lo[0])
+                    + n.y * ((n.y > 0.0f) ? nd.hi[1] : nd.lo[1])
+                    + n.z * ((n.z > 0.0f) ? nd.hi[2] : nd.lo[2]);
+                if (far < 0.0f) {
+                    outside = true;
+                    break;
+                }
+                float near = dists[p]
+                    + n.x * ((n.x > 0.0f) ? nd.lo[0] : nd.hi[0])
+                    + n.y * ((n.y > 0.0f) ? nd.lo[1] : nd.hi[1])
+                    + n.z * ((n.z > 0.0f) ? nd.lo[2] : nd.hi[2]);
+                if (near >= 0.0f) {
+                    mask &= ~(1u << p);
+                }
+            }
+            if (outside) {
+                continue;
+            }
+            if (mask == 0) {
+              // the node is completely inside the region
+                for (uint32_t i = nd.first;  i < nd.first + nd.count;  i++) {
+                    items.push_back (i);
+                }
+            }
+            else if (nd.second == 0) {
+              // test the items of the leaf
+                for (uint32_t i = nd.first;  i < nd.first + nd.count;  i++) {
+                    bool in = true;
+                    for (int p = 0;  in && (p < nPlanes);  p++) {
+                        if (mask & (1u << p)) {
+                            vec3f const &n = norms[p];
+                            float far = dists[p]
+                                + n.x * ((n.x > 0.0f) ? this->_maxX[i] : this->_minX[i])
+                                + n.y * ((n.y > 0.0f) ? this->_maxY[i] : this->_minY[i])
+                                + n.z * ((n.z > 0.0f) ? this->_maxZ[i] : this->_minZ[i]);
+                            in = (far >= 0.0f);
+                        }
+                    }
+                    if (in) {
+                        items.push_back (i);
+                    }
+                }
+            }
+            else {
+                stack[sp++] = Entry{ nd.second, mask };
+                stack[sp++] = Entry{ e.node + 1, mask };
+            }
+        }
+    }
+
+    void BVH::RadiusQuery (vec3f const &center, float radius, std::vector<uint32_t> &items) const
+    {
+        if (this->_nodes.empty()) {
+            return;
+        }
+
+        float r2 = radius * radius;
+        uint32_t stack[kStackSize];
+        int sp = 0;
+        stack[sp++] = 0;
+
+        while (sp > 0) {
+            uint32_t id = stack[--sp];
+            Node const &nd = this->_nodes[id];
+          // squared distances to the nearest and farthest points of the node's box
+            float dNear = 0.0f, dFar = 0.0f;
+            for (int k = 0;  k < 3;  k++) {
+                float dLo = center[k] - nd.lo[k];
+                float dHi = nd.hi[k] - center[k];
+                float d = std::max(0.0f, std::max(-dLo, -dHi));
+                dNear += d * d;
+                d = std::max(dLo, dHi);
+                dFar += d * d;
+            }
+            if (dNear > r2) {
+                continue;
+            }
+            if (dFar <= r2) {
+                for (uint32_t i = nd.first;  i < nd.first + nd.count;  i++) {
+                    items.push_back (i);
+                }
+            }
+            else if (nd.second == 0) {
+                for (uint32_t i = nd.first;  i < nd.first + nd.count;  i++) {
+                    float dx = std::max(0.0f, std::max(this->_minX[i] - center.x, center.x - this->_maxX[i]));
+                    float dy = std::max(0.0f, std::max(this->_minY[i] - center.y, center.y - this->_maxY[i]));
+                    float dz = std::max(0.0f, std::max(this->_minZ[i] - center.z, center.z - this->_maxZ[i]));
+                    if (dx*dx + dy*dy + dz*dz <= r2) {
+                        items.push_back (i);
+                    }
+                }
+            }
+            else {
+                stack[sp++] = nd.second;
+                stack[sp++] = id + 1;
+            }
+        }
+    }
+
+    void BVH::RayQuery (
+        vec3f const &orig,
+        vec3f const &dir,
+        float tMax,
+        std::vector<uint32_t> &items) const
+    {
+        if (this->_nodes.empty()) {
+            return;
+        }
+
+        vec3f invDir = InvDir(dir);
+        uint32_t stack[kStackSize];
+        int sp = 0;
+        stack[sp++] = 0;
+
+        while (sp > 0) {
+            uint32_t id = stack[--sp];
+            Node const &nd = this->_nodes[id];
+            float t;
+            if (! HitBox (nd.lo, nd.hi, orig, invDir, tMax, t)) {
+                continue;
+            }
+            if (nd.second == 0) {
+                for (uint32_t i = nd.first;  i < nd.first + nd.count;  i++) {
+                    float lo[3] = { this->_minX[i], this->_minY[i], this->_minZ[i] };
+                    float hi[3] = { this->_maxX[i], this->_maxY[i], this->_maxZ[i] };
+                    if (HitBox (lo, hi, orig, invDir, tMax, t)) {
+                        items.push_back (i);
+                    }
+                }
+            }
+            else {
+                stack[sp++] = nd.second;
+                stack[sp++] = id + 1;
+            }
+        }
+    }
+
+    int BVH::FirstHit (vec3f const &orig, vec3f const &dir, float &t) const
+    {
+        if (this->_nodes.empty()) {
+            return -1;
+        }
+
+        vec3f invDir = InvDir(dir);
+        float tBest = t;
+        int best = -1;
+
+      // the entries record the distance to the node's box, so that nodes that are
+      // farther than the best hit so far can be skipped
+        struct Entry { uint32_t node; float t; };
+        Entry stack[kStackSize];
+        int sp = 0;
+        float tRoot;
+        if (! HitBox (this->_nodes[0].lo, this->_nodes[0].hi, orig, invDir, tBest, tRoot)) {
+            return -1;
+        }
+        stack[sp++] = Entry{ 0, tRoot };
+
+        while (sp > 0) {
+            Entry e = stack[--sp];
+            if (e.t > tBest) {
+                continue;
+            }
+            Node const &nd = this->_nodes[e.node];
+            if (nd.second == 0) {
+                for (uint32_t i = nd.first;  i < nd.first + nd.count;  i++) {
+                    float lo[3] = { this->_minX[i], this->_minY[i], this->_minZ[i] };
+                    float hi[3] = { this->_maxX[i], this->_maxY[i], this->_maxZ[i] };
+                    float tHit;
+                    if (HitBox (lo, hi, orig, invDir, tBest, tHit)) {
+                        tHit = std::max(tHit, 0.0f);
+                        if ((best < 0) || (tHit < tBest)) {
+                            tBest = tHit;
+                            best = i;
+                        }
+                    }
+                }
+            }
+            else {
+              // visit the nearer child first
+                uint32_t c0 = e.node + 1, c1 = nd.second;
+                float t0, t1;
+                bool hit0 = HitBox (this->_nodes[c0].lo, this->_nodes[c0].hi, orig, invDir, tBest, t0);
+                bool hit1 = HitBox (this->_nodes[c1].lo, this->_nodes[c1].hi, orig, invDir, tBest, t1);
+                if (hit0 && hit1) {
+                    if (t0 <= t1) {
+                        stack[sp++] = Entry{ c1, t1 };
+                        stack[sp++] = Entry{ c0, t0 };
+                    }
+                    else {
+                        stack[sp++] = Entry{ c0, t0 };
+                        stack[sp++] = Entry{ c1, t1 };
+                    }
+                }
+                else if (hit0) {
+                    stack[sp++] = Entry{ c0, t0 };
+                }
+                else if (hit1) {
+                    stack[sp++] = Entry{ c1, t1 };
+                }
+            }
+        }
+
+        if (best >= 0) {
+            t = tBest;
+        }
+        return best;
+    }
+
+} /* namespace cs237 */
@@ -0,0 +1,302 @@
+/*! \file cs237-image-ops.cxx
+ *
+ * Support code for CMSC 23700 Autumn 2017.
+ *
+ * Kernels that operate on raw pixel data.
+ *
+ * \author John Reppy
+ */
+
+/*
+ * COPYRIGHT (c) 2017 John Reppy (http://cs.uchicago.edu/~jhr)
+ * All rights reserved.
+ */
+
+#include "cs237.hxx"
+#include <cstring>
+#include <vector>
+
+#if !defined(CS237_NO_SIMD) && defined(__SSE2__)
+#  define USE_SSE2
+#  include <emmintrin.h>
+  // SSSE3 is not part of the x86-64 baseline, so the kernels that need it are compiled
+  // for it separately and selected at runtime
+#  if defined(__GNUC__)
+#    define USE_SSSE3
+#    include <tmmintrin.h>
+#    define SSSE3_FN __attribute__((target("ssse3")))
+#  endif
+#endif
+
+namespace cs237 {
+
+#ifdef USE_SSSE3
+  //! does the processor support SSSE3?
+    static bool hasSSSE3 ()
+    {
+        static bool has = __builtin_cpu_supports("ssse3");
+        return has;
+    }
+#endif
+
+  /***** RGB <-> RGBA *****/
+
+    static void expandRGBToRGBA (const uint8_t *src, uint8_t *dst, size_t n, uint8_t alpha)
+    {
+        for (size_t i = 0;  i < n;  i++, src += 3, dst += 4) {
+            dst[0] = src[0];
+            dst[1] = src[1];
+            dst[2] = src[2];
+            dst[3] = alpha;
+        }
+    }
+
+    static void packRGBAToRGB (const uint8_t *src, uint8_t *dst, size_t n)
+    {
+        for (size_t i = 0;  i < n;  i++, src += 4, dst += 3) {
+            dst[0] = src[0];
+            dst[1] = src[1];
+            dst[2] = src[2];
+        }
+    }
+
+#ifdef USE_SSSE3
+  // convert four pixels per iteration; each iteration reads 16 bytes of RGB data, so we
+  // stop while there are at least 16 bytes (i.e., six pixels) left.
+    SSSE3_FN static size_t expandRGBToRGBA_SSSE3 (
+        const uint8_t *src, uint8_t *dst, size_t n, uint8_t alpha)
+    {
+        const __m128i shuffle = _mm_setr_epi8(
+            0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+        const __m128i alphaMask = _mm_set1_epi32(static_cast<int>(uint32_t(alpha) << 24));
+        size_t i = 0;
+        for (;  i + 6 <= n;  i += 4) {
+            __m128i rgb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 3*i));
+            __m128i rgba = _mm_or_si128(_mm_shuffle_epi8(rgb, shuffle), alphaMask);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 4*i), rgba);
+        }
+        return i;
+    }
+
+  // convert four pixels per iteration; each iteration writes 16 bytes of RGB data (the
+  // last four of which are overwritten by the next iteration), so we stop while there
+  // is room for 16 bytes.
+    SSSE3_FN static size_t packRGBAToRGB_SSSE3 (const uint8_t *src, uint8_t *dst, size_t n)
+    {
+        const __m128i shuffle = _mm_setr_epi8(
+            0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+        size_t i = 0;
+        for (;  i + 6 <= n;  i += 4) {
+            __m128i rgba = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 4*i));
+            _mm_storeu_si128(
+                reinterpret_cast<__m128i *>(dst + 3*i), _mm_shuffle_epi8(rgba, shuffle));
+        }
+        return i;
+    }
+#endif
+
+    void ExpandRGBToRGBA (const uint8_t *src, uint8_t *dst, size_t nPixels, uint8_t alpha)
+    {
+        size_t i = 0;
+#ifdef USE_SSSE3
+        if (hasSSSE3()) {
+            i = expandRGBToRGBA_SSSE3 (src, dst, nPixels, alpha);
+        }
+#endif
+        expandRGBToRGBA (src + 3*i, dst + 4*i, nPixels - i, alpha);
+    }
+
+    void PackRGBAToRGB (const uint8_t *src, uint8_t *dst, size_t nPixels)
+    {
+        size_t i = 0;
+#ifdef USE_SSSE3
+        if (hasSSSE3()) {
+            i = packRGBAToRGB_SSSE3 (src, dst, nPixels);
+        }
+#endif
+        packRGBAToRGB (src + 4*i, dst + 3*i, nPixels - i);
+    }
+
+  /***** 16-bit byte swapping *****/
+
+    void SwapBytes16 (uint16_t *data, size_t n)
+    {
+        size_t i = 0;
+#ifdef USE_SSE2
+        for (;  i + 8 <= n;  i += 8) {
+            __m128i *p = reinterpret_cast<__m128i *>(data + i);
+            __m128i v = _mm_loadu_si128(p);
+            _mm_storeu_si128(p, _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8)));
+        }
+#endif
+        for (;  i < n;  i++) {
+            data[i] = static_cast<uint16_t>((data[i] << 8) | (data[i] >> 8));
+        }
+    }
+
+  /***** Vertical flip *****/
+
+    void FlipRows (void *data, size_t rowBytes, size_t nRows)
+    {
+        uint8_t *base = reinterpret_cast<uint8_t *>(data);
+        for (size_t r = 0;  r < nRows / 2;  r++) {
+            uint8_t *top = base + r*rowBytes;
+            uint8_t *bot = base + (nRows - 1 - r)*rowBytes;
+            size_t i = 0;
+#ifdef USE_SSE2
+            for (;  i + 16 <= rowBytes;  i += 16) {
+                __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(top + i));
+                __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bot + i));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(top + i), b);
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(bot + i), a);
+            }
+#endif
+            for (;  i < rowBytes;  i++) {
+                uint8_t tmp = top[i];
+                top[i] = bot[i];
+                bot[i] = tmp;
+            }
+        }
+    }
+
+  /***** 2x downsampling *****/
+
+  // the downsampling is done one output row at a time.  First, the two source rows are
+  // added into a row of 16-bit sums; then each output element is computed from the sums
+  // for the two horizontally adjacent pixels as (s[i] + s[i+nChans] + 2) / 4.
+
+  // add two rows of bytes into 16-bit sums
+    static void sumRows (const uint8_t *a, const uint8_t *b, size_t n, uint16_t *sum)
+    {
+        size_t i = 0;
+#ifdef USE_SSE2
+        const __m128i zero = _mm_setzero_si128();
+        for (;  i + 16 <= n;  i += 16) {
+            __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+            __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+            __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(va, zero), _mm_unpacklo_epi8(vb, zero));
+            __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(va, zero), _mm_unpackhi_epi8(vb, zero));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(sum + i), lo);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(sum + i + 8), hi);
+        }
+#endif
+        for (;  i < n;  i++) {
+            sum[i] = a[i] + b[i];
+        }
+    }
+
+  // combine horizontally adjacent sums for output pixels [x0..outWid)
+    static void sumCols (
+        const uint16_t *sum, size_t x0, size_t outWid, uint32_t nChans, uint8_t *dst)
+    {
+        for (size_t x = x0;  x < outWid;  x++) {
+            const uint16_t *s = sum + 2*x*nChans;
+            for (uint32_t c = 0;  c < nChans;  c++) {
+                dst[x*nChans + c] = static_cast<uint8_t>((s[c] + s[c + nChans] + 2) >> 2);
+            }
+        }
+    }
+
+#ifdef USE_SSSE3
+  //! shuffle masks for compacting the output elements of sumColsSSSE3.  For a
+  //! pixel size of c, element i of the sums row is an output element when
+  //! (i mod 2c) < c.  A block of 48 elements is a whole number of pixel pairs for
+  //! 1 <= c <= 4, so the pattern of output elements in each of its three 16-element
+  //! parts is fixed.
+    struct CompactMasks {
+        uint8_t mask[5][3][16];         //!< pshufb masks indexed by c and part
+        int     count[5][3];            //!< number of output elements in each part
+
+        CompactMasks ()
+        {
+            for (int c = 1;  c <= 4;  c++) {
+                for (int j = 0;  j < 3;  j++) {
+                    int n = 0;
+                    for (int k = 0;  k < 16;  k++) {
+                        if ((16*j + k) % (2*c) < c) {
+                            this->mask[c][j][n++] = k;
+                        }
+                    }
+                    this->count[c][j] = n;
+                    for (int k = n;  k < 16;  k++) {
+                        this->mask[c][j][k] = 0x80;
+                    }
+                }
+            }
+        }
+    };
+
+  // combine horizontally adjacent sums 48 elements (24 output bytes) at a time; returns
+  // the number of output pixels that were computed.
+    SSSE3_FN static size_t sumColsSSSE3 (
+        const uint16_t *sum, size_t n, uint32_t nChans, uint8_t *dst)
+    {
+        static const CompactMasks masks;
+
+        const __m128i two = _mm_set1_epi16(2);
+        __m128i mask[3];
+        for (int j = 0;  j < 3;  j++) {
+            mask[j] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(masks.mask[nChans][j]));
+        }
+
+      // the loads of a block reach 48+nChans elements past i0 and its last store reaches
+      // 24+9 bytes past the output position, so we leave a generous margin
+        size_t i0 = 0;
+        for (;  i0 + 96 <= n;  i0 += 48) {
+            uint8_t *out = dst + i0/2;
+            for (int j = 0;  j < 3;  j++) {
+                const uint16_t *s = sum + i0 + 16*j;
+                __m128i lo = _mm_add_epi16(
+                    _mm_loadu_si128(reinterpret_cast<const __m128i *>(s)),
+                    _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + nChans)));
+                __m128i hi = _mm_add_epi16(
+                    _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + 8)),
+                    _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + 8 + nChans)));
+                lo = _mm_srli_epi16(_mm_add_epi16(lo, two), 2);
+                hi = _mm_srli_epi16(_mm_add_epi16(hi, two), 2);
+                __m128i bytes = _mm_shuffle_epi8(_mm_packus_epi16(lo, hi), mask[j]);
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(out), bytes);
+                out += masks.count[nChans][j];
+            }
+        }
+
+        return i0 / (2*nChans);
+    }
+#endif
+
+    void DownsampleBox2x (
+        const uint8_t *src, uint32_t wid, uint32_t ht, uint32_t nChans, uint8_t *dst)
+    {
+        assert ((1 <= nChans) && (nChans <= 4));
+        assert ((wid == 1) || ((wid & 1) == 0));
+        assert ((ht == 1) || ((ht & 1) == 0));
+
+        size_t rowBytes = size_t(wid) * nChans;
+        size_t outWid = (wid > 1) ? wid / 2 : 1;
+        size_t outHt = (ht > 1) ? ht / 2 : 1;
+        size_t outRowBytes = outWid * nChans;
+        std::vector<uint16_t> sum(rowBytes);
+
+        for (size_t y = 0;  y < outHt;  y++) {
+            const uint8_t *a = src + ((ht > 1) ? 2*y : 0) * rowBytes;
+            const uint8_t *b = (ht > 1) ? a + rowBytes : a;
+            uint8_t *out = dst + y*outRowBytes;
+            sumRows (a, b, rowBytes, sum.data());
+            if (wid == 1) {
+              // a single column, so each output element is (2*sum + 2) / 4
+                for (uint32_t c = 0;  c < nChans;  c++) {
+                    out[c] = static_cast<uint8_t>((2*sum[c] + 2) >> 2);
+                }
+                continue;
+            }
+            size_t x = 0;
+#ifdef USE_SSSE3
+            if (hasSSSE3()) {
+                x = sumColsSSSE3 (sum.data(), rowBytes, nChans, out);
+            }
+#endif
+            sumCols (sum.data(), x, outWid, nChans, out);
+        }
+    }
+
+} /* namespace cs237 */
@@ -14,6 +14,11 @@
 
 #include "cs237.hxx"
 #include "png.h"
+#include <cstring>
+#include <vector>
+
+//! the size of the blocks in the per-thread PNG decoding arena
+#define DECODE_ARENA_BLOCK_SZ	(256*1024)
 
 namespace cs237 {
 
@@ -69,6 +74,21 @@ namespace cs237 {
 	}
     } /* sizeOfType */
 
+  //! \brief helper function to map a compressed format to the size of a 4x4 block
+  //! \return the number of bytes per block or 0 if fmt is not a compressed format
+    static size_t blockSize (GLenum fmt)
+    {
+	switch (fmt) {
+	  case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+	  case GL_COMPRESSED_RED_RGTC1:
+	    return 8;
+	  case GL_COMPRESSED_RG_RGTC2:
+	    return 16;
+	  default:
+	    return 0;
+	}
+    } /* blockSize */
+
   //! \brief read function wrapper around an istream.
     static void readData (png_struct *pngPtr, png_bytep data, png_size_t length)
     {
@@ -83,34 +103,116 @@ namespace cs237 {
 	}
     }
 
-  //! \brief helper function to read a PNG image from an input stream
-  //! \param inS the input stream
+  //! \brief a PNG data source that is a range of bytes in memory
+    struct MemSource {
+	const png_byte	*_next;		//!< the next byte to read
+	size_t		_nLeft;		//!< the number of bytes remaining
+    };
+
+  //! \brief read function wrapper around a range of bytes.
+    static void readMem (png_struct *pngPtr, png_bytep data, png_size_t length)
+    {
+	MemSource *src = reinterpret_cast<MemSource *>(png_get_io_ptr(pngPtr));
+	if (src->_nLeft < length) {
+#if ((PNG_LIBPNG_VER_MAJOR == 1) && (PNG_LIBPNG_VER_MINOR < 5))
+	    longjmp(pngPtr->jmpbuf, 1);
+#else
+	    png_longjmp (pngPtr, 1);
+#endif
+	}
+	std::memcpy (data, src->_next, length);
+	src->_next += length;
+	src->_nLeft -= length;
+    }
+
+  //! \brief per-thread storage for decoding PNG images.  libpng has to create fresh
+  //! read structures for every image, so we supply it with an allocator that carves
+  //! memory out of a thread-local arena, which is reset at the start of each decode.
+  //! Once a thread has decoded an image, decoding images of the same (or smaller) size
+  //! does not touch the heap.
+    struct DecodeArena {
+	struct Block {
+	    char	*_base;		//!< the block's storage
+	    size_t	_sz;		//!< the size of the block in bytes
+	};
+	std::vector<Block>	_blocks;	//!< the blocks of the arena
+	size_t		_cur;		//!< the block that we are allocating from
+	size_t		_used;		//!< number of bytes allocated from the current block
+	std::vector<png_bytep>	_rows;	//!< row pointers for the image being decoded
+
+	DecodeArena () : _cur(0), _used(0) { }
+	~DecodeArena ()
+	{
+	    for (auto it = this->_blocks.begin();  it != this->_blocks.end();  it++) {
+		std::free (it->_base);
+	    }
+	}
+
+      //! release all of the memory allocated from the arena
+	void reset () { this->_cur = 0;  this->_used = 0; }
+
+      //! allocate memory (16-byte aligned) from the arena
+	void *alloc (size_t n)
+	{
+	    n = (n + 15) & ~static_cast<size_t>(15);
+	    for (;  this->_cur < this->_blocks.size();  this->_cur++, this->_used = 0) {
+		Block &b = this->_blocks[this->_cur];
+		if (this->_used + n <= b._sz) {
+		    void *p = b._base + this->_used;
+		    this->_used += n;
+		    return p;
+		}
+	    }
+	    size_t sz = (n < DECODE_ARENA_BLOCK_SZ) ? DECODE_ARENA_BLOCK_SZ : n;
+	    char *p = static_cast<char *>(std::malloc(sz));
+	    if (p == nullptr) {
+		return nullptr;
+	    }
+	    this->_blocks.push_back (Block{p, sz});
+	    this->_cur = this->_blocks.size() - 1;
+	    this->_used = n;
+	    return p;
+	}
+    };
+
+    static thread_local DecodeArena decodeArena;
+
+#ifdef PNG_USER_MEM_SUPPORTED
+  //! \brief libpng allocation function that uses the decoding arena
+    static png_voidp arenaMalloc (png_structp pngPtr, png_alloc_size_t n)
+    {
+	return decodeArena.alloc (n);
+    }
+
+  //! \brief libpng free function for the decoding arena; memory is reclaimed when the
+  //! arena is reset.
+    static void arenaFree (png_structp pngPtr, png_voidp ptr) { }
+#endif
+
+  //! \brief helper function to decode a PNG image whose signature has already been read
+  //! \param ioPtr the I/O pointer that is passed to readFn
+  //! \param readFn the function used by libpng to read the data
   //! \param flip true if the rows of the image should be flipped to match OpenGL coordinates
+  //! \param buf caller-supplied storage for the pixels (may be nullptr)
+  //! \param bufSz the size of buf in bytes
   //! \param widOut output variable for the image width
   //! \param htOut output variable for the image height (nullptr for 1D images)
   //! \param fmtOut output variable for the OpenGL pixel format
   //! \param tyOut output variable for the OpenGL pixel type
-  //! \return a pointer to the image data, or nullptr on error
-    void *readPNG (std::ifstream &inS, bool flip, GLsizei *widOut, GLsizei *htOut, GLenum *fmtOut, GLenum *tyOut)
+  //! \return a pointer to the image data, or nullptr on error.  The result is buf if
+  //!         the image fits in it; otherwise it is freshly allocated with malloc.
+    static void *decodePNG (
+	void *ioPtr, png_rw_ptr readFn, bool flip, void *buf, size_t bufSz,
+	GLsizei *widOut, GLsizei *htOut, GLenum *fmtOut, GLenum *tyOut)
     {
-      /* check PNG signature */
-	unsigned char sig[8];
-	inS.read (reinterpret_cast<char *>(sig), sizeof(sig));
-	if (! inS.good()) {
-#ifndef NDEBUG
-	    std::cerr << "readPNG: I/O error reading header" << std::endl;
-#endif
-	    return nullptr;
-	}
-	if (png_sig_cmp(sig, 0, 8)) {
-#ifndef NDEBUG
-	    std::cerr << "readPNG: bogus header" << std::endl;
-#endif
-	    return nullptr;
-	}
-
       /* setup read structures */
+	decodeArena.reset();
+#ifdef PNG_USER_MEM_SUPPORTED
+	png_structp pngPtr = png_create_read_struct_2(PNG_LIBPNG_VER_STRING, 0, 0, 0,
+	    0, arenaMalloc, arenaFree);
+#else
 	png_structp pngPtr = png_create_read_struct(PNG_LIBPNG_VER_STRING, 0, 0, 0);
+#endif
 	if (pngPtr == nullptr) {
 #ifndef NDEBUG
 	    std::cerr << "readPNG: error creating read_struct" << std::endl;
@@ -144,7 +246,7 @@ namespace cs237 {
 	}
 
       /* set up input */
-	png_set_read_fn (pngPtr, reinterpret_cast<void *>(&inS), readData);
+	png_set_read_fn (pngPtr, ioPtr, readFn);
 
       /* let the PNG library know that we already checked the signature */
 	png_set_sig_bytes (pngPtr, 8);
@@ -167,8 +269,6 @@ namespace cs237 {
 		png_set_expand_gray_1_2_4_to_8(pngPtr);
 	    }
 	    else if (bitDepth == 16) {
-	      // PNG files store date in network byte order (big-endian), but the x86 is little-endian
-		png_set_swap (pngPtr);
 		ty = GL_UNSIGNED_SHORT;
 		bytesPerPixel = 2;
 	    }
@@ -178,8 +278,6 @@ namespace cs237 {
 	    ty = GL_UNSIGNED_BYTE;
 	    bytesPerPixel = 2;
 	    if (bitDepth == 16) {
-	      // PNG files store date in network byte order (big-endian), but the x86 is little-endian
-		png_set_swap (pngPtr);
 		bytesPerPixel = 4;
 		ty = GL_UNSIGNED_SHORT;
 	    }
@@ -195,9 +293,7 @@ namespace cs237 {
 	    ty = GL_UNSIGNED_BYTE;
 	    bytesPerPixel = 3;
 	    if (bitDepth == 16) {
-	      // PNG files store date in network byte order (big-endian), but the x86 is little-endian
-		png_set_swap (pngPtr);
-		bytesPerPixel = 12;
+		bytesPerPixel = 6;
 		ty = GL_UNSIGNED_SHORT;
 	    }
 	    break;
@@ -206,8 +302,6 @@ namespace cs237 {
 	    ty = GL_UNSIGNED_BYTE;
 	    bytesPerPixel = 4;
 	    if (bitDepth == 16) {
-	      // PNG files store date in network byte order (big-endian), but the x86 is little-endian
-		png_set_swap (pngPtr);
 		bytesPerPixel = 8;
 		ty = GL_UNSIGNED_SHORT;
 	    }
@@ -225,12 +319,15 @@ namespace cs237 {
 #ifndef NDEBUG
 	    std::cerr << "readPNG: image too large" << std::endl;
 #endif
+	    png_destroy_read_struct (&pngPtr, &infoPtr, &endPtr);
 	    return nullptr;
 	}
 
-      /* allocate image data */
-	int bytesPerRow = bytesPerPixel * width;
-	png_byte *img = (png_bytep) std::malloc (height * bytesPerRow);
+      /* allocate image data, unless the caller's buffer is big enough */
+	size_t bytesPerRow = bytesPerPixel * width;
+	png_byte *img = (height * bytesPerRow <= bufSz)
+	    ? reinterpret_cast<png_bytep>(buf)
+	    : reinterpret_cast<png_bytep>(std::malloc (height * bytesPerRow));
 	if (img == nullptr) {
 #ifndef NDEBUG
 	    std::cerr << "readPNG: unable to allocate image" << std::endl;
@@ -239,7 +336,8 @@ namespace cs237 {
 	    return nullptr;
 	}
 
-	png_bytepp rowPtrs = new png_bytep[height];
+	decodeArena._rows.resize (height);
+	png_bytepp rowPtrs = decodeArena._rows.data();
 	if (flip) {
 	  /* setup row pointers so that the texture has OpenGL orientation */
 	    for (png_uint_32 i = 1;  i <= height;  i++)
@@ -253,9 +351,16 @@ namespace cs237 {
       /* read the image */
 	png_read_image(pngPtr, rowPtrs);
 
+      /* PNG files store 16-bit samples in network byte order (big-endian), but the x86 is
+       * little-endian.  We swap the whole image at once, which is faster than having libpng
+       * swap each row.
+       */
+	if (ty == GL_UNSIGNED_SHORT) {
+	    SwapBytes16 (reinterpret_cast<uint16_t *>(img), (height * bytesPerRow) / 2);
+	}
+
       /* Clean up. */
 	png_destroy_read_struct (&pngPtr, &infoPtr, &endPtr);
-	delete[] rowPtrs;
 
 	if ((htOut == nullptr) && (height > 1)) {
 	    width *= height;
@@ -268,6 +373,70 @@ namespace cs237 {
 
 	return img;
 
+    } /* decodePNG */
+
+  //! \brief helper function to read a PNG image from an input stream
+  //! \param inS the input stream
+  //! \param flip true if the rows of the image should be flipped to match OpenGL coordinates
+  //! \param widOut output variable for the image width
+  //! \param htOut output variable for the image height (nullptr for 1D images)
+  //! \param fmtOut output variable for the OpenGL pixel format
+  //! \param tyOut output variable for the OpenGL pixel type
+  //! \return a pointer to the image data, or nullptr on error
+    void *readPNG (std::ifstream &inS, bool flip, GLsizei *widOut, GLsizei *htOut, GLenum *fmtOut, GLenum *tyOut)
+    {
+      /* check PNG signature */
+	unsigned char sig[8];
+	inS.read (reinterpret_cast<char *>(sig), sizeof(sig));
+	if (! inS.good()) {
+#ifndef NDEBUG
+	    std::cerr << "readPNG: I/O error reading header" << std::endl;
+#endif
+	    return nullptr;
+	}
+	if (png_sig_cmp(sig, 0, 8)) {
+#ifndef NDEBUG
+	    std::cerr << "readPNG: bogus header" << std::endl;
+#endif
+	    return nullptr;
+	}
+
+	return decodePNG (
+	    reinterpret_cast<void *>(&inS), readData, flip, nullptr, 0,
+	    widOut, htOut, fmtOut, tyOut);
+
+    } /* readPNG */
+
+  //! \brief helper function to read a PNG image from memory
+  //! \param data the PNG-format data
+  //! \param nBytes the number of bytes of data
+  //! \param flip true if the rows of the image should be flipped to match OpenGL coordinates
+  //! \param buf caller-supplied storage for the pixels (may be nullptr)
+  //! \param bufSz the size of buf in bytes
+  //! \param widOut output variable for the image width
+  //! \param htOut output variable for the image height
+  //! \param fmtOut output variable for the OpenGL pixel format
+  //! \param tyOut output variable for the OpenGL pixel type
+  //! \return a pointer to the image data (buf, if the image fits), or nullptr on error
+    static void *readPNG (
+	const void *data, size_t nBytes, bool flip, void *buf, size_t bufSz,
+	GLsizei *widOut, GLsizei *htOut, GLenum *fmtOut, GLenum *tyOut)
+    {
+	const png_byte *bytes = reinterpret_cast<const png_byte *>(data);
+
+      /* check PNG signature */
+	if ((nBytes < 8) || png_sig_cmp(const_cast<png_bytep>(bytes), 0, 8)) {
+#ifndef NDEBUG
+	    std::cerr << "readPNG: bogus header" << std::endl;
+#endif
+	    return nullptr;
+	}
+
+	MemSource src = { bytes + 8, nBytes - 8 };
+	return decodePNG (
+	    reinterpret_cast<void *>(&src), readMem, flip, buf, bufSz,
+	    widOut, htOut, fmtOut, tyOut);
+
     } /* readPNG */
 
   //! \brief write function wrapper around an ostream.
@@ -449,6 +618,11 @@ namespace cs237 {
 		std::free(this->_data);
 	}
 
+	bool image_base::isCompressed () const
+	{
+	    return (blockSize (this->_format) != 0);
+	}
+
 	unsigned int image_base::nChannels () const
 	{
 	    return numChannels (this->_format);
@@ -533,6 +707,20 @@ namespace cs237 {
 	: __detail::image_base (2, fmt, ty, wid * ht), _wid(wid), _ht(ht)
     { }
 
+    image2d::image2d (uint32_t wid, uint32_t ht, GLenum cfmt)
+	: __detail::image_base (2), _wid(wid), _ht(ht)
+    {
+	assert (((wid & 3) == 0) && ((ht & 3) == 0));
+	if (blockSize(cfmt) == 0) {
+	    std::cerr << "Error: invalid compressed format " << cfmt << " specified for image"
+		<< std::endl;
+	    exit (1);
+	}
+	this->_format = cfmt;
+	this->_nBytes = (wid / 4) * (ht / 4) * blockSize(cfmt);
+	this->_data = std::malloc(this->_nBytes);
+    }
+
     image2d::image2d (std::string const &file, bool flip)
 	: __detail::image_base (2)
     {
@@ -567,12 +755,58 @@ namespace cs237 {
 	this->_nBytes = numChannels(this->_format) * this->_wid * this->_ht * sizeOfType(this->_type);
     }
 
+    image2d::image2d (const uint8_t *data, size_t nBytes, bool flip)
+	: __detail::image_base (2)
+    {
+	this->_data = readPNG(data, nBytes, flip, nullptr, 0,
+	    &this->_wid, &this->_ht, &this->_format, &this->_type);
+	if (this->_data == nullptr) {
+	    std::cerr << "image2d::image2d: unable to decode 2D image" << std::endl;
+	    exit (1);
+	}
+	this->_nBytes = numChannels(this->_format) * this->_wid * this->_ht * sizeOfType(this->_type);
+    }
+
+    bool image2d::Decode (const uint8_t *data, size_t nBytes, bool flip)
+    {
+	GLsizei wid, ht;
+	GLenum fmt, ty;
+	void *pixels = readPNG(data, nBytes, flip, this->_data, this->_nBytes, &wid, &ht, &fmt, &ty);
+	if (pixels == nullptr) {
+	    return false;
+	}
+	if (pixels != this->_data) {
+	  // the image did not fit in our existing storage
+	    std::free (this->_data);
+	    this->_data = pixels;
+	}
+	this->_wid = wid;
+	this->_ht = ht;
+	this->_format = fmt;
+	this->_type = ty;
+	this->_nBytes = numChannels(fmt) * wid * ht * sizeOfType(ty);
+
+	return true;
+    }
+
   // Load the image into a GL texture
     void image2d::texImage (GLenum target, GLuint texId)
     {
 	assert ((target = GL_TEXTURE_2D) || (target == GL_TEXTURE_RECTANGLE));
 
 	CS237_CHECK( glBindTexture (target, texId) );
+	if (this->isCompressed()) {
+	    CS237_CHECK( glCompressedTexImage2D (
+		target,		// target
+		0,		// level
+		this->_format,	// compressed format
+		this->_wid,	// width
+		this->_ht,	// height
+		0,		// border
+		this->_nBytes,	// size of the compressed data
+		this->_data) );	// image data
+	    return;
+	}
 	CS237_CHECK( glTexImage2D (
 	    target,		// target
 	    0,			// level
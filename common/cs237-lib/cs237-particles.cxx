@@ -0,0 +1,393 @@
+/*! \file cs237-particles.cxx
+ *
+ * Support code for CMSC 23700 Autumn 2017.
+ *
+ * Implementation of the particle pool.  A sequential update integrates the particles
+ * and compacts the survivors in place in a single pass over the live range.  A
+ * parallel update splits the live range into chunks; it first counts the survivors
+ * of each chunk, which determines where the chunk's survivors go, and then updates
+ * the chunks into a second set of arrays.
+ *
+ * \author John Reppy
+ */
+
+/*
+ * COPYRIGHT (c) 2017 John Reppy (http://cs.uchicago.edu/~jhr)
+ * All rights reserved.
+ */
+
+#include "cs237.hxx"
+#include <algorithm>
+#include <cstring>
+
+#if !defined(CS237_NO_SIMD) && defined(__SSE2__)
+#  define USE_SSE2
+#  include <emmintrin.h>
+#endif
+
+namespace cs237 {
+
+  // the number of particles in a chunk of a parallel update
+    static const size_t kGrain = 16 * 1024;
+  // pools with fewer live particles than this are updated sequentially
+    static const size_t kParallelMin = 4 * kGrain;
+
+    void ParticleSystem::Arrays::Resize (size_t n)
+    {
+        this->life.resize(n);
+        this->px.resize(n);  this->py.resize(n);  this->pz.resize(n);
+        this->vx.resize(n);  this->vy.resize(n);  this->vz.resize(n);
+    }
+
+    ParticleSystem::ParticleSystem (size_t capacity)
+        : _nLive(0), _nUnsorted(0)
+    {
+        this->_cur.Resize (capacity);
+    }
+
+    bool ParticleSystem::Spawn (float life, vec3f const &pos, vec3f const &vel)
+    {
+        if (this->_nLive == this->Capacity()) {
+            return false;
+        }
+        size_t i = this->_nLive++;
+        this->_nUnsorted++;
+        Arrays &a = this->_cur;
+        a.life[i] = life;
+        a.px[i] = pos.x;  a.py[i] = pos.y;  a.pz[i] = pos.z;
+        a.vx[i] = vel.x;  a.vy[i] = vel.y;  a.vz[i] = vel.z;
+        return true;
+    }
+
+    void ParticleSystem::Kill (size_t i)
+    {
+        assert (i < this->_nLive);
+        size_t last = --this->_nLive;
+        if (i != last) {
+            Arrays &a = this->_cur;
+            a.life[i] = a.life[last];
+            a.px[i] = a.px[last];  a.py[i] = a.py[last];  a.pz[i] = a.pz[last];
+            a.vx[i] = a.vx[last];  a.vy[i] = a.vy[last];  a.vz[i] = a.vz[last];
+        }
+      // the moved particle may have been spawned since the last sort, but SortByDistance
+      // does not depend on the new particles being at the end
+    }
+
+    void ParticleSystem::SetCapacity (size_t capacity)
+    {
+        this->_cur.Resize (capacity);
+        this->_nLive = std::min(this->_nLive, capacity);
+      // the other arrays are reallocated on demand
+        this->_next = Arrays();
+    }
+
+    size_t ParticleSystem::_UpdateRange (
+        Arrays &src, size_t lo, size_t hi,
+        Arrays &dst, size_t w,
+        float dt, vec3f const &dv)
+    {
+        const float *life = src.life.data();
+        const float *px = src.px.data(), *py = src.py.data(), *pz = src.pz.data();
+        const float *vx = src.vx.data(), *vy = src.vy.data(), *vz = src.vz.data();
+        float *dLife = dst.life.data();
+        float *dPx = dst.px.data(), *dPy = dst.py.data(), *dPz = dst.pz.data();
+        float *dVx = dst.vx.data(), *dVy = dst.vy.data(), *dVz = dst.vz.data();
+
+      // when updating in place, w <= i, so we only overwrite particles that have
+      // already been read
+        size_t w0 = w;
+        size_t i = lo;
+#ifdef USE_SSE2
+        const __m128 vDt = _mm_set1_ps(dt);
+        const __m128 vDvx = _mm_set1_ps(dv.x);
+        const __m128 vDvy = _mm_set1_ps(dv.y);
+        const __m128 vDvz = _mm_set1_ps(dv.z);
+        const __m128 zero = _mm_setzero_ps();
+        for (;  i + 4 <= hi;  i += 4) {
+            __m128 l = _mm_sub_ps(_mm_loadu_ps(life + i), vDt);
+            int alive = _mm_movemask_ps(_mm_cmpgt_ps(l, zero));
+            if (alive == 0) {
+                continue;
+            }
+            __m128 nvx = _mm_add_ps(_mm_loadu_ps(vx + i), vDvx);
+            __m128 nvy = _mm_add_ps(_mm_loadu_ps(vy + i), vDvy);
+            __m128 nvz = _mm_add_ps(_mm_loadu_ps(vz + i), vDvz);
+            __m128 npx = _mm_add_ps(_mm_loadu_ps(px + i), _mm_mul_ps(nvx, vDt));
+            __m128 npy = _mm_add_ps(_mm_loadu_ps(py + i), _mm_mul_ps(nvy, vDt));
+            __m128 npz = _mm_add_ps(_mm_loadu_ps(pz + i), _mm_mul_ps(nvz, vDt));
+            if (alive == 0xf) {
+              // the common case: all four survive
+                _mm_storeu_ps(dLife + w, l);
+                _mm_storeu_ps(dPx + w, npx);  _mm_storeu_ps(dPy + w, npy);  _mm_storeu_ps(dPz + w, npz);
+                _mm_storeu_ps(dVx + w, nvx);  _mm_storeu_ps(dVy + w, nvy);  _mm_storeu_ps(dVz + w, nvz);
+                w += 4;
+            }
+            else {
+                float tl[4], tpx[4], tpy[4], tpz[4], tvx[4], tvy[4], tvz[4];
+                _mm_storeu_ps(tl, l);
+                _mm_storeu_ps(tpx, npx);  _mm_storeu_ps(tpy, npy);  _mm_storeu_ps(tpz, npz);
+                _mm_storeu_ps(tvx, nvx);  _mm_storeu_ps(tvy, nvy);  _mm_storeu_ps(tvz, nvz);
+                for (int k = 0;  k < 4;  k++) {
+                    if (alive & (1 << k)) {
+                        dLife[w] = tl[k];
+                        dPx[w] = tpx[k];  dPy[w] = tpy[k];  dPz[w] = tpz[k];
+                        dVx[w] = tvx[k];  dVy[w] = tvy[k];  dVz[w] = tvz[k];
+                        w++;
+                    }
+                }
+            }
+        }
+#endif
+        for (;  i < hi;  i++) {
+            float l = life[i] - dt;
+            if (l > 0.0f) {
+                float nvx = vx[i] + dv.x;
+                float nvy = vy[i] + dv.y;
+                float nvz = vz[i] + dv.z;
+                dLife[w] = l;
+                dPx[w] = px[i] + nvx * dt;
+                dPy[w] = py[i] + nvy * dt;
+                dPz[w] = pz[i] + nvz * dt;
+                dVx[w] = nvx;  dVy[w] = nvy;  dVz[w] = nvz;
+                w++;
+            }
+        }
+
+        return w - w0;
+    }
+
+    void ParticleSystem::Update (float dt, vec3f const &accel, ThreadPool *pool)
+    {
+        size_t n = this->_nLive;
+        vec3f dv = accel * dt;
+
+        if ((pool == nullptr) || (n < kParallelMin)) {
+            this->_nLive = _UpdateRange (this->_cur, 0, n, this->_cur, 0, dt, dv);
+            return;
+        }
+
+      // count the survivors of each chunk; this test must match the one in _UpdateRange
+        size_t nChunks = (n + kGrain - 1) / kGrain;
+        std::vector<size_t> offsets(nChunks + 1);
+        const float *life = this->_cur.life.data();
+        pool->ParallelFor (n, kGrain,
+            [life, dt, &offsets] (size_t lo, size_t hi) {
+                size_t cnt = 0;
+                for (size_t i = lo;  i < hi;  i++) {
+                    cnt += ((life[i] - dt) > 0.0f) ? 1 : 0;
+                }
+                offsets[lo / kGrain + 1] = cnt;
+            });
+
+      // convert the counts to the offsets of the chunks' survivors
+        for (size_t c = 0;  c < nChunks;  c++) {
+            offsets[c+1] += offsets[c];
+        }
+
+      // update the chunks into the other set of arrays and then swap the sets
+        this->_next.Resize (this->Capacity());
+        Arrays &src = this->_cur;
+        Arrays &dst = this->_next;
+        pool->ParallelFor (n, kGrain,
+            [&src, &dst, dt, &dv, &offsets] (size_t lo, size_t hi) {
+                _UpdateRange (src, lo, hi, dst, offsets[lo / kGrain], dt, dv);
+            });
+        std::swap (this->_cur, this->_next);
+        this->_nLive = offsets[nChunks];
+    }
+
+  // the number of element moves per particle that an insertion sort is allowed before
+  // we give up and use the radix sort
+    static const size_t kInsertionMoves = 8;
+  // the insertion sort is not tried when more than one in this many of the keys is
+  // smaller than its predecessor
+    static const size_t kMaxDescents = 32;
+  // runs of new particles that are shorter than this are sorted with std::sort
+    static const size_t kRadixMin = 1024;
+  // the number of bits in a sort key
+    static const int kKeyBits = 16;
+    static const uint32_t kKeyMax = (1 << kKeyBits) - 1;
+  // the number of bits per radix-sort digit; three passes cover any 32-bit key, but the
+  // passes over digits that are the same for all keys are skipped, so the 16-bit keys
+  // take two passes
+    static const int kRadixBits = 11;
+    static const uint32_t kRadixSize = (1 << kRadixBits);
+
+  // sort items by insertion, giving up once more than budget moves have been made (in
+  // which case the items are left partially sorted); returns true if the items are sorted
+    template <typename T>
+    static bool InsertionSort (T *items, size_t n, size_t budget)
+    {
+        size_t nMoves = 0;
+        for (size_t i = 1;  i < n;  i++) {
+            T item = items[i];
+            size_t j = i;
+            while ((j > 0) && (item.key < items[j-1].key)) {
+                items[j] = items[j-1];
+                j--;
+            }
+            items[j] = item;
+            nMoves += i - j;
+            if (nMoves > budget) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void ParticleSystem::_RadixSort (size_t lo, size_t hi)
+    {
+        size_t n = hi - lo;
+        if (n < 2) {
+            return;
+        }
+
+      // compute the histograms of the three digits in one pass
+        std::vector<uint32_t> hist(3 * kRadixSize, 0);
+        SortItem *src = this->_order.data() + lo;
+        for (size_t i = 0;  i < n;  i++) {
+            uint32_t k = src[i].key;
+            hist[k & (kRadixSize - 1)]++;
+            hist[kRadixSize + ((k >> kRadixBits) & (kRadixSize - 1))]++;
+            hist[2*kRadixSize + (k >> (2*kRadixBits))]++;
+        }
+
+        this->_orderTmp.resize (this->_order.size());
+        SortItem *dst = this->_orderTmp.data() + lo;
+        for (int pass = 0;  pass < 3;  pass++) {
+            uint32_t *count = hist.data() + pass * kRadixSize;
+            int shift = pass * kRadixBits;
+          // skip the pass when all of the keys have the same digit
+            if (count[(src[0].key >> shift) & (kRadixSize - 1)] == n) {
+                continue;
+            }
+          // convert the counts to offsets and distribute the items
+            uint32_t offset = 0;
+            for (uint32_t d = 0;  d < kRadixSize;  d++) {
+                uint32_t c = count[d];
+                count[d] = offset;
+                offset += c;
+            }
+            for (size_t i = 0;  i < n;  i++) {
+                dst[count[(src[i].key >> shift) & (kRadixSize - 1)]++] = src[i];
+            }
+            std::swap (src, dst);
+        }
+
+        if (src != this->_order.data() + lo) {
+            std::memcpy (this->_order.data() + lo, src, n * sizeof(SortItem));
+        }
+    }
+
+    void ParticleSystem::SortByDistance (vec3f const &eye)
+    {
+        size_t n = this->_nLive;
+        size_t nNew = std::min(this->_nUnsorted, n);
+        size_t nOld = n - nNew;
+        Arrays const &a = this->_cur;
+
+      // compute the distances and their maximum
+        this->_scratch.resize (n);
+        float *dist = this->_scratch.data();
+        float maxDist = 0.0f;
+        for (size_t i = 0;  i < n;  i++) {
+            float dx = a.px[i] - eye.x;
+            float dy = a.py[i] - eye.y;
+            float dz = a.pz[i] - eye.z;
+            dist[i] = std::sqrt(dx*dx + dy*dy + dz*dz);
+            maxDist = std::max(maxDist, dist[i]);
+        }
+
+      // the keys are the distances quantized to kKeyBits bits over [0..range], where
+      // range is a power of two so that it does not change from frame to frame (which
+      // would disturb the order of the keys).  The keys are reversed, so that increasing
+      // keys give back-to-front order.  Particles that have the same key are close
+      // enough that their order does not matter.
+        float range = std::exp2(std::ceil(std::log2(std::max(maxDist, 1.0f))));
+        float scale = float(kKeyMax) / range;
+        this->_order.resize (n);
+        for (size_t i = 0;  i < n;  i++) {
+            uint32_t q = std::min(kKeyMax, static_cast<uint32_t>(dist[i] * scale));
+            this->_order[i].key = kKeyMax - q;
+            this->_order[i].idx = static_cast<uint32_t>(i);
+        }
+        this->_nUnsorted = 0;
+
+        SortItem *items = this->_order.data();
+        auto cmp = [] (SortItem const &x, SortItem const &y) { return x.key < y.key; };
+
+      // the particles that were sorted last time are usually still in roughly the same
+      // order, so we sort them by insertion.  The number of descents in the keys is a
+      // cheap measure of how far out of order they are, which lets us skip the insertion
+      // sort when it is likely to fail.
+        size_t nDescents = 0;
+        for (size_t i = 1;  i < nOld;  i++) {
+            nDescents += (items[i].key < items[i-1].key) ? 1 : 0;
+        }
+        if ((kMaxDescents * nDescents > nOld)
+        || ! InsertionSort (items, nOld, kInsertionMoves * nOld)) {
+          // too far out of order; sort everything from scratch
+            this->_RadixSort (0, n);
+        }
+        else if (nNew > 0) {
+          // sort the new particles and merge them with the old ones
+            if (nNew < kRadixMin) {
+                std::sort (items + nOld, items + n, cmp);
+            }
+            else {
+                this->_RadixSort (nOld, n);
+            }
+            if (nOld > 0) {
+                this->_orderTmp.resize (n);
+                std::merge (items, items + nOld, items + nOld, items + n,
+                    this->_orderTmp.begin(), cmp);
+                std::swap (this->_order, this->_orderTmp);
+            }
+        }
+
+        this->_Permute ();
+    }
+
+    void ParticleSystem::_Permute ()
+    {
+        size_t n = this->_nLive;
+        const SortItem *order = this->_order.data();
+
+      // skip the prefix that is already in place, which is usually most of it
+        size_t first = 0;
+        while ((first < n) && (order[first].idx == first)) {
+            first++;
+        }
+        if (first == n) {
+            return;
+        }
+
+      // gather each array into the scratch space and copy it back
+        this->_scratch.resize (n);
+        float *tmp = this->_scratch.data();
+        std::vector<float> *arrays[7] = {
+                &this->_cur.life, &this->_cur.px, &this->_cur.py, &this->_cur.pz,
+                &this->_cur.vx, &this->_cur.vy, &this->_cur.vz
+            };
+        for (int k = 0;  k < 7;  k++) {
+            float *a = arrays[k]->data();
+            for (size_t i = first;  i < n;  i++) {
+                tmp[i] = a[order[i].idx];
+            }
+            std::memcpy (a + first, tmp + first, (n - first) * sizeof(float));
+        }
+    }
+
+    size_t ParticleSystem::PackPositions (float *dst) const
+    {
+        size_t n = this->_nLive;
+        Arrays const &a = this->_cur;
+        for (size_t i = 0;  i < n;  i++) {
+            dst[3*i] = a.px[i];
+            dst[3*i+1] = a.py[i];
+            dst[3*i+2] = a.pz[i];
+        }
+        return n;
+    }
+
+} /* namespace cs237 */
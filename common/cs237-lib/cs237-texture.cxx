@@ -13,6 +13,7 @@
  */
 
 #include "cs237.hxx"
+#include <vector>
 
 namespace cs237 {
 
@@ -94,6 +95,11 @@ namespace cs237 {
         : texture_base (target)
     {
         assert (img != nullptr);
+        if (img->isCompressed()) {
+          // compressed data is a sequence of blocks, so alignment does not matter
+            img->texImage (target, this->Id());
+            return;
+        }
       // Note: if the number of bytes in a row is not a multiple of 4, then we need to adjust the
       // unpacking alignment
         size_t bytesPerRow = img->width() * img->nBytesPerPixel();
@@ -138,4 +144,112 @@ namespace cs237 {
             nullptr) );         // image data (no image)
     }
 
+    void texture2D::LoadMipmaps (image2d *img)
+    {
+        assert (img != nullptr);
+        this->Bind();
+
+      // the box filter requires 8-bit pixels and dimensions that halve evenly down to one
+        bool useCPU = (! img->isCompressed()) && (img->type() == GL_UNSIGNED_BYTE);
+        for (uint32_t w = img->width(), h = img->height();  useCPU && ((w > 1) || (h > 1));  ) {
+            useCPU = ((w == 1) || ((w & 1) == 0)) && ((h == 1) || ((h & 1) == 0));
+            w = (w > 1) ? w / 2 : 1;
+            h = (h > 1) ? h / 2 : 1;
+        }
+        if (! useCPU) {
+            CS237_CHECK( glGenerateMipmap (this->_target) );
+            return;
+        }
+
+        uint32_t nChans = img->nChannels();
+        uint32_t wid = img->width();
+        uint32_t ht = img->height();
+        const uint8_t *src = reinterpret_cast<const uint8_t *>(img->data());
+        std::vector<uint8_t> levels[2];   // alternating buffers for the source/destination
+      // the rows of the smaller levels are not multiples of 4 bytes
+        CS237_CHECK (glPixelStorei (GL_UNPACK_ALIGNMENT, 1) );
+        for (GLint level = 1;  (wid > 1) || (ht > 1);  level++) {
+            uint32_t w = (wid > 1) ? wid / 2 : 1;
+            uint32_t h = (ht > 1) ? ht / 2 : 1;
+            std::vector<uint8_t> &dst = levels[level & 1];
+            dst.resize (size_t(w) * h * nChans);
+            DownsampleBox2x (src, wid, ht, nChans, dst.data());
+            CS237_CHECK( glTexImage2D (
+                this->_target,  // target
+                level,          // level
+                img->format(),  // internal format (same as image format)
+                w,              // width
+                h,              // height
+                0,              // border
+                img->format(),  // image format
+                GL_UNSIGNED_BYTE, // image type
+                dst.data()) );  // image data
+            src = dst.data();
+            wid = w;
+            ht = h;
+        }
+        CS237_CHECK (glPixelStorei (GL_UNPACK_ALIGNMENT, 4) );  // restore default
+    }
+
+  /***** class texture2DArray member functions *****/
+
+    texture2DArray::texture2DArray (
+        GLenum ifmt, GLenum wid, GLenum ht, GLenum nLayers, GLenum fmt, GLenum ty)
+        : texture_base (GL_TEXTURE_2D_ARRAY), _wid(wid), _ht(ht), _nLayers(nLayers)
+    {
+        this->Bind();
+        CS237_CHECK( glTexImage3D (
+            GL_TEXTURE_2D_ARRAY, // target
+            0,                  // level
+            ifmt,               // internal format
+            wid,                // width
+            ht,                 // height
+            nLayers,            // depth (number of layers)
+            0,                  // border
+            fmt,                // image format
+            ty,                 // image type
+            nullptr) );         // image data (no image)
+    }
+
+    void texture2DArray::Upload (GLenum layer, image2d *img)
+    {
+        assert (img != nullptr);
+        assert (layer < this->_nLayers);
+        assert ((static_cast<GLenum>(img->width()) == this->_wid)
+            && (static_cast<GLenum>(img->height()) == this->_ht));
+        this->Bind();
+        if (img->isCompressed()) {
+            CS237_CHECK( glCompressedTexSubImage3D (
+                GL_TEXTURE_2D_ARRAY, // target
+                0,              // level
+                0, 0, layer,    // offset of the layer
+                img->width(),   // width
+                img->height(),  // height
+                1,              // depth
+                img->format(),  // compressed format
+                img->nBytes(),  // size of the compressed data
+                img->data()) ); // image data
+            return;
+        }
+      // see the texture2D constructor for the alignment issue
+        size_t bytesPerRow = img->width() * img->nBytesPerPixel();
+        if ((bytesPerRow & 3) != 0) {
+            GLint alignment = (bytesPerRow & 1) ? 1 : 2;
+            CS237_CHECK (glPixelStorei (GL_UNPACK_ALIGNMENT, alignment) );
+        }
+        CS237_CHECK( glTexSubImage3D (
+            GL_TEXTURE_2D_ARRAY, // target
+            0,                  // level
+            0, 0, layer,        // offset of the layer
+            img->width(),       // width
+            img->height(),      // height
+            1,                  // depth
+            img->format(),      // image format
+            img->type(),        // image type
+            img->data()) );     // image data
+        if ((bytesPerRow & 3) != 0) {
+            CS237_CHECK (glPixelStorei (GL_UNPACK_ALIGNMENT, 4) );  // restore default
+        }
+    }
+
 } /* namespace cs237 */
@@ -0,0 +1,168 @@
+/*! \file cs237-thread-pool.cxx
+ *
+ * Support code for CMSC 23700 Autumn 2017.
+ *
+ * Implementation of the worker-thread pool.
+ *
+ * \author John Reppy
+ */
+
+/*
+ * COPYRIGHT (c) 2017 John Reppy (http://cs.uchicago.edu/~jhr)
+ * All rights reserved.
+ */
+
+#include "cs237.hxx"
+#include <atomic>
+
+namespace cs237 {
+
+    ThreadPool::ThreadPool (unsigned int nWorkers)
+        : _nBusy(0), _done(false)
+    {
+        if (nWorkers == 0) {
+            unsigned int nHW = std::thread::hardware_concurrency();
+            nWorkers = (nHW > 2) ? nHW - 1 : 1;
+        }
+        this->_workers.reserve(nWorkers);
+        for (unsigned int i = 0;  i < nWorkers;  i++) {
+            this->_workers.push_back (std::thread(&ThreadPool::_Worker, this));
+        }
+    }
+
+    ThreadPool::~ThreadPool ()
+    {
+        {
+            std::lock_guard<std::mutex> guard(this->_lock);
+            this->_done = true;
+            this->_jobs.clear();
+        }
+        this->_jobReady.notify_all();
+        for (auto it = this->_workers.begin();  it != this->_workers.end();  it++) {
+            it->join();
+        }
+    }
+
+    void ThreadPool::Enqueue (std::function<void()> const &job)
+    {
+        {
+            std::lock_guard<std::mutex> guard(this->_lock);
+            this->_jobs.push_back(job);
+        }
+        this->_jobReady.notify_one();
+    }
+
+    void ThreadPool::Wait ()
+    {
+        std::unique_lock<std::mutex> guard(this->_lock);
+        while ((! this->_jobs.empty()) || (this->_nBusy > 0)) {
+            this->_idle.wait(guard);
+        }
+    }
+
+  // state shared between the caller of ParallelFor and its helper jobs.  It is
+  // reference counted, since helper jobs may start after the caller has returned.
+    struct ParallelForState {
+        std::function<void(size_t,size_t)> fn;
+        size_t                  n;
+        size_t                  grain;
+        size_t                  nChunks;
+        std::atomic<size_t>     next;           // next chunk to claim
+        size_t                  nFinished;      // number of completed chunks
+        std::mutex              lock;
+        std::condition_variable finished;
+
+        ParallelForState (std::function<void(size_t,size_t)> const &f, size_t nn, size_t g)
+            : fn(f), n(nn), grain(g), nChunks((nn + g - 1) / g), next(0), nFinished(0)
+        { }
+
+      // claim and run chunks until there are none left
+        void Run ()
+        {
+            size_t nDone = 0;
+            for (size_t c = this->next++;  c < this->nChunks;  c = this->next++) {
+                size_t lo = c * this->grain;
+                size_t hi = (lo + this->grain < this->n) ? lo + this->grain : this->n;
+                this->fn (lo, hi);
+                nDone++;
+            }
+            if (nDone > 0) {
+                std::lock_guard<std::mutex> guard(this->lock);
+                this->nFinished += nDone;
+                if (this->nFinished == this->nChunks) {
+                    this->finished.notify_all();
+                }
+            }
+        }
+    };
+
+    void ThreadPool::ParallelFor (size_t n, size_t grain, std::function<void(size_t,size_t)> const &fn)
+    {
+        assert (grain > 0);
+        if (n == 0) {
+            return;
+        }
+        else if (n <= grain) {
+            fn (0, n);
+            return;
+        }
+
+        std::shared_ptr<ParallelForState> state =
+            std::make_shared<ParallelForState>(fn, n, grain);
+
+      // one helper per worker (at most), since each helper runs chunks until they are gone
+        size_t nHelpers = state->nChunks - 1;
+        if (nHelpers > this->_workers.size()) {
+            nHelpers = this->_workers.size();
+        }
+        for (size_t i = 0;  i < nHelpers;  i++) {
+            this->Enqueue ([state] () { state->Run(); });
+        }
+
+      // the calling thread works too, which guarantees progress even when all of the
+      // workers are busy (e.g., when ParallelFor is called from a job).
+        state->Run();
+
+        std::unique_lock<std::mutex> guard(state->lock);
+        while (state->nFinished < state->nChunks) {
+            state->finished.wait(guard);
+        }
+    }
+
+    /* static */ ThreadPool *ThreadPool::Shared ()
+    {
+      // the shared pool lives until the program exits
+        static ThreadPool *pool = new ThreadPool();
+        return pool;
+    }
+
+    void ThreadPool::_Worker ()
+    {
+        while (true) {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> guard(this->_lock);
+                while ((! this->_done) && this->_jobs.empty()) {
+                    this->_jobReady.wait(guard);
+                }
+                if (this->_done) {
+                    return;
+                }
+                job = this->_jobs.front();
+                this->_jobs.pop_front();
+                this->_nBusy++;
+            }
+
+            job();
+
+            {
+                std::lock_guard<std::mutex> guard(this->_lock);
+                this->_nBusy--;
+                if (this->_jobs.empty() && (this->_nBusy == 0)) {
+                    this->_idle.notify_all();
+                }
+            }
+        }
+    }
+
+} /* namespace cs237 */
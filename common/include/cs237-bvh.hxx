@@ -0,0 +1,127 @@
+/*! \file cs237-bvh.hxx
+ *
+ * Support code for CMSC 23700 Autumn 2017.
+ *
+ * A bounding-volume hierarchy over a set of axis-aligned boxes that supports
+ * frustum-culling, radius, and ray queries.
+ *
+ * \author John Reppy
+ */
+
+/*
+ * COPYRIGHT (c) 2017 John Reppy (http://cs.uchicago.edu/~jhr)
+ * All rights reserved.
+ */
+
+#ifndef _CS237_BVH_HXX_
+#define _CS237_BVH_HXX_
+
+#ifndef _CS237_HXX_
+#error "cs237-bvh.hxx should not be included directly"
+#endif
+
+#include <vector>
+
+namespace cs237 {
+
+  //! A bounding-volume hierarchy over a set of boxes (the items).  The tree is stored in
+  //! a flat array of nodes in depth-first order and the bounds of the items are stored
+  //! in structure-of-arrays form in the order of the leaves, so the items of any subtree
+  //! have consecutive indices.  Building the tree computes this order; clients should
+  //! store their per-item data in the same order, so that the indices returned by the
+  //! queries can be used directly.
+    class BVH {
+      public:
+
+        BVH () { }
+
+      //! build the hierarchy over a set of boxes
+      //! \param n the number of boxes
+      //! \param boxes the boxes, which must not be empty
+      //! \param[out] order set to the permutation of the boxes; item i of the
+      //!             hierarchy is boxes[order[i]]
+        void Build (size_t n, const AABBf *boxes, std::vector<uint32_t> &order);
+
+      //! remove all of the items
+        void Clear ();
+
+      //! the number of items
+        size_t NumItems () const { return this->_minX.size(); }
+      //! the number of nodes in the tree
+        size_t NumNodes () const { return this->_nodes.size(); }
+      //! the bounding box of an item
+        AABBf ItemBBox (uint32_t i) const
+        {
+            return AABBf(
+                vec3f(this->_minX[i], this->_minY[i], this->_minZ[i]),
+                vec3f(this->_maxX[i], this->_maxY[i], this->_maxZ[i]));
+        }
+      //! the bounding box of all of the items; undefined if the hierarchy is empty
+        AABBf BBox () const;
+
+      //! find the items whose boxes are not completely outside a convex region that is
+      //! the intersection of half spaces.  A point p is inside the half space of plane i
+      //! when dot(norms[i], p) + dists[i] >= 0 (the convention used by the Frustum class).
+      //! \param nPlanes the number of planes (at most 32)
+      //! \param norms the plane normals
+      //! \param dists the plane distances
+      //! \param[out] items the indices of the visible items are added to this vector
+        void FrustumQuery (
+            int nPlanes,
+            const vec3f *norms,
+            const float *dists,
+            std::vector<uint32_t> &items) const;
+
+      //! find the items whose boxes are within a given distance of a point
+      //! \param center the point
+      //! \param radius the distance
+      //! \param[out] items the indices of the items are added to this vector
+        void RadiusQuery (vec3f const &center, float radius, std::vector<uint32_t> &items) const;
+
+      //! find the items whose boxes are hit by a ray segment
+      //! \param orig the origin of the ray
+      //! \param dir the direction of the ray (need not be normalized)
+      //! \param tMax the end of the ray segment (orig + tMax*dir)
+      //! \param[out] items the indices of the items are added to this vector
+        void RayQuery (
+            vec3f const &orig,
+            vec3f const &dir,
+            float tMax,
+            std::vector<uint32_t> &items) const;
+
+      //! find the first item whose box is hit by a ray segment
+      //! \param orig the origin of the ray
+      //! \param dir the direction of the ray (need not be normalized)
+      //! \param[in,out] t the end of the ray segment on entry and the distance
+      //!                (in units of dir) to the hit on exit
+      //! \return the index of the item or -1 if no box is hit
+        int FirstHit (vec3f const &orig, vec3f const &dir, float &t) const;
+
+      private:
+      //! a node in the tree; the first child of an interior node immediately follows
+      //! it in the array.
+        struct Node {
+            float       lo[3];          //!< minimum corner of the node's box
+            float       hi[3];          //!< maximum corner of the node's box
+            uint32_t    first;          //!< index of the first item in the subtree
+            uint32_t    count;          //!< number of items in the subtree
+            uint32_t    second;         //!< index of the second child (0 for leaves)
+        };
+
+        std::vector<Node>       _nodes;         //!< the tree in depth-first order
+        std::vector<float>      _minX, _minY, _minZ; //!< minimum corners of the items
+        std::vector<float>      _maxX, _maxY, _maxZ; //!< maximum corners of the items
+
+        uint32_t _Build (
+            const AABBf *boxes,
+            std::vector<vec3f> const &centers,
+            uint32_t *order,
+            uint32_t first,
+            uint32_t count,
+            int depth);
+
+    };
+
+} /* namespace cs237 */
+
+#endif /* !_CS237_BVH_HXX_ */
@@ -0,0 +1,65 @@
+/*! \file cs237-image-ops.hxx
+ *
+ * Support code for CMSC 23700 Autumn 2017.
+ *
+ * Kernels that operate on raw pixel data.  On x86 processors, these use SSE2 (and
+ * SSSE3, when the processor supports it) with scalar code for other processors and
+ * for the ragged ends of rows.  The vector and scalar paths produce identical results.
+ * Defining CS237_NO_SIMD when compiling the library forces the scalar code.
+ *
+ * \author John Reppy
+ */
+
+/*
+ * COPYRIGHT (c) 2017 John Reppy (http://cs.uchicago.edu/~jhr)
+ * All rights reserved.
+ */
+
+#ifndef _CS237_IMAGE_OPS_HXX_
+#define _CS237_IMAGE_OPS_HXX_
+
+#ifndef _CS237_HXX_
+#error "c237-image-ops.hxx should not be included directly"
+#endif
+
+namespace cs237 {
+
+  //! expand 8-bit RGB pixels to RGBA pixels
+  //! \param src the RGB pixels
+  //! \param[out] dst the RGBA pixels (4*nPixels bytes)
+  //! \param nPixels the number of pixels
+  //! \param alpha the alpha value for the pixels
+    void ExpandRGBToRGBA (const uint8_t *src, uint8_t *dst, size_t nPixels, uint8_t alpha = 255);
+
+  //! drop the alpha channel from 8-bit RGBA pixels
+  //! \param src the RGBA pixels
+  //! \param[out] dst the RGB pixels (3*nPixels bytes)
+  //! \param nPixels the number of pixels
+    void PackRGBAToRGB (const uint8_t *src, uint8_t *dst, size_t nPixels);
+
+  //! swap the bytes of 16-bit values in place (e.g., to convert the big-endian samples
+  //! of a 16-bit PNG to the host's byte order)
+  //! \param data the values
+  //! \param n the number of values
+    void SwapBytes16 (uint16_t *data, size_t n);
+
+  //! reverse the order of the rows of an image in place
+  //! \param data the image data
+  //! \param rowBytes the number of bytes in a row
+  //! \param nRows the number of rows
+    void FlipRows (void *data, size_t rowBytes, size_t nRows);
+
+  //! downsample an 8-bit image by a factor of two in each dimension using a 2x2 box
+  //! filter (rounding to nearest).  A dimension of one is left unchanged, so this can
+  //! be used to generate the complete mipmap chain of a power-of-two texture.
+  //! \param src the source pixels
+  //! \param wid the width of the source image; it must be even or one
+  //! \param ht the height of the source image; it must be even or one
+  //! \param nChans the number of 8-bit channels per pixel (1 to 4)
+  //! \param[out] dst the downsampled pixels, which is max(wid/2,1) by max(ht/2,1)
+    void DownsampleBox2x (
+        const uint8_t *src, uint32_t wid, uint32_t ht, uint32_t nChans, uint8_t *dst);
+
+} /* namespace cs237 */
+
+#endif /* !_CS237_IMAGE_OPS_HXX_ */
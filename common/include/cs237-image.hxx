@@ -46,6 +46,11 @@ namespace cs237 {
 	  //! the total number of bytes of image data
 	    size_t nBytes () const { return this->_nBytes; }
 
+	  //! is the image data stored in a block-compressed format?  For compressed images,
+	  //! format() returns the OpenGL compressed internal format (e.g.,
+	  //! GL_COMPRESSED_RGB_S3TC_DXT1_EXT or GL_COMPRESSED_RG_RGTC2) and type() is 0.
+	    bool isCompressed () const;
+
 	  //! the number of channels (1, 2, 3, or 4)
 	    unsigned int nChannels () const;
 
@@ -132,6 +137,14 @@ namespace cs237 {
       //!           GL_UNSIGNED_INT_10_10_10_2, or GL_UNSIGNED_INT_2_10_10_10_REV
 	image2d (uint32_t wid, uint32_t ht, GLenum fmt, GLenum ty);
 
+      //! create and allocate space for an uninitialized block-compressed image
+      //! \param wid the width of the image (a multiple of 4)
+      //! \param ht the height of the image (a multiple of 4)
+      //! \param cfmt the compressed format, which should be one of
+      //!            GL_COMPRESSED_RGB_S3TC_DXT1_EXT, GL_COMPRESSED_RED_RGTC1,
+      //!            or GL_COMPRESSED_RG_RGTC2.
+	image2d (uint32_t wid, uint32_t ht, GLenum cfmt);
+
       //! create and initialize an image from a PNG file.
       //! \param file the name of the PNG file
       //! \param flip set to true if the image should be flipped vertically to match OpenGL
@@ -144,13 +157,33 @@ namespace cs237 {
       //!        texture coordinates (default true)
 	image2d (std::ifstream &inS, bool flip = true);
 
+      //! create and initialize an image from PNG-format data in memory
+      //! \param data the PNG data (e.g., a tile in a memory-mapped file)
+      //! \param nBytes the number of bytes of PNG data
+      //! \param flip set to true if the image should be flipped vertically to match OpenGL
+      //!        texture coordinates (default true)
+	image2d (const uint8_t *data, size_t nBytes, bool flip = true);
+
+      //! decode PNG-format data in memory into this image, replacing its contents.  The
+      //! image's existing pixel storage is reused when it is large enough to hold the
+      //! new image, so decoding a sequence of same-sized images (e.g., TQT tiles) into
+      //! one image does no allocation.
+      //! \param data the PNG data
+      //! \param nBytes the number of bytes of PNG data
+      //! \param flip set to true if the image should be flipped vertically to match OpenGL
+      //!        texture coordinates (default true)
+      //! \return true if successful; otherwise false, in which case the image's contents
+      //!         are undefined.
+	bool Decode (const uint8_t *data, size_t nBytes, bool flip = true);
+
       //! return the width of the image
 	GLsizei width () const { return this->_wid; }
 
       //! return the height of the image
 	GLsizei height () const { return this->_ht; }
 
-      //! Load the image into a 2D GL texture; this function also binds the current texture to texId
+      //! Load the image into a 2D GL texture; this function also binds the current texture to texId.
+      //! Compressed images are loaded using glCompressedTexImage2D.
       //! \param[in] target specifies the target texture. Must be GL_TEXTURE_2D or GL_TEXTURE_RECTANGLE
       //! \param[in] texId the GL texture ID for this image
 	void texImage (GLenum target, GLuint texId);
@@ -0,0 +1,149 @@
+/*! \file cs237-particles.hxx
+ *
+ * Support code for CMSC 23700 Autumn 2017.
+ *
+ * A pool of point particles stored in structure-of-arrays form.  On x86 processors,
+ * the update kernel uses SSE2 with scalar code for other processors and for the
+ * ragged ends of the arrays; the two paths produce identical results.  Defining
+ * CS237_NO_SIMD when compiling the library forces the scalar code.
+ *
+ * \author John Reppy
+ */
+
+/*
+ * COPYRIGHT (c) 2017 John Reppy (http://cs.uchicago.edu/~jhr)
+ * All rights reserved.
+ */
+
+#ifndef _CS237_PARTICLES_HXX_
+#define _CS237_PARTICLES_HXX_
+
+#ifndef _CS237_HXX_
+#error "cs237-particles.hxx should not be included directly"
+#endif
+
+#include <vector>
+
+namespace cs237 {
+
+  //! A pool of particles, each of which has a remaining life span, a position, and a
+  //! velocity.  The live particles always occupy the indices [0..NumLive()), so
+  //! spawning a particle is an O(1) append, killing one is an O(1) swap with the last
+  //! live particle, and the cost of an update is proportional to the number of live
+  //! particles, not to the capacity.  Updating the particles preserves the relative
+  //! order of the survivors.
+    class ParticleSystem {
+      public:
+
+      //! create an empty pool
+      //! \param capacity the maximum number of live particles
+        explicit ParticleSystem (size_t capacity);
+
+      //! the maximum number of live particles
+        size_t Capacity () const { return this->_cur.life.size(); }
+      //! change the maximum number of live particles; if there are more live particles
+      //! than the new capacity, then the ones at the end of the live range are killed.
+        void SetCapacity (size_t capacity);
+      //! the number of live particles
+        size_t NumLive () const { return this->_nLive; }
+
+      //! add a particle
+      //! \param life the life span of the particle in seconds
+      //! \param pos the initial position of the particle
+      //! \param vel the initial velocity of the particle
+      //! \return false if the pool is full, in which case the particle is dropped
+        bool Spawn (float life, vec3f const &pos, vec3f const &vel);
+
+      //! kill a particle by moving the last live particle into its place, which does
+      //! not preserve the order of the particles
+      //! \param i the index of the particle (< NumLive())
+        void Kill (size_t i);
+
+      //! kill all of the particles
+        void Clear () { this->_nLive = 0;  this->_nUnsorted = 0; }
+
+      //! advance the particles by a time step.  The velocity is updated by the
+      //! acceleration before the position is updated by the velocity; particles
+      //! whose life span runs out are removed.
+      //! \param dt the time step in seconds
+      //! \param accel the acceleration that applies to all of the particles
+      //! \param pool if not nullptr, then large systems are updated in parallel
+      //!        using the pool's workers
+        void Update (float dt, vec3f const &accel, ThreadPool *pool = nullptr);
+
+      //! sort the live particles into back-to-front order (i.e., by decreasing
+      //! distance from a point), which is the order needed for alpha blending.
+      //! The distances are quantized to 16 bits, so particles that are very close to
+      //! each other in depth may be in either order.  The sort exploits frame-to-frame
+      //! coherence: the particles that were sorted by the previous call are usually
+      //! still almost in order, so they are sorted by insertion (falling back to a
+      //! radix sort when they are not) and then merged with the particles that have
+      //! been spawned since.
+      //! \param eye the viewer's position
+        void SortByDistance (vec3f const &eye);
+
+      //! copy the positions of the live particles into a buffer as packed
+      //! xyz triples
+      //! \param[out] dst the buffer, which must have room for 3*NumLive() floats
+      //! \return the number of positions copied
+        size_t PackPositions (float *dst) const;
+
+      //! the remaining life span of the i'th live particle
+        float Life (size_t i) const { return this->_cur.life[i]; }
+      //! the position of the i'th live particle
+        vec3f Pos (size_t i) const
+        {
+            return vec3f(this->_cur.px[i], this->_cur.py[i], this->_cur.pz[i]);
+        }
+      //! the velocity of the i'th live particle
+        vec3f Vel (size_t i) const
+        {
+            return vec3f(this->_cur.vx[i], this->_cur.vy[i], this->_cur.vz[i]);
+        }
+
+      private:
+      //! the per-particle state in structure-of-arrays form
+        struct Arrays {
+            std::vector<float>  life;                   //!< remaining life spans
+            std::vector<float>  px, py, pz;             //!< positions
+            std::vector<float>  vx, vy, vz;             //!< velocities
+
+            void Resize (size_t n);
+        };
+
+        size_t                  _nLive;                 //!< the number of live particles
+        Arrays                  _cur;                   //!< the particles
+        Arrays                  _next;                  //!< the target of parallel updates
+                                                        //!  (allocated on first use)
+        size_t                  _nUnsorted;             //!< upper bound on the number of
+                                                        //!  particles spawned since the last
+                                                        //!  sort; these are at the end of the
+                                                        //!  live range
+      //! a particle's sort key and index
+        struct SortItem {
+            uint32_t    key;                            //!< the key (ascending order)
+            uint32_t    idx;                            //!< the particle's index
+        };
+        std::vector<SortItem>   _order;                 //!< the sorted order
+        std::vector<SortItem>   _orderTmp;              //!< scratch space for sorting
+        std::vector<float>      _scratch;               //!< scratch space for permuting
+
+      //! update the particles src[lo..hi) and write the survivors to dst starting at
+      //! index w.  The source and destination may be the same when w <= lo.
+      //! \return the number of survivors
+        static size_t _UpdateRange (
+            Arrays &src, size_t lo, size_t hi,
+            Arrays &dst, size_t w,
+            float dt, vec3f const &dv);
+
+      //! sort the items in _order[lo..hi) by radix sort
+        void _RadixSort (size_t lo, size_t hi);
+
+      //! apply the permutation in _order to the live particles
+        void _Permute ();
+
+    };
+
+} /* namespace cs237 */
+
+#endif /* !_CS237_PARTICLES_HXX_ */
@@ -101,6 +101,45 @@ namespace cs237 {
       //! \param fmt specifies the image format
       //! \param ty specifies the type of the image elements
         void resize (GLenum ifmt, GLenum wid, GLenum ht, GLenum fmt, GLenum ty);
+
+      //! \brief generate the mipmap levels of the texture on the CPU from its base image
+      //!        using a 2x2 box filter.  Images that are not 8-bit or whose dimensions
+      //!        are not powers of two fall back to glGenerateMipmap.
+      //! \param img the image that was used to initialize the texture (i.e., level 0)
+        void LoadMipmaps (image2d *img);
+    };
+
+  //! wrapper class for OpenGL 2D array textures, which hold a fixed number of
+  //! equal-sized layers
+    class texture2DArray : public __detail::texture_base {
+      public:
+
+      //! \brief create a 2D array texture and allocate uninitialized storage for it.
+      //! \param ifmt specifies the internal texture format, which may be a compressed format
+      //! \param wid specifies the width of a layer
+      //! \param ht specifies the height of a layer
+      //! \param nLayers specifies the number of layers
+      //! \param fmt specifies the image format
+      //! \param ty specifies the type of the image elements
+        texture2DArray (GLenum ifmt, GLenum wid, GLenum ht, GLenum nLayers, GLenum fmt, GLenum ty);
+
+      //! the width of a layer
+        GLenum width () const { return this->_wid; }
+      //! the height of a layer
+        GLenum height () const { return this->_ht; }
+      //! the number of layers
+        GLenum nLayers () const { return this->_nLayers; }
+
+      //! \brief replace the contents of a layer with an image
+      //! \param layer the index of the layer to replace
+      //! \param img the image data, which must have the same size as a layer (and must
+      //!        be compressed if the array's internal format is compressed)
+        void Upload (GLenum layer, image2d *img);
+
+      private:
+        GLenum _wid;
+        GLenum _ht;
+        GLenum _nLayers;
     };
 
 } /* namespace cs237 */
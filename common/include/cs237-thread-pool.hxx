@@ -0,0 +1,81 @@
+/*! \file cs237-thread-pool.hxx
+ *
+ * Support code for CMSC 23700 Autumn 2017.
+ *
+ * A simple pool of worker threads for running background jobs.
+ *
+ * \author John Reppy
+ */
+
+/*
+ * COPYRIGHT (c) 2017 John Reppy (http://cs.uchicago.edu/~jhr)
+ * All rights reserved.
+ */
+
+#ifndef _CS237_THREAD_POOL_HXX_
+#define _CS237_THREAD_POOL_HXX_
+
+#ifndef _CS237_HXX_
+#error "cs237-thread-pool.hxx should not be included directly"
+#endif
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cs237 {
+
+  //! A fixed-size pool of worker threads that run queued jobs in FIFO order.  Jobs
+  //! must not make OpenGL calls, since the GL context belongs to the main thread.
+    class ThreadPool {
+      public:
+
+      //! create a pool with the given number of workers
+      //! \param nWorkers the number of worker threads; if 0, then the pool uses one
+      //!        fewer than the number of hardware threads (but at least one).
+        explicit ThreadPool (unsigned int nWorkers = 0);
+
+      //! destructor: discards any jobs that have not started and joins the workers
+        ~ThreadPool ();
+
+      //! the number of worker threads in the pool
+        unsigned int NumWorkers () const { return this->_workers.size(); }
+
+      //! add a job to the end of the queue
+        void Enqueue (std::function<void()> const &job);
+
+      //! block until the queue is empty and all of the workers are idle
+        void Wait ();
+
+      //! run fn over the index range [0..n) split into chunks of (at most) grain
+      //! indices.  The calling thread participates in the work and the call
+      //! returns once every chunk has been processed, so it is safe to call
+      //! from inside a job.
+      //! \param n the size of the index range
+      //! \param grain the maximum number of indices in a chunk (> 0)
+      //! \param fn the function to apply to each chunk [lo..hi)
+        void ParallelFor (size_t n, size_t grain, std::function<void(size_t,size_t)> const &fn);
+
+      //! a pool shared by the library and application code that is created on
+      //! first use.
+        static ThreadPool *Shared ();
+
+      private:
+        std::vector<std::thread>                _workers;       //!< the worker threads
+        std::deque<std::function<void()>>       _jobs;          //!< pending jobs
+        std::mutex                              _lock;          //!< protects _jobs, _nBusy, _done
+        std::condition_variable                 _jobReady;      //!< signaled when a job is queued
+        std::condition_variable                 _idle;          //!< signaled when a worker goes idle
+        unsigned int                            _nBusy;         //!< number of workers running a job
+        bool                                    _done;          //!< true when shutting down
+
+        void _Worker ();
+
+    };
+
+} /* namespace cs237 */
+
+#endif /* !_CS237_THREAD_POOL_HXX_ */
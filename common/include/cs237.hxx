@@ -63,6 +63,7 @@
 
 /* Images and textures */
 #include "cs237-image.hxx"
+#include "cs237-image-ops.hxx"
 #include "cs237-texture.hxx"
 
 /* Shader support */
@@ -99,8 +100,17 @@
 
 #include "cs237-sphere.hxx"
 
+/* Spatial indexing */
+#include "cs237-bvh.hxx"
+
 #include "cs237-window.hxx"
 
+/* Background jobs */
+#include "cs237-thread-pool.hxx"
+
+/* Particle systems */
+#include "cs237-particles.hxx"
+
 namespace cs237 {
 
   //! Dump the current OpenGL state to the given output stream
@@ -0,0 +1,164 @@
+/*! \file json-reader.hxx
+ *
+ * \author John Reppy
+ *
+ * A pull-style reader for JSON files.  Unlike JSON::ParseFile, which builds a tree
+ * for the whole file, the reader returns the file as a sequence of tokens and reads
+ * the file through a fixed-size buffer, so a large file (e.g., a list of object
+ * instances) can be processed with a bounded amount of memory.
+ *
+ * CMSC 23700 Autumn 2017.
+ */
+
+/*
+ * COPYRIGHT (c) 2017 John Reppy (http://cs.uchicago.edu/~jhr)
+ * All rights reserved.
+ */
+
+#ifndef _JSON_READER_HXX_
+#define _JSON_READER_HXX_
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace JSON {
+
+  //! A pull reader for JSON files.  Each call to next() advances to the next token of
+  //! the input.  The reader checks that the tokens form a well-formed JSON value; if
+  //! they do not, then next() returns T_ERROR (and continues to do so).  For example,
+  //! an array of objects can be processed as follows:
+  //!
+  //!     JSON::Reader rdr(file);
+  //!     if (rdr.next() == JSON::Reader::T_BEGIN_ARRAY) {
+  //!         while (rdr.next() == JSON::Reader::T_BEGIN_OBJECT) {
+  //!             while (rdr.next() == JSON::Reader::T_KEY) {
+  //!                 if (rdr.string() == "name") ... else rdr.skipValue();
+  //!             }
+  //!         }
+  //!     }
+  //!
+    class Reader {
+      public:
+
+      //! the tokens of a JSON file
+        enum Token {
+            T_BEGIN_OBJECT,     //!< the start of an object
+            T_END_OBJECT,       //!< the end of an object
+            T_BEGIN_ARRAY,      //!< the start of an array
+            T_END_ARRAY,        //!< the end of an array
+            T_KEY,              //!< a field label; the label is available from string()
+            T_STRING,           //!< a string value, which is available from string()
+            T_INTEGER,          //!< an integer value, which is available from intVal()
+            T_REAL,             //!< a real value, which is available from realVal()
+            T_BOOL,             //!< a boolean value, which is available from boolVal()
+            T_NULL,             //!< the null value
+            T_EOF,              //!< the end of the input
+            T_ERROR             //!< a syntax error or I/O error
+        };
+
+      //! open a JSON file for reading
+      //! \param filename the file to read
+      //! \param bufSz the size of the input buffer
+        explicit Reader (std::string const &filename, size_t bufSz = 64*1024);
+        ~Reader ();
+
+      //! return true if the file was opened
+        bool isOpen () const { return this->_inS.is_open(); }
+
+      //! advance to the next token
+      //! \return the token
+        Token next ();
+
+      //! the current token
+        Token token () const { return this->_tok; }
+
+      //! the text of the current label or string value
+        std::string const &string () const { return this->_str; }
+
+      //! the value of the current integer token
+        int64_t intVal () const { return this->_int; }
+
+      //! the value of the current number (integer or real) token
+        double realVal () const
+        {
+            return (this->_tok == T_INTEGER) ? static_cast<double>(this->_int) : this->_real;
+        }
+
+      //! the value of the current boolean token
+        bool boolVal () const { return this->_bool; }
+
+      //! return true if the current token is a number
+        bool isNumber () const { return (this->_tok == T_INTEGER) || (this->_tok == T_REAL); }
+
+      //! skip the next value in the input, including all of its contents when it is an
+      //! object or array.  This function is typically used to ignore the value of a
+      //! field whose label is not recognized.
+      //! \return false if there was an error
+        bool skipValue ();
+
+      //! skip the rest of the object or array whose T_BEGIN_OBJECT or T_BEGIN_ARRAY
+      //! token is the current token.  For other tokens, this function does nothing.
+      //! \return false if there was an error
+        bool skip ();
+
+      //! a description of the error when the current token is T_ERROR
+        std::string const &errorMsg () const { return this->_errMsg; }
+
+      private:
+      //! what the reader expects next
+        enum State {
+            S_VALUE,            //!< a value
+            S_VALUE_OR_END,     //!< a value or ']' (after '[')
+            S_KEY,              //!< a field label (after ',' in an object)
+            S_KEY_OR_END,       //!< a field label or '}' (after '{')
+            S_COMMA_OR_END,     //!< ',' or the end of the enclosing object/array
+            S_DONE              //!< the end of the input
+        };
+
+        std::string             _file;          //!< the name of the file
+        std::ifstream           _inS;           //!< the input stream
+        std::vector<char>       _buf;           //!< the input buffer
+        size_t                  _pos;           //!< the index of the next character in _buf
+        size_t                  _end;           //!< the number of valid characters in _buf
+        int                     _lnum;          //!< the current line number
+        std::vector<char>       _stk;           //!< the open objects ('{') and arrays ('[')
+        State                   _state;         //!< what the reader expects next
+        Token                   _tok;           //!< the current token
+        std::string             _str;           //!< the current label or string
+        int64_t                 _int;           //!< the current integer
+        double                  _real;          //!< the current real
+        bool                    _bool;          //!< the current boolean
+        std::string             _errMsg;        //!< the error message
+
+      //! make sure that at least n characters are available in the buffer
+      //! \return false if the end of the file is reached first
+        bool _fill (size_t n);
+
+      //! return the next character without consuming it (-1 at end of file)
+        int _peek ()
+        {
+            if ((this->_pos < this->_end) || this->_fill(1))
+                return static_cast<unsigned char>(this->_buf[this->_pos]);
+            else
+                return -1;
+        }
+
+      //! consume the next character
+        void _advance ()
+        {
+            if (this->_buf[this->_pos++] == '\n') this->_lnum++;
+        }
+
+        void _skipWhitespace ();
+        bool _string ();
+        Token _number ();
+        Token _value ();
+        Token _endValue (Token tok);
+        Token _error (std::string const &msg);
+    };
+
+} // namespace JSON
+
+#endif // !_JSON_READER_HXX_
@@ -18,7 +18,6 @@
 
 #include <vector>
 #include <string>
-#include <map>
 
 namespace JSON {
 
@@ -42,10 +41,17 @@ namespace JSON {
     class String;
     class Bool;
     class Null;
+    class Document;
 
   // parse a JSON file; this returns nullptr if there is a parsing error
     Value *ParseFile (std::string filename);
 
+  //! parse a JSON file into a document, which allocates all of the nodes of the tree
+  //! from a single arena and which represents strings as views into the file's text.
+  //! \param filename the file to parse
+  //! \return the document or nullptr if there is a parsing error
+    Document *ParseDocument (std::string filename);
+
   // virtual base class of JSON values
     class Value {
       public:
@@ -105,10 +111,13 @@ namespace JSON {
         virtual std::string toString() = 0;
 
       protected:
+        friend class Parser;
 
-        explicit Value (Type ty) : _ty(ty) { };
+        explicit Value (Type ty) : _ty(ty), _owned(true) { };
 
         Type    _ty;
+        bool    _owned;         //!< true if this value owns its children and text; false
+                                //!  for values that live in the arena of a Document
     };
 
     inline std::ostream& operator<< (std::ostream& s, Value *v)
@@ -119,22 +128,30 @@ namespace JSON {
   //! JSON objects
     class Object : public Value {
       public:
-        Object () : Value(T_OBJECT), _value() { };
+      //! a field of an object
+        struct Field {
+            const char  *_key;  //!< the field's label (NUL terminated)
+            size_t      _len;   //!< the length of the label
+            Value       *_val;  //!< the field's value
+        };
+
         ~Object ();
 
       //! return the number of fields in the object
-        int size () const { return this->_value.size(); }
-
-      //! insert a key-value pair into the object
-        void insert (std::string key, Value *val);
+        int size () const { return this->_size; }
 
       //! return the value corresponding to the given key.
       //! \returns nil if the key is not defined in the object
-        Value *operator[] (std::string key) const;
+        Value *operator[] (std::string const &key) const
+        {
+            return this->_find(key.data(), key.size());
+        }
+        Value *operator[] (const char *key) const;
 
       //! return an object-valued field
       //! \returns nullptr if the field is not present or is not an object
-        const Object *fieldAsObject (std::string key) const
+        template <typename K>
+        const Object *fieldAsObject (K const &key) const
         {
             const Value *v = (*this)[key];
             return (v != nullptr) ? v->asObject() : nullptr;
@@ -142,7 +159,8 @@ namespace JSON {
 
       //! return an array-valued field
       //! \returns nullptr if the field is not present or is not an array
-        const Array *fieldAsArray (std::string key) const
+        template <typename K>
+        const Array *fieldAsArray (K const &key) const
         {
             const Value *v = (*this)[key];
             return (v != nullptr) ? v->asArray() : nullptr;
@@ -150,7 +168,8 @@ namespace JSON {
 
       //! return a number-valued field
       //! \returns nullptr if the field is not present or is not a number
-        const Number *fieldAsNumber (std::string key) const
+        template <typename K>
+        const Number *fieldAsNumber (K const &key) const
         {
             const Value *v = (*this)[key];
             return (v != nullptr) ? v->asNumber() : nullptr;
@@ -158,7 +177,8 @@ namespace JSON {
 
       //! return an integer-valued field
       //! \returns nullptr if the field is not present or is not an integer
-        const Integer *fieldAsInteger (std::string key) const
+        template <typename K>
+        const Integer *fieldAsInteger (K const &key) const
         {
             const Value *v = (*this)[key];
             return (v != nullptr) ? v->asInteger() : nullptr;
@@ -166,7 +186,8 @@ namespace JSON {
 
       //! return an real-valued field
       //! \returns nullptr if the field is not present or is not a real
-        const Real *fieldAsReal (std::string key) const
+        template <typename K>
+        const Real *fieldAsReal (K const &key) const
         {
             const Value *v = (*this)[key];
             return (v != nullptr) ? v->asReal() : nullptr;
@@ -174,7 +195,8 @@ namespace JSON {
 
       //! return an string-valued field
       //! \returns nullptr if the field is not present or is not a string
-        const String *fieldAsString (std::string key) const
+        template <typename K>
+        const String *fieldAsString (K const &key) const
         {
             const Value *v = (*this)[key];
             return (v != nullptr) ? v->asString() : nullptr;
@@ -182,7 +204,8 @@ namespace JSON {
 
       //! return an bool-valued field
       //! \returns nullptr if the field is not present or is not a bool
-        const Bool *fieldAsBool (std::string key) const
+        template <typename K>
+        const Bool *fieldAsBool (K const &key) const
         {
             const Value *v = (*this)[key];
             return (v != nullptr) ? v->asBool() : nullptr;
@@ -191,24 +214,36 @@ namespace JSON {
         std::string toString();
 
       private:
-        std::map<std::string, Value *> _value;
+        friend class Parser;
+
+      //! the fields are sorted by label, so that lookup is a binary search; when a
+      //! label is repeated, the first occurrence wins.
+        Field   *_fields;
+        int     _size;
+
+        Object (Field *fields, int n) : Value(T_OBJECT), _fields(fields), _size(n) { };
+
+        Value *_find (const char *key, size_t len) const;
     };
 
   //! JSON arrays
     class Array : public Value {
       public:
-        Array () : Value(T_ARRAY), _value() { };
         ~Array ();
 
-        int length () const { return static_cast<int>(this->_value.size()); }
-        void add (Value *v) { this->_value.push_back(v); }
+        int length () const { return this->_length; }
 
         Value *operator[] (int idx) const { return this->_value[idx]; }
 
         std::string toString();
 
       private:
-        std::vector<Value *> _value;
+        friend class Parser;
+
+        Value   **_value;
+        int     _length;
+
+        Array (Value **elems, int n) : Value(T_ARRAY), _value(elems), _length(n) { };
     };
 
   //! base class for JSON numbers
@@ -253,15 +288,25 @@ namespace JSON {
 
     class String : public Value {
       public:
-        String (std::string v) : Value(T_STRING), _value(v) { };
         ~String ();
 
-        std::string value () const { return this->_value; }
+        std::string value () const { return std::string(this->_value, this->_len); }
+
+      //! the characters of the string (NUL terminated)
+        const char *data () const { return this->_value; }
+
+      //! the length of the string
+        size_t length () const { return this->_len; }
 
         std::string toString();
 
       private:
-        std::string _value;
+        friend class Parser;
+
+        const char      *_value;
+        size_t          _len;
+
+        String (const char *v, size_t len) : Value(T_STRING), _value(v), _len(len) { };
     };
 
     class Bool : public Value {
@@ -286,6 +331,50 @@ namespace JSON {
 
     };
 
+  //! A parsed JSON file whose values are allocated from a single arena.  The strings
+  //! of the tree (including object labels) point into the document's copy of the
+  //! file, so parsing does not allocate any storage per value.  All of the values
+  //! are freed when the document is deleted and must not be deleted individually.
+  //! Values in a document are accessed using the same API as the result of
+  //! ParseFile.
+    class Document {
+      public:
+        ~Document ();
+
+      //! the root value of the document
+        Value *root () const { return this->_root; }
+
+      //! the number of bytes of arena storage allocated for the values of the document
+        size_t arenaSize () const { return this->_nBytes; }
+
+      //! the number of arena blocks allocated for the document
+        int numBlocks () const { return this->_nBlocks; }
+
+      private:
+        friend class Parser;
+        friend Document *ParseDocument (std::string filename);
+
+      //! a block of arena storage
+        struct Block {
+            Block       *_next;         //!< the previously allocated block
+        };
+
+        char    *_text;         //!< the text of the JSON file
+        Value   *_root;         //!< the root value
+        Block   *_blocks;       //!< the list of arena blocks
+        char    *_nextP;        //!< the next free byte in the current block
+        size_t  _avail;         //!< the number of free bytes in the current block
+        size_t  _blkSz;         //!< the size of arena blocks
+        size_t  _nBytes;        //!< the total size of the arena blocks
+        int     _nBlocks;       //!< the number of arena blocks
+
+      //! \param textLen the length of the JSON text, which is used to size the arena blocks
+        explicit Document (size_t textLen);
+
+      //! allocate storage from the arena
+        void *_alloc (size_t nb);
+    };
+
 } // namespace JSON
 
 #endif // !_JSON_HXX_
@@ -0,0 +1,266 @@
+/*! \file obj-mesh.hxx
+ *
+ * \author John Reppy
+ *
+ * Support for compiled meshes, which are a binary form of OBJ models that can be
+ * loaded without any parsing.  A compiled mesh holds the model's vertex pool (with
+ * precomputed tangent vectors when the model is normal mapped), its index array (using
+ * 16-bit indices when the pool is small enough), its bounding box, and its groups and
+ * materials.  The compiled form of "foo.obj" is stored in "foo.obj.mesh" next to it
+ * and is memory mapped, so the vertex data can be passed directly to glBufferData.
+ *
+ * When a model is compiled, the triangles of each group are reordered for the
+ * post-transform vertex cache and to reduce overdraw, the vertices are reordered by
+ * their first use, and the vertex attributes are interleaved into a single stream.
+ *
+ * A compiled mesh also holds a chain of simplified levels of detail (LODs) for each
+ * group.  Level 0 is the original mesh; the triangles of the other levels are stored
+ * after level 0 in the index array and use the same vertex pool, so all of the levels
+ * can be drawn from the same buffers.
+ */
+
+/*
+ * COPYRIGHT (c) 2017 John Reppy (http://cs.uchicago.edu/~jhr)
+ * All rights reserved.
+ */
+
+#ifndef _OBJ_MESH_HXX_
+#define _OBJ_MESH_HXX_
+
+#include "cs237.hxx"
+#include "obj.hxx"
+#include <vector>
+
+namespace OBJ {
+
+  //! compute the extended tangent vectors for a vertex pool.  The xyz components of
+  //! a tangent are the tangent vector orthogonalized against the normal and the w
+  //! component is the handedness (+1 or -1) of the tangent frame.  The results do not
+  //! depend on whether a pool is used or on its size.  On x86 processors, the
+  //! tangents are orthogonalized with SSE2; defining CS237_NO_SIMD when compiling the
+  //! library forces the scalar code, which produces the same results.
+  //! \param nVerts the number of vertices in the pool
+  //! \param verts the vertex coordinates
+  //! \param norms the normal vectors
+  //! \param txtCoords the texture coordinates
+  //! \param nIndices the number of indices (3 * number of triangles)
+  //! \param indices the triangles
+  //! \param[out] tangents the array of nVerts tangents
+  //! \param pool if non-null, the triangles and vertices are processed in parallel
+  //!        using the pool's workers
+    void ComputeTangents (
+        uint32_t nVerts,
+        const cs237::vec3f *verts,
+        const cs237::vec3f *norms,
+        const cs237::vec2f *txtCoords,
+        uint32_t nIndices,
+        const uint32_t *indices,
+        cs237::vec4f *tangents,
+        cs237::ThreadPool *pool = nullptr);
+
+  //! reorder the triangles of each group of a model to improve the hit rate of the
+  //! post-transform vertex cache and then sort clusters of triangles to reduce overdraw.
+  //! The triangles of a group stay in the group's range of the index array.
+  //! \param nVerts the number of vertices in the pool
+  //! \param verts the vertex coordinates
+  //! \param groups the groups of the model
+  //! \param indices the index array of the model, which is updated in place
+    void OptimizeTriangleOrder (
+        uint32_t nVerts,
+        const cs237::vec3f *verts,
+        std::vector<OBJ::Group> const &groups,
+        uint32_t *indices);
+
+  //! renumber the vertices of a pool in the order of their first use in an index array,
+  //! which improves the locality of vertex fetches.  Vertices that are not used are
+  //! dropped.
+  //! \param nVerts the number of vertices in the pool
+  //! \param nIndices the number of indices
+  //! \param indices the index array, which is updated in place
+  //! \param[out] remap maps the old vertex numbers to the new ones (~0 for unused vertices)
+  //! \return the number of vertices in the renumbered pool
+    uint32_t OptimizeVertexOrder (
+        uint32_t nVerts,
+        uint32_t nIndices,
+        uint32_t *indices,
+        std::vector<uint32_t> &remap);
+
+  //! the range of the index array that holds the triangles of a group at some level
+  //! of detail
+    struct LODRange {
+        uint32_t firstIndex;    //!< the position of the first index in the index array
+        uint32_t nIndices;      //!< the number of indices (3 * number of triangles)
+    };
+
+  //! build a chain of simplified levels of detail for the groups of a model using
+  //! quadric-error edge collapses.  Each level has about a quarter of the triangles of
+  //! the previous level.  Since vertices are collapsed onto their neighbors, the levels
+  //! only use vertices from the pool; vertices on seams, on the boundary of a group, or
+  //! shared between groups are never moved, so the groups stay connected.
+  //! \param nVerts the number of vertices in the pool
+  //! \param verts the vertex coordinates
+  //! \param groups the groups of the model
+  //! \param nIndices the number of indices in the model's index array
+  //! \param indices the index array of the model
+  //! \param nLODs the number of simplified levels to build
+  //! \param[out] lodIndices the triangles of the simplified levels, which are meant to
+  //!             be appended to the model's index array
+  //! \param[out] lodRanges the range of the triangles of group g at level l+1 is
+  //!             lodRanges[l*groups.size() + g].  A group that cannot be simplified
+  //!             further uses the range of the previous level.
+  //! \param[out] lodErrors the maximum geometric error (in model units) of each level,
+  //!             which is the largest distance from a vertex of the model to the
+  //!             simplified triangles around the vertex that it was collapsed into
+    void BuildLODs (
+        uint32_t nVerts,
+        const cs237::vec3f *verts,
+        std::vector<OBJ::Group> const &groups,
+        uint32_t nIndices,
+        const uint32_t *indices,
+        int nLODs,
+        std::vector<uint32_t> &lodIndices,
+        std::vector<LODRange> &lodRanges,
+        std::vector<float> &lodErrors);
+
+  //! compute the average cache miss ratio (i.e., the number of vertex-shader invocations
+  //! per triangle) of an index array for a 16-entry FIFO vertex cache
+  //! \param nVerts the number of vertices in the pool
+  //! \param nIndices the number of indices
+  //! \param indices the index array
+    float ACMR (uint32_t nVerts, uint32_t nIndices, const uint32_t *indices);
+
+  //! A compiled mesh, which is either memory mapped from a ".mesh" file or compiled
+  //! in memory from a model.
+    class MeshFile {
+      public:
+
+      //! compile and optimize a model.  Tangent vectors are included when the model has
+      //! normals and texture coordinates and some material has a normal map.
+      //! \param model the model
+      //! \param pool if non-null, the pool used to compute the tangents in parallel
+      //! \return the compiled mesh, which has not been saved
+        static MeshFile *Compile (Model const *model, cs237::ThreadPool *pool = nullptr);
+
+      //! map the compiled form of an OBJ file
+      //! \param objFile the OBJ file
+      //! \return the compiled mesh, or nullptr if it is missing, has the wrong version,
+      //!         or is out of date with respect to the OBJ file or its material library
+        static MeshFile *Open (std::string const &objFile);
+
+      //! the path of the compiled form of an OBJ file
+        static std::string MeshPath (std::string const &objFile) { return objFile + ".mesh"; }
+
+      //! write a compiled mesh to the MeshPath of the OBJ file that it was compiled
+      //! from.  The file is written to a temporary and then renamed, so readers never
+      //! see a partial file.
+      //! \return false if the file could not be written (e.g., the directory is read only)
+        bool Save () const;
+
+        ~MeshFile ();
+
+      //! the path of the OBJ file that the mesh was compiled from
+        std::string const &Path () const { return this->_objFile; }
+
+      //! the model's axis-aligned bounding box
+        const cs237::AABBf &BBox () const { return this->_bbox; }
+
+      //! the number of materials in the mesh
+        int NumMaterials () const { return this->_materials.size(); }
+      //! get a material
+        const OBJ::Material & Material (int i) const { return this->_materials[i]; }
+
+      //! the number of groups in the mesh
+        int NumGroups () const { return this->_groups.size(); }
+      //! get a group by index
+        const OBJ::Group & Group (int i) const { return this->_groups[i]; }
+      //! iterator for looping over the groups in the mesh
+        std::vector<OBJ::Group>::const_iterator beginGroups () const { return this->_groups.begin(); }
+      //! terminator for looping over the groups in the mesh
+        std::vector<OBJ::Group>::const_iterator endGroups () const { return this->_groups.end(); }
+
+      //! the number of levels of detail (at least 1, since level 0 is the original mesh)
+        int NumLODs () const { return this->_lodErrors.size(); }
+      //! the maximum geometric error (in model units) of a level of detail
+        float LODError (int lod) const { return this->_lodErrors[lod]; }
+      //! the range of the index array that holds the triangles of a group at a level of
+      //! detail; the range of level 0 is the group's range
+        LODRange const &GroupLOD (int grp, int lod) const
+        {
+            return this->_lodRanges[lod * this->_groups.size() + grp];
+        }
+
+      //! the number of vertices in the vertex pool
+        uint32_t NumVerts () const { return this->_nVerts; }
+      //! the interleaved vertex data of the pool.  Each vertex holds its coordinates
+      //! (a vec3f) followed by its normal (a vec3f), its texture coordinates (a vec2f),
+      //! and its extended tangent (a vec4f), when those are present.
+        const void *VertexData () const { return this->_vertData; }
+      //! the size in bytes of a vertex
+        uint32_t VertexStride () const { return this->_stride; }
+      //! the byte offset of the normal in a vertex (or -1)
+        int NormOffset () const { return this->_normOffset; }
+      //! the byte offset of the texture coordinates in a vertex (or -1)
+        int TxtCoordOffset () const { return this->_txtCoordOffset; }
+      //! the byte offset of the extended tangent in a vertex (or -1)
+        int TangentOffset () const { return this->_tangentOffset; }
+      //! does the pool have normals?
+        bool HasNorms () const { return (this->_normOffset >= 0); }
+      //! does the pool have texture coordinates?
+        bool HasTxtCoords () const { return (this->_txtCoordOffset >= 0); }
+      //! does the pool have extended tangents?
+        bool HasTangents () const { return (this->_tangentOffset >= 0); }
+      //! the coordinates of the i'th vertex
+        cs237::vec3f const &Vert (uint32_t i) const
+        {
+            return *reinterpret_cast<const cs237::vec3f *>(
+                static_cast<const uint8_t *>(this->_vertData) + i * this->_stride);
+        }
+
+      //! the number of indices in the index array
+        uint32_t NumIndices () const { return this->_nIndices; }
+      //! the size in bytes of an index (2 or 4)
+        uint32_t IndexSize () const { return this->_indexSz; }
+      //! the index array, which is an array of uint16_t or uint32_t values depending on
+      //! the IndexSize
+        const void *Indices () const { return this->_indices; }
+
+      //! the total size in bytes of the vertex and index data
+        size_t DataSize () const;
+
+      private:
+        std::string     _objFile;       //!< the OBJ file that the mesh was compiled from
+        const uint8_t   *_data;         //!< the contents of the compiled file
+        size_t          _size;          //!< the size of the contents
+        bool            _mapped;        //!< true if _data is memory mapped; otherwise it
+                                        //!  is heap allocated
+        cs237::AABBf    _bbox;
+        std::vector<OBJ::Material> _materials;
+        std::vector<OBJ::Group> _groups;
+        std::vector<float> _lodErrors;  //!< the error of each level of detail
+        std::vector<LODRange> _lodRanges; //!< the ranges of the groups at each level
+        uint32_t        _nVerts;
+        uint32_t        _nIndices;
+        uint32_t        _indexSz;
+        uint32_t        _stride;
+        int             _normOffset;
+        int             _txtCoordOffset;
+        int             _tangentOffset;
+        const void      *_vertData;
+        const void      *_indices;
+
+        MeshFile (std::string const &objFile, const uint8_t *data, size_t size, bool mapped)
+            : _objFile(objFile), _data(data), _size(size), _mapped(mapped),
+              _nVerts(0), _nIndices(0), _indexSz(0), _stride(0),
+              _normOffset(-1), _txtCoordOffset(-1), _tangentOffset(-1),
+              _vertData(nullptr), _indices(nullptr)
+        { }
+
+      // initialize the mesh from the contents of a compiled file; returns false if
+      // the contents are not valid
+        bool _Init ();
+
+    }; // class MeshFile
+
+} // namespace OBJ
+
+#endif // !_OBJ_MESH_HXX_
@@ -66,17 +66,15 @@ struct Material {
     std::string         normalMap;      //!< optional normal map for bump mapping
 }; // struct Material
 
-//! A mesh that corresponds to a group in the obj file
+//! A mesh that corresponds to a group in the obj file.  The group's triangles are a
+//! range of the model's index array and the indices refer to the model's vertex pool,
+//! which is shared by all of the groups.
 struct Group {
     std::string         name;           //!< name of this group */
     int                 material;       //!< index to material for group (-1 for no material)
-    uint32_t            nVerts;         //!< the number of vertices in this group.
+    uint32_t            firstIndex;     //!< the position of the group's first index in
+                                        //!  the model's index array
     uint32_t            nIndices;       //!< the number of indices (3 * number of triangles)
-    cs237::vec3f        *verts;         //!< array of nVerts vertex coordinates
-    cs237::vec3f        *norms;         //!< array of nVerts normal vectors (or nullptr)
-    cs237::vec2f        *txtCoords;     //!< array of nVerts texture coordinates (or nullptr)
-    uint32_t            *indices;       //!< array of nIndices element indices that can be used
-                                        //!  to render the group
 }; // struct Group
 
 //! A model from an OBJ file
@@ -85,9 +83,18 @@ class Model {
 
   //! create a Model by loading it from the specified OBJ file
   //! \param filename the path of the OBJ file to be loaded
-    Model (std::string filename);
+  //! \param pool if non-null, then large files are parsed in parallel using the
+  //!        pool's threads; the resulting model is the same as for a serial load
+    Model (std::string filename, cs237::ThreadPool *pool = nullptr);
     ~Model ();
 
+  //! the path of the OBJ file that the model was loaded from
+    std::string const &Path () const { return this->_path; }
+
+  //! the name of the model's material library (empty if there is none).  The name is
+  //! relative to the directory that contains the OBJ file.
+    std::string const &MtlLib () const { return this->_mtlLibName; }
+
   //! the model's axis-aligned bounding box
     const cs237::AABBf &BBox () const { return this->_bbox; }
 
@@ -105,6 +112,33 @@ class Model {
   //! terminator for looping over the groups in the module
     std::vector<OBJ::Group>::const_iterator endGroups () const { return this->_groups.end(); }
 
+  //! the number of vertices in the model's vertex pool.  Each unique combination
+  //! of position, normal, and texture coordinate in the OBJ file is a vertex.
+    uint32_t NumVerts () const { return this->_verts.size(); }
+  //! the vertex coordinates of the pool
+    const cs237::vec3f *Verts () const { return this->_verts.data(); }
+  //! the normal vectors of the pool (or nullptr if the model does not have normals)
+    const cs237::vec3f *Norms () const
+    {
+        return this->_norms.empty() ? nullptr : this->_norms.data();
+    }
+  //! the texture coordinates of the pool (or nullptr if the model does not have them)
+    const cs237::vec2f *TxtCoords () const
+    {
+        return this->_txtCoords.empty() ? nullptr : this->_txtCoords.data();
+    }
+
+  //! the number of indices in the model's index array
+    uint32_t NumIndices () const { return this->_indices.size(); }
+  //! the index array, which holds the triangles of the groups.  The indices refer to
+  //! the vertex pool.
+    const uint32_t *Indices () const { return this->_indices.data(); }
+  //! the indices of a group's triangles
+    const uint32_t *Indices (OBJ::Group const &grp) const
+    {
+        return this->_indices.data() + grp.firstIndex;
+    }
+
   private:
     std::string         _path;          //!< path to the obj file that this model came from
     std::string         _mtlLibName;    //!< name of the material library for this model
@@ -113,6 +147,11 @@ class Model {
     std::vector<OBJ::Material> _materials;
     std::vector<OBJ::Group> _groups;
 
+    std::vector<cs237::vec3f> _verts;   //!< the vertex pool's coordinates
+    std::vector<cs237::vec3f> _norms;   //!< the vertex pool's normals (or empty)
+    std::vector<cs237::vec2f> _txtCoords; //!< the vertex pool's texture coordinates (or empty)
+    std::vector<uint32_t> _indices;     //!< the triangles of the groups
+
   // read a material library
     bool readMaterial (std::string m);
 
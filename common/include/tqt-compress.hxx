@@ -0,0 +1,82 @@
+/*! \file tqt-compress.hxx
+ *
+ * CPU encoders and decoders for the block-compressed tile formats that are supported
+ * by texture quadtrees.  BC1 stores an RGB image in 8-byte 4x4 blocks (4 bits/pixel)
+ * and BC5 stores two channels as a pair of 8-byte BC4 blocks (8 bits/pixel).
+ *
+ * \author John Reppy
+ */
+
+/*
+ * COPYRIGHT (c) 2017 John Reppy (http://cs.uchicago.edu/~jhr)
+ * All rights reserved.
+ */
+
+#ifndef _TQT_COMPRESS_HXX_
+#define _TQT_COMPRESS_HXX_
+
+#include "tqt.hxx"
+
+namespace TQT {
+
+  //! the OpenGL compressed-texture format for a tile format
+  //! \param fmt the tile format (TILE_BC1 or TILE_BC5)
+    GLenum GLFormat (TileFormat fmt);
+
+  //! the number of bytes required to hold a compressed image
+  //! \param fmt the tile format (TILE_BC1 or TILE_BC5)
+  //! \param wid the width of the image (a multiple of 4)
+  //! \param ht the height of the image (a multiple of 4)
+    size_t CompressedSize (TileFormat fmt, int wid, int ht);
+
+  //! encode a 4x4 block of RGB pixels as a BC1 block
+  //! \param rgb points to the upper-left pixel of the block
+  //! \param stride the distance in bytes between rows of pixels
+  //! \param[out] blk the 8-byte BC1 block
+    void EncodeBC1Block (const uint8_t *rgb, int stride, uint8_t blk[8]);
+
+  //! decode a BC1 block into a 4x4 block of RGB pixels
+  //! \param blk the 8-byte BC1 block
+  //! \param[out] rgb points to the upper-left pixel of the block
+  //! \param stride the distance in bytes between rows of pixels
+    void DecodeBC1Block (const uint8_t blk[8], uint8_t *rgb, int stride);
+
+  //! encode one channel of a 4x4 block of pixels as a BC4 block
+  //! \param src points to the channel of the upper-left pixel of the block
+  //! \param pixStride the distance in bytes between pixels
+  //! \param rowStride the distance in bytes between rows of pixels
+  //! \param[out] blk the 8-byte BC4 block
+    void EncodeBC4Block (const uint8_t *src, int pixStride, int rowStride, uint8_t blk[8]);
+
+  //! decode a BC4 block into one channel of a 4x4 block of pixels
+  //! \param blk the 8-byte BC4 block
+  //! \param[out] dst points to the channel of the upper-left pixel of the block
+  //! \param pixStride the distance in bytes between pixels
+  //! \param rowStride the distance in bytes between rows of pixels
+    void DecodeBC4Block (const uint8_t blk[8], uint8_t *dst, int pixStride, int rowStride);
+
+  //! compress an RGB image.  For TILE_BC5, the red and green channels are encoded and
+  //! the blue channel is dropped.  The work is split across the shared thread pool.
+  //! \param img the source image, which must be GL_RGB/GL_UNSIGNED_BYTE and have
+  //!        dimensions that are multiples of 4
+  //! \param fmt the tile format (TILE_BC1 or TILE_BC5)
+  //! \return the compressed image; the caller is responsible for its storage
+    cs237::image2d *Compress (cs237::image2d *img, TileFormat fmt);
+
+  //! decompress an image that was produced by Compress (or read from a compressed TQT)
+  //! into a GL_RGB/GL_UNSIGNED_BYTE image.  For BC5 images, which hold the x and y
+  //! components of unit vectors, the blue channel is reconstructed as the (non-negative)
+  //! third component.
+  //! \return the decompressed image; the caller is responsible for its storage
+    cs237::image2d *Decompress (cs237::image2d *img);
+
+  //! flip a compressed image vertically in place
+  //! \param fmt the tile format (TILE_BC1 or TILE_BC5)
+  //! \param wid the width of the image (a multiple of 4)
+  //! \param ht the height of the image (a multiple of 4)
+  //! \param data the compressed blocks
+    void FlipBlocks (TileFormat fmt, int wid, int ht, uint8_t *data);
+
+} // namespace TQT
+
+#endif // !_TQT_COMPRESS_HXX_
@@ -18,20 +18,39 @@
 
 namespace TQT {
 
+  //! the encoding of the image tiles in a TQT file.  Version 1 files always hold
+  //! PNG tiles; version 2 files record the encoding in their header.
+    enum TileFormat {
+        TILE_PNG = 0,           //!< PNG-encoded RGB images
+        TILE_BC1 = 1,           //!< BC1 (a.k.a. DXT1) compressed RGB images
+        TILE_BC5 = 2            //!< BC5 (a.k.a. RGTC2) compressed two-channel images; used
+                                //!  for normal maps, where the third component is
+                                //!  reconstructed from the first two.
+    };
+
   //! Manages a disk-based texture quadtree and supports loading individual
-  //! texture images at different levels and locations in the tree.
+  //! texture images at different levels and locations in the tree.  The file
+  //! is memory mapped, so tiles are decoded directly from the mapped bytes.
     class TextureQTree {
       public:
 
+      //! a range of bytes in the mapped TQT file
+        struct ByteRange {
+            const uint8_t       *data;          //!< the first byte of the range
+            size_t              nBytes;         //!< the number of bytes in the range
+        };
+
         TextureQTree (const char* filename);
         ~TextureQTree();
 
       //! is this a valid TQT?
-        bool isValid () const { return this->_source != nullptr; }
+        bool isValid () const { return this->_base != nullptr; }
       //! the depth of the TQT
         int Depth() const { return this->_depth; }
       //! the size of a texture tile measured in pixels (tiles are always square)
         int TileSize() const { return this->_tileSize; }
+      //! the encoding of the tiles in the TQT
+        TileFormat Format() const { return this->_format; }
 
       //! return the image tile at the specified quadtree node.
       //! \param[in] level the level of the node in the tree (root = 0)
@@ -40,17 +59,58 @@ namespace TQT {
       //! \param[in] flip should the image be flipped to match OpenGL (default true)
       //! \return a pointer to the image; nullptr is returned if there is
       //!         an error.  It is the caller's responsibility to manage the
-      //!         image's storage.
+      //!         image's storage.  For compressed TQTs, the image holds the
+      //!         compressed blocks (i.e., img->isCompressed() is true).
+      //!
+      //! This method is reentrant, so it may be called from multiple threads at
+      //! once on the same tree.
         cs237::image2d *LoadImage (int level, int row, int col, bool flip = true);
 
+      //! load the image tile at the specified quadtree node into an existing image,
+      //! reusing the image's storage.  This is the allocation-free version of LoadImage
+      //! for callers that recycle tile images.
+      //! \param[in] level the level of the node in the tree (root = 0)
+      //! \param[in] row the row of the node on its level (north == 0)
+      //! \param[in] col the column of the node on its level (west == 0)
+      //! \param[in] flip should the image be flipped to match OpenGL
+      //! \param[in,out] img the image to load into; it must have been returned by
+      //!                 LoadImage for this tree (so that it has the tile's shape)
+      //! \return true if successful, false otherwise
+        bool LoadImage (int level, int row, int col, bool flip, cs237::image2d *img);
+
+      //! return the encoded data (PNG or compressed blocks) for the tile at the
+      //! specified quadtree node.  The bytes are valid for the lifetime of the tree.
+      //! \param[in] level the level of the node in the tree (root = 0)
+      //! \param[in] row the row of the node on its level (north == 0)
+      //! \param[in] col the column of the node on its level (west == 0)
+        ByteRange TileBytes (int level, int row, int col) const;
+
       //! return true if the file looks like a TQT file of the right version
         static bool isTQTFile (std::string const &filename);
 
+      //! write the header and table of contents of a TQT file whose tiles all have the
+      //! same size in bytes (i.e., a compressed TQT).  The tiles should be written
+      //! following the TOC in node-index order (see NodeIndex).
+      //! \param outS the output stream
+      //! \param depth the depth of the tree
+      //! \param tileSize the width of the tiles in pixels
+      //! \param fmt the tile encoding (TILE_BC1 or TILE_BC5)
+      //! \return true if successful, false otherwise
+        static bool WriteHeader (std::ofstream &outS, int depth, int tileSize, TileFormat fmt);
+
+      //! the number of nodes in a tree of the given depth
+        static uint32_t NumNodes (int depth);
+
+      //! the index of a node in the TOC
+        static uint32_t NodeIndex (int level, int row, int col);
+
       private:
-        std::vector<std::streamoff> _toc;       //!< stream offsets for images
+        std::vector<ByteRange> _toc;            //!< the encoded data for each tile
         int _depth;                             //!< the depth of the TQT
         int _tileSize;                          //!< the size of a texture tile in pixels
-        std::ifstream *_source;                 //!< the source file for the textures
+        TileFormat _format;                     //!< the encoding of the tiles
+        const uint8_t *_base;                   //!< the mapped file (nullptr if invalid)
+        size_t _size;                           //!< the size of the mapped file in bytes
 
     };  // class TextureQTree
 
@@ -18,7 +18,10 @@
 #include "json.hxx"
 #include <iostream>
 #include <fstream>
+#include <algorithm>
 #include <cctype>
+#include <cstring>
+#include <new>
 #include "strings.h"
 
 namespace JSON {
@@ -27,7 +30,15 @@ namespace JSON {
 class Input {
   public:
     Input (std::string filename);
-    ~Input () { delete this->_buffer; }
+    ~Input () { delete[] this->_buffer; }
+
+  //! take ownership of the input buffer
+    char *release ()
+    {
+        char *buf = this->_buffer;
+        this->_buffer = nullptr;
+        return buf;
+    }
 
 
     Input const &operator++ (int _unused) {
@@ -49,7 +60,7 @@ class Input {
         std::cerr << "    input = \"";
         int n = this->avail();
         if (20 < n) n = 20;
-        for (int i = 0;  (i < 20);  i++) {
+        for (int i = 0;  (i < n);  i++) {
             if (isprint(this->_buffer[this->_i+i]))
                 std::cerr << this->_buffer[this->_i+i];
             else
@@ -81,13 +92,15 @@ Input::Input (std::string filename)
     int length = inS.tellg();
     inS.seekg (0, inS.beg);
 
-  // read length bytes
+  // read length bytes; we add a trailing NUL so that lookahead past the end of the
+  // input is safe
     this->_lnum = 1;
-    this->_buffer = new char[length];
+    this->_buffer = new char[length+1];
     inS.read (this->_buffer, length);
+    this->_buffer[length] = '\0';
 
     if (inS.fail()) {
-        delete this->_buffer;
+        delete[] this->_buffer;
         this->_buffer = 0;
         return;
     }
@@ -95,9 +108,66 @@ Input::Input (std::string filename)
     this->_len = length;
 }
 
-// forward decls
+// The parser builds the tree bottom up.  The fields and elements of the objects and
+// arrays that are being parsed are accumulated on stacks that are shared by all levels
+// of nesting, so that each object or array can be allocated at its final size once
+// its closing bracket is seen.  When parsing into a Document, the values and their
+// field/element arrays are allocated from the document's arena and strings are
+// unescaped in place in the input buffer, which becomes part of the document.
+// Otherwise, each value is allocated on the heap and owns its contents.
+//
+class Parser {
+  public:
+    Parser (Input &datap, Document *doc) : _datap(datap), _doc(doc) { }
+
+    Value *parse ();
+
+  private:
+    Input                       &_datap;
+    Document                    *_doc;
+    std::vector<Object::Field>  _fields;        // fields of the open objects
+    std::vector<Value *>        _elems;         // elements of the open arrays
+
+  // allocate a value
+    template <typename T, typename... Args>
+    T *_make (Args... args)
+    {
+        if (this->_doc == nullptr) {
+            return new T(args...);
+        }
+        else {
+            T *v = new (this->_doc->_alloc(sizeof(T))) T(args...);
+            v->_owned = false;
+            return v;
+        }
+    }
+
+  // allocate an array of n items
+    template <typename T>
+    T *_makeArray (int n)
+    {
+        if (n == 0) {
+            return nullptr;
+        }
+        else if (this->_doc == nullptr) {
+            return new T[n];
+        }
+        else {
+            return static_cast<T *>(this->_doc->_alloc(n * sizeof(T)));
+        }
+    }
+
+  // return the storage for a string that has been unescaped in place
+    const char *_text (char *s, size_t len);
+
+  // parse a string
+    bool _string (const char * &s, size_t &len);
+
+  // clean up the partial results of an object or array after an error
+    void _abandon (size_t fieldBase, size_t elemBase);
+};
+
 static bool SkipWhitespace (Input &datap);
-static Value *Parse (Input &datap);
 
 // parse a JSON file; this returns nullptr if there is a parsing error
 Value *ParseFile (std::string filename)
@@ -115,12 +185,44 @@ Value *ParseFile (std::string filename)
         return nullptr;
     }
 
-    Value *value = Parse (datap);
+    Parser parser(datap, nullptr);
+    Value *value = parser.parse ();
 
     return value;
 
 }
 
+Document *ParseDocument (std::string filename)
+{
+  // open the JSON file for reading
+    Input datap(filename);
+    if (datap.eof()) {
+#ifndef NDEBUG
+        std::cerr << "JSON::ParseDocument: unable to read \"" << filename << "\"" << std::endl;
+#endif
+        return nullptr;
+    }
+
+    if (! SkipWhitespace (datap)) {
+        return nullptr;
+    }
+
+    Document *doc = new Document(datap.avail());
+    Parser parser(datap, doc);
+    Value *value = parser.parse ();
+    if (value == nullptr) {
+        delete doc;
+        return nullptr;
+    }
+
+  // the document's strings point into the input buffer, so the document takes it over
+    doc->_root = value;
+    doc->_text = datap.release();
+
+    return doc;
+
+}
+
 static bool SkipWhitespace (Input &datap)
 {
     while ((! datap.eof()) && isspace(*datap))
@@ -134,14 +236,17 @@ static bool SkipWhitespace (Input &datap)
         return true;
 }
 
-static bool ExtractString (Input &datap, std::string &str)
+// extract a string from the input.  The string is unescaped in place, so on success
+// str points to its first character in the input buffer and len is its length.
+static bool ExtractString (Input &datap, char * &str, size_t &len)
 {
-    str = "";
-
     if (*datap != '\"')
         return false;
     datap++;
 
+    char *start = const_cast<char *>(datap());
+    char *dst = start;
+
     while (! datap.eof()) {
         // Save the char so we can change it if need be
         char nextChar = *datap;
@@ -170,7 +275,8 @@ static bool ExtractString (Input &datap, std::string &str)
       // End of the string?
         else if (nextChar == '"') {
             datap++;
-            str.reserve(); // Remove unused capacity
+            str = start;
+            len = dst - start;
             return true;
         }
       // Disallowed char?
@@ -179,8 +285,8 @@ static bool ExtractString (Input &datap, std::string &str)
             datap.error("invalid character in string");
             return false;
         }
-      // Add the next char
-        str += nextChar;
+      // Add the next char; the unescaped text is never longer than the input
+        *dst++ = nextChar;
       // Move on
         datap++;
     }
@@ -189,6 +295,13 @@ static bool ExtractString (Input &datap, std::string &str)
     return false;
 }
 
+// ordering on object fields by label
+static inline bool FieldLess (Object::Field const &a, Object::Field const &b)
+{
+    int cmp = std::memcmp(a._key, b._key, (a._len < b._len) ? a._len : b._len);
+    return (cmp < 0) || ((cmp == 0) && (a._len < b._len));
+}
+
 static int64_t ParseInt (Input &datap)
 {
     int64_t n = 0;
@@ -214,8 +327,10 @@ static double ParseDecimal (Input &datap)
     return decimal;
 }
 
-static Value *Parse (Input &datap)
+Value *Parser::parse ()
 {
+    Input &datap = this->_datap;
+
     if (datap.eof()) {
         datap.error("unexpected end of file");
         return nullptr;
@@ -223,25 +338,26 @@ static Value *Parse (Input &datap)
 
   // Is it a string?
     if (*datap == '"') {
-        std::string str;
-        if (! ExtractString(datap, str))
+        const char *str;
+        size_t len;
+        if (! this->_string(str, len))
             return nullptr;
         else
-            return new String(str);
+            return this->_make<String>(str, len);
     }
   // Is it a boolean?
     else if ((datap.avail() >= 4) && strncasecmp(datap(), "true", 4) == 0) {
         datap += 4;
-        return new Bool(true);
+        return this->_make<Bool>(true);
     }
     else if ((datap.avail() >=  5) && strncasecmp(datap(), "false", 5) == 0) {
         datap += 5;
-        return new Bool(false);
+        return this->_make<Bool>(false);
     }
   // Is it a null?
     else if ((datap.avail() >=  4) && strncasecmp(datap(), "null", 4) == 0) {
         datap += 4;
-        return new Null();
+        return this->_make<Null>();
     }
   // Is it a number?
     else if (*datap == '-' || isdigit(*datap)) {
@@ -314,86 +430,102 @@ static Value *Parse (Input &datap)
         }
 
         if (isReal) {
-            return new Real (neg ? -r : r);
+            return this->_make<Real>(neg ? -r : r);
         }
         else {
-            return new Integer (neg ? -whole : whole);
+            return this->_make<Integer>(neg ? -whole : whole);
         }
     }
   // An object?
     else if (*datap == '{') {
-        Object *object = new Object();
+        size_t fieldBase = this->_fields.size();
 
         datap++;
 
         while (!datap.eof()) {
           // Whitespace at the start?
             if (! SkipWhitespace(datap)) {
-                delete object;
+                this->_abandon (fieldBase, this->_elems.size());
                 return nullptr;
             }
 
           // Special case: empty object
-            if ((object->size() == 0) && (*datap == '}')) {
+            if ((this->_fields.size() == fieldBase) && (*datap == '}')) {
                 datap++;
-                return object;
+                return this->_make<Object>(nullptr, 0);
             }
 
           // We want a string now...
-            std::string name;
-// CHECK: do we need to look for "?
-            if (! ExtractString(datap, name)) {
+            Object::Field fld;
+            if (! this->_string(fld._key, fld._len)) {
                 datap.error("expected label");
-                delete object;
+                this->_abandon (fieldBase, this->_elems.size());
                 return nullptr;
             }
+            fld._val = nullptr;
+            this->_fields.push_back (fld);
 
           // More whitespace?
             if (! SkipWhitespace(datap)) {
-                delete object;
+                this->_abandon (fieldBase, this->_elems.size());
                 return nullptr;
             }
 
           // Need a : now
             if (*datap != ':') {
                 datap.error("expected ':'");
-                delete object;
+                this->_abandon (fieldBase, this->_elems.size());
                 return nullptr;
             }
             datap++;
 
           // More whitespace?
             if (! SkipWhitespace(datap)) {
-                delete object;
+                this->_abandon (fieldBase, this->_elems.size());
                 return nullptr;
             }
 
           // The value is here
-            Value *value = Parse(datap);
+            Value *value = this->parse();
             if (value == nullptr) {
-                delete object;
+                this->_abandon (fieldBase, this->_elems.size());
                 return nullptr;
             }
 
           // Add the name:value
-            object->insert(name, value);
+            this->_fields.back()._val = value;
 
           // More whitespace?
             if (! SkipWhitespace(datap)) {
-                delete object;
+                this->_abandon (fieldBase, this->_elems.size());
                 return nullptr;
             }
 
             // End of object?
             if (*datap == '}') {
                 datap++;
-                return object;
+              // copy the fields into an array that is sorted by label.  Objects
+              // typically have only a few fields, so we use a stable insertion
+              // sort, which keeps the first of any repeated labels first.
+                int n = static_cast<int>(this->_fields.size() - fieldBase);
+                Object::Field *fields = this->_makeArray<Object::Field>(n);
+                for (int i = 0;  i < n;  i++) {
+                    Object::Field fld = this->_fields[fieldBase + i];
+                    int j = i;
+                    while ((j > 0) && (FieldLess(fld, fields[j-1]))) {
+                        fields[j] = fields[j-1];
+                        j--;
+                    }
+                    fields[j] = fld;
+                }
+                this->_fields.resize (fieldBase);
+                return this->_make<Object>(fields, n);
             }
 
             // Want a , now
             if (*datap != ',') {
                 datap.error("expected ','");
-                delete object;
+                this->_abandon (fieldBase, this->_elems.size());
                 return nullptr;
             }
 
@@ -402,55 +534,59 @@ static Value *Parse (Input &datap)
 
       // Only here if we ran out of data
         datap.error("unexpected eof");
-        delete object;
+        this->_abandon (fieldBase, this->_elems.size());
         return nullptr;
     }
 
     // An array?
     else if (*datap == '[') {
-        Array *array = new Array();
+        size_t elemBase = this->_elems.size();
 
         datap++;
 
         while (! datap.eof()) {
           // Whitespace at the start?
             if (! SkipWhitespace(datap)) {
-                delete array;
+                this->_abandon (this->_fields.size(), elemBase);
                 return nullptr;
             }
 
           // Special case - empty array
-            if ((array->length() == 0) && (*datap == ']')) {
+            if ((this->_elems.size() == elemBase) && (*datap == ']')) {
                 datap++;
-                return array;
+                return this->_make<Array>(nullptr, 0);
             }
 
           // Get the value
-            Value *value = Parse(datap);
+            Value *value = this->parse();
             if (value == nullptr) {
-                delete array;
+                this->_abandon (this->_fields.size(), elemBase);
                 return nullptr;
             }
 
           // Add the value
-            array->add(value);
+            this->_elems.push_back (value);
 
           // More whitespace?
             if (! SkipWhitespace(datap)) {
-                delete array;
+                this->_abandon (this->_fields.size(), elemBase);
                 return nullptr;
             }
 
           // End of array?
             if (*datap == ']') {
                 datap++;
-                return array;
+                int n = static_cast<int>(this->_elems.size() - elemBase);
+                Value **elems = this->_makeArray<Value *>(n);
+                std::copy (this->_elems.begin() + elemBase, this->_elems.end(), elems);
+                this->_elems.resize (elemBase);
+                return this->_make<Array>(elems, n);
             }
 
             // Want a , now
             if (*datap != ',') {
                 datap.error("expected ','");
-                delete array;
+                this->_abandon (this->_fields.size(), elemBase);
                 return nullptr;
             }
 
@@ -459,7 +595,7 @@ static Value *Parse (Input &datap)
 
       // Only here if we ran out of data
         datap.error("unexpected eof");
-        delete array;
+        this->_abandon (this->_fields.size(), elemBase);
         return nullptr;
     }
   // Ran out of possibilites, it's bad!
@@ -469,4 +605,45 @@ static Value *Parse (Input &datap)
     }
 }
 
+const char *Parser::_text (char *s, size_t len)
+{
+    if (this->_doc == nullptr) {
+        char *str = new char[len+1];
+        std::memcpy (str, s, len);
+        str[len] = '\0';
+        return str;
+    }
+    else {
+      // the closing quote (or an escape character) follows the unescaped text, so
+      // we can terminate the string in place
+        s[len] = '\0';
+        return s;
+    }
+}
+
+bool Parser::_string (const char * &s, size_t &len)
+{
+    char *str;
+    if (! ExtractString(this->_datap, str, len))
+        return false;
+    s = this->_text(str, len);
+    return true;
+}
+
+void Parser::_abandon (size_t fieldBase, size_t elemBase)
+{
+    if (this->_doc == nullptr) {
+      // we own the partial results, so we need to free them
+        for (size_t i = fieldBase;  i < this->_fields.size();  i++) {
+            delete[] this->_fields[i]._key;
+            delete this->_fields[i]._val;
+        }
+        for (size_t i = elemBase;  i < this->_elems.size();  i++) {
+            delete this->_elems[i];
+        }
+    }
+    this->_fields.resize (fieldBase);
+    this->_elems.resize (elemBase);
+}
+
 } // namespace JSON
@@ -0,0 +1,356 @@
+/*! \file json-reader.cxx
+ *
+ * Code for reading JSON files as a stream of tokens.
+ *
+ * CMSC 23700 Autumn 2017.
+ *
+ * \author John Reppy
+ */
+
+/*
+ * COPYRIGHT (c) 2017 John Reppy (http://cs.uchicago.edu/~jhr)
+ * All rights reserved.
+ */
+
+#include "json-reader.hxx"
+#include <cctype>
+#include <cstring>
+#include "strings.h"
+
+namespace JSON {
+
+Reader::Reader (std::string const &filename, size_t bufSz)
+    : _file(filename), _inS(filename, std::ios::in | std::ios::binary),
+      _buf(bufSz < 16 ? 16 : bufSz), _pos(0), _end(0), _lnum(1), _stk(),
+      _state(S_VALUE), _tok(T_NULL), _str(), _int(0), _real(0.0), _bool(false)
+{
+    if (! this->_inS.is_open()) {
+        this->_error ("unable to open file");
+    }
+}
+
+Reader::~Reader () { }
+
+Reader::Token Reader::next ()
+{
+    if ((this->_tok == T_ERROR) || (this->_tok == T_EOF)) {
+        return this->_tok;
+    }
+
+    this->_skipWhitespace ();
+    int c = this->_peek();
+
+    switch (this->_state) {
+      case S_COMMA_OR_END:
+        if (c == ',') {
+            this->_advance();
+            this->_skipWhitespace ();
+            if (this->_stk.back() == '{') {
+                this->_state = S_KEY;
+                break;  // to read the label
+            }
+            else {
+                return this->_value ();
+            }
+        }
+        else if ((c == '}') && (this->_stk.back() == '{')) {
+            this->_advance();
+            this->_stk.pop_back();
+            return this->_endValue (T_END_OBJECT);
+        }
+        else if ((c == ']') && (this->_stk.back() == '[')) {
+            this->_advance();
+            this->_stk.pop_back();
+            return this->_endValue (T_END_ARRAY);
+        }
+        else {
+            return this->_error ("expected ','");
+        }
+      case S_KEY_OR_END:
+        if (c == '}') {
+            this->_advance();
+            this->_stk.pop_back();
+            return this->_endValue (T_END_OBJECT);
+        }
+        break;  // to read the label
+      case S_KEY:
+        break;  // to read the label
+      case S_VALUE_OR_END:
+        if (c == ']') {
+            this->_advance();
+            this->_stk.pop_back();
+            return this->_endValue (T_END_ARRAY);
+        }
+        return this->_value ();
+      case S_VALUE:
+        return this->_value ();
+      case S_DONE:
+        if (c < 0) {
+            return this->_tok = T_EOF;
+        }
+        else {
+            return this->_error ("extra input after value");
+        }
+    }
+
+  // we are expecting "label" :
+    if (! this->_string ()) {
+        return this->_error ("expected label");
+    }
+    this->_skipWhitespace ();
+    if (this->_peek() != ':') {
+        return this->_error ("expected ':'");
+    }
+    this->_advance();
+    this->_state = S_VALUE;
+
+    return this->_tok = T_KEY;
+}
+
+bool Reader::skipValue ()
+{
+    this->next ();
+    return this->skip ();
+}
+
+bool Reader::skip ()
+{
+    if ((this->_tok == T_BEGIN_OBJECT) || (this->_tok == T_BEGIN_ARRAY)) {
+        size_t depth = this->_stk.size();
+      // we only need to track the nesting, so we do not look at the tokens
+        while (this->_stk.size() >= depth) {
+            Token tok = this->next();
+            if ((tok == T_ERROR) || (tok == T_EOF)) {
+                return false;
+            }
+        }
+    }
+    return (this->_tok != T_ERROR);
+}
+
+bool Reader::_fill (size_t n)
+{
+    if (this->_end - this->_pos >= n) {
+        return true;
+    }
+    if (! this->_inS.is_open() || this->_inS.eof() || this->_inS.fail()) {
+        return false;
+    }
+
+  // shift the unconsumed input to the front of the buffer and read more
+    size_t nLeft = this->_end - this->_pos;
+    if (nLeft > 0) {
+        std::memmove (this->_buf.data(), this->_buf.data() + this->_pos, nLeft);
+    }
+    this->_pos = 0;
+    this->_end = nLeft;
+    while (this->_end < n) {
+        this->_inS.read (this->_buf.data() + this->_end, this->_buf.size() - this->_end);
+        size_t nRead = this->_inS.gcount();
+        if (nRead == 0) {
+            return false;
+        }
+        this->_end += nRead;
+    }
+
+    return true;
+}
+
+void Reader::_skipWhitespace ()
+{
+    int c = this->_peek();
+    while ((c >= 0) && isspace(c)) {
+        this->_advance();
+        c = this->_peek();
+    }
+}
+
+// read a string into _str; the reader must be at the opening quote
+bool Reader::_string ()
+{
+    if (this->_peek() != '"') {
+        return false;
+    }
+    this->_advance();
+
+    this->_str.clear();
+    while (true) {
+        int c = this->_peek();
+        if (c < 0) {
+            return false;
+        }
+        this->_advance();
+        if (c == '"') {
+            return true;
+        }
+        else if (c == '\\') {
+            switch (this->_peek()) {
+                case '"': c = '"'; break;
+                case '\\': c = '\\'; break;
+                case '/': c = '/'; break;
+                case 'b': c = '\b'; break;
+                case 'f': c = '\f'; break;
+                case 'n': c = '\n'; break;
+                case 'r': c = '\r'; break;
+                case 't': c = '\t'; break;
+                case 'u': /* no UNICODE support */
+                default:
+                    return false;
+            }
+            this->_advance();
+        }
+        else if (! isprint(c) && (c != '\t')) {
+            return false;
+        }
+        this->_str += static_cast<char>(c);
+    }
+}
+
+// read a number; the numeric value is computed in the same way as JSON::ParseFile,
+// so that both produce identical values
+Reader::Token Reader::_number ()
+{
+    bool neg = (this->_peek() == '-');
+    if (neg) this->_advance();
+
+    int64_t whole = 0;
+    int c = this->_peek();
+    if (c == '0') {
+        this->_advance();
+    }
+    else if ((c >= 0) && isdigit(c)) {
+        while (((c = this->_peek()) >= 0) && isdigit(c)) {
+            whole = whole * 10 + (c - '0');
+            this->_advance();
+        }
+    }
+    else {
+        return this->_error ("invalid number");
+    }
+
+    bool isReal = false;
+    double r = 0.0;
+
+  // fractional part
+    if (this->_peek() == '.') {
+        this->_advance();
+        r = static_cast<double>(whole);
+        isReal = true;
+        c = this->_peek();
+        if ((c < 0) || ! isdigit(c)) {
+            return this->_error ("invalid number");
+        }
+        double decimal = 0.0;
+        double factor = 0.1;
+        while (((c = this->_peek()) >= 0) && isdigit(c)) {
+            decimal = decimal + (c - '0') * factor;
+            factor *= 0.1;
+            this->_advance();
+        }
+        r += decimal;
+    }
+
+  // exponent
+    c = this->_peek();
+    if ((c == 'E') || (c == 'e')) {
+        if (! isReal) {
+            r = static_cast<double>(whole);
+            isReal = true;
+        }
+        this->_advance();
+        bool negExp = false;
+        c = this->_peek();
+        if ((c == '-') || (c == '+')) {
+            negExp = (c == '-');
+            this->_advance();
+        }
+        c = this->_peek();
+        if ((c < 0) || ! isdigit(c)) {
+            return this->_error ("invalid number");
+        }
+        int64_t expo = 0;
+        while (((c = this->_peek()) >= 0) && isdigit(c)) {
+            expo = expo * 10 + (c - '0');
+            this->_advance();
+        }
+        for (int64_t i = 0;  i < expo;  i++) {
+            r = negExp ? (r / 10.0) : (r * 10.0);
+        }
+    }
+
+    if (isReal) {
+        this->_real = neg ? -r : r;
+        return this->_endValue (T_REAL);
+    }
+    else {
+        this->_int = neg ? -whole : whole;
+        return this->_endValue (T_INTEGER);
+    }
+}
+
+// read a value; the reader is at the first character of the value
+Reader::Token Reader::_value ()
+{
+    int c = this->_peek();
+    if (c == '{') {
+        this->_advance();
+        this->_stk.push_back ('{');
+        this->_state = S_KEY_OR_END;
+        return this->_tok = T_BEGIN_OBJECT;
+    }
+    else if (c == '[') {
+        this->_advance();
+        this->_stk.push_back ('[');
+        this->_state = S_VALUE_OR_END;
+        return this->_tok = T_BEGIN_ARRAY;
+    }
+    else if (c == '"') {
+        if (! this->_string()) {
+            return this->_error ("invalid string");
+        }
+        return this->_endValue (T_STRING);
+    }
+    else if ((c == '-') || ((c >= 0) && isdigit(c))) {
+        return this->_number ();
+    }
+    else if (c < 0) {
+        return this->_error ("unexpected eof");
+    }
+
+  // check for the literals; like JSON::ParseFile, we ignore case
+    this->_fill (5);
+    const char *p = this->_buf.data() + this->_pos;
+    size_t avail = this->_end - this->_pos;
+    if ((avail >= 4) && (strncasecmp(p, "true", 4) == 0)) {
+        for (int i = 0;  i < 4;  i++) this->_advance();
+        this->_bool = true;
+        return this->_endValue (T_BOOL);
+    }
+    else if ((avail >= 5) && (strncasecmp(p, "false", 5) == 0)) {
+        for (int i = 0;  i < 5;  i++) this->_advance();
+        this->_bool = false;
+        return this->_endValue (T_BOOL);
+    }
+    else if ((avail >= 4) && (strncasecmp(p, "null", 4) == 0)) {
+        for (int i = 0;  i < 4;  i++) this->_advance();
+        return this->_endValue (T_NULL);
+    }
+    else {
+        return this->_error ("bogus input");
+    }
+}
+
+// update the state after a complete value (or the end of an object or array)
+Reader::Token Reader::_endValue (Token tok)
+{
+    this->_state = this->_stk.empty() ? S_DONE : S_COMMA_OR_END;
+    return this->_tok = tok;
+}
+
+Reader::Token Reader::_error (std::string const &msg)
+{
+    this->_errMsg = this->_file + ": " + msg + " at line " + std::to_string(this->_lnum);
+    return this->_tok = T_ERROR;
+}
+
+} // namespace JSON
@@ -16,6 +16,9 @@
 #include <iostream>
 #include <fstream>
 #include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <new>
 #include "strings.h"
 
 namespace JSON {
@@ -26,58 +29,76 @@ Value::~Value () { }
 
 const Object *Value::asObject () const
 {
-    return dynamic_cast<const Object *>(this);
+    return this->isObject() ? static_cast<const Object *>(this) : nullptr;
 }
 
 const Array *Value::asArray () const
 {
-    return dynamic_cast<const Array *>(this);
+    return this->isArray() ? static_cast<const Array *>(this) : nullptr;
 }
 
 const Number *Value::asNumber () const
 {
-    return dynamic_cast<const Number *>(this);
+    return this->isNumber() ? static_cast<const Number *>(this) : nullptr;
 }
 
 const Integer *Value::asInteger () const
 {
-    return dynamic_cast<const Integer *>(this);
+    return this->isInteger() ? static_cast<const Integer *>(this) : nullptr;
 }
 
 const Real *Value::asReal () const
 {
-    return dynamic_cast<const Real *>(this);
+    return this->isReal() ? static_cast<const Real *>(this) : nullptr;
 }
 
 const String *Value::asString () const
 {
-    return dynamic_cast<const String *>(this);
+    return this->isString() ? static_cast<const String *>(this) : nullptr;
 }
 
 const Bool *Value::asBool () const
 {
-    return dynamic_cast<const Bool *>(this);
+    return this->isBool() ? static_cast<const Bool *>(this) : nullptr;
 }
 
 /***** class Object member functions *****/
 
 Object::~Object ()
 {
-  // need to delete contents
+    if (this->_owned) {
+        for (int i = 0;  i < this->_size;  i++) {
+            delete[] this->_fields[i]._key;
+            delete this->_fields[i]._val;
+        }
+        delete[] this->_fields;
+    }
 }
 
-void Object::insert (std::string key, Value *val)
+Value *Object::operator[] (const char *key) const
 {
-    this->_value.insert (std::pair<std::string, Value *>(key, val));
+    return this->_find(key, std::strlen(key));
 }
 
-Value *Object::operator[] (std::string key) const
+Value *Object::_find (const char *key, size_t len) const
 {
-    std::map<std::string, Value *>::const_iterator got = this->_value.find(key);
-    if (got == this->_value.end())
-        return nullptr;
+  // binary search for the first field whose label is not less than the key
+    int lo = 0, hi = this->_size;
+    while (lo < hi) {
+        int mid = (lo + hi) >> 1;
+        const Field &f = this->_fields[mid];
+        int cmp = std::memcmp(f._key, key, (f._len < len) ? f._len : len);
+        if ((cmp < 0) || ((cmp == 0) && (f._len < len)))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if ((lo < this->_size)
+    && (this->_fields[lo]._len == len)
+    && (std::memcmp(this->_fields[lo]._key, key, len) == 0))
+        return this->_fields[lo]._val;
     else
-        return got->second;
+        return nullptr;
 }
 
 std::string Object::toString() { return std::string("<object>"); }
@@ -86,7 +107,12 @@ std::string Object::toString() { return std::string("<object>"); }
 
 Array::~Array ()
 {
-  // need to delete contents
+    if (this->_owned) {
+        for (int i = 0;  i < this->_length;  i++) {
+            delete this->_value[i];
+        }
+        delete[] this->_value;
+    }
 }
 
 std::string Array::toString() { return std::string("<array>"); }
@@ -109,9 +135,14 @@ std::string Real::toString() { return std::string("<real>"); }
 
 /***** class String member functions *****/
 
-String::~String () { }
+String::~String ()
+{
+    if (this->_owned) {
+        delete[] this->_value;
+    }
+}
 
-std::string String::toString () { return this->_value; }
+std::string String::toString () { return this->value(); }
 
 /***** class Bool member functions *****/
 
@@ -125,4 +156,58 @@ Null::~Null () { }
 
 std::string Null::toString() { return std::string("null"); }
 
+/***** class Document member functions *****/
+
+//! bounds on the size of an arena block; requests that are larger than a block get a
+//! block of their own
+static const size_t kMinBlockSize = 4*1024;
+static const size_t kMaxBlockSize = 64*1024;
+
+Document::Document (size_t textLen)
+    : _text(nullptr), _root(nullptr), _blocks(nullptr), _nextP(nullptr),
+      _avail(0), _nBytes(0), _nBlocks(0)
+{
+  // the tree typically takes a couple of bytes of arena per byte of text, so small
+  // files (e.g., map.json) do not need a full-sized block
+    this->_blkSz = 2 * textLen;
+    if (this->_blkSz < kMinBlockSize) this->_blkSz = kMinBlockSize;
+    else if (this->_blkSz > kMaxBlockSize) this->_blkSz = kMaxBlockSize;
+}
+
+Document::~Document ()
+{
+  // the values in the arena own no storage of their own, so we just free the blocks
+    Block *blk = this->_blocks;
+    while (blk != nullptr) {
+        Block *next = blk->_next;
+        std::free (blk);
+        blk = next;
+    }
+    delete[] this->_text;
+}
+
+void *Document::_alloc (size_t nb)
+{
+  // round up to preserve the alignment of doubles and pointers
+    nb = (nb + alignof(double) - 1) & ~(alignof(double) - 1);
+    if (nb > this->_avail) {
+        size_t hdrSz = (sizeof(Block) + alignof(double) - 1) & ~(alignof(double) - 1);
+        size_t blkSz = (nb > this->_blkSz - hdrSz) ? nb + hdrSz : this->_blkSz;
+        Block *blk = static_cast<Block *>(std::malloc(blkSz));
+        if (blk == nullptr) {
+            throw std::bad_alloc();
+        }
+        blk->_next = this->_blocks;
+        this->_blocks = blk;
+        this->_nextP = reinterpret_cast<char *>(blk) + hdrSz;
+        this->_avail = blkSz - hdrSz;
+        this->_nBytes += blkSz;
+        this->_nBlocks++;
+    }
+    void *p = this->_nextP;
+    this->_nextP += nb;
+    this->_avail -= nb;
+    return p;
+}
+
 } // namespace JSON
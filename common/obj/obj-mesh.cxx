@@ -0,0 +1,868 @@
+/*! \file obj-mesh.cxx
+ *
+ * Support for compiled OBJ meshes.
+ *
+ * \author John Reppy
+ */
+
+/*
+ * COPYRIGHT (c) 2017 John Reppy (http://cs.uchicago.edu/~jhr)
+ * All rights reserved.
+ */
+
+#include "cs237.hxx"
+#include "obj-mesh.hxx"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if !defined(CS237_NO_SIMD) && defined(__SSE2__)
+#  define USE_SSE2
+#  include <emmintrin.h>
+#endif
+
+namespace OBJ {
+
+  // the version of the compiled-mesh format; this should be incremented whenever the
+  // layout or the contents of the file change
+    static const uint32_t kVersion = 6;
+
+  // the magic number at the start of a compiled mesh
+    static const char kMagic[8] = { 'c', 's', '2', '3', '7', 'm', 's', 'h' };
+
+  // the number of levels of detail in a compiled mesh, including the original mesh
+    static const int kNumLODs = 4;
+
+  // the sections of a compiled mesh
+    enum {
+        META_SECT = 0,          // the material library, materials, groups, and LODs
+        VERTS_SECT,             // the interleaved vertex data
+        INDICES_SECT,           // the index array
+        NUM_SECTS
+    };
+
+  // the header of a compiled mesh.  The sizes and modification times of the OBJ file
+  // and its material library are used to detect out-of-date files.
+    struct MeshHeader {
+        char            magic[8];               // kMagic
+        uint32_t        version;                // kVersion
+        uint32_t        byteOrder;              // 0x01020304 in the writer's byte order
+        int64_t         objMTime;               // modification time of the OBJ file
+        int64_t         objMTimeNSec;           // nanosecond part of objMTime
+        int64_t         objSize;                // size of the OBJ file
+        int64_t         mtlMTime;               // modification time of the material
+                                                // library (-1 if there is none)
+        int64_t         mtlMTimeNSec;           // nanosecond part of mtlMTime
+        int64_t         mtlSize;                // size of the material library (-1 if
+                                                // there is none)
+        uint32_t        nVerts;                 // number of vertices in the pool
+        uint32_t        nIndices;               // number of indices
+        uint32_t        indexSz;                // size of an index in bytes (2 or 4)
+        uint32_t        stride;                 // size of a vertex in bytes
+        int32_t         normOffset;             // offsets of the vertex attributes (-1
+        int32_t         txtCoordOffset;         // for attributes that are not present)
+        int32_t         tangentOffset;
+        uint32_t        hasBBox;                // 0 if the bounding box is empty
+        float           bboxMin[3];             // the bounding box
+        float           bboxMax[3];
+        uint64_t        sects[NUM_SECTS];       // the file offsets of the sections; 0
+                                                // for sections that are not present
+        uint64_t        fileSize;               // the size of the file
+    };
+
+  // sections are aligned to this many bytes
+    static const size_t kSectAlign = 16;
+
+  // return the path of the material library of an OBJ file; the path is computed in
+  // the same way as by the material reader
+    static std::string MtlPath (std::string const &objFile, std::string const &mtlLib)
+    {
+        return objFile.substr(0, objFile.find_last_of('/')) + "/" + mtlLib;
+    }
+
+  // get the modification time (in seconds and nanoseconds) and size of a file; the
+  // nanoseconds catch edits within the same second.  Returns false if the file does
+  // not exist
+    static bool FileInfo (std::string const &file, int64_t &mtime, int64_t &mtimeNSec, int64_t &size)
+    {
+        struct stat st;
+        if (stat(file.c_str(), &st) < 0) {
+            return false;
+        }
+        mtime = static_cast<int64_t>(st.st_mtime);
+#ifdef __APPLE__
+        mtimeNSec = static_cast<int64_t>(st.st_mtimespec.tv_nsec);
+#else
+        mtimeNSec = static_cast<int64_t>(st.st_mtim.tv_nsec);
+#endif
+        size = static_cast<int64_t>(st.st_size);
+        return true;
+    }
+
+  // get the modification times and sizes of an OBJ file and its material library;
+  // returns false if the OBJ file does not exist
+    static bool SourceInfo (std::string const &objFile, std::string const &mtlLib, MeshHeader &hdr)
+    {
+        if (! FileInfo (objFile, hdr.objMTime, hdr.objMTimeNSec, hdr.objSize)) {
+            return false;
+        }
+        if (mtlLib.empty()
+        || ! FileInfo (MtlPath(objFile, mtlLib), hdr.mtlMTime, hdr.mtlMTimeNSec, hdr.mtlSize)) {
+            hdr.mtlMTime = -1;
+            hdr.mtlMTimeNSec = -1;
+            hdr.mtlSize = -1;
+        }
+        return true;
+    }
+
+  // returns true if all of the indices in an index array are less than nVerts
+    template <typename T>
+    static bool IndicesInRange (const void *data, uint32_t nIndices, uint32_t nVerts)
+    {
+        const T *indices = reinterpret_cast<const T *>(data);
+        T maxIdx = 0;
+        for (uint32_t i = 0;  i < nIndices;  i++) {
+            maxIdx = std::max(maxIdx, indices[i]);
+        }
+        return (nIndices == 0) || (uint32_t(maxIdx) < nVerts);
+    }
+
+  // helper class for building the contents of a compiled mesh
+    class MeshWriter {
+      public:
+        MeshWriter () : _bytes() { }
+
+        template <typename T>
+        void Put (T const &v)
+        {
+            const uint8_t *p = reinterpret_cast<const uint8_t *>(&v);
+            this->_bytes.insert (this->_bytes.end(), p, p + sizeof(T));
+        }
+
+        void PutString (std::string const &s)
+        {
+            this->Put (static_cast<uint32_t>(s.size()));
+            this->_bytes.insert (this->_bytes.end(), s.begin(), s.end());
+        }
+
+        void PutColor (cs237::color3f const &c)
+        {
+            this->Put (c.r);
+            this->Put (c.g);
+            this->Put (c.b);
+        }
+
+      // start a new section; returns its offset
+        size_t BeginSection ()
+        {
+            while (this->_bytes.size() % kSectAlign != 0) {
+                this->_bytes.push_back (0);
+            }
+            return this->_bytes.size();
+        }
+
+      // append a section that holds an array; returns its offset
+        template <typename T>
+        size_t PutSection (const T *v, size_t n)
+        {
+            size_t offset = this->BeginSection ();
+            const uint8_t *p = reinterpret_cast<const uint8_t *>(v);
+            this->_bytes.insert (this->_bytes.end(), p, p + n * sizeof(T));
+            return offset;
+        }
+
+        std::vector<uint8_t> &Bytes () { return this->_bytes; }
+
+      private:
+        std::vector<uint8_t> _bytes;
+    };
+
+  // helper class for reading the meta-data section of a compiled mesh.  All reads are
+  // bounds checked; once a read fails, all further reads fail.
+    class MeshReader {
+      public:
+        MeshReader (const uint8_t *base, size_t size)
+            : _base(base), _pos(0), _size(size), _ok(true)
+        { }
+
+        template <typename T>
+        bool Get (T &v)
+        {
+            if (! this->_check (sizeof(T))) return false;
+            std::memcpy (&v, this->_base + this->_pos, sizeof(T));
+            this->_pos += sizeof(T);
+            return true;
+        }
+
+        bool GetString (std::string &s)
+        {
+            uint32_t len;
+            if (! this->Get(len) || ! this->_check(len)) return false;
+            s.assign (reinterpret_cast<const char *>(this->_base + this->_pos), len);
+            this->_pos += len;
+            return true;
+        }
+
+        bool GetColor (cs237::color3f &c)
+        {
+            float r = 0.0f, g = 0.0f, b = 0.0f;
+            this->Get (r);
+            this->Get (g);
+            this->Get (b);
+            c = cs237::color3f(r, g, b);
+            return this->_ok;
+        }
+
+        bool ok () const { return this->_ok; }
+
+      private:
+        const uint8_t   *_base;
+        size_t          _pos;
+        size_t          _size;
+        bool            _ok;
+
+        bool _check (size_t n)
+        {
+            this->_ok = this->_ok && (this->_pos <= this->_size) && (n <= this->_size - this->_pos);
+            return this->_ok;
+        }
+    };
+
+  // the number of triangles per chunk in the tangent computation.  The chunking does
+  // not depend on the number of threads, so neither do the tangents.
+    static const size_t kTangentGrain = 16 * 1024;
+
+  // the tangent and bitangent sums for a range of vertices, which are accumulated from
+  // a range of triangles
+    struct TangentSums {
+        uint32_t firstVert;                     // the first vertex in the range
+        std::vector<cs237::vec3f> tan, bitan;   // the sums for the vertices in the range
+    };
+
+  // accumulate the tangents and bitangents of the triangles [lo..hi) into the sums
+  // for the vertices [sums.firstVert..sums.firstVert+sums.tan.size())
+    static void AccumTangents (
+        const cs237::vec3f *verts,
+        const cs237::vec2f *txtCoords,
+        const uint32_t *indices,
+        size_t lo, size_t hi,
+        TangentSums &sums)
+    {
+        cs237::vec3f *tan = sums.tan.data() - sums.firstVert;
+        cs237::vec3f *bitan = sums.bitan.data() - sums.firstVert;
+        for (size_t tri = lo;  tri < hi;  tri++) {
+          // get the indices for the triangle
+            uint32_t i1 = indices[3*tri + 0];
+            uint32_t i2 = indices[3*tri + 1];
+            uint32_t i3 = indices[3*tri + 2];
+          // the sides of the triangle in object space and in tangent space
+            cs237::vec3f e1 = verts[i2] - verts[i1];
+            cs237::vec3f e2 = verts[i3] - verts[i1];
+            float du1 = txtCoords[i2].x - txtCoords[i1].x;
+            float dv1 = txtCoords[i2].y - txtCoords[i1].y;
+            float du2 = txtCoords[i3].x - txtCoords[i1].x;
+            float dv2 = txtCoords[i3].y - txtCoords[i1].y;
+          // solve e1 = du1*T + dv1*B and e2 = du2*T + dv2*B for T and B; triangles with
+          // degenerate texture coordinates do not contribute
+            float det = du1 * dv2 - du2 * dv1;
+            if (det == 0.0f) {
+                continue;
+            }
+            float s = 1.0f / det;
+            cs237::vec3f t = (e1 * dv2 - e2 * dv1) * s;
+            cs237::vec3f b = (e2 * du1 - e1 * du2) * s;
+          // add to vector sums
+            tan[i1] += t;
+            tan[i2] += t;
+            tan[i3] += t;
+            bitan[i1] += b;
+            bitan[i2] += b;
+            bitan[i3] += b;
+        }
+    }
+
+  // orthogonalize four tangents (tx, ty, tz) against their normals (nx, ny, nz) and
+  // compute the handedness of the tangent frames, i.e., dot(cross(n, t), b), where b is
+  // the bitangent (bx, by, bz).  The tangents are normalized in place; a zero tangent
+  // stays zero.
+    static inline void Orthogonalize4 (
+        float *tx, float *ty, float *tz,
+        const float *bx, const float *by, const float *bz,
+        const float *nx, const float *ny, const float *nz,
+        float *w)
+    {
+#ifdef USE_SSE2
+        __m128 Tx = _mm_loadu_ps(tx), Ty = _mm_loadu_ps(ty), Tz = _mm_loadu_ps(tz);
+        __m128 Nx = _mm_loadu_ps(nx), Ny = _mm_loadu_ps(ny), Nz = _mm_loadu_ps(nz);
+        __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(Nx, Tx), _mm_mul_ps(Ny, Ty)), _mm_mul_ps(Nz, Tz));
+        __m128 x = _mm_sub_ps(Tx, _mm_mul_ps(Nx, d));
+        __m128 y = _mm_sub_ps(Ty, _mm_mul_ps(Ny, d));
+        __m128 z = _mm_sub_ps(Tz, _mm_mul_ps(Nz, d));
+        __m128 len2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z));
+        __m128 s = _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(_mm_max_ps(len2, _mm_set1_ps(1.0e-30f))));
+        __m128 cx = _mm_sub_ps(_mm_mul_ps(Ny, z), _mm_mul_ps(Nz, y));
+        __m128 cy = _mm_sub_ps(_mm_mul_ps(Nz, x), _mm_mul_ps(Nx, z));
+        __m128 cz = _mm_sub_ps(_mm_mul_ps(Nx, y), _mm_mul_ps(Ny, x));
+        _mm_storeu_ps(w, _mm_add_ps(_mm_add_ps(
+            _mm_mul_ps(cx, _mm_loadu_ps(bx)), _mm_mul_ps(cy, _mm_loadu_ps(by))),
+            _mm_mul_ps(cz, _mm_loadu_ps(bz))));
+        _mm_storeu_ps(tx, _mm_mul_ps(x, s));
+        _mm_storeu_ps(ty, _mm_mul_ps(y, s));
+        _mm_storeu_ps(tz, _mm_mul_ps(z, s));
+#else
+        for (int i = 0;  i < 4;  i++) {
+            float d = nx[i] * tx[i] + ny[i] * ty[i] + nz[i] * tz[i];
+            float x = tx[i] - nx[i] * d;
+            float y = ty[i] - ny[i] * d;
+            float z = tz[i] - nz[i] * d;
+            float s = 1.0f / std::sqrt(std::max(x * x + y * y + z * z, 1.0e-30f));
+            w[i] = (ny[i] * z - nz[i] * y) * bx[i]
+                + (nz[i] * x - nx[i] * z) * by[i]
+                + (nx[i] * y - ny[i] * x) * bz[i];
+            tx[i] = x * s;  ty[i] = y * s;  tz[i] = z * s;
+        }
+#endif
+    }
+
+    void ComputeTangents (
+        uint32_t nVerts,
+        const cs237::vec3f *verts,
+        const cs237::vec3f *norms,
+        const cs237::vec2f *txtCoords,
+        uint32_t nIndices,
+        const uint32_t *indices,
+        cs237::vec4f *tangents,
+        cs237::ThreadPool *pool)
+    {
+        uint32_t nTris = nIndices / 3;
+        assert (nTris * 3 == nIndices);
+
+      // the triangles are split into fixed-size chunks, each of which has its own sums
+      // for the range of vertices that its triangles use.  Since the vertices of a
+      // compiled mesh are numbered in the order of their first use, these ranges are
+      // mostly disjoint.  The sums of a vertex are combined in chunk order, so the
+      // floating-point results are the same whether or not the chunks are processed in
+      // parallel.
+        size_t chunkSz = kTangentGrain;
+        size_t nChunks = std::max(size_t(1), (nTris + chunkSz - 1) / chunkSz);
+        bool parallel = (pool != nullptr) && (nChunks > 1);
+        std::vector<TangentSums> sums(nChunks);
+        auto accum = [&] (size_t lo, size_t hi) {
+            for (size_t c = lo;  c < hi;  c++) {
+                size_t triLo = c * chunkSz;
+                size_t triHi = std::min(size_t(nTris), triLo + chunkSz);
+                uint32_t minV = nVerts, maxV = 0;
+                for (size_t i = 3 * triLo;  i < 3 * triHi;  i++) {
+                    minV = std::min(minV, indices[i]);
+                    maxV = std::max(maxV, indices[i]);
+                }
+                sums[c].firstVert = (minV <= maxV) ? minV : 0;
+                sums[c].tan.resize ((minV <= maxV) ? maxV - minV + 1 : 0);
+                sums[c].bitan.resize (sums[c].tan.size());
+                AccumTangents (verts, txtCoords, indices, triLo, triHi, sums[c]);
+            }
+        };
+        if (parallel) {
+            pool->ParallelFor (nChunks, 1, accum);
+        }
+        else {
+            accum (0, nChunks);
+        }
+
+      // the vertices are reduced in fixed-size ranges.  Each range has a list of the
+      // chunks whose sums overlap it, in chunk order, so the sums of a vertex are added
+      // in the same order however the ranges are scheduled.
+        const size_t kBlk = 4;  // must match Orthogonalize4
+        const size_t rangeSz = kTangentGrain;  // must be a multiple of kBlk
+        size_t nRanges = (nVerts + rangeSz - 1) / rangeSz;
+        std::vector<std::vector<uint32_t>> rangeChunks(nRanges);
+        for (size_t c = 0;  c < nChunks;  c++) {
+            if (! sums[c].tan.empty()) {
+                size_t rLo = sums[c].firstVert / rangeSz;
+                size_t rHi = (sums[c].firstVert + sums[c].tan.size() - 1) / rangeSz;
+                for (size_t r = rLo;  r <= rHi;  r++) {
+                    rangeChunks[r].push_back (c);
+                }
+            }
+        }
+
+      // compute extended tangents for the vertices of the ranges [lo..hi).  The sums of
+      // a range are accumulated in structure-of-arrays form, so that its tangents can be
+      // orthogonalized kBlk at a time with SIMD arithmetic.
+        auto finish = [&] (size_t lo, size_t hi) {
+            std::vector<float> soa(9 * rangeSz);
+            float *tx = soa.data(), *ty = tx + rangeSz, *tz = ty + rangeSz;
+            float *bx = tz + rangeSz, *by = bx + rangeSz, *bz = by + rangeSz;
+            float *nx = bz + rangeSz, *ny = nx + rangeSz, *nz = ny + rangeSz;
+            float w[kBlk];
+            for (size_t r = lo;  r < hi;  r++) {
+                size_t vFirst = r * rangeSz;
+                size_t n = std::min(rangeSz, nVerts - vFirst);
+                std::fill (soa.begin(), soa.end(), 0.0f);
+                for (auto c = rangeChunks[r].begin();  c != rangeChunks[r].end();  c++) {
+                    TangentSums const &cs = sums[*c];
+                    size_t vLo = std::max(vFirst, size_t(cs.firstVert));
+                    size_t vHi = std::min(vFirst + n, cs.firstVert + cs.tan.size());
+                    for (size_t v = vLo;  v < vHi;  v++) {
+                        cs237::vec3f const &t = cs.tan[v - cs.firstVert];
+                        cs237::vec3f const &b = cs.bitan[v - cs.firstVert];
+                        size_t i = v - vFirst;
+                        tx[i] += t.x;  ty[i] += t.y;  tz[i] += t.z;
+                        bx[i] += b.x;  by[i] += b.y;  bz[i] += b.z;
+                    }
+                }
+                for (size_t i = 0;  i < n;  i++) {
+                    cs237::vec3f const &nv = norms[vFirst + i];
+                    nx[i] = nv.x;  ny[i] = nv.y;  nz[i] = nv.z;
+                }
+              // orthogonalize the tangents and compute the handedness
+                for (size_t blk = 0;  blk < n;  blk += kBlk) {
+                    Orthogonalize4 (
+                        tx + blk, ty + blk, tz + blk, bx + blk, by + blk, bz + blk,
+                        nx + blk, ny + blk, nz + blk, w);
+                    size_t m = std::min(kBlk, n - blk);
+                    for (size_t i = 0;  i < m;  i++) {
+                        tangents[vFirst + blk + i] = cs237::vec4f(
+                            tx[blk+i], ty[blk+i], tz[blk+i], (w[i] < 0.0f) ? -1.0f : 1.0f);
+                    }
+                }
+            }
+        };
+        if (parallel && (nRanges > 1)) {
+            pool->ParallelFor (nRanges, 1, finish);
+        }
+        else {
+            finish (0, nRanges);
+        }
+
+    } // ComputeTangents
+
+    MeshFile *MeshFile::Compile (Model const *model, cs237::ThreadPool *pool)
+    {
+        MeshHeader hdr;
+        std::memset (&hdr, 0, sizeof(hdr));
+        std::memcpy (hdr.magic, kMagic, sizeof(kMagic));
+        hdr.version = kVersion;
+        hdr.byteOrder = 0x01020304;
+        if (! SourceInfo (model->Path(), model->MtlLib(), hdr)) {
+          // the OBJ file has been removed since the model was loaded, so the
+          // compiled file will never be valid
+            hdr.objMTime = hdr.objMTimeNSec = hdr.objSize = -1;
+        }
+
+      // optimize the order of the triangles in each group and then the order of the
+      // vertices in the pool
+        uint32_t nIndices = model->NumIndices();
+        std::vector<OBJ::Group> groups(model->beginGroups(), model->endGroups());
+        std::vector<uint32_t> indices(model->Indices(), model->Indices() + nIndices);
+        OptimizeTriangleOrder (model->NumVerts(), model->Verts(), groups, indices.data());
+
+      // build the levels of detail, which follow the original triangles in the index
+      // array, and optimize their triangle order too.  Ranges that are shared with the
+      // previous level are only optimized once.
+        std::vector<uint32_t> lodIndices;
+        std::vector<LODRange> lodRanges;
+        std::vector<float> lodErrors;
+        BuildLODs (
+            model->NumVerts(), model->Verts(), groups, nIndices, indices.data(),
+            kNumLODs - 1, lodIndices, lodRanges, lodErrors);
+        indices.insert (indices.end(), lodIndices.begin(), lodIndices.end());
+        std::vector<OBJ::Group> lodGroups;
+        for (auto it = lodRanges.begin();  it != lodRanges.end();  it++) {
+            if ((it->firstIndex >= nIndices) && (it->nIndices > 0)
+            && ((it < lodRanges.begin() + groups.size())
+                || ((it - groups.size())->firstIndex != it->firstIndex))) {
+                OBJ::Group grp;
+                grp.material = -1;
+                grp.firstIndex = it->firstIndex;
+                grp.nIndices = it->nIndices;
+                lodGroups.push_back (grp);
+            }
+        }
+        OptimizeTriangleOrder (model->NumVerts(), model->Verts(), lodGroups, indices.data());
+
+      // renumber the vertices by their first use, which puts the vertices of the original
+      // mesh first since all of the levels use them
+        uint32_t nLODIndices = indices.size();
+        std::vector<uint32_t> remap;
+        uint32_t nVerts = OptimizeVertexOrder (model->NumVerts(), nLODIndices, indices.data(), remap);
+
+        hdr.nVerts = nVerts;
+        hdr.nIndices = nLODIndices;
+        hdr.indexSz = (nVerts <= 65536) ? sizeof(uint16_t) : sizeof(uint32_t);
+        cs237::AABBf const &bbox = model->BBox();
+        if (! bbox.isEmpty()) {
+            hdr.hasBBox = 1;
+            for (int i = 0;  i < 3;  i++) {
+                hdr.bboxMin[i] = bbox.min()[i];
+                hdr.bboxMax[i] = bbox.max()[i];
+            }
+        }
+
+        MeshWriter wr;
+        wr.Put (hdr);
+
+      // the material library, materials, and groups
+        hdr.sects[META_SECT] = wr.BeginSection ();
+        wr.PutString (model->MtlLib());
+        wr.Put (static_cast<uint32_t>(model->NumMaterials()));
+        bool hasNormMap = false;
+        for (int i = 0;  i < model->NumMaterials();  i++) {
+            OBJ::Material const &mtl = model->Material(i);
+            wr.PutString (mtl.name);
+            wr.Put (static_cast<int32_t>(mtl.illum));
+            wr.Put (static_cast<int32_t>(mtl.ambientC));
+            wr.Put (static_cast<int32_t>(mtl.emissiveC));
+            wr.Put (static_cast<int32_t>(mtl.diffuseC));
+            wr.Put (static_cast<int32_t>(mtl.specularC));
+            wr.PutColor (mtl.ambient);
+            wr.PutColor (mtl.emissive);
+            wr.PutColor (mtl.diffuse);
+            wr.PutColor (mtl.specular);
+            wr.Put (mtl.shininess);
+            wr.PutString (mtl.ambientMap);
+            wr.PutString (mtl.emissiveMap);
+            wr.PutString (mtl.diffuseMap);
+            wr.PutString (mtl.specularMap);
+            wr.PutString (mtl.normalMap);
+            hasNormMap = hasNormMap || ! mtl.normalMap.empty();
+        }
+        wr.Put (static_cast<uint32_t>(model->NumGroups()));
+        for (auto it = groups.begin();  it != groups.end();  it++) {
+            wr.PutString (it->name);
+            wr.Put (static_cast<int32_t>(it->material));
+            wr.Put (it->firstIndex);
+            wr.Put (it->nIndices);
+        }
+        wr.Put (static_cast<uint32_t>(kNumLODs));
+        for (int lod = 1;  lod < kNumLODs;  lod++) {
+            wr.Put (lodErrors[lod-1]);
+            for (uint32_t g = 0;  g < groups.size();  g++) {
+                LODRange const &range = lodRanges[(lod-1) * groups.size() + g];
+                wr.Put (range.firstIndex);
+                wr.Put (range.nIndices);
+            }
+        }
+
+      // permute the vertex pool
+        const cs237::vec3f *modelNorms = model->Norms();
+        const cs237::vec2f *modelTxtCoords = model->TxtCoords();
+        std::vector<cs237::vec3f> verts(nVerts);
+        std::vector<cs237::vec3f> norms((modelNorms != nullptr) ? nVerts : 0);
+        std::vector<cs237::vec2f> txtCoords((modelTxtCoords != nullptr) ? nVerts : 0);
+        for (uint32_t i = 0;  i < model->NumVerts();  i++) {
+            uint32_t j = remap[i];
+            if (j != ~0u) {
+                verts[j] = model->Verts()[i];
+                if (modelNorms != nullptr) norms[j] = modelNorms[i];
+                if (modelTxtCoords != nullptr) txtCoords[j] = modelTxtCoords[i];
+            }
+        }
+      // we only need tangents when there is a normal map
+        std::vector<cs237::vec4f> tangents;
+        if (hasNormMap && ! norms.empty() && ! txtCoords.empty()) {
+            tangents.resize (nVerts);
+            ComputeTangents (
+                nVerts, verts.data(), norms.data(), txtCoords.data(),
+                nIndices, indices.data(), tangents.data(), pool);
+        }
+
+      // the layout of the interleaved vertices (in floats)
+        uint32_t stride = 3;
+        hdr.normOffset = hdr.txtCoordOffset = hdr.tangentOffset = -1;
+        if (! norms.empty()) {
+            hdr.normOffset = stride;
+            stride += 3;
+        }
+        if (! txtCoords.empty()) {
+            hdr.txtCoordOffset = stride;
+            stride += 2;
+        }
+        if (! tangents.empty()) {
+            hdr.tangentOffset = stride;
+            stride += 4;
+        }
+        std::vector<float> vertData(size_t(nVerts) * stride);
+        for (uint32_t i = 0;  i < nVerts;  i++) {
+            float *vp = &vertData[size_t(i) * stride];
+            for (int j = 0;  j < 3;  j++) {
+                vp[j] = verts[i][j];
+                if (hdr.normOffset >= 0) vp[hdr.normOffset + j] = norms[i][j];
+            }
+            if (hdr.txtCoordOffset >= 0) {
+                vp[hdr.txtCoordOffset] = txtCoords[i][0];
+                vp[hdr.txtCoordOffset + 1] = txtCoords[i][1];
+            }
+            if (hdr.tangentOffset >= 0) {
+                for (int j = 0;  j < 4;  j++) {
+                    vp[hdr.tangentOffset + j] = tangents[i][j];
+                }
+            }
+        }
+      // convert the layout to bytes
+        hdr.stride = stride * sizeof(float);
+        if (hdr.normOffset >= 0) hdr.normOffset *= sizeof(float);
+        if (hdr.txtCoordOffset >= 0) hdr.txtCoordOffset *= sizeof(float);
+        if (hdr.tangentOffset >= 0) hdr.tangentOffset *= sizeof(float);
+        hdr.sects[VERTS_SECT] = wr.PutSection (vertData.data(), vertData.size());
+
+      // the index array
+        if (hdr.indexSz == sizeof(uint16_t)) {
+            std::vector<uint16_t> shortIndices(indices.begin(), indices.end());
+            hdr.sects[INDICES_SECT] = wr.PutSection (shortIndices.data(), nLODIndices);
+        }
+        else {
+            hdr.sects[INDICES_SECT] = wr.PutSection (indices.data(), nLODIndices);
+        }
+
+      // fill in the header
+        std::vector<uint8_t> &bytes = wr.Bytes();
+        hdr.fileSize = bytes.size();
+        std::memcpy (bytes.data(), &hdr, sizeof(hdr));
+
+        uint8_t *data = new uint8_t[bytes.size()];
+        std::memcpy (data, bytes.data(), bytes.size());
+        MeshFile *mesh = new MeshFile (model->Path(), data, bytes.size(), false);
+        if (! mesh->_Init()) {
+            std::cerr << "MeshFile::Compile: invalid mesh for \"" << model->Path() << "\"\n";
+            exit (1);
+        }
+
+        return mesh;
+
+    } // MeshFile::Compile
+
+    MeshFile *MeshFile::Open (std::string const &objFile)
+    {
+      // map the compiled file into memory
+        int fd = open (MeshPath(objFile).c_str(), O_RDONLY);
+        if (fd < 0) {
+            return nullptr;
+        }
+        struct stat st;
+        if ((fstat(fd, &st) < 0) || (static_cast<size_t>(st.st_size) < sizeof(MeshHeader))) {
+            close (fd);
+            return nullptr;
+        }
+        size_t mapSz = static_cast<size_t>(st.st_size);
+        void *base = mmap (nullptr, mapSz, PROT_READ, MAP_PRIVATE, fd, 0);
+        close (fd);
+        if (base == MAP_FAILED) {
+            return nullptr;
+        }
+
+        MeshFile *mesh = new MeshFile (objFile, static_cast<const uint8_t *>(base), mapSz, true);
+        if (! mesh->_Init()) {
+            delete mesh;
+            return nullptr;
+        }
+
+      // check that the compiled file is up to date
+        MeshHeader expected;
+        const MeshHeader *hdr = reinterpret_cast<const MeshHeader *>(base);
+        MeshReader rdr(mesh->_data + hdr->sects[META_SECT], mesh->_size - hdr->sects[META_SECT]);
+        std::string mtlLib;
+        rdr.GetString (mtlLib);
+        if (! SourceInfo (objFile, mtlLib, expected)
+        ||  (hdr->objMTime != expected.objMTime)
+        ||  (hdr->objMTimeNSec != expected.objMTimeNSec)
+        ||  (hdr->objSize != expected.objSize)
+        ||  (hdr->mtlMTime != expected.mtlMTime)
+        ||  (hdr->mtlMTimeNSec != expected.mtlMTimeNSec)
+        ||  (hdr->mtlSize != expected.mtlSize)) {
+            delete mesh;
+            return nullptr;
+        }
+
+        return mesh;
+
+    } // MeshFile::Open
+
+    bool MeshFile::Save () const
+    {
+        std::string dst = MeshPath(this->_objFile);
+        std::string tmp = dst + "." + std::to_string(getpid());
+        {
+            std::ofstream outS(tmp, std::ios::out | std::ios::binary | std::ios::trunc);
+            if (outS.fail()) {
+                return false;
+            }
+            outS.write (reinterpret_cast<const char *>(this->_data), this->_size);
+            if (outS.fail()) {
+                outS.close();
+                std::remove (tmp.c_str());
+                return false;
+            }
+        }
+        if (std::rename (tmp.c_str(), dst.c_str()) != 0) {
+            std::remove (tmp.c_str());
+            return false;
+        }
+
+        return true;
+
+    } // MeshFile::Save
+
+    MeshFile::~MeshFile ()
+    {
+        if (this->_mapped) {
+            munmap (const_cast<uint8_t *>(this->_data), this->_size);
+        }
+        else {
+            delete[] this->_data;
+        }
+
+    } // MeshFile::~MeshFile
+
+    size_t MeshFile::DataSize () const
+    {
+        return size_t(this->_nVerts) * this->_stride + size_t(this->_nIndices) * this->_indexSz;
+
+    } // MeshFile::DataSize
+
+    bool MeshFile::_Init ()
+    {
+        const MeshHeader *hdr = reinterpret_cast<const MeshHeader *>(this->_data);
+        if ((this->_size < sizeof(MeshHeader))
+        ||  (std::memcmp(hdr->magic, kMagic, sizeof(kMagic)) != 0)
+        ||  (hdr->version != kVersion)
+        ||  (hdr->byteOrder != 0x01020304)
+        ||  (hdr->fileSize != this->_size)
+        ||  ((hdr->indexSz != sizeof(uint16_t)) && (hdr->indexSz != sizeof(uint32_t)))
+        ||  ((hdr->indexSz == sizeof(uint16_t)) && (hdr->nVerts > 65536))
+        ||  (hdr->stride < sizeof(cs237::vec3f)) || (hdr->stride % sizeof(float) != 0)
+        ||  (hdr->normOffset + int(sizeof(cs237::vec3f)) > int(hdr->stride))
+        ||  (hdr->txtCoordOffset + int(sizeof(cs237::vec2f)) > int(hdr->stride))
+        ||  (hdr->tangentOffset + int(sizeof(cs237::vec4f)) > int(hdr->stride))) {
+            return false;
+        }
+
+      // check that the sections are aligned and fit in the file
+        size_t sectSz[NUM_SECTS] = {
+                0,
+                hdr->nVerts * size_t(hdr->stride),
+                hdr->nIndices * size_t(hdr->indexSz)
+            };
+        for (int i = 0;  i < NUM_SECTS;  i++) {
+            uint64_t offset = hdr->sects[i];
+            if ((offset != 0)
+            && ((offset % kSectAlign != 0) || (offset < sizeof(MeshHeader))
+            || (offset > this->_size) || (sectSz[i] > this->_size - offset))) {
+                return false;
+            }
+        }
+        if ((hdr->sects[META_SECT] == 0) || (hdr->sects[VERTS_SECT] == 0)
+        || (hdr->sects[INDICES_SECT] == 0)) {
+            return false;
+        }
+
+        this->_nVerts = hdr->nVerts;
+        this->_nIndices = hdr->nIndices;
+        this->_indexSz = hdr->indexSz;
+        if (hdr->hasBBox != 0) {
+            this->_bbox = cs237::AABBf(
+                cs237::vec3f(hdr->bboxMin[0], hdr->bboxMin[1], hdr->bboxMin[2]),
+                cs237::vec3f(hdr->bboxMax[0], hdr->bboxMax[1], hdr->bboxMax[2]));
+        }
+        this->_stride = hdr->stride;
+        this->_normOffset = (hdr->normOffset < 0) ? -1 : hdr->normOffset;
+        this->_txtCoordOffset = (hdr->txtCoordOffset < 0) ? -1 : hdr->txtCoordOffset;
+        this->_tangentOffset = (hdr->tangentOffset < 0) ? -1 : hdr->tangentOffset;
+        this->_vertData = this->_data + hdr->sects[VERTS_SECT];
+        this->_indices = this->_data + hdr->sects[INDICES_SECT];
+
+      // check that the indices refer to vertices in the pool, since a corrupt file would
+      // otherwise cause out-of-bounds reads when it is drawn
+        if ((this->_indexSz == sizeof(uint16_t))
+            ? ! IndicesInRange<uint16_t>(this->_indices, this->_nIndices, this->_nVerts)
+            : ! IndicesInRange<uint32_t>(this->_indices, this->_nIndices, this->_nVerts)) {
+            return false;
+        }
+
+      // read the materials and groups
+        MeshReader rdr(this->_data + hdr->sects[META_SECT], this->_size - hdr->sects[META_SECT]);
+        std::string mtlLib;
+        uint32_t nMaterials, nGroups;
+        rdr.GetString (mtlLib);
+        if (! rdr.Get(nMaterials)) {
+            return false;
+        }
+        for (uint32_t i = 0;  rdr.ok() && (i < nMaterials);  i++) {
+            OBJ::Material mtl;
+            int32_t illum = 0, ambientC = 0, emissiveC = 0, diffuseC = 0, specularC = 0;
+            rdr.GetString (mtl.name);
+            rdr.Get (illum);
+            rdr.Get (ambientC);
+            rdr.Get (emissiveC);
+            rdr.Get (diffuseC);
+            rdr.Get (specularC);
+            rdr.GetColor (mtl.ambient);
+            rdr.GetColor (mtl.emissive);
+            rdr.GetColor (mtl.diffuse);
+            rdr.GetColor (mtl.specular);
+            rdr.Get (mtl.shininess);
+            rdr.GetString (mtl.ambientMap);
+            rdr.GetString (mtl.emissiveMap);
+            rdr.GetString (mtl.diffuseMap);
+            rdr.GetString (mtl.specularMap);
+            rdr.GetString (mtl.normalMap);
+            mtl.illum = illum;
+            mtl.ambientC = ambientC;
+            mtl.emissiveC = emissiveC;
+            mtl.diffuseC = diffuseC;
+            mtl.specularC = specularC;
+            this->_materials.push_back (mtl);
+        }
+        if (! rdr.Get(nGroups)) {
+            return false;
+        }
+        for (uint32_t i = 0;  rdr.ok() && (i < nGroups);  i++) {
+            OBJ::Group grp;
+            int32_t material = 0;
+            rdr.GetString (grp.name);
+            rdr.Get (material);
+            rdr.Get (grp.firstIndex);
+            rdr.Get (grp.nIndices);
+            grp.material = material;
+            if ((grp.material < -1) || (grp.material >= int32_t(nMaterials))
+            ||  (grp.firstIndex > this->_nIndices)
+            ||  (grp.nIndices > this->_nIndices - grp.firstIndex)) {
+                return false;
+            }
+            this->_groups.push_back (grp);
+        }
+
+      // read the levels of detail
+        uint32_t nLODs;
+        if (! rdr.Get(nLODs) || (nLODs == 0)) {
+            return false;
+        }
+        this->_lodErrors.push_back (0.0f);
+        for (auto it = this->_groups.begin();  it != this->_groups.end();  it++) {
+            this->_lodRanges.push_back (LODRange{it->firstIndex, it->nIndices});
+        }
+        for (uint32_t lod = 1;  rdr.ok() && (lod < nLODs);  lod++) {
+            float err = 0.0f;
+            rdr.Get (err);
+            this->_lodErrors.push_back (err);
+            for (uint32_t i = 0;  rdr.ok() && (i < nGroups);  i++) {
+                LODRange range = { 0, 0 };
+                rdr.Get (range.firstIndex);
+                rdr.Get (range.nIndices);
+                if ((range.firstIndex > this->_nIndices)
+                ||  (range.nIndices > this->_nIndices - range.firstIndex)) {
+                    return false;
+                }
+                this->_lodRanges.push_back (range);
+            }
+        }
+
+        return rdr.ok();
+
+    } // MeshFile::_Init
+
+} // namespace OBJ
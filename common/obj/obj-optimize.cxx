@@ -0,0 +1,351 @@
+/*! \file obj-optimize.cxx
+ *
+ * Optimizations of the triangle and vertex order of compiled meshes.
+ *
+ * The triangle order is optimized for the post-transform vertex cache using
+ * Tom Forsyth's "Linear-Speed Vertex Cache Optimisation" algorithm, and then clusters
+ * of triangles are sorted to reduce overdraw following Sander, Nehab, and Barczak,
+ * "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw" (SIGGRAPH 2007).
+ *
+ * \author John Reppy
+ */
+
+/*
+ * COPYRIGHT (c) 2017 John Reppy (http://cs.uchicago.edu/~jhr)
+ * All rights reserved.
+ */
+
+#include "cs237.hxx"
+#include "obj-mesh.hxx"
+#include <algorithm>
+#include <cmath>
+
+namespace OBJ {
+
+  // the size of the LRU cache that is modeled by the vertex-cache optimization
+    static const int kCacheSz = 32;
+
+  // vertex valences above this limit get the same score
+    static const int kMaxValence = 64;
+
+  // the size of the FIFO cache used to find the cluster boundaries for the overdraw
+  // optimization (and for ACMR)
+    static const int kFIFOSz = 16;
+
+  // The scoring function for vertices, which is precomputed in two tables
+    class VertexScore {
+      public:
+        VertexScore ()
+        {
+          // the three most recently used vertices get a fixed score, so that the next
+          // triangle does not favor any particular edge of the last one
+            for (int i = 0;  i < 3;  i++) {
+                this->_cache[i] = 0.75f;
+            }
+            for (int i = 3;  i < kCacheSz;  i++) {
+                this->_cache[i] = std::pow(1.0f - float(i - 3) / float(kCacheSz - 3), 1.5f);
+            }
+          // boost vertices with few remaining triangles, so that they can be retired
+            this->_valence[0] = 0.0f;
+            for (int i = 1;  i < kMaxValence;  i++) {
+                this->_valence[i] = 2.0f * std::pow(float(i), -0.5f);
+            }
+        }
+
+        float operator() (int cachePos, uint32_t remaining) const
+        {
+            if (remaining == 0) {
+                return -1.0f;  // the vertex has no triangles left
+            }
+            float s = this->_valence[std::min(remaining, uint32_t(kMaxValence - 1))];
+            if (cachePos >= 0) {
+                s += this->_cache[cachePos];
+            }
+            return s;
+        }
+
+      private:
+        float   _cache[kCacheSz];       // score by cache position
+        float   _valence[kMaxValence];  // score by number of remaining triangles
+    };
+
+  // Forsyth's algorithm.  The input indices must be in the range 0..nVerts-1.
+    static void VertexCacheOrder (
+        uint32_t nVerts,
+        uint32_t nTris,
+        const uint32_t *in,
+        uint32_t *out)
+    {
+        static const VertexScore score;
+
+      // build the vertex-to-triangle adjacency lists; the live triangles of vertex v
+      // are adj[first[v]] .. adj[first[v]+remaining[v]-1]
+        std::vector<uint32_t> remaining(nVerts, 0);
+        std::vector<uint32_t> first(nVerts + 1);
+        std::vector<uint32_t> adj(3 * nTris);
+        for (uint32_t i = 0;  i < 3 * nTris;  i++) {
+            remaining[in[i]]++;
+        }
+        first[0] = 0;
+        for (uint32_t v = 0;  v < nVerts;  v++) {
+            first[v+1] = first[v] + remaining[v];
+            remaining[v] = 0;
+        }
+        for (uint32_t i = 0;  i < 3 * nTris;  i++) {
+            uint32_t v = in[i];
+            adj[first[v] + remaining[v]++] = i / 3;
+        }
+
+      // initial scores
+        std::vector<int> cachePos(nVerts, -1);
+        std::vector<float> vScore(nVerts);
+        for (uint32_t v = 0;  v < nVerts;  v++) {
+            vScore[v] = score(-1, remaining[v]);
+        }
+        std::vector<float> tScore(nTris);
+        std::vector<bool> emitted(nTris, false);
+        int32_t best = -1;
+        float bestScore = -1.0f;
+        for (uint32_t t = 0;  t < nTris;  t++) {
+            tScore[t] = vScore[in[3*t]] + vScore[in[3*t+1]] + vScore[in[3*t+2]];
+            if (tScore[t] > bestScore) {
+                best = t;
+                bestScore = tScore[t];
+            }
+        }
+
+      // the cache has room for the vertices of the new triangle, which may push
+      // three old vertices out
+        uint32_t cache[kCacheSz + 3], newCache[kCacheSz + 3];
+        int cacheLen = 0;
+        uint32_t nextTri = 0;   // for finding a triangle when none is adjacent to the cache
+        for (uint32_t k = 0;  k < nTris;  k++) {
+            if (best < 0) {
+                while (emitted[nextTri]) {
+                    nextTri++;
+                }
+                best = nextTri;
+            }
+            const uint32_t *tri = in + 3 * best;
+            out[3*k] = tri[0];
+            out[3*k+1] = tri[1];
+            out[3*k+2] = tri[2];
+            emitted[best] = true;
+
+          // remove the triangle from the adjacency lists of its vertices
+            for (int j = 0;  j < 3;  j++) {
+                uint32_t v = tri[j];
+                uint32_t *lst = &adj[first[v]];
+                uint32_t n = remaining[v];
+                for (uint32_t i = 0;  i < n;  i++) {
+                    if (lst[i] == uint32_t(best)) {
+                        lst[i] = lst[n-1];
+                        break;
+                    }
+                }
+                remaining[v] = n - 1;
+            }
+
+          // move the triangle's vertices to the front of the cache
+            int newLen = 0;
+            newCache[newLen++] = tri[0];
+            newCache[newLen++] = tri[1];
+            newCache[newLen++] = tri[2];
+            for (int i = 0;  i < cacheLen;  i++) {
+                uint32_t v = cache[i];
+                if ((v != tri[0]) && (v != tri[1]) && (v != tri[2])) {
+                    newCache[newLen++] = v;
+                }
+            }
+            for (int i = 0;  i < newLen;  i++) {
+                uint32_t v = newCache[i];
+                cachePos[v] = (i < kCacheSz) ? i : -1;
+                vScore[v] = score(cachePos[v], remaining[v]);
+            }
+
+          // rescore the triangles of the vertices whose scores changed and pick the best
+          // one that uses a cached vertex
+            best = -1;
+            bestScore = -1.0f;
+            for (int i = 0;  i < newLen;  i++) {
+                uint32_t v = newCache[i];
+                const uint32_t *lst = &adj[first[v]];
+                for (uint32_t j = 0;  j < remaining[v];  j++) {
+                    uint32_t t = lst[j];
+                    tScore[t] = vScore[in[3*t]] + vScore[in[3*t+1]] + vScore[in[3*t+2]];
+                    if ((i < kCacheSz) && (tScore[t] > bestScore)) {
+                        best = t;
+                        bestScore = tScore[t];
+                    }
+                }
+            }
+
+            cacheLen = std::min(newLen, kCacheSz);
+            std::copy (newCache, newCache + cacheLen, cache);
+        }
+
+    } // VertexCacheOrder
+
+  // a cluster of triangles for the overdraw optimization
+    struct Cluster {
+        uint32_t        first;          // the first triangle of the cluster
+        uint32_t        nTris;          // the number of triangles in the cluster
+        float           key;            // the sort key
+
+        bool operator< (Cluster const &other) const { return this->key > other.key; }
+    };
+
+  // split a cache-optimized sequence of triangles into clusters at the triangles that
+  // miss the cache for all three vertices and sort the clusters so that those that
+  // face away from the center of the mesh come first, since they are likely to occlude
+  // the others.  Since the cache is cold at the start of a cluster anyway, reordering
+  // the clusters has little effect on the cache performance.
+    static void OverdrawOrder (
+        uint32_t nVerts,
+        uint32_t nTris,
+        const uint32_t *in,
+        const uint32_t *toPool,
+        const cs237::vec3f *verts,
+        uint32_t *out)
+    {
+      // find the clusters
+        std::vector<Cluster> clusters;
+        std::vector<uint32_t> cacheTime(nVerts, 0);
+        uint32_t time = kFIFOSz + 1;
+        for (uint32_t t = 0;  t < nTris;  t++) {
+            int nMisses = 0;
+            for (int j = 0;  j < 3;  j++) {
+                uint32_t v = in[3*t + j];
+                if (time - cacheTime[v] > kFIFOSz) {
+                    cacheTime[v] = time++;
+                    nMisses++;
+                }
+            }
+            if ((t == 0) || (nMisses == 3)) {
+                clusters.push_back (Cluster{t, 0, 0.0f});
+            }
+            clusters.back().nTris++;
+        }
+        if (clusters.size() < 2) {
+            std::copy (in, in + 3*nTris, out);
+            return;
+        }
+
+      // compute the area-weighted centroid and normal of each cluster and of the mesh
+        std::vector<cs237::vec3f> centers(clusters.size()), norms(clusters.size());
+        cs237::vec3f meshCenter(0.0f, 0.0f, 0.0f);
+        float meshArea = 0.0f;
+        for (size_t c = 0;  c < clusters.size();  c++) {
+            cs237::vec3f center(0.0f, 0.0f, 0.0f), norm(0.0f, 0.0f, 0.0f);
+            float area = 0.0f;
+            for (uint32_t t = clusters[c].first;  t < clusters[c].first + clusters[c].nTris;  t++) {
+                cs237::vec3f p0 = verts[toPool[in[3*t]]];
+                cs237::vec3f p1 = verts[toPool[in[3*t+1]]];
+                cs237::vec3f p2 = verts[toPool[in[3*t+2]]];
+                cs237::vec3f n = cross(p1 - p0, p2 - p0);
+                float a = length(n);  // twice the area
+                center += (a / 3.0f) * (p0 + p1 + p2);
+                norm += n;
+                area += a;
+            }
+            meshCenter += center;
+            meshArea += area;
+            centers[c] = (area > 0.0f) ? center / area : center;
+            norms[c] = norm;
+        }
+        if (meshArea > 0.0f) {
+            meshCenter = meshCenter / meshArea;
+        }
+        for (size_t c = 0;  c < clusters.size();  c++) {
+            float len = length(norms[c]);
+            clusters[c].key = (len > 0.0f) ? dot(centers[c] - meshCenter, norms[c]) / len : 0.0f;
+        }
+
+        std::stable_sort (clusters.begin(), clusters.end());
+        for (auto it = clusters.begin();  it != clusters.end();  it++) {
+            std::copy (in + 3*it->first, in + 3*(it->first + it->nTris), out);
+            out += 3*it->nTris;
+        }
+
+    } // OverdrawOrder
+
+    void OptimizeTriangleOrder (
+        uint32_t nVerts,
+        const cs237::vec3f *verts,
+        std::vector<OBJ::Group> const &groups,
+        uint32_t *indices)
+    {
+      // the groups are optimized separately using local vertex numbers, so that the
+      // work for a group is proportional to its size
+        std::vector<uint32_t> toLocal(nVerts, ~0u);
+        std::vector<uint32_t> toPool, local, tmp;
+        for (auto it = groups.begin();  it != groups.end();  it++) {
+            uint32_t *grpIndices = indices + it->firstIndex;
+            uint32_t nTris = it->nIndices / 3;
+            if (nTris < 2) {
+                continue;
+            }
+            toPool.clear();
+            local.resize (3 * nTris);
+            tmp.resize (3 * nTris);
+            for (uint32_t i = 0;  i < 3 * nTris;  i++) {
+                uint32_t v = grpIndices[i];
+                if (toLocal[v] == ~0u) {
+                    toLocal[v] = toPool.size();
+                    toPool.push_back (v);
+                }
+                local[i] = toLocal[v];
+            }
+
+            VertexCacheOrder (toPool.size(), nTris, local.data(), tmp.data());
+            OverdrawOrder (toPool.size(), nTris, tmp.data(), toPool.data(), verts, local.data());
+
+            for (uint32_t i = 0;  i < 3 * nTris;  i++) {
+                grpIndices[i] = toPool[local[i]];
+            }
+            for (auto v = toPool.begin();  v != toPool.end();  v++) {
+                toLocal[*v] = ~0u;
+            }
+        }
+
+    } // OptimizeTriangleOrder
+
+    uint32_t OptimizeVertexOrder (
+        uint32_t nVerts,
+        uint32_t nIndices,
+        uint32_t *indices,
+        std::vector<uint32_t> &remap)
+    {
+        remap.assign (nVerts, ~0u);
+        uint32_t next = 0;
+        for (uint32_t i = 0;  i < nIndices;  i++) {
+            uint32_t &v = remap[indices[i]];
+            if (v == ~0u) {
+                v = next++;
+            }
+            indices[i] = v;
+        }
+        return next;
+
+    } // OptimizeVertexOrder
+
+    float ACMR (uint32_t nVerts, uint32_t nIndices, const uint32_t *indices)
+    {
+        if (nIndices < 3) {
+            return 0.0f;
+        }
+        std::vector<uint32_t> cacheTime(nVerts, 0);
+        uint32_t time = kFIFOSz + 1;
+        uint32_t nMisses = 0;
+        for (uint32_t i = 0;  i < nIndices;  i++) {
+            uint32_t v = indices[i];
+            if (time - cacheTime[v] > kFIFOSz) {
+                cacheTime[v] = time++;
+                nMisses++;
+            }
+        }
+        return float(nMisses) / float(nIndices / 3);
+
+    } // ACMR
+
+} // namespace OBJ
@@ -20,12 +20,16 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <algorithm>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "obj-reader.hxx"
 
 #define FREE(p)         std::free(p)
 
-#define T(x) (model->triangles[(x)])
-
 /* OBJAbs: returns the absolute value of a float */
 static inline float OBJAbs(float f)
 {
@@ -72,344 +76,612 @@ OBJAddGroup(OBJmodel* model, const char* name)
 }
 
 
-/* OBJFirstPass: first pass at a Wavefront OBJ file that gets all the
- * statistics of the model (such as #vertices, #normals, etc)
- *
- * model - properly initialized OBJmodel structure
- * file  - (fopen'd) file descriptor
+/* OBJArray: a growable array.  The storage is allocated with new[], so the
+ * array can be handed off to the model with release().
+ */
+template <typename T>
+struct OBJArray {
+    T           *data;
+    uint32_t    size;
+    uint32_t    cap;
+
+    OBJArray () : data(nullptr), size(0), cap(0) { }
+    OBJArray (OBJArray const &) = delete;
+    OBJArray &operator= (OBJArray const &) = delete;
+    ~OBJArray () { delete[] data; }
+
+    T &push ()
+    {
+        if (size == cap) {
+            cap = (cap == 0) ? 1024 : 2 * cap;
+            T *newData = new T[cap];
+            std::copy (data, data + size, newData);
+            delete[] data;
+            data = newData;
+        }
+        return data[size++];
+    }
+
+    T *release ()
+    {
+        T *p = data;
+        data = nullptr;
+        size = cap = 0;
+        return p;
+    }
+};
+
+/* character classes; we do not use isspace() because it is locale dependent */
+static inline bool OBJIsSpace (char c)
+{
+    return (c == ' ') || (c == '\t') || (c == '\n') || (c == '\r') || (c == '\v') || (c == '\f');
+}
+static inline bool OBJIsBlank (char c)
+{
+    return (c != '\n') && OBJIsSpace(c);
+}
+static inline bool OBJIsDigit (char c)
+{
+    return (c >= '0') && (c <= '9');
+}
+
+/* OBJRestOfLine: get the rest of the current line (not including the '\n') and
+ * advance p to the start of the next line.
  */
+static inline void
+OBJRestOfLine (const char *&p, const char *end, const char *&s, const char *&e)
+{
+    s = p;
+    e = static_cast<const char *>(memchr(p, '\n', end - p));
+    if (e == nullptr) {
+        e = end;
+        p = end;
+    } else {
+        p = e + 1;
+    }
+}
+
+/* OBJFirstWord: return the first whitespace-delimited word in [s, e) */
+static std::string
+OBJFirstWord (const char *s, const char *e)
+{
+    while ((s < e) && OBJIsBlank(*s)) s++;
+    const char *w = s;
+    while ((s < e) && ! OBJIsSpace(*s)) s++;
+    return std::string(w, s - w);
+}
+
+/* OBJParseInt: parse an optionally signed integer at p.  Returns false if there
+ * are no digits.
+ */
+static inline bool
+OBJParseInt (const char *&p, const char *end, int &n)
+{
+    bool neg = false;
+    if ((p < end) && ((*p == '-') || (*p == '+'))) {
+        neg = (*p == '-');
+        p++;
+    }
+    if ((p >= end) || ! OBJIsDigit(*p)) {
+        return false;
+    }
+    int v = 0;
+    while ((p < end) && OBJIsDigit(*p)) {
+        v = 10 * v + (*p - '0');
+        p++;
+    }
+    n = neg ? -v : v;
+    return true;
+}
+
+/* OBJParseFloat: parse a float at p, skipping leading blanks.  A number with at most
+ * 53 bits of mantissa and a decimal exponent in [-22..22] is converted to double with
+ * a single correctly-rounded multiply or divide.  Rounding that double to float gives
+ * the correctly-rounded float (i.e., the same result as strtof, and hence fscanf),
+ * unless the double lies exactly halfway between two floats.  Those numbers, and
+ * anything else that is unusual, are handed to strtof.  If there is no number before
+ * the end of the line, then f is set to 0.
+ */
+static const double OBJPow10[23] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
 static void
-OBJFirstPass(OBJmodel* model, FILE* file)
+OBJParseFloat (const char *&p, const char *end, float &f)
 {
-    uint32_t numvertices;        /* number of vertices in model */
-    uint32_t numnormals;         /* number of normals in model */
-    uint32_t numtexcoords;       /* number of texcoords in model */
-    uint32_t numtriangles;       /* number of triangles in model */
-    OBJgroup* group = 0;         /* current group */
-    int v, n, t;
-    char buf[1024];
-    char *dummy;
-
-    numvertices = numnormals = numtexcoords = numtriangles = 0;
-    while(fscanf(file, "%s", buf) != EOF) {
-        switch(buf[0]) {
-        case '#':               /* comment */
-            /* eat up rest of line */
-            dummy = fgets(buf, sizeof(buf), file);
-            break;
+    while ((p < end) && OBJIsBlank(*p)) p++;
+    const char *start = p;
+
+    bool neg = false;
+    if ((p < end) && ((*p == '-') || (*p == '+'))) {
+        neg = (*p == '-');
+        p++;
+    }
+    uint64_t mant = 0;
+    int nDigits = 0;
+    int exp10 = 0;
+    bool fast = true;
+    while ((p < end) && OBJIsDigit(*p)) {
+        if (mant < (1ull << 53)) mant = 10 * mant + (*p - '0'); else fast = false;
+        nDigits++;
+        p++;
+    }
+    if ((p < end) && (*p == '.')) {
+        p++;
+        while ((p < end) && OBJIsDigit(*p)) {
+            if (mant < (1ull << 53)) mant = 10 * mant + (*p - '0'); else fast = false;
+            exp10--;
+            nDigits++;
+            p++;
+        }
+    }
+    if ((nDigits > 0) && (p < end) && ((*p == 'e') || (*p == 'E'))) {
+        p++;
+        int e;
+        if (OBJParseInt (p, end, e) && (e > -100) && (e < 100)) {
+            exp10 += e;
+        } else {
+            fast = false;
+        }
+    }
+    if (fast && (nDigits > 0) && ((p >= end) || OBJIsSpace(*p))
+    && (mant <= (1ull << 53)) && (exp10 >= -22) && (exp10 <= 22)) {
+        double d = static_cast<double>(mant);
+        d = (exp10 < 0) ? d / OBJPow10[-exp10] : d * OBJPow10[exp10];
+        uint64_t bits;
+        memcpy (&bits, &d, sizeof(bits));
+      /* the 29 low bits of the double's mantissa are dropped when rounding to float */
+        if ((bits & 0x1fffffff) != 0x10000000) {
+            f = static_cast<float>(neg ? -d : d);
+            return;
+        }
+    }
+
+  /* slow path: hand the token to strtof */
+    p = start;
+    while ((p < end) && ! OBJIsSpace(*p)) p++;
+    char buf[64];
+    size_t len = p - start;
+    if (len >= sizeof(buf)) len = sizeof(buf) - 1;
+    memcpy (buf, start, len);
+    buf[len] = '\0';
+    f = strtof (buf, nullptr);
+}
+
+/* face vertex formats */
+#define OBJ_FACE_T      1       /* has a texcoord index */
+#define OBJ_FACE_N      2       /* has a normal index */
+
+/* OBJParseFaceVertex: parse a face vertex of the form "v", "v/t", "v//n", or "v/t/n".
+ * The fmt argument is set to the components that are present.
+ */
+static inline bool
+OBJParseFaceVertex (const char *&p, const char *end, int &v, int &t, int &n, int &fmt)
+{
+    fmt = 0;
+    if (! OBJParseInt (p, end, v)) {
+        return false;
+    }
+    if ((p < end) && (*p == '/')) {
+        p++;
+        if (OBJParseInt (p, end, t)) {
+            fmt |= OBJ_FACE_T;
+        }
+        if ((p < end) && (*p == '/')) {
+            p++;
+            if (OBJParseInt (p, end, n)) {
+                fmt |= OBJ_FACE_N;
+            }
+        }
+    }
+  /* skip any junk at the end of the token */
+    while ((p < end) && ! OBJIsSpace(*p)) p++;
+    return true;
+}
+
+/* OBJOp: a change to the current group, material, or material library.  The state
+ * at the start of a chunk of the file is not known until the preceding chunks have
+ * been parsed, so each chunk records its ops in order, along with the number of the
+ * chunk's triangles that precede them, and the ops are replayed when the chunks are
+ * merged.
+ */
+struct OBJOp {
+    enum Kind {
+        DEFAULT_GROUP,          /* make the default group if there is no current group */
+        GROUP,                  /* g */
+        MATERIAL,               /* usemtl */
+        MTLLIB                  /* mtllib */
+    };
+    Kind        kind;
+    uint32_t    tri;            /* number of triangles in the chunk before this op */
+    std::string name;
+
+    OBJOp (Kind k, uint32_t t, std::string const &n) : kind(k), tri(t), name(n) { }
+};
+
+/* a triangle is also viewed as an array of 9 indices: the vertex, normal, and
+ * texcoord indices of its three corners.
+ */
+static_assert(sizeof(OBJtriangle) == 9 * sizeof(uint32_t), "unexpected OBJtriangle layout");
+
+/* OBJChunk: the data parsed from a range of lines in the file.  Each chunk
+ * numbers its vertices, normals, and texcoords from 1.  Positive indices in faces
+ * are absolute, but negative indices are relative to the current position in the
+ * file, so in any chunk but the first they are resolved to chunk-local indices and
+ * recorded as fixups, which are rebased when the chunks are merged.
+ */
+struct OBJChunk {
+    const char *start;                  /* the text of the chunk */
+    const char *end;
+    uint32_t    dummy;                  /* 1 if the arrays have an unused 0th element */
+    OBJArray<cs237::vec3f> vertices;
+    OBJArray<cs237::vec3f> normals;
+    OBJArray<cs237::vec2f> texcoords;
+    OBJArray<OBJtriangle> triangles;
+    std::vector<OBJOp> ops;
+    std::vector<uint32_t> fixups;       /* 9*triangle + 3*component + corner of the
+                                         * relative indices */
+    uint32_t    base[3];                /* number of vertices/normals/texcoords before */
+    uint32_t    firstTri;               /* number of triangles before this chunk */
+
+    OBJChunk () : start(nullptr), end(nullptr), dummy(0) { }
+};
+
+/* OBJParseChunk: parse the lines of a chunk.  The first chunk of the file puts
+ * an unused 0th element in its vertex arrays, so that they can be handed off to
+ * the model when the file is parsed as a single chunk.
+ */
+static void
+OBJParseChunk (OBJChunk &chunk, bool isFirst)
+{
+    const char *p = chunk.start;
+    const char *end = chunk.end;
+    bool hasGroup = false;              /* true once the chunk is known to have a group */
+    const char *s, *e;
+
+    if (isFirst) {
+        chunk.dummy = 1;
+        chunk.vertices.push();
+        chunk.normals.push();
+        chunk.texcoords.push();
+    }
+
+    while (true) {
+        /* skip to the start of the next token */
+        while ((p < end) && OBJIsSpace(*p)) p++;
+        if (p >= end) break;
+        const char *tok = p;
+        while ((p < end) && ! OBJIsSpace(*p)) p++;
+        char c1 = (p - tok > 1) ? tok[1] : '\0';
+
+        switch (tok[0]) {
         case 'v':               /* v, vn, vt */
-            if (group == 0) {
+            if (! hasGroup) {
               /* make a default group */
-                group = OBJAddGroup(model, "default");
+                chunk.ops.push_back (OBJOp(OBJOp::DEFAULT_GROUP, chunk.triangles.size, ""));
+                hasGroup = true;
             }
-            switch(buf[1]) {
+            switch (c1) {
             case '\0':          /* vertex */
-                /* eat up rest of line */
-                dummy = fgets(buf, sizeof(buf), file);
-                numvertices++;
+                {
+                    cs237::vec3f &v = chunk.vertices.push();
+                    OBJParseFloat (p, end, v[0]);
+                    OBJParseFloat (p, end, v[1]);
+                    OBJParseFloat (p, end, v[2]);
+                }
                 break;
             case 'n':           /* normal */
-                /* eat up rest of line */
-                dummy = fgets(buf, sizeof(buf), file);
-                numnormals++;
+                {
+                    cs237::vec3f &n = chunk.normals.push();
+                    OBJParseFloat (p, end, n[0]);
+                    OBJParseFloat (p, end, n[1]);
+                    OBJParseFloat (p, end, n[2]);
+                }
                 break;
             case 't':           /* texcoord */
-                /* eat up rest of line */
-                dummy = fgets(buf, sizeof(buf), file);
-                numtexcoords++;
+                {
+                    cs237::vec2f &t = chunk.texcoords.push();
+                    OBJParseFloat (p, end, t[0]);
+                    OBJParseFloat (p, end, t[1]);
+                }
                 break;
             default:
-                printf("OBJFirstPass(): Unknown token \"%s\".\n", buf);
+                fprintf(stderr, "OBJReadOBJ(): Unknown token \"%.*s\".\n",
+                    static_cast<int>(p - tok), tok);
                 exit(1);
                 break;
             }
+            /* eat up rest of line */
+            OBJRestOfLine (p, end, s, e);
             break;
         case 'm':
-            dummy = fgets(buf, sizeof(buf), file);
-            sscanf(buf, "%s %s", buf, buf);
-            model->mtllibname = strdup(buf);
+            OBJRestOfLine (p, end, s, e);
+            chunk.ops.push_back (OBJOp(OBJOp::MTLLIB, chunk.triangles.size, OBJFirstWord(s, e)));
             break;
         case 'u':
-            if (group == 0) {
+            if (! hasGroup) {
               /* make a default group */
-                group = OBJAddGroup(model, "default");
+                chunk.ops.push_back (OBJOp(OBJOp::DEFAULT_GROUP, chunk.triangles.size, ""));
+                hasGroup = true;
             }
-            /* eat up rest of line */
-            dummy = fgets(buf, sizeof(buf), file);
+            OBJRestOfLine (p, end, s, e);
+            chunk.ops.push_back (OBJOp(OBJOp::MATERIAL, chunk.triangles.size, OBJFirstWord(s, e)));
             break;
         case 'g':               /* group */
-            /* eat up rest of line */
-            dummy = fgets(buf, sizeof(buf), file);
+            OBJRestOfLine (p, end, s, e);
 #if SINGLE_STRING_GROUP_NAMES
-            sscanf(buf, "%s", buf);
+            chunk.ops.push_back (OBJOp(OBJOp::GROUP, chunk.triangles.size, OBJFirstWord(s, e)));
 #else
-            buf[strlen(buf)-1] = '\0';  /* nuke '\n' */
+            chunk.ops.push_back (OBJOp(OBJOp::GROUP, chunk.triangles.size, std::string(s, e - s)));
 #endif
-            group = OBJAddGroup(model, buf);
+            hasGroup = true;
             break;
         case 'f':               /* face */
-            if (group == 0) {
+            if (! hasGroup) {
               /* make a default group */
-                group = OBJAddGroup(model, "default");
+                chunk.ops.push_back (OBJOp(OBJOp::DEFAULT_GROUP, chunk.triangles.size, ""));
+                hasGroup = true;
             }
-            v = n = t = 0;
-            fscanf(file, "%s", buf);
-            /* can be one of %d, %d//%d, %d/%d, %d/%d/%d %d//%d */
-            if (strstr(buf, "//")) {
-                /* v//n */
-                sscanf(buf, "%d//%d", &v, &n);
-                fscanf(file, "%d//%d", &v, &n);
-                fscanf(file, "%d//%d", &v, &n);
-                numtriangles++;
-                group->numtriangles++;
-                while(fscanf(file, "%d//%d", &v, &n) > 0) {
-                    numtriangles++;
-                    group->numtriangles++;
-                }
-            } else if (sscanf(buf, "%d/%d/%d", &v, &t, &n) == 3) {
-                /* v/t/n */
-                fscanf(file, "%d/%d/%d", &v, &t, &n);
-                fscanf(file, "%d/%d/%d", &v, &t, &n);
-                numtriangles++;
-                group->numtriangles++;
-                while(fscanf(file, "%d/%d/%d", &v, &t, &n) > 0) {
-                    numtriangles++;
-                    group->numtriangles++;
-                }
-            } else if (sscanf(buf, "%d/%d", &v, &t) == 2) {
-                /* v/t */
-                fscanf(file, "%d/%d", &v, &t);
-                fscanf(file, "%d/%d", &v, &t);
-                numtriangles++;
-                group->numtriangles++;
-                while(fscanf(file, "%d/%d", &v, &t) > 0) {
-                    numtriangles++;
-                    group->numtriangles++;
-                }
-            } else {
-                /* v */
-                fscanf(file, "%d", &v);
-                fscanf(file, "%d", &v);
-                numtriangles++;
-                group->numtriangles++;
-                while(fscanf(file, "%d", &v) > 0) {
-                    numtriangles++;
-                    group->numtriangles++;
+            OBJRestOfLine (p, end, s, e);
+            {
+                /* can be one of %d, %d//%d, %d/%d, %d/%d/%d; the format of the
+                 * first vertex determines the format of the face.  Polygons are
+                 * split into a fan of triangles.
+                 */
+                int faceFmt = 0;
+                uint32_t nv = 0;
+                uint32_t first[3] = {0, 0, 0}, prev[3] = {0, 0, 0}, cur[3];  /* v/n/t indices */
+                unsigned firstRel = 0, prevRel = 0;     /* bit masks of relative indices */
+                while (true) {
+                    while ((s < e) && OBJIsBlank(*s)) s++;
+                    int idx[3], fmt;                    /* v/n/t indices from the file */
+                    idx[1] = idx[2] = 0;
+                    if ((s >= e) || ! OBJParseFaceVertex (s, e, idx[0], idx[2], idx[1], fmt)) {
+                        break;
+                    }
+                    if (nv == 0) {
+                        faceFmt = fmt;
+                    }
+                    if (! (faceFmt & OBJ_FACE_N)) idx[1] = 0;
+                    if (! (faceFmt & OBJ_FACE_T)) idx[2] = 0;
+                    const uint32_t counts[3] = {
+                            chunk.vertices.size, chunk.normals.size, chunk.texcoords.size
+                        };
+                    unsigned curRel = 0;
+                    for (int c = 0;  c < 3;  c++) {
+                        if (idx[c] < 0) {
+                            cur[c] = idx[c] + counts[c] + 1 - chunk.dummy;
+                            curRel |= (1 << c);
+                        } else {
+                            cur[c] = idx[c];
+                        }
+                    }
+                    if (nv == 0) {
+                        std::copy (cur, cur+3, first);
+                        firstRel = curRel;
+                    } else if (nv >= 2) {
+                        uint32_t triId = chunk.triangles.size;
+                        uint32_t *tri = reinterpret_cast<uint32_t *>(&chunk.triangles.push());
+                        for (int c = 0;  c < 3;  c++) {
+                            tri[3*c] = first[c];
+                            tri[3*c+1] = prev[c];
+                            tri[3*c+2] = cur[c];
+                        }
+                        if (! isFirst && (firstRel | prevRel | curRel)) {
+                            for (int c = 0;  c < 3;  c++) {
+                                if (firstRel & (1 << c)) chunk.fixups.push_back (9*triId + 3*c);
+                                if (prevRel & (1 << c)) chunk.fixups.push_back (9*triId + 3*c + 1);
+                                if (curRel & (1 << c)) chunk.fixups.push_back (9*triId + 3*c + 2);
+                            }
+                        }
+                    }
+                    std::copy (cur, cur+3, prev);
+                    prevRel = curRel;
+                    nv++;
                 }
             }
             break;
 
         default:
             /* eat up rest of line */
-            dummy = fgets(buf, sizeof(buf), file);
+            OBJRestOfLine (p, end, s, e);
             break;
         }
-  }
-
-  /* set the stats in the model structure */
-  model->numvertices  = numvertices;
-  model->numnormals   = numnormals;
-  model->numtexcoords = numtexcoords;
-  model->numtriangles = numtriangles;
-
-  /* allocate memory for the triangles in each group */
-  group = model->groups;
-  while(group) {
-      group->triangles = new uint32_t[group->numtriangles];
-      group->numtriangles = 0;
-      group = group->next;
-  }
+    }
 }
 
-/* OBJSecondPass: second pass at a Wavefront OBJ file that gets all
- * the data.
- *
- * model - properly initialized OBJmodel structure
- * file  - (fopen'd) file descriptor
+/* OBJCopyChunk: copy the data of a chunk into the model's arrays, rebasing the
+ * relative indices.
  */
 static void
-OBJSecondPass (OBJmodel* model, FILE* file)
+OBJCopyChunk (OBJmodel* model, OBJChunk &chunk)
 {
-    uint32_t numvertices;       /* number of vertices in model */
-    uint32_t numnormals;        /* number of normals in model */
-    uint32_t numtexcoords;      /* number of texcoords in model */
-    uint32_t numtriangles;      /* number of triangles in model */
-    cs237::vec3f *vertices;     /* array of vertices  */
-    cs237::vec3f *normals;      /* array of normals */
-    cs237::vec2f *texcoords;    /* array of texture coordinates */
-    OBJgroup* group;            /* current group pointer */
-    char* material;             /* current material */
-    int v, n, t;
-    char buf[512];
-    char *dummy;
-
-    /* set the pointer shortcuts */
-    vertices    = model->vertices;
-    normals     = model->normals;
-    texcoords   = model->texcoords;
-    group       = model->groups;
-
-    /* on the second pass through the file, read all the data into the
-    allocated arrays */
-    numvertices = numnormals = numtexcoords = 1;
-    numtriangles = 0;
-    material = nullptr;
-    while (fscanf(file, "%s", buf) != EOF) {
-        switch (buf[0]) {
-        case '#':               /* comment */
-            /* eat up rest of line */
-            dummy = fgets(buf, sizeof(buf), file);
-            break;
-        case 'v':               /* v, vn, vt */
-            switch (buf[1]) {
-            case '\0':          /* vertex */
-                fscanf(file, "%f %f %f",
-                    &(vertices[numvertices][0]),
-                    &(vertices[numvertices][1]),
-                    &(vertices[numvertices][2]));
-                numvertices++;
+    /* the first chunk's arrays include the unused 0th element */
+    std::copy (chunk.vertices.data, chunk.vertices.data + chunk.vertices.size,
+        model->vertices + chunk.base[0] + 1 - chunk.dummy);
+    if (model->normals) {
+        std::copy (chunk.normals.data, chunk.normals.data + chunk.normals.size,
+            model->normals + chunk.base[1] + 1 - chunk.dummy);
+    }
+    if (model->texcoords) {
+        std::copy (chunk.texcoords.data, chunk.texcoords.data + chunk.texcoords.size,
+            model->texcoords + chunk.base[2] + 1 - chunk.dummy);
+    }
+    OBJtriangle *tris = model->triangles + chunk.firstTri;
+    std::copy (chunk.triangles.data, chunk.triangles.data + chunk.triangles.size, tris);
+    uint32_t *fields = reinterpret_cast<uint32_t *>(tris);
+    for (auto it = chunk.fixups.begin();  it != chunk.fixups.end();  it++) {
+        fields[*it] += chunk.base[(*it % 9) / 3];
+    }
+}
+
+/* OBJMerge: combine the chunks into the model.  The ops of the chunks are replayed
+ * in order to assign the triangles to groups.
+ */
+static void
+OBJMerge (OBJmodel* model, std::vector<OBJChunk> &chunks, cs237::ThreadPool *pool)
+{
+    /* replay the ops, which divides the triangles into runs that belong to a group */
+    struct Run {
+        OBJgroup        *group;
+        uint32_t        start;
+        uint32_t        count;
+    };
+    std::vector<Run> runs;
+    OBJgroup* group = nullptr;          /* current group */
+    std::string material;               /* current material */
+    bool hasMaterial = false;
+    uint32_t nTris = 0;
+    for (auto it = chunks.begin();  it != chunks.end();  it++) {
+        uint32_t next = 0;
+        for (size_t i = 0;  i <= it->ops.size();  i++) {
+            uint32_t tri = (i < it->ops.size()) ? it->ops[i].tri : it->triangles.size;
+            if (tri > next) {
+                runs.push_back (Run{group, nTris + next, tri - next});
+                group->numtriangles += tri - next;
+                next = tri;
+            }
+            if (i == it->ops.size()) {
                 break;
-            case 'n':           /* normal */
-                fscanf(file, "%f %f %f",
-                    &(normals[numnormals][0]),
-                    &(normals[numnormals][1]),
-                    &(normals[numnormals][2]));
-                numnormals++;
+            }
+            OBJOp const &op = it->ops[i];
+            switch (op.kind) {
+            case OBJOp::DEFAULT_GROUP:
+                if (group == nullptr) {
+                    group = OBJAddGroup(model, "default");
+                }
                 break;
-            case 't':           /* texcoord */
-                fscanf(file, "%f %f",
-                    &(texcoords[numtexcoords][0]),
-                    &(texcoords[numtexcoords][1]));
-                numtexcoords++;
+            case OBJOp::GROUP:
+                group = OBJAddGroup(model, op.name.c_str());
+                if (group->material) FREE(group->material);
+                group->material = hasMaterial ? strdup(material.c_str()) : nullptr;
                 break;
-            }
-            break;
-            case 'u':
-                dummy = fgets(buf, sizeof(buf), file);
-                sscanf(buf, "%s %s", buf, buf);
-                material = strdup(buf);
+            case OBJOp::MATERIAL:
+                material = op.name;
+                hasMaterial = true;
               // if there is already a material associated with this group, then we
               // ignore this material.
-/* QUESION: will this work for multiple groups with shared and different materials? */
                 if (group->material == nullptr) {
-                    group->material = material;
+                    group->material = strdup(material.c_str());
                 }
                 break;
-            case 'g':               /* group */
-                /* eat up rest of line */
-                dummy = fgets(buf, sizeof(buf), file);
-#if SINGLE_STRING_GROUP_NAMES
-                sscanf(buf, "%s", buf);
-#else
-                buf[strlen(buf)-1] = '\0';  /* nuke '\n' */
-#endif
-                group = OBJFindGroup(model, buf);
-                group->material = (material != nullptr) ? strdup(material) : nullptr;
-                break;
-            case 'f':               /* face */
-                v = n = t = 0;
-                fscanf(file, "%s", buf);
-                /* can be one of %d, %d//%d, %d/%d, %d/%d/%d %d//%d */
-                if (strstr(buf, "//")) {
-                    /* v//n */
-                    sscanf(buf, "%d//%d", &v, &n);
-                    T(numtriangles).vindices[0] = v < 0 ? v + numvertices : v;
-                    T(numtriangles).nindices[0] = n < 0 ? n + numnormals : n;
-                    fscanf(file, "%d//%d", &v, &n);
-                    T(numtriangles).vindices[1] = v < 0 ? v + numvertices : v;
-                    T(numtriangles).nindices[1] = n < 0 ? n + numnormals : n;
-                    fscanf(file, "%d//%d", &v, &n);
-                    T(numtriangles).vindices[2] = v < 0 ? v + numvertices : v;
-                    T(numtriangles).nindices[2] = n < 0 ? n + numnormals : n;
-                    group->triangles[group->numtriangles++] = numtriangles;
-                    numtriangles++;
-                    while(fscanf(file, "%d//%d", &v, &n) > 0) {
-                        T(numtriangles).vindices[0] = T(numtriangles-1).vindices[0];
-                        T(numtriangles).nindices[0] = T(numtriangles-1).nindices[0];
-                        T(numtriangles).vindices[1] = T(numtriangles-1).vindices[2];
-                        T(numtriangles).nindices[1] = T(numtriangles-1).nindices[2];
-                        T(numtriangles).vindices[2] = v < 0 ? v + numvertices : v;
-                        T(numtriangles).nindices[2] = n < 0 ? n + numnormals : n;
-                        group->triangles[group->numtriangles++] = numtriangles;
-                        numtriangles++;
-                    }
-                } else if (sscanf(buf, "%d/%d/%d", &v, &t, &n) == 3) {
-                    /* v/t/n */
-                    T(numtriangles).vindices[0] = v < 0 ? v + numvertices : v;
-                    T(numtriangles).tindices[0] = t < 0 ? t + numtexcoords : t;
-                    T(numtriangles).nindices[0] = n < 0 ? n + numnormals : n;
-                    fscanf(file, "%d/%d/%d", &v, &t, &n);
-                    T(numtriangles).vindices[1] = v < 0 ? v + numvertices : v;
-                    T(numtriangles).tindices[1] = t < 0 ? t + numtexcoords : t;
-                    T(numtriangles).nindices[1] = n < 0 ? n + numnormals : n;
-                    fscanf(file, "%d/%d/%d", &v, &t, &n);
-                    T(numtriangles).vindices[2] = v < 0 ? v + numvertices : v;
-                    T(numtriangles).tindices[2] = t < 0 ? t + numtexcoords : t;
-                    T(numtriangles).nindices[2] = n < 0 ? n + numnormals : n;
-                    group->triangles[group->numtriangles++] = numtriangles;
-                    numtriangles++;
-                    while(fscanf(file, "%d/%d/%d", &v, &t, &n) > 0) {
-                        T(numtriangles).vindices[0] = T(numtriangles-1).vindices[0];
-                        T(numtriangles).tindices[0] = T(numtriangles-1).tindices[0];
-                        T(numtriangles).nindices[0] = T(numtriangles-1).nindices[0];
-                        T(numtriangles).vindices[1] = T(numtriangles-1).vindices[2];
-                        T(numtriangles).tindices[1] = T(numtriangles-1).tindices[2];
-                        T(numtriangles).nindices[1] = T(numtriangles-1).nindices[2];
-                        T(numtriangles).vindices[2] = v < 0 ? v + numvertices : v;
-                        T(numtriangles).tindices[2] = t < 0 ? t + numtexcoords : t;
-                        T(numtriangles).nindices[2] = n < 0 ? n + numnormals : n;
-                        group->triangles[group->numtriangles++] = numtriangles;
-                        numtriangles++;
-                    }
-                } else if (sscanf(buf, "%d/%d", &v, &t) == 2) {
-                    /* v/t */
-                    T(numtriangles).vindices[0] = v < 0 ? v + numvertices : v;
-                    T(numtriangles).tindices[0] = t < 0 ? t + numtexcoords : t;
-                    fscanf(file, "%d/%d", &v, &t);
-                    T(numtriangles).vindices[1] = v < 0 ? v + numvertices : v;
-                    T(numtriangles).tindices[1] = t < 0 ? t + numtexcoords : t;
-                    fscanf(file, "%d/%d", &v, &t);
-                    T(numtriangles).vindices[2] = v < 0 ? v + numvertices : v;
-                    T(numtriangles).tindices[2] = t < 0 ? t + numtexcoords : t;
-                    group->triangles[group->numtriangles++] = numtriangles;
-                    numtriangles++;
-                    while(fscanf(file, "%d/%d", &v, &t) > 0) {
-                        T(numtriangles).vindices[0] = T(numtriangles-1).vindices[0];
-                        T(numtriangles).tindices[0] = T(numtriangles-1).tindices[0];
-                        T(numtriangles).vindices[1] = T(numtriangles-1).vindices[2];
-                        T(numtriangles).tindices[1] = T(numtriangles-1).tindices[2];
-                        T(numtriangles).vindices[2] = v < 0 ? v + numvertices : v;
-                        T(numtriangles).tindices[2] = t < 0 ? t + numtexcoords : t;
-                        group->triangles[group->numtriangles++] = numtriangles;
-                        numtriangles++;
-                    }
-                } else {
-                    /* v */
-                    sscanf(buf, "%d", &v);
-                    T(numtriangles).vindices[0] = v < 0 ? v + numvertices : v;
-                    fscanf(file, "%d", &v);
-                    T(numtriangles).vindices[1] = v < 0 ? v + numvertices : v;
-                    fscanf(file, "%d", &v);
-                    T(numtriangles).vindices[2] = v < 0 ? v + numvertices : v;
-                    group->triangles[group->numtriangles++] = numtriangles;
-                    numtriangles++;
-                    while(fscanf(file, "%d", &v) > 0) {
-                        T(numtriangles).vindices[0] = T(numtriangles-1).vindices[0];
-                        T(numtriangles).vindices[1] = T(numtriangles-1).vindices[2];
-                        T(numtriangles).vindices[2] = v < 0 ? v + numvertices : v;
-                        group->triangles[group->numtriangles++] = numtriangles;
-                        numtriangles++;
-                    }
-                }
+            case OBJOp::MTLLIB:
+                if (model->mtllibname) FREE(model->mtllibname);
+                model->mtllibname = strdup(op.name.c_str());
                 break;
+            }
+        }
+        it->firstTri = nTris;
+        nTris += it->triangles.size;
+    }
 
-            default:
-                /* eat up rest of line */
-                dummy = fgets(buf, sizeof(buf), file);
-                break;
+    /* distribute the triangles to their groups */
+    for (group = model->groups;  group;  group = group->next) {
+        group->triangles = new uint32_t[group->numtriangles];
+        group->numtriangles = 0;
+    }
+    for (auto it = runs.begin();  it != runs.end();  it++) {
+        uint32_t *tris = it->group->triangles + it->group->numtriangles;
+        for (uint32_t i = 0;  i < it->count;  i++) {
+            tris[i] = it->start + i;
         }
+        it->group->numtriangles += it->count;
     }
 
+    if (chunks.size() == 1) {
+        /* hand the arrays off to the model */
+        OBJChunk &chunk = chunks[0];
+        model->numvertices  = chunk.vertices.size - 1;
+        model->numnormals   = chunk.normals.size - 1;
+        model->numtexcoords = chunk.texcoords.size - 1;
+        model->numtriangles = chunk.triangles.size;
+        model->vertices = chunk.vertices.release();
+        if (model->numnormals > 0) {
+            model->normals = chunk.normals.release();
+        }
+        if (model->numtexcoords > 0) {
+            model->texcoords = chunk.texcoords.release();
+        }
+        model->triangles = chunk.triangles.release();
+        return;
+    }
+
+    /* compute where each chunk goes in the model's arrays */
+    uint32_t counts[3] = { 0, 0, 0 };
+    for (auto it = chunks.begin();  it != chunks.end();  it++) {
+        it->base[0] = counts[0];
+        it->base[1] = counts[1];
+        it->base[2] = counts[2];
+        counts[0] += it->vertices.size - it->dummy;
+        counts[1] += it->normals.size - it->dummy;
+        counts[2] += it->texcoords.size - it->dummy;
+    }
+    model->numvertices  = counts[0];
+    model->numnormals   = counts[1];
+    model->numtexcoords = counts[2];
+    model->numtriangles = nTris;
+    model->vertices = new cs237::vec3f[counts[0] + 1];
+    if (counts[1] > 0) {
+        model->normals = new cs237::vec3f[counts[1] + 1];
+    }
+    if (counts[2] > 0) {
+        model->texcoords = new cs237::vec2f[counts[2] + 1];
+    }
+    model->triangles = new OBJtriangle[nTris];
+
+    pool->ParallelFor (chunks.size(), 1, [&] (size_t lo, size_t hi) {
+        for (size_t i = lo;  i < hi;  i++) {
+            OBJCopyChunk (model, chunks[i]);
+        }
+    });
+}
+
+/* the minimum size of a chunk when the file is parsed in parallel */
+#define OBJ_MIN_CHUNK_SZ        (1 << 20)
+
+/* OBJParse: read the model from the text in [text, text+len).  If a thread pool is
+ * given, then the text is split into chunks at line boundaries, which are parsed in
+ * parallel and then merged.
+ *
+ * model - properly initialized OBJmodel structure
+ */
+static void
+OBJParse (OBJmodel* model, const char *text, size_t len, cs237::ThreadPool *pool)
+{
+    size_t nChunks = 1;
+    if (pool != nullptr) {
+        nChunks = std::min(static_cast<size_t>(pool->NumWorkers() + 1), len / OBJ_MIN_CHUNK_SZ);
+        nChunks = std::max(nChunks, static_cast<size_t>(1));
+    }
+
+    std::vector<OBJChunk> chunks(nChunks);
+    const char *end = text + len;
+    const char *p = text;
+    for (size_t i = 0;  i < nChunks;  i++) {
+        chunks[i].start = p;
+        if (i+1 < nChunks) {
+            /* split after the end of the line that contains the nominal boundary */
+            const char *q = std::max(p, text + (len * (i+1)) / nChunks);
+            const char *nl = static_cast<const char *>(memchr(q, '\n', end - q));
+            p = (nl == nullptr) ? end : nl + 1;
+        } else {
+            p = end;
+        }
+        chunks[i].end = p;
+    }
+
+    if (nChunks == 1) {
+        OBJParseChunk (chunks[0], true);
+    } else {
+        pool->ParallelFor (nChunks, 1, [&] (size_t lo, size_t hi) {
+            for (size_t i = lo;  i < hi;  i++) {
+                OBJParseChunk (chunks[i], i == 0);
+            }
+        });
+    }
+
+    OBJMerge (model, chunks, pool);
 }
 
 
@@ -465,25 +737,9 @@ OBJDimensions(OBJmodel* model, float* dimensions)
 void
 OBJDelete(OBJmodel* model)
 {
-    OBJgroup* group;
-
     assert(model);
 
-    if (model->mtllibname) FREE(model->mtllibname);
-    if (model->vertices)   FREE(model->vertices);
-    if (model->normals)    FREE(model->normals);
-    if (model->texcoords)  FREE(model->texcoords);
-    if (model->triangles)  FREE(model->triangles);
-    while (model->groups) {
-        group = model->groups;
-        model->groups = model->groups->next;
-        FREE (group->name);
-        if (group->material) FREE (group->material);
-        FREE (group->triangles);
-        FREE (group);
-    }
-
-    FREE(model);
+    delete model;
 }
 
 /* OBJReadOBJ: Reads a model description from a Wavefront .OBJ file.
@@ -491,44 +747,40 @@ OBJDelete(OBJmodel* model)
  * OBJDelete().
  *
  * filename - name of the file containing the Wavefront .OBJ format data.
+ * pool - if non-null, then the threads used to parse large files in parallel.
  */
 OBJmodel*
-OBJReadOBJ(const char* filename)
+OBJReadOBJ(const char* filename, cs237::ThreadPool *pool)
 {
-    FILE* file;
-
-    /* open the file */
-    file = fopen(filename, "r");
-    if (!file) {
+    /* map the file into memory */
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    if ((fd < 0) || (fstat(fd, &st) < 0)) {
         fprintf(stderr, "OBJReadOBJ() failed: can't open data file \"%s\".\n",
             filename);
         exit(1);
     }
+    size_t len = static_cast<size_t>(st.st_size);
+    void *base = nullptr;
+    if (len > 0) {
+        base = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (base == MAP_FAILED) {
+            fprintf(stderr, "OBJReadOBJ() failed: can't map data file \"%s\".\n",
+                filename);
+            exit(1);
+        }
+        madvise(base, len, MADV_SEQUENTIAL);
+    }
+    close(fd);
 
     /* allocate a new model */
     OBJmodel* model = new OBJmodel();
 
-    /* make a first pass through the file to get a count of the number
-    of vertices, normals, texcoords & triangles */
-    OBJFirstPass (model, file);
+    OBJParse (model, static_cast<const char *>(base), len, pool);
 
-    /* allocate memory */
-    model->vertices = new cs237::vec3f[model->numvertices + 1];
-    model->triangles = new OBJtriangle[model->numtriangles];
-    if (model->numnormals > 0) {
-        model->normals = new cs237::vec3f[model->numnormals + 1];
+    if (base != nullptr) {
+        munmap(base, len);
     }
-    if (model->numtexcoords > 0) {
-        model->texcoords = new cs237::vec2f[model->numtexcoords + 1];
-    }
-
-    /* rewind to beginning of file and read in the data this pass */
-    rewind(file);
-
-    OBJSecondPass(model, file);
-
-    /* close the file */
-    fclose(file);
 
     return model;
 }
@@ -544,18 +796,19 @@ OBJmodel::OBJmodel ()
 
 OBJmodel::~OBJmodel ()
 {
+    /* the strings are allocated with strdup and everything else with new */
     if (this->mtllibname) FREE(this->mtllibname);
-    if (this->vertices)   FREE(this->vertices);
-    if (this->normals)    FREE(this->normals);
-    if (this->texcoords)  FREE(this->texcoords);
-    if (this->triangles)  FREE(this->triangles);
+    delete[] this->vertices;
+    delete[] this->normals;
+    delete[] this->texcoords;
+    delete[] this->triangles;
     while (this->groups) {
         OBJgroup *group = this->groups;
         this->groups = this->groups->next;
         FREE (group->name);
         if (group->material) FREE (group->material);
-        FREE (group->triangles);
-        FREE (group);
+        delete[] group->triangles;
+        delete group;
     }
 
 }
@@ -54,7 +54,10 @@ struct OBJmodel {
  * OBJDelete().
  *
  * filename - name of the file containing the Wavefront .OBJ format data.  
+ * pool - if non-null, then large files are split into chunks at line boundaries,
+ *        which are parsed in parallel by the pool's threads.  The result is the
+ *        same as for a serial read.
  */
-OBJmodel *OBJReadOBJ (const char* filename);
+OBJmodel *OBJReadOBJ (const char* filename, cs237::ThreadPool *pool = nullptr);
 
 #endif /*! _OBJ_READER_HXX_ */
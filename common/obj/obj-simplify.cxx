@@ -0,0 +1,551 @@
+/*! \file obj-simplify.cxx
+ *
+ * Mesh simplification for building the levels of detail of compiled meshes.
+ *
+ * The simplifier uses quadric error metrics (Garland and Heckbert, "Surface
+ * Simplification Using Quadric Error Metrics", SIGGRAPH 1997) to order half-edge
+ * collapses, which move a vertex onto one of its neighbors.  Since no new vertices are
+ * created, all of the levels of detail share the model's vertex pool.  The quadric
+ * costs only order the collapses; the error of a level is measured as a distance in
+ * model units (see Simplifier::Error).
+ *
+ * \author John Reppy
+ */
+
+/*
+ * COPYRIGHT (c) 2017 John Reppy (http://cs.uchicago.edu/~jhr)
+ * All rights reserved.
+ */
+
+#include "cs237.hxx"
+#include "obj-mesh.hxx"
+#include <algorithm>
+#include <cmath>
+
+namespace OBJ {
+
+  // each level of detail has at most this fraction of the triangles of the previous level
+    static const float kLODRatio = 0.25f;
+
+  // a level of detail is only added for a group when it has at most this fraction of
+  // the triangles of the previous level
+    static const float kMinReduction = 0.9f;
+
+  // a collapse is not allowed to rotate a triangle's normal by more than about 60 degrees
+    static const float kMinCos = 0.5f;
+
+  // groups are not simplified below this number of triangles
+    static const uint32_t kMinTris = 8;
+
+    static inline cs237::vec3d ToDouble (cs237::vec3f const &v)
+    {
+        return cs237::vec3d(v.x, v.y, v.z);
+    }
+
+  // the squared distance from p to the triangle abc (see Ericson, "Real-Time Collision
+  // Detection", Section 5.1.5)
+    static double DistSqToTri (
+        cs237::vec3d const &p, cs237::vec3d const &a, cs237::vec3d const &b, cs237::vec3d const &c)
+    {
+        cs237::vec3d ab = b - a, ac = c - a, ap = p - a;
+        double d1 = dot(ab, ap), d2 = dot(ac, ap);
+        if ((d1 <= 0.0) && (d2 <= 0.0)) return dot(ap, ap);
+        cs237::vec3d bp = p - b;
+        double d3 = dot(ab, bp), d4 = dot(ac, bp);
+        if ((d3 >= 0.0) && (d4 <= d3)) return dot(bp, bp);
+        double vc = d1*d4 - d3*d2;
+        if ((vc <= 0.0) && (d1 >= 0.0) && (d3 <= 0.0)) {
+            cs237::vec3d q = a + ab * (d1 / (d1 - d3));
+            return dot(p - q, p - q);
+        }
+        cs237::vec3d cp = p - c;
+        double d5 = dot(ab, cp), d6 = dot(ac, cp);
+        if ((d6 >= 0.0) && (d5 <= d6)) return dot(cp, cp);
+        double vb = d5*d2 - d1*d6;
+        if ((vb <= 0.0) && (d2 >= 0.0) && (d6 <= 0.0)) {
+            cs237::vec3d q = a + ac * (d2 / (d2 - d6));
+            return dot(p - q, p - q);
+        }
+        double va = d3*d6 - d5*d4;
+        if ((va <= 0.0) && ((d4 - d3) >= 0.0) && ((d5 - d6) >= 0.0)) {
+            cs237::vec3d q = b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+            return dot(p - q, p - q);
+        }
+        double denom = 1.0 / (va + vb + vc);
+        cs237::vec3d q = a + ab * (vb * denom) + ac * (vc * denom);
+        return dot(p - q, p - q);
+    }
+
+  // a symmetric 4x4 matrix that computes the sum of the squared distances from a point
+  // to a set of planes
+    struct Quadric {
+        double a00, a01, a02, a03, a11, a12, a13, a22, a23, a33;
+
+        Quadric ()
+            : a00(0), a01(0), a02(0), a03(0), a11(0), a12(0), a13(0), a22(0), a23(0), a33(0)
+        { }
+
+      // add the plane n.p + d = 0, where n is a unit vector
+        void addPlane (cs237::vec3d const &n, double d)
+        {
+            this->a00 += n.x * n.x;  this->a01 += n.x * n.y;  this->a02 += n.x * n.z;
+            this->a03 += n.x * d;
+            this->a11 += n.y * n.y;  this->a12 += n.y * n.z;  this->a13 += n.y * d;
+            this->a22 += n.z * n.z;  this->a23 += n.z * d;
+            this->a33 += d * d;
+        }
+
+        Quadric & operator+= (Quadric const &q)
+        {
+            this->a00 += q.a00;  this->a01 += q.a01;  this->a02 += q.a02;  this->a03 += q.a03;
+            this->a11 += q.a11;  this->a12 += q.a12;  this->a13 += q.a13;
+            this->a22 += q.a22;  this->a23 += q.a23;
+            this->a33 += q.a33;
+            return *this;
+        }
+
+      // the error of a point
+        double eval (cs237::vec3f const &p) const
+        {
+            double x = p.x, y = p.y, z = p.z;
+            return x * (this->a00 * x + 2.0 * (this->a01 * y + this->a02 * z + this->a03))
+                + y * (this->a11 * y + 2.0 * (this->a12 * z + this->a13))
+                + z * (this->a22 * z + 2.0 * this->a23)
+                + this->a33;
+        }
+
+      // the error of a point for the sum of two quadrics
+        static double eval (Quadric const &q1, Quadric const &q2, cs237::vec3f const &p)
+        {
+            Quadric q = q1;
+            q += q2;
+            return q.eval(p);
+        }
+    };
+
+  // a candidate half-edge collapse
+    struct Collapse {
+        double          cost;
+        uint32_t        from, to;
+
+        bool operator< (Collapse const &other) const { return this->cost < other.cost; }
+    };
+
+  // simplifier for the triangles of one group.  The vertices are numbered locally.
+    class Simplifier {
+      public:
+        Simplifier (
+            std::vector<cs237::vec3f> const &pos,
+            std::vector<bool> const &locked,
+            std::vector<uint32_t> const &tris)
+            : _pos(pos), _locked(locked), _tris(tris),
+              _triAlive(tris.size() / 3, true), _nLive(tris.size() / 3),
+              _vertAlive(pos.size(), true), _adj(pos.size()), _quadrics(pos.size()),
+              _parent(pos.size())
+        {
+            for (uint32_t v = 0;  v < pos.size();  v++) {
+                this->_parent[v] = v;
+            }
+          // initialize the adjacency lists and quadrics
+            for (uint32_t t = 0;  t < this->_nLive;  t++) {
+                const uint32_t *tri = &this->_tris[3*t];
+                cs237::vec3d p0 = ToDouble(pos[tri[0]]);
+                cs237::vec3d p1 = ToDouble(pos[tri[1]]);
+                cs237::vec3d p2 = ToDouble(pos[tri[2]]);
+                cs237::vec3d n = cross(p1 - p0, p2 - p0);
+                double len = length(n);
+                for (int j = 0;  j < 3;  j++) {
+                    this->_adj[tri[j]].push_back (t);
+                    if (len > 0.0) {
+                        this->_quadrics[tri[j]].addPlane (n / len, -dot(n, p0) / len);
+                    }
+                }
+            }
+        }
+
+      // the number of live triangles
+        uint32_t NumTris () const { return this->_nLive; }
+
+      // the geometric error of the simplified mesh in model units, which is the maximum
+      // distance from a vertex of the original mesh to the triangles around the vertex
+      // that it was collapsed into.  Since the nearest part of the simplified surface
+      // might be outside that neighborhood, this is an upper bound on the distance from
+      // the original vertices to the simplified surface.
+        float Error ();
+
+      // collapse edges until there are at most target triangles or no more edges can be
+      // collapsed
+        void Simplify (uint32_t target);
+
+      // append the live triangles to a vector
+        void GetTris (std::vector<uint32_t> &out) const
+        {
+            for (uint32_t t = 0;  t < this->_triAlive.size();  t++) {
+                if (this->_triAlive[t]) {
+                    out.insert (out.end(), &this->_tris[3*t], &this->_tris[3*t+3]);
+                }
+            }
+        }
+
+      private:
+        std::vector<cs237::vec3f> const &_pos;
+        std::vector<bool> const &_locked;
+        std::vector<uint32_t> _tris;
+        std::vector<bool> _triAlive;
+        uint32_t _nLive;
+        std::vector<bool> _vertAlive;
+        std::vector<std::vector<uint32_t>> _adj;  // the triangles of each vertex
+        std::vector<Quadric> _quadrics;
+        std::vector<uint32_t> _parent;          // the vertex that each vertex was collapsed
+                                                // into (itself for live vertices)
+
+      // the live vertex that a vertex has been collapsed into
+        uint32_t _Find (uint32_t v)
+        {
+            uint32_t r = v;
+            while (this->_parent[r] != r) {
+                r = this->_parent[r];
+            }
+          // path compression
+            while (this->_parent[v] != r) {
+                uint32_t next = this->_parent[v];
+                this->_parent[v] = r;
+                v = next;
+            }
+            return r;
+        }
+
+      // remove dead triangles from a vertex's adjacency list
+        void _Compact (uint32_t v)
+        {
+            std::vector<uint32_t> &adj = this->_adj[v];
+            size_t n = 0;
+            for (size_t i = 0;  i < adj.size();  i++) {
+                if (this->_triAlive[adj[i]]) {
+                    adj[n++] = adj[i];
+                }
+            }
+            adj.resize (n);
+        }
+
+      // get the neighbors of a vertex
+        void _Neighbors (uint32_t v, std::vector<uint32_t> &nbrs) const
+        {
+            nbrs.clear();
+            for (auto it = this->_adj[v].begin();  it != this->_adj[v].end();  it++) {
+                const uint32_t *tri = &this->_tris[3 * *it];
+                for (int j = 0;  j < 3;  j++) {
+                    if ((tri[j] != v)
+                    && (std::find(nbrs.begin(), nbrs.end(), tri[j]) == nbrs.end())) {
+                        nbrs.push_back (tri[j]);
+                    }
+                }
+            }
+        }
+
+      // check if a collapse would be valid, i.e., it would not change the topology of the
+      // mesh or flip any triangles
+        bool _CanCollapse (uint32_t u, uint32_t v, std::vector<uint32_t> &uNbrs, std::vector<uint32_t> &vNbrs);
+
+      // collapse the edge from u to v
+        void _Collapse (uint32_t u, uint32_t v);
+    };
+
+    bool Simplifier::_CanCollapse (
+        uint32_t u, uint32_t v,
+        std::vector<uint32_t> &uNbrs, std::vector<uint32_t> &vNbrs)
+    {
+      // the link condition: the common neighbors of u and v must be the third vertices of
+      // the triangles that contain the edge
+        this->_Neighbors (u, uNbrs);
+        this->_Neighbors (v, vNbrs);
+        int nCommon = 0, nShared = 0;
+        for (auto it = uNbrs.begin();  it != uNbrs.end();  it++) {
+            if (std::find(vNbrs.begin(), vNbrs.end(), *it) != vNbrs.end()) {
+                nCommon++;
+            }
+        }
+        for (auto it = this->_adj[u].begin();  it != this->_adj[u].end();  it++) {
+            const uint32_t *tri = &this->_tris[3 * *it];
+            if ((tri[0] == v) || (tri[1] == v) || (tri[2] == v)) {
+                nShared++;
+            }
+        }
+        if (nCommon != nShared) {
+            return false;
+        }
+
+      // the triangles that are moved must not flip, turn too far, or become degenerate
+        cs237::vec3f const &pv = this->_pos[v];
+        for (auto it = this->_adj[u].begin();  it != this->_adj[u].end();  it++) {
+            const uint32_t *tri = &this->_tris[3 * *it];
+            if ((tri[0] == v) || (tri[1] == v) || (tri[2] == v)) {
+                continue;  // this triangle will be removed
+            }
+            cs237::vec3f p[3], q[3];
+            for (int j = 0;  j < 3;  j++) {
+                p[j] = this->_pos[tri[j]];
+                q[j] = (tri[j] == u) ? pv : p[j];
+            }
+            cs237::vec3f nOld = cross(p[1] - p[0], p[2] - p[0]);
+            cs237::vec3f nNew = cross(q[1] - q[0], q[2] - q[0]);
+            if (dot(nOld, nNew) <= kMinCos * length(nOld) * length(nNew)) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    void Simplifier::_Collapse (uint32_t u, uint32_t v)
+    {
+        for (auto it = this->_adj[u].begin();  it != this->_adj[u].end();  it++) {
+            uint32_t t = *it;
+            uint32_t *tri = &this->_tris[3*t];
+            if ((tri[0] == v) || (tri[1] == v) || (tri[2] == v)) {
+                this->_triAlive[t] = false;
+                this->_nLive--;
+            }
+            else {
+                for (int j = 0;  j < 3;  j++) {
+                    if (tri[j] == u) tri[j] = v;
+                }
+                this->_adj[v].push_back (t);
+            }
+        }
+        this->_adj[u].clear();
+        this->_vertAlive[u] = false;
+        this->_parent[u] = v;
+        this->_quadrics[v] += this->_quadrics[u];
+        this->_Compact (v);
+    }
+
+    float Simplifier::Error ()
+    {
+        double maxDistSq = 0.0;
+        for (uint32_t p = 0;  p < this->_pos.size();  p++) {
+            uint32_t r = this->_Find(p);
+          // a live vertex is on its own triangles
+            if (r == p) {
+                continue;
+            }
+            cs237::vec3d pp = ToDouble(this->_pos[p]);
+            double distSq = HUGE_VAL;
+            for (auto it = this->_adj[r].begin();  it != this->_adj[r].end();  it++) {
+                if (! this->_triAlive[*it]) {
+                    continue;
+                }
+                const uint32_t *tri = &this->_tris[3 * *it];
+                distSq = std::min(distSq, DistSqToTri (pp,
+                    ToDouble(this->_pos[tri[0]]),
+                    ToDouble(this->_pos[tri[1]]),
+                    ToDouble(this->_pos[tri[2]])));
+            }
+            if (distSq < HUGE_VAL) {
+                maxDistSq = std::max(maxDistSq, distSq);
+            }
+        }
+        return float(std::sqrt(maxDistSq));
+    }
+
+    void Simplifier::Simplify (uint32_t target)
+    {
+        std::vector<Collapse> candidates;
+        std::vector<uint32_t> nbrs, uNbrs, vNbrs;
+        std::vector<bool> touched(this->_pos.size());
+        while (this->_nLive > target) {
+          // find the cheapest collapse for each vertex
+            candidates.clear();
+            for (uint32_t u = 0;  u < this->_pos.size();  u++) {
+                if (! this->_vertAlive[u] || this->_locked[u] || this->_adj[u].empty()) {
+                    continue;
+                }
+                this->_Compact (u);
+                this->_Neighbors (u, nbrs);
+                Collapse best = { HUGE_VAL, u, u };
+                for (auto it = nbrs.begin();  it != nbrs.end();  it++) {
+                    double cost = Quadric::eval(this->_quadrics[u], this->_quadrics[*it], this->_pos[*it]);
+                    if (cost < best.cost) {
+                        best.cost = cost;
+                        best.to = *it;
+                    }
+                }
+                if (best.to != u) {
+                    candidates.push_back (best);
+                }
+            }
+            std::sort (candidates.begin(), candidates.end());
+
+          // do the cheapest collapses that do not overlap.  Each collapse removes about
+          // two triangles, so we limit the number of collapses in a pass to avoid doing
+          // expensive collapses when cheaper ones become possible in the next pass.
+            uint32_t budget = (this->_nLive - target) / 2 + 1;
+            uint32_t nCollapsed = 0;
+            touched.assign (touched.size(), false);
+            for (auto it = candidates.begin();
+                (it != candidates.end()) && (nCollapsed < budget) && (this->_nLive > target);
+                it++)
+            {
+                uint32_t u = it->from, v = it->to;
+                if (touched[u] || touched[v] || ! this->_CanCollapse (u, v, uNbrs, vNbrs)) {
+                    continue;
+                }
+                this->_Collapse (u, v);
+                nCollapsed++;
+              // the neighborhood of v has changed, so its vertices cannot be collapsed
+              // until the next pass
+                touched[u] = touched[v] = true;
+                for (auto nb = uNbrs.begin();  nb != uNbrs.end();  nb++) touched[*nb] = true;
+                for (auto nb = vNbrs.begin();  nb != vNbrs.end();  nb++) touched[*nb] = true;
+            }
+            if (nCollapsed == 0) {
+                break;
+            }
+        }
+    }
+
+    void BuildLODs (
+        uint32_t nVerts,
+        const cs237::vec3f *verts,
+        std::vector<OBJ::Group> const &groups,
+        uint32_t nIndices,
+        const uint32_t *indices,
+        int nLODs,
+        std::vector<uint32_t> &lodIndices,
+        std::vector<LODRange> &lodRanges,
+        std::vector<float> &lodErrors)
+    {
+        lodIndices.clear();
+        lodRanges.assign (nLODs * groups.size(), LODRange{0, 0});
+        lodErrors.assign (nLODs, 0.0f);
+
+      // lock the vertices whose position is shared with other vertices of the pool (i.e.,
+      // seams in the normals or texture coordinates), so that seams do not open up
+        std::vector<bool> locked(nVerts, false);
+        {
+            std::vector<uint32_t> order(nVerts);
+            for (uint32_t i = 0;  i < nVerts;  i++) order[i] = i;
+            auto lessPos = [verts] (uint32_t a, uint32_t b) {
+                    cs237::vec3f const &p = verts[a], &q = verts[b];
+                    return (p.x < q.x) || ((p.x == q.x) && ((p.y < q.y) || ((p.y == q.y) && (p.z < q.z))));
+                };
+            std::sort (order.begin(), order.end(), lessPos);
+            for (uint32_t i = 1;  i < nVerts;  i++) {
+                if (! lessPos(order[i-1], order[i])) {
+                    locked[order[i-1]] = locked[order[i]] = true;
+                }
+            }
+        }
+      // lock the vertices that are used by more than one group, so that the groups stay
+      // connected
+        {
+            std::vector<uint32_t> lastGrp(nVerts, ~0u);
+            for (uint32_t g = 0;  g < groups.size();  g++) {
+                const uint32_t *grpIndices = indices + groups[g].firstIndex;
+                for (uint32_t i = 0;  i < groups[g].nIndices;  i++) {
+                    uint32_t v = grpIndices[i];
+                    if ((lastGrp[v] != ~0u) && (lastGrp[v] != g)) {
+                        locked[v] = true;
+                    }
+                    lastGrp[v] = g;
+                }
+            }
+        }
+
+        std::vector<uint32_t> toLocal(nVerts, ~0u);
+        std::vector<uint32_t> toPool, tris, edges, out;
+        std::vector<cs237::vec3f> pos;
+        std::vector<bool> localLocked;
+        for (uint32_t g = 0;  g < groups.size();  g++) {
+            const uint32_t *grpIndices = indices + groups[g].firstIndex;
+            uint32_t nTris = groups[g].nIndices / 3;
+
+          // number the group's vertices locally
+            toPool.clear();
+            pos.clear();
+            localLocked.clear();
+            tris.resize (3 * nTris);
+            for (uint32_t i = 0;  i < 3 * nTris;  i++) {
+                uint32_t v = grpIndices[i];
+                if (toLocal[v] == ~0u) {
+                    toLocal[v] = toPool.size();
+                    toPool.push_back (v);
+                    pos.push_back (verts[v]);
+                    localLocked.push_back (locked[v]);
+                }
+                tris[i] = toLocal[v];
+            }
+            for (auto v = toPool.begin();  v != toPool.end();  v++) {
+                toLocal[*v] = ~0u;
+            }
+
+          // lock the vertices of boundary and non-manifold edges
+            edges.clear();
+            for (uint32_t t = 0;  t < nTris;  t++) {
+                for (int j = 0;  j < 3;  j++) {
+                    uint32_t a = tris[3*t + j], b = tris[3*t + (j+1)%3];
+                    edges.push_back (std::min(a, b));
+                    edges.push_back (std::max(a, b));
+                }
+            }
+            {
+                std::vector<uint64_t> keys(edges.size() / 2);
+                for (size_t i = 0;  i < keys.size();  i++) {
+                    keys[i] = (uint64_t(edges[2*i]) << 32) | edges[2*i+1];
+                }
+                std::sort (keys.begin(), keys.end());
+                for (size_t i = 0;  i < keys.size(); ) {
+                    size_t j = i + 1;
+                    while ((j < keys.size()) && (keys[j] == keys[i])) j++;
+                    if (j - i != 2) {
+                        localLocked[keys[i] >> 32] = true;
+                        localLocked[keys[i] & 0xffffffff] = true;
+                    }
+                    i = j;
+                }
+            }
+
+          // build the levels
+            Simplifier simp(pos, localLocked, tris);
+            uint32_t prevTris = nTris;
+            LODRange prevRange = { groups[g].firstIndex, groups[g].nIndices };
+            for (int lod = 0;  lod < nLODs;  lod++) {
+                uint32_t target = std::max(kMinTris, uint32_t(kLODRatio * prevTris));
+                if (target < prevTris) {
+                    simp.Simplify (target);
+                }
+                if (simp.NumTris() <= kMinReduction * prevTris) {
+                    out.clear();
+                    simp.GetTris (out);
+                    prevRange.firstIndex = nIndices + lodIndices.size();
+                    prevRange.nIndices = out.size();
+                    for (auto it = out.begin();  it != out.end();  it++) {
+                        lodIndices.push_back (toPool[*it]);
+                    }
+                    prevTris = simp.NumTris();
+                    lodErrors[lod] = std::max(lodErrors[lod], simp.Error());
+                }
+              // otherwise, the group could not be simplified enough to be worth another
+              // level and the level uses the previous level's triangles
+                lodRanges[lod * groups.size() + g] = prevRange;
+            }
+        }
+
+      // a level's error is at least the error of the previous level.  The errors are
+      // distances between points of the model, so they cannot exceed the diagonal of its
+      // bounding box.
+        cs237::AABBf bbox;
+        for (uint32_t i = 0;  i < nVerts;  i++) {
+            bbox.addPt (verts[i]);
+        }
+        float diag = bbox.isEmpty() ? 0.0f : length(bbox.max() - bbox.min());
+        for (int lod = 0;  lod < nLODs;  lod++) {
+            if (lod > 0) {
+                lodErrors[lod] = std::max(lodErrors[lod], lodErrors[lod-1]);
+            }
+            assert (lodErrors[lod] <= 1.0001f * diag);
+        }
+
+    } // BuildLODs
+
+} // namespace OBJ
@@ -13,7 +13,6 @@
 #include "cs237.hxx"
 #include "obj.hxx"
 #include "obj-reader.hxx"
-#include <unordered_map>
 
 namespace OBJ {
 
@@ -30,31 +29,83 @@ namespace OBJ {
 
         VInfo (uint32_t v, uint32_t n, uint32_t t) : _v(v), _n(n), _t(t) { }
 
-        struct Hash {
-            std::size_t operator() (VInfo const &v) const
-            {
-                return static_cast<std::size_t>(
-                    v._v +
-                    (v._n << 5) * 101 +
-                    (v._t << 10) * 101);
-            }
-        };
-        struct Equal {
-            bool operator()(VInfo const &v1, VInfo const &v2) const
-            {
-                return (v1._v == v2._v) && (v1._n == v2._n) && (v1._t == v2._t);
+    }; // VInfo
+
+  // An open-addressing hash table that maps the v/n/t index triples of an OBJ file to
+  // the vertices of the model's vertex pool.  The table uses linear probing and is
+  // kept at most half full.
+    class VertexMap {
+      public:
+        explicit VertexMap (uint32_t sizeHint)
+        {
+            uint32_t sz = 64;
+            while (sz < 2 * sizeHint) sz *= 2;
+            this->_table.assign (sz, 0);
+            this->_mask = sz - 1;
+            this->_verts.reserve (sizeHint);
+        }
+
+      // return the pool index of a triple, adding it to the pool if it is new
+        uint32_t Find (uint32_t v, uint32_t n, uint32_t t)
+        {
+            for (uint32_t i = Hash(v, n, t) & this->_mask;  ;  i = (i + 1) & this->_mask) {
+                uint32_t slot = this->_table[i];
+                if (slot == 0) {
+                    uint32_t idx = this->_verts.size();
+                    this->_verts.push_back (VInfo(v, n, t));
+                    this->_table[i] = idx + 1;
+                    if (2 * this->_verts.size() > this->_table.size()) {
+                        this->_Grow ();
+                    }
+                    return idx;
+                }
+                VInfo const &vi = this->_verts[slot - 1];
+                if ((vi._v == v) && (vi._n == n) && (vi._t == t)) {
+                    return slot - 1;
+                }
             }
-        };
+        }
 
-    }; // VInfo
+      // the triples of the pool's vertices
+        std::vector<VInfo> const &Verts () const { return this->_verts; }
+
+      private:
+        std::vector<uint32_t> _table;   // pool index + 1 for each slot (0 for empty slots)
+        uint32_t _mask;                 // table size - 1
+        std::vector<VInfo> _verts;      // the pool's triples
+
+        static uint32_t Hash (uint32_t v, uint32_t n, uint32_t t)
+        {
+            uint32_t h = (v * 0x9e3779b1u) ^ (n * 0x85ebca77u) ^ (t * 0xc2b2ae3du);
+            h ^= h >> 15;
+            h *= 0x2c1b3c6du;
+            h ^= h >> 12;
+            return h;
+        }
+
+      // double the size of the table
+        void _Grow ()
+        {
+            uint32_t sz = 2 * this->_table.size();
+            this->_table.assign (sz, 0);
+            this->_mask = sz - 1;
+            for (uint32_t idx = 0;  idx < this->_verts.size();  idx++) {
+                VInfo const &vi = this->_verts[idx];
+                uint32_t i = Hash(vi._v, vi._n, vi._t) & this->_mask;
+                while (this->_table[i] != 0) {
+                    i = (i + 1) & this->_mask;
+                }
+                this->_table[i] = idx + 1;
+            }
+        }
 
-    typedef std::unordered_map<VInfo,uint32_t,VInfo::Hash,VInfo::Equal> VertexMap_t;
+    }; // VertexMap
 
-    Model::Model (std::string file)
+    Model::Model (std::string file, cs237::ThreadPool *pool)
         : _path(file), _bbox()
     {
       // read the file
-        OBJmodel *model = OBJReadOBJ (file.c_str());
+        OBJmodel *model = OBJReadOBJ (file.c_str(), pool);
         if (model == 0) {
             std::cerr << "unable to read model \"" << file << "\"" << std::endl;
             exit (1);
@@ -73,35 +124,17 @@ namespace OBJ {
             this->_materials.clear();
         }
 
-      // compute the bounding box
-        for (uint32_t i = 0;  i < model->numvertices;  i++) {
+      // compute the bounding box (the vertex array is 1-based)
+        for (uint32_t i = 1;  i <= model->numvertices;  i++) {
             this->_bbox.addPt (model->vertices[i]);
         }
 
-      // build mesh data structures for the groups.  We need to identify unique v/n/t
-      // triplets
-        VertexMap_t map;
-        std::vector<VInfo> verts;
-        std::vector<uint32_t> indices;
-        uint32_t idx;
+      // build the vertex pool, which has a vertex for each unique v/n/t triplet in the
+      // model, and the index array, which holds the groups' triangles as contiguous
+      // ranges
+        VertexMap map(model->numvertices);
+        this->_indices.reserve (3 * model->numtriangles);
         for (OBJgroup *grp = model->groups;  grp != nullptr;  grp = grp->next) {
-            for (uint32_t i = 0;  i < grp->numtriangles;  i++) {
-                for (int j = 0;  j < 3;  j++) {
-                    OBJtriangle *tri = &(model->triangles[i]);
-                    VInfo v(tri->vindices[j], tri->nindices[j], tri->tindices[j]);
-                    VertexMap_t::const_iterator got = map.find (v);
-                    if (got == map.end()) {
-                        idx = verts.size();
-                        verts.push_back (v);
-                        map.insert (std::pair<VInfo,uint32_t>(v, idx));
-                    }
-                    else {
-                        idx = got->second;
-                    }
-                    indices.push_back(idx);
-                }
-            }
-          // here we have identified the mesh vertices for the group
             struct Group g;
             g.name = std::string(grp->name);
             g.material = -1;
@@ -129,54 +162,38 @@ namespace OBJ {
                         << "\" for group \"" << g.name << "\"" << std::endl;
                 }
             }
-          // initialize the vertex data arrays
-            g.nVerts = verts.size();
-            g.verts = new cs237::vec3f[g.nVerts];
-            if ((model->numnormals > 0) && (model->numtexcoords > 0)) {
-              // has all three components
-                g.norms = new cs237::vec3f[g.nVerts];
-                g.txtCoords = new cs237::vec2f[g.nVerts];
-                for (uint32_t i = 0;  i < g.nVerts;  i++) {
-                    g.verts[i] = model->vertices[verts[i]._v];
-                    g.norms[i] = model->normals[verts[i]._n];
-                    g.txtCoords[i] = model->texcoords[verts[i]._t];
-                }
-            }
-            else if (model->numnormals > 0) {
-                g.norms = new cs237::vec3f[g.nVerts];
-                g.txtCoords = nullptr;
-                for (uint32_t i = 0;  i < g.nVerts;  i++) {
-                    g.verts[i] = model->vertices[verts[i]._v];
-                    g.norms[i] = model->normals[verts[i]._n];
-                }
-            }
-            else if (model->numtexcoords > 0) {
-                g.norms = nullptr;
-                g.txtCoords = new cs237::vec2f[g.nVerts];
-                for (uint32_t i = 0;  i < g.nVerts;  i++) {
-                    g.verts[i] = model->vertices[verts[i]._v];
-                    g.txtCoords[i] = model->texcoords[verts[i]._t];
-                }
-            }
-            else {
-                g.norms = nullptr;
-                g.txtCoords = nullptr;
-                for (uint32_t i = 0;  i < g.nVerts;  i++) {
-                    g.verts[i] = model->vertices[verts[i]._v];
+          // add the group's triangles to the index array
+            g.firstIndex = this->_indices.size();
+            for (uint32_t i = 0;  i < grp->numtriangles;  i++) {
+                OBJtriangle *tri = &(model->triangles[grp->triangles[i]]);
+                for (int j = 0;  j < 3;  j++) {
+                    this->_indices.push_back (
+                        map.Find (tri->vindices[j], tri->nindices[j], tri->tindices[j]));
                 }
             }
-          // initialize the group's indices array
-            g.nIndices = indices.size();
-            g.indices = new uint32_t[g.nIndices];
-            for (uint32_t i = 0;  i < g.nIndices;  i++) {
-                g.indices[i] = indices[i];
-            }
+            g.nIndices = this->_indices.size() - g.firstIndex;
           // add to this model
             this->_groups.push_back (g);
-          // cleanup
-            map.clear();
-            verts.clear();
-            indices.clear();
+        }
+
+      // initialize the vertex data arrays of the pool
+        std::vector<VInfo> const &verts = map.Verts();
+        uint32_t nVerts = verts.size();
+        this->_verts.resize (nVerts);
+        for (uint32_t i = 0;  i < nVerts;  i++) {
+            this->_verts[i] = model->vertices[verts[i]._v];
+        }
+        if (model->numnormals > 0) {
+            this->_norms.resize (nVerts);
+            for (uint32_t i = 0;  i < nVerts;  i++) {
+                this->_norms[i] = model->normals[verts[i]._n];
+            }
+        }
+        if (model->numtexcoords > 0) {
+            this->_txtCoords.resize (nVerts);
+            for (uint32_t i = 0;  i < nVerts;  i++) {
+                this->_txtCoords[i] = model->texcoords[verts[i]._t];
+            }
         }
 
         delete model;
@@ -185,19 +202,6 @@ namespace OBJ {
 
     Model::~Model ()
     {
-      // free the storage for the groups
-        for (uint32_t i = 0;  i < this->_groups.size();  i++) {
-            assert (this->_groups[i].verts != nullptr);
-            delete[] this->_groups[i].verts;
-            if (this->_groups[i].norms != nullptr) {
-                delete[] this->_groups[i].norms;
-            }
-            if (this->_groups[i].txtCoords != nullptr) {
-                delete[] this->_groups[i].txtCoords;
-            }
-            assert (this->_groups[i].indices != nullptr);
-            delete[] this->_groups[i].indices;
-        }
     } // Model::~Model
 
 } // namespace OBJ
@@ -0,0 +1,233 @@
+/*! \file bvh-bench.cxx
+ *
+ * A benchmark for the bounding-volume hierarchy (cs237::BVH) that is used to index
+ * the object instances of a map cell.
+ *
+ * Usage: bvh-bench [-instances n] [-queries n] [-size w]
+ *
+ * The benchmark scatters the given number of instance boxes (default 100000) over a
+ * w x w cell (default 2048 meters) and builds the hierarchy over them.  It then runs
+ * random view-frustum, radius, and ray queries against the hierarchy and against a
+ * linear scan over the boxes, and reports the time per query and the number of
+ * instances that are culled (i.e., classified) per microsecond.
+ *
+ * \author John Reppy
+ */
+
+/*
+ * COPYRIGHT (c) 2017 John Reppy (http://cs.uchicago.edu/~jhr)
+ * All rights reserved.
+ */
+
+#include "cs237.hxx"
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <vector>
+
+static void Usage (int sts)
+{
+    std::cerr << "usage: bvh-bench [-instances n] [-queries n] [-size w]\n";
+    exit (sts);
+}
+
+// a view frustum as six planes, where p is inside when dot(norm[i], p) + dist[i] >= 0
+struct Planes {
+    cs237::vec3f norm[6];
+    float dist[6];
+};
+
+// make the frustum of a camera at eye looking in direction fwd (which is horizontal)
+static Planes MakeFrustum (cs237::vec3f const &eye, cs237::vec3f const &fwd, float farDist)
+{
+    const float halfW = 0.6f;   // horizontal half angle (radians)
+    const float halfH = 0.4f;   // vertical half angle (radians)
+    const float nearDist = 1.0f;
+    cs237::vec3f up(0.0f, 1.0f, 0.0f);
+    cs237::vec3f right = cs237::__detail::cross(fwd, up);
+
+    Planes f;
+    f.norm[0] = right * std::cos(halfW) + fwd * std::sin(halfW);
+    f.norm[1] = -right * std::cos(halfW) + fwd * std::sin(halfW);
+    f.norm[2] = up * std::cos(halfH) + fwd * std::sin(halfH);
+    f.norm[3] = -up * std::cos(halfH) + fwd * std::sin(halfH);
+    f.norm[4] = fwd;
+    f.norm[5] = -fwd;
+    for (int i = 0;  i < 4;  i++) {
+        f.dist[i] = -cs237::__detail::dot(f.norm[i], eye);
+    }
+    f.dist[4] = -cs237::__detail::dot(fwd, eye) - nearDist;
+    f.dist[5] = cs237::__detail::dot(fwd, eye) + farDist;
+    return f;
+}
+
+// the linear-scan versions of the queries
+static void ScanFrustum (std::vector<cs237::AABBf> const &boxes, Planes const &f, std::vector<uint32_t> &out)
+{
+    for (uint32_t i = 0;  i < boxes.size();  i++) {
+        cs237::vec3f const &lo = boxes[i].min();
+        cs237::vec3f const &hi = boxes[i].max();
+        bool in = true;
+        for (int p = 0;  in && (p < 6);  p++) {
+            cs237::vec3f const &n = f.norm[p];
+            in = (f.dist[p]
+                + n.x * ((n.x > 0.0f) ? hi.x : lo.x)
+                + n.y * ((n.y > 0.0f) ? hi.y : lo.y)
+                + n.z * ((n.z > 0.0f) ? hi.z : lo.z)) >= 0.0f;
+        }
+        if (in) {
+            out.push_back (i);
+        }
+    }
+}
+
+static void ScanRadius (
+    std::vector<cs237::AABBf> const &boxes,
+    cs237::vec3f const &center, float radius,
+    std::vector<uint32_t> &out)
+{
+    for (uint32_t i = 0;  i < boxes.size();  i++) {
+        if (boxes[i].distanceToPt(center) <= radius) {
+            out.push_back (i);
+        }
+    }
+}
+
+static double Micros (std::chrono::steady_clock::time_point startT)
+{
+    std::chrono::duration<double, std::micro> t = std::chrono::steady_clock::now() - startT;
+    return t.count();
+}
+
+static void Report (const char *what, size_t nInsts, int nQueries, double usecs, size_t nFound)
+{
+    double perQuery = usecs / nQueries;
+    std::clog << "    " << what << perQuery << " us/query, "
+        << double(nInsts) / perQuery << " instances/us, "
+        << double(nFound) / nQueries << " found/query\n";
+}
+
+int main (int argc, char **argv)
+{
+    int nInsts = 100000;
+    int nQueries = 1000;
+    float size = 2048.0f;
+    int argi = 1;
+
+    for (;  (argi < argc) && (argv[argi][0] == '-');  argi++) {
+        if ((strcmp(argv[argi], "-instances") == 0) && (argi+1 < argc)) {
+            nInsts = atoi(argv[++argi]);
+        }
+        else if ((strcmp(argv[argi], "-queries") == 0) && (argi+1 < argc)) {
+            nQueries = atoi(argv[++argi]);
+        }
+        else if ((strcmp(argv[argi], "-size") == 0) && (argi+1 < argc)) {
+            size = atof(argv[++argi]);
+        }
+        else if ((strcmp(argv[argi], "-h") == 0) || (strcmp(argv[argi], "-help") == 0)) {
+            Usage (0);
+        }
+        else {
+            Usage (1);
+        }
+    }
+    if ((argi != argc) || (nInsts < 1) || (nQueries < 1) || (size <= 0.0f)) {
+        Usage (1);
+    }
+
+  // scatter the instances over the cell; the sizes are in the range of trees and houses
+    std::mt19937 rng(23700);
+    std::uniform_real_distribution<float> pos(0.0f, size);
+    std::uniform_real_distribution<float> elev(0.0f, 200.0f);
+    std::uniform_real_distribution<float> ext(0.5f, 10.0f);
+    std::uniform_real_distribution<float> angle(0.0f, 2.0f * float(M_PI));
+    std::vector<cs237::AABBf> boxes(nInsts);
+    for (int i = 0;  i < nInsts;  i++) {
+        cs237::vec3f base(pos(rng), elev(rng), pos(rng));
+        float r = ext(rng);
+        boxes[i] = cs237::AABBf(
+            base - cs237::vec3f(r, 0.0f, r),
+            base + cs237::vec3f(r, 2.0f * ext(rng), r));
+    }
+
+    cs237::BVH bvh;
+    std::vector<uint32_t> order;
+    auto startT = std::chrono::steady_clock::now();
+    bvh.Build (boxes.size(), boxes.data(), order);
+    double buildT = Micros(startT);
+    std::clog << nInsts << " instances in a " << size << "x" << size << " cell: "
+        << bvh.NumNodes() << " nodes, build time " << buildT / 1000.0 << " ms\n";
+
+  // the queries
+    std::vector<Planes> frusta(nQueries);
+    std::vector<cs237::vec3f> points(nQueries), dirs(nQueries);
+    for (int q = 0;  q < nQueries;  q++) {
+        float a = angle(rng);
+        points[q] = cs237::vec3f(pos(rng), 100.0f + elev(rng), pos(rng));
+        dirs[q] = cs237::vec3f(std::cos(a), 0.0f, std::sin(a));
+        frusta[q] = MakeFrustum (points[q], dirs[q], 0.25f * size);
+    }
+    std::vector<uint32_t> found;
+    found.reserve (nInsts);
+    size_t nFound;
+
+    std::clog << "  frustum culling (far plane at " << 0.25f * size << "):\n";
+    nFound = 0;
+    startT = std::chrono::steady_clock::now();
+    for (int q = 0;  q < nQueries;  q++) {
+        found.clear();
+        ScanFrustum (boxes, frusta[q], found);
+        nFound += found.size();
+    }
+    Report ("linear scan: ", nInsts, nQueries, Micros(startT), nFound);
+    nFound = 0;
+    startT = std::chrono::steady_clock::now();
+    for (int q = 0;  q < nQueries;  q++) {
+        found.clear();
+        bvh.FrustumQuery (6, frusta[q].norm, frusta[q].dist, found);
+        nFound += found.size();
+    }
+    Report ("BVH:         ", nInsts, nQueries, Micros(startT), nFound);
+
+    float radius = 0.05f * size;
+    std::clog << "  radius queries (radius " << radius << "):\n";
+    nFound = 0;
+    startT = std::chrono::steady_clock::now();
+    for (int q = 0;  q < nQueries;  q++) {
+        found.clear();
+        ScanRadius (boxes, points[q], radius, found);
+        nFound += found.size();
+    }
+    Report ("linear scan: ", nInsts, nQueries, Micros(startT), nFound);
+    nFound = 0;
+    startT = std::chrono::steady_clock::now();
+    for (int q = 0;  q < nQueries;  q++) {
+        found.clear();
+        bvh.RadiusQuery (points[q], radius, found);
+        nFound += found.size();
+    }
+    Report ("BVH:         ", nInsts, nQueries, Micros(startT), nFound);
+
+  // rays are cast downward at a shallow angle from the query points
+    float rayLen = 0.25f * size;
+    std::clog << "  ray queries (length " << rayLen << "):\n";
+    nFound = 0;
+    startT = std::chrono::steady_clock::now();
+    for (int q = 0;  q < nQueries;  q++) {
+        found.clear();
+        bvh.RayQuery (points[q], dirs[q] - cs237::vec3f(0.0f, 0.5f, 0.0f), rayLen, found);
+        nFound += found.size();
+    }
+    Report ("BVH (all):   ", nInsts, nQueries, Micros(startT), nFound);
+    nFound = 0;
+    startT = std::chrono::steady_clock::now();
+    for (int q = 0;  q < nQueries;  q++) {
+        float t = rayLen;
+        if (bvh.FirstHit (points[q], dirs[q] - cs237::vec3f(0.0f, 0.5f, 0.0f), t) >= 0) {
+            nFound++;
+        }
+    }
+    Report ("BVH (first): ", nInsts, nQueries, Micros(startT), nFound);
+
+    return 0;
+}
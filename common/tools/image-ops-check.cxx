@@ -0,0 +1,379 @@
+/*! \file image-ops-check.cxx
+ *
+ * A differential test of the pixel kernels in cs237-image-ops.cxx.
+ *
+ * Usage: image-ops-check [-seed n] [-v]
+ *
+ * The library's kernels use SSE2 and SSSE3 on x86 processors, with scalar code for
+ * the ragged ends of rows.  This tool checks each kernel (ExpandRGBToRGBA,
+ * PackRGBAToRGB, SwapBytes16, FlipRows, and DownsampleBox2x) against a simple scalar
+ * reference that is written here, on random data over a range of sizes that covers
+ * the vector/scalar boundaries (including odd widths and heights and images with a
+ * single row or column), for every pixel size (one to four channels), and with source
+ * and destination buffers at every alignment from 0 to 15 bytes.  The destination
+ * buffers are surrounded by guard bytes to catch writes past either end.  Building
+ * the library with CS237_NO_SIMD checks the library's scalar path against the same
+ * references.
+ *
+ * The tool prints the first few mismatches and exits with status 1 if there are any.
+ *
+ * \author John Reppy
+ */
+
+/*
+ * COPYRIGHT (c) 2017 John Reppy (http://cs.uchicago.edu/~jhr)
+ * All rights reserved.
+ */
+
+#include "cs237.hxx"
+#include <cstring>
+#include <random>
+#include <vector>
+
+static void Usage (int sts)
+{
+    std::cerr << "usage: image-ops-check [-seed n] [-v]\n";
+    exit (sts);
+}
+
+// the number of guard bytes before and after each destination buffer
+static const size_t kGuard = 64;
+// the value of the guard bytes
+static const uint8_t kGuardByte = 0xA5;
+// the maximum number of mismatches that are reported per kernel
+static const int kMaxReports = 5;
+
+static std::mt19937 Rng;
+static bool Verbose = false;
+
+// a byte buffer with guard bytes around it, whose data can start at any alignment
+struct Buffer {
+    std::vector<uint8_t> _bytes;
+    size_t _offset;
+    size_t _n;
+
+    Buffer (size_t n, size_t align)
+        : _bytes(n + 2*kGuard + 16, kGuardByte), _offset(kGuard), _n(n)
+    {
+      // move the start to the requested offset from a 16-byte boundary
+        uintptr_t addr = reinterpret_cast<uintptr_t>(this->_bytes.data() + kGuard);
+        this->_offset += (align - (addr & 15)) & 15;
+    }
+
+    uint8_t *data () { return this->_bytes.data() + this->_offset; }
+
+    void Randomize ()
+    {
+        std::uniform_int_distribution<int> byte(0, 255);
+        for (size_t i = 0;  i < this->_n;  i++) {
+            this->data()[i] = static_cast<uint8_t>(byte(Rng));
+        }
+    }
+
+  // are the guard bytes intact?
+    bool GuardsOK () const
+    {
+        for (size_t i = 0;  i < this->_offset;  i++) {
+            if (this->_bytes[i] != kGuardByte) return false;
+        }
+        for (size_t i = this->_offset + this->_n;  i < this->_bytes.size();  i++) {
+            if (this->_bytes[i] != kGuardByte) return false;
+        }
+        return true;
+    }
+};
+
+// the results for one kernel
+struct Result {
+    const char *_name;
+    int _nTests;
+    int _nFailures;
+
+    explicit Result (const char *name) : _name(name), _nTests(0), _nFailures(0) { }
+
+  // compare the output of a test against the reference and report a mismatch
+    void Check (Buffer &out, const uint8_t *expected, std::string const &what)
+    {
+        this->_nTests++;
+        size_t bad = out._n;
+        for (size_t i = 0;  i < out._n;  i++) {
+            if (out.data()[i] != expected[i]) {
+                bad = i;
+                break;
+            }
+        }
+        bool guardsOK = out.GuardsOK();
+        if ((bad == out._n) && guardsOK) {
+            return;
+        }
+        if (this->_nFailures++ < kMaxReports) {
+            std::cerr << this->_name << ": " << what << ": ";
+            if (bad < out._n) {
+                std::cerr << "byte " << bad << " is " << int(out.data()[bad])
+                    << ", expected " << int(expected[bad]);
+                if (! guardsOK) std::cerr << "; ";
+            }
+            if (! guardsOK) {
+                std::cerr << "wrote outside of the destination";
+            }
+            std::cerr << "\n";
+        }
+    }
+
+    bool Report () const
+    {
+        if (Verbose || (this->_nFailures > 0)) {
+            std::clog << this->_name << ": " << this->_nTests << " tests, "
+                << this->_nFailures << " failures\n";
+        }
+        return (this->_nFailures == 0);
+    }
+};
+
+static std::string Describe (size_t wid, size_t ht, size_t srcAlign, size_t dstAlign)
+{
+    return std::to_string(wid) + "x" + std::to_string(ht)
+        + " (alignment " + std::to_string(srcAlign) + "/" + std::to_string(dstAlign) + ")";
+}
+
+// the pixel counts used for the one-dimensional kernels: every count up to 80, which
+// covers the vector loops' boundaries, plus some larger ones
+static std::vector<size_t> Counts ()
+{
+    std::vector<size_t> counts;
+    for (size_t n = 0;  n <= 80;  n++) {
+        counts.push_back (n);
+    }
+    for (size_t n : { 127, 128, 129, 255, 256, 257, 1000, 1023, 1024, 1025, 4099 }) {
+        counts.push_back (n);
+    }
+    return counts;
+}
+
+/***** the scalar references *****/
+
+static void RefExpandRGBToRGBA (const uint8_t *src, uint8_t *dst, size_t n, uint8_t alpha)
+{
+    for (size_t i = 0;  i < n;  i++) {
+        dst[4*i+0] = src[3*i+0];
+        dst[4*i+1] = src[3*i+1];
+        dst[4*i+2] = src[3*i+2];
+        dst[4*i+3] = alpha;
+    }
+}
+
+static void RefPackRGBAToRGB (const uint8_t *src, uint8_t *dst, size_t n)
+{
+    for (size_t i = 0;  i < n;  i++) {
+        dst[3*i+0] = src[4*i+0];
+        dst[3*i+1] = src[4*i+1];
+        dst[3*i+2] = src[4*i+2];
+    }
+}
+
+// the reference works on bytes, so it does not depend on the host's byte order
+static void RefSwapBytes16 (uint8_t *data, size_t n)
+{
+    for (size_t i = 0;  i < n;  i++) {
+        std::swap (data[2*i], data[2*i+1]);
+    }
+}
+
+static void RefFlipRows (const uint8_t *src, uint8_t *dst, size_t rowBytes, size_t nRows)
+{
+    for (size_t r = 0;  r < nRows;  r++) {
+        std::memcpy (dst + r*rowBytes, src + (nRows - 1 - r)*rowBytes, rowBytes);
+    }
+}
+
+static void RefDownsampleBox2x (
+    const uint8_t *src, size_t wid, size_t ht, size_t nChans, uint8_t *dst)
+{
+    size_t outWid = (wid > 1) ? wid / 2 : 1;
+    size_t outHt = (ht > 1) ? ht / 2 : 1;
+    for (size_t y = 0;  y < outHt;  y++) {
+        size_t y0 = (ht > 1) ? 2*y : 0;
+        size_t y1 = (ht > 1) ? 2*y + 1 : 0;
+        for (size_t x = 0;  x < outWid;  x++) {
+            size_t x0 = (wid > 1) ? 2*x : 0;
+            size_t x1 = (wid > 1) ? 2*x + 1 : 0;
+            for (size_t c = 0;  c < nChans;  c++) {
+                unsigned s = src[(y0*wid + x0)*nChans + c] + src[(y0*wid + x1)*nChans + c]
+                    + src[(y1*wid + x0)*nChans + c] + src[(y1*wid + x1)*nChans + c];
+                dst[(y*outWid + x)*nChans + c] = static_cast<uint8_t>((s + 2) / 4);
+            }
+        }
+    }
+}
+
+/***** the tests *****/
+
+static bool CheckExpand ()
+{
+    Result res("ExpandRGBToRGBA");
+    std::vector<size_t> counts = Counts();
+    for (size_t n : counts) {
+        for (size_t sa = 0;  sa < 16;  sa++) {
+            for (size_t da = 0;  da < 16;  da += 5) {
+                Buffer src(3*n, sa), dst(4*n, da);
+                src.Randomize();
+                uint8_t alpha = static_cast<uint8_t>(Rng());
+                std::vector<uint8_t> expected(4*n);
+                RefExpandRGBToRGBA (src.data(), expected.data(), n, alpha);
+                cs237::ExpandRGBToRGBA (src.data(), dst.data(), n, alpha);
+                res.Check (dst, expected.data(), Describe(n, 1, sa, da));
+            }
+        }
+    }
+    return res.Report();
+}
+
+static bool CheckPack ()
+{
+    Result res("PackRGBAToRGB");
+    std::vector<size_t> counts = Counts();
+    for (size_t n : counts) {
+        for (size_t sa = 0;  sa < 16;  sa++) {
+            for (size_t da = 0;  da < 16;  da += 5) {
+                Buffer src(4*n, sa), dst(3*n, da);
+                src.Randomize();
+                std::vector<uint8_t> expected(3*n);
+                RefPackRGBAToRGB (src.data(), expected.data(), n);
+                cs237::PackRGBAToRGB (src.data(), dst.data(), n);
+                res.Check (dst, expected.data(), Describe(n, 1, sa, da));
+            }
+        }
+    }
+    return res.Report();
+}
+
+static bool CheckSwap ()
+{
+    Result res("SwapBytes16");
+    std::vector<size_t> counts = Counts();
+    for (size_t n : counts) {
+      // the data must be 16-bit aligned
+        for (size_t a = 0;  a < 16;  a += 2) {
+            Buffer data(2*n, a);
+            data.Randomize();
+            std::vector<uint8_t> expected(data.data(), data.data() + 2*n);
+            RefSwapBytes16 (expected.data(), n);
+            cs237::SwapBytes16 (reinterpret_cast<uint16_t *>(data.data()), n);
+            res.Check (data, expected.data(), Describe(n, 1, a, a));
+        }
+    }
+    return res.Report();
+}
+
+static bool CheckFlip ()
+{
+    Result res("FlipRows");
+    for (size_t nChans = 1;  nChans <= 4;  nChans++) {
+        for (size_t wid : { 1, 2, 3, 5, 7, 15, 16, 17, 31, 33, 64, 99 }) {
+            for (size_t ht : { 0, 1, 2, 3, 4, 5, 8, 9 }) {
+                size_t rowBytes = wid * nChans;
+                for (size_t a = 0;  a < 16;  a += 3) {
+                    Buffer data(rowBytes * ht, a);
+                    data.Randomize();
+                    std::vector<uint8_t> expected(rowBytes * ht);
+                    RefFlipRows (data.data(), expected.data(), rowBytes, ht);
+                    cs237::FlipRows (data.data(), rowBytes, ht);
+                    res.Check (data, expected.data(),
+                        std::to_string(nChans) + " channels, " + Describe(wid, ht, a, a));
+                }
+            }
+        }
+    }
+    return res.Report();
+}
+
+static bool CheckDownsample ()
+{
+    Result res("DownsampleBox2x");
+  // the source dimensions must be even or one, but the output dimensions can be odd
+    std::vector<size_t> dims = { 1, 2, 4, 6, 10, 14, 16, 18, 30, 32, 34, 46, 48, 50, 62, 64, 66 };
+    for (size_t d = 70;  d <= 200;  d += 2) {
+        dims.push_back (d);
+    }
+    for (size_t nChans = 1;  nChans <= 4;  nChans++) {
+        for (size_t wid : dims) {
+            for (size_t ht : { 1, 2, 4, 6 }) {
+                size_t outWid = (wid > 1) ? wid / 2 : 1;
+                size_t outHt = (ht > 1) ? ht / 2 : 1;
+                for (size_t sa = 0;  sa < 16;  sa += 7) {
+                    for (size_t da = 0;  da < 16;  da += 5) {
+                        Buffer src(wid * ht * nChans, sa), dst(outWid * outHt * nChans, da);
+                        src.Randomize();
+                        std::vector<uint8_t> expected(outWid * outHt * nChans);
+                        RefDownsampleBox2x (src.data(), wid, ht, nChans, expected.data());
+                        cs237::DownsampleBox2x (src.data(), wid, ht, nChans, dst.data());
+                        res.Check (dst, expected.data(),
+                            std::to_string(nChans) + " channels, " + Describe(wid, ht, sa, da));
+                    }
+                }
+            }
+        }
+    }
+  // a 256x256 image down to 1x1, which is how mipmaps are generated
+    for (size_t nChans = 1;  nChans <= 4;  nChans++) {
+        size_t wid = 256, ht = 256;
+        Buffer level(wid * ht * nChans, 0);
+        level.Randomize();
+        std::vector<uint8_t> cur(level.data(), level.data() + level._n);
+        while ((wid > 1) || (ht > 1)) {
+            size_t outWid = (wid > 1) ? wid / 2 : 1;
+            size_t outHt = (ht > 1) ? ht / 2 : 1;
+            Buffer dst(outWid * outHt * nChans, 0);
+            std::vector<uint8_t> expected(outWid * outHt * nChans);
+            RefDownsampleBox2x (cur.data(), wid, ht, nChans, expected.data());
+            cs237::DownsampleBox2x (cur.data(), wid, ht, nChans, dst.data());
+            res.Check (dst, expected.data(),
+                std::to_string(nChans) + " channels, mipmap level " + Describe(wid, ht, 0, 0));
+            cur = expected;
+            wid = outWid;
+            ht = outHt;
+        }
+    }
+    return res.Report();
+}
+
+int main (int argc, char **argv)
+{
+    unsigned seed = 23700;
+    int argi = 1;
+
+    for (;  (argi < argc) && (argv[argi][0] == '-');  argi++) {
+        if ((strcmp(argv[argi], "-seed") == 0) && (argi+1 < argc)) {
+            seed = static_cast<unsigned>(atol(argv[++argi]));
+        }
+        else if (strcmp(argv[argi], "-v") == 0) {
+            Verbose = true;
+        }
+        else if ((strcmp(argv[argi], "-h") == 0) || (strcmp(argv[argi], "-help") == 0)) {
+            Usage (0);
+        }
+        else {
+            Usage (1);
+        }
+    }
+    if (argi != argc) {
+        Usage (1);
+    }
+
+    Rng.seed (seed);
+
+    bool ok = CheckExpand();
+    ok = CheckPack() && ok;
+    ok = CheckSwap() && ok;
+    ok = CheckFlip() && ok;
+    ok = CheckDownsample() && ok;
+
+    if (ok) {
+        std::clog << "image-ops-check: all kernels match the scalar references\n";
+        return 0;
+    }
+    else {
+        std::clog << "image-ops-check: FAILED\n";
+        return 1;
+    }
+}
@@ -0,0 +1,244 @@
+/*! \file instance-batch-check.cxx
+ *
+ * A headless test of the instance batching (InstanceBatches) that is used to draw the
+ * map objects of Project 5.
+ *
+ * Usage: instance-batch-check [-instances n] [-seed n] [-v]
+ *
+ * InstanceBatches does not make any OpenGL calls or look inside the meshes, so the
+ * tool uses dummy mesh pointers and tags each instance with a serial number in its
+ * color.  It checks an empty frame, a frame with a single instance, a small frame
+ * with a known answer, and random frames (by default 10000 instances over 1 to 50
+ * meshes and four levels of detail) against a reference grouping.  For each frame,
+ * it checks that there is one batch per (mesh, level of detail) pair in the order of
+ * their first instance; that the batches' ranges tile the packed data in order; that
+ * each batch holds exactly the instances of its pair in the order they were added;
+ * and that Clear resets the batches so that they can be reused for the next frame.
+ *
+ * The tool prints the first few failures and exits with status 1 if there are any.
+ *
+ * \author John Reppy
+ */
+
+/*
+ * COPYRIGHT (c) 2017 John Reppy (http://cs.uchicago.edu/~jhr)
+ * All rights reserved.
+ */
+
+#include "cs237.hxx"
+#include "instance-batch.hxx"
+#include <cstring>
+#include <random>
+#include <vector>
+
+static void Usage (int sts)
+{
+    std::cerr << "usage: instance-batch-check [-instances n] [-seed n] [-v]\n";
+    exit (sts);
+}
+
+// the maximum number of failures that are reported
+static const int kMaxReports = 10;
+
+static int NumFailures = 0;
+static bool Verbose = false;
+
+static void Fail (std::string const &test, std::string const &msg)
+{
+    if (NumFailures++ < kMaxReports) {
+        std::cerr << test << ": " << msg << "\n";
+    }
+}
+
+// dummy meshes; InstanceBatches only uses the addresses
+static char MeshStorage[64];
+static TriMesh *Mesh (int i)
+{
+    return reinterpret_cast<TriMesh *>(&MeshStorage[i]);
+}
+
+// an instance as added to the batches
+struct Item {
+    int mesh;
+    int lod;
+};
+
+// per-instance data that records the instance's serial number
+static InstanceData Data (uint32_t serial)
+{
+    InstanceData data;
+    data.modelMat = cs237::mat4f(1.0f);
+    for (int i = 0;  i < 3;  i++) {
+        data.normMat[i] = cs237::vec4f(0.0f);
+    }
+    data.color = cs237::color4f(float(serial), 0.0f, 0.0f, 1.0f);
+    return data;
+}
+
+static uint32_t Serial (InstanceData const &data)
+{
+    return static_cast<uint32_t>(data.color[0]);
+}
+
+// add the items to the batches, finish them, and check the result against a reference
+// grouping of the items
+static void Check (std::string const &test, InstanceBatches &batches, std::vector<Item> const &items)
+{
+    for (uint32_t i = 0;  i < items.size();  i++) {
+        batches.Add (Mesh(items[i].mesh), items[i].lod, Data(i));
+    }
+    batches.Finish ();
+
+  // the reference: the (mesh, lod) pairs in the order of their first instance and the
+  // serial numbers of each pair's instances in the order that they were added
+    std::vector<Item> keys;
+    std::vector<std::vector<uint32_t>> members;
+    for (uint32_t i = 0;  i < items.size();  i++) {
+        size_t k = 0;
+        while ((k < keys.size())
+        && ((keys[k].mesh != items[i].mesh) || (keys[k].lod != items[i].lod))) {
+            k++;
+        }
+        if (k == keys.size()) {
+            keys.push_back (items[i]);
+            members.push_back (std::vector<uint32_t>());
+        }
+        members[k].push_back (i);
+    }
+
+    if (batches.NumInstances() != items.size()) {
+        Fail (test, "expected " + std::to_string(items.size()) + " instances, but got "
+            + std::to_string(batches.NumInstances()));
+        return;
+    }
+    if (batches.NumBatches() != int(keys.size())) {
+        Fail (test, "expected " + std::to_string(keys.size()) + " batches, but got "
+            + std::to_string(batches.NumBatches()));
+        return;
+    }
+
+    uint32_t first = 0;
+    for (int b = 0;  b < batches.NumBatches();  b++) {
+        InstanceBatches::Batch const &batch = batches.GetBatch(b);
+        std::string which = "batch " + std::to_string(b);
+        if ((batch.mesh != Mesh(keys[b].mesh)) || (batch.lod != keys[b].lod)) {
+            Fail (test, which + " is for the wrong mesh or level of detail");
+        }
+        if (batch.first != first) {
+            Fail (test, which + " starts at " + std::to_string(batch.first)
+                + ", expected " + std::to_string(first));
+            return;
+        }
+        if (batch.count != members[b].size()) {
+            Fail (test, which + " has " + std::to_string(batch.count)
+                + " instances, expected " + std::to_string(members[b].size()));
+            return;
+        }
+        for (uint32_t i = 0;  i < batch.count;  i++) {
+            uint32_t got = Serial(batches.Data()[batch.first + i]);
+            if (got != members[b][i]) {
+                Fail (test, which + ", instance " + std::to_string(i) + " is "
+                    + std::to_string(got) + ", expected " + std::to_string(members[b][i]));
+                break;
+            }
+        }
+        first += batch.count;
+    }
+
+  // the iterators visit the same batches
+    int n = 0;
+    for (auto it = batches.begin();  it != batches.end();  it++, n++) {
+        if (&*it != &batches.GetBatch(n)) {
+            Fail (test, "iteration does not match GetBatch");
+            break;
+        }
+    }
+
+    if (Verbose) {
+        std::clog << test << ": " << items.size() << " instances, "
+            << batches.NumBatches() << " batches\n";
+    }
+}
+
+int main (int argc, char **argv)
+{
+    uint32_t nInstances = 10000;
+    unsigned seed = 23700;
+    int argi = 1;
+
+    for (;  (argi < argc) && (argv[argi][0] == '-');  argi++) {
+        if ((strcmp(argv[argi], "-instances") == 0) && (argi+1 < argc)) {
+            nInstances = atol(argv[++argi]);
+            if (nInstances < 1) Usage (1);
+        }
+        else if ((strcmp(argv[argi], "-seed") == 0) && (argi+1 < argc)) {
+            seed = static_cast<unsigned>(atol(argv[++argi]));
+        }
+        else if (strcmp(argv[argi], "-v") == 0) {
+            Verbose = true;
+        }
+        else if ((strcmp(argv[argi], "-h") == 0) || (strcmp(argv[argi], "-help") == 0)) {
+            Usage (0);
+        }
+        else {
+            Usage (1);
+        }
+    }
+    if (argi != argc) {
+        Usage (1);
+    }
+
+    InstanceBatches batches;
+
+  // an empty frame has no batches
+    Check ("empty", batches, std::vector<Item>());
+    batches.Clear ();
+
+  // a single instance is a batch of one
+    Check ("single", batches, std::vector<Item>{ {3, 1} });
+    batches.Clear ();
+
+  // a small frame: A0 B0 A1 A0 B0 A0 should give the batches A0 = [0, 3, 5],
+  // B0 = [1, 4], and A1 = [2]
+    Check ("small", batches, std::vector<Item>{ {0, 0}, {1, 0}, {0, 1}, {0, 0}, {1, 0}, {0, 0} });
+    {
+        static const uint32_t expected[6] = { 0, 3, 5, 1, 4, 2 };
+        for (int i = 0;  i < 6;  i++) {
+            if (Serial(batches.Data()[i]) != expected[i]) {
+                Fail ("small", "the packed instances are not A0 A0 A0 B0 B0 A1");
+                break;
+            }
+        }
+    }
+    batches.Clear ();
+    if ((batches.NumBatches() != 0) || (batches.NumInstances() != 0)) {
+        Fail ("clear", "Clear did not remove the batches and instances");
+    }
+
+  // random frames, reusing the batches from frame to frame; the mesh pointers of
+  // different sizes of frames overlap, so stale batches would be detected
+    std::mt19937 rng(seed);
+    for (int nMeshes : { 1, 2, 7, 50 }) {
+        std::uniform_int_distribution<int> mesh(0, nMeshes - 1);
+        std::uniform_int_distribution<int> lod(0, 3);
+        for (int frame = 0;  frame < 3;  frame++) {
+            std::vector<Item> items(nInstances);
+            for (auto it = items.begin();  it != items.end();  it++) {
+                it->mesh = mesh(rng);
+                it->lod = lod(rng);
+            }
+            Check ("random (" + std::to_string(nMeshes) + " meshes, frame "
+                + std::to_string(frame) + ")", batches, items);
+            batches.Clear ();
+        }
+    }
+
+    if (NumFailures == 0) {
+        std::clog << "instance-batch-check: all tests passed\n";
+        return 0;
+    }
+    else {
+        std::clog << "instance-batch-check: " << NumFailures << " failures\n";
+        return 1;
+    }
+}
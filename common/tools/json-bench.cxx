@@ -0,0 +1,240 @@
+/*! \file json-bench.cxx
+ *
+ * A benchmark that compares the ways of reading a JSON file: JSON::ParseFile,
+ * which allocates each value on the heap, JSON::ParseDocument, which allocates
+ * the values from an arena and leaves strings in the input buffer, and JSON::Reader,
+ * which streams through the file without building a tree.
+ *
+ * Usage: json-bench [-passes n] <file.json>
+ *
+ * For each mode, the benchmark reports the average time to parse and free the file,
+ * the number of heap allocations per parse, and the peak memory used while parsing.
+ * For the two tree modes, it also reports the average time of a field lookup (using
+ * the labels of map.json and objects.json files).
+ *
+ * \author John Reppy
+ */
+
+/*
+ * COPYRIGHT (c) 2017 John Reppy (http://cs.uchicago.edu/~jhr)
+ * All rights reserved.
+ */
+
+#include "json.hxx"
+#include "json-reader.hxx"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+// count the heap allocations made by the parser and track the peak number of bytes
+// in use.  Each block has a header that records its size.
+static size_t NumAllocs = 0;
+static size_t LiveBytes = 0;
+static size_t PeakBytes = 0;
+static const size_t kHdrSz = 16;
+
+void *operator new (size_t sz)
+{
+    NumAllocs++;
+    char *p = static_cast<char *>(std::malloc(sz + kHdrSz));
+    if (p == nullptr) throw std::bad_alloc();
+    *reinterpret_cast<size_t *>(p) = sz;
+    LiveBytes += sz;
+    if (LiveBytes > PeakBytes) PeakBytes = LiveBytes;
+    return p + kHdrSz;
+}
+void operator delete (void *p) noexcept
+{
+    if (p != nullptr) {
+        char *blk = static_cast<char *>(p) - kHdrSz;
+        LiveBytes -= *reinterpret_cast<size_t *>(blk);
+        std::free(blk);
+    }
+}
+void *operator new[] (size_t sz) { return operator new(sz); }
+void operator delete[] (void *p) noexcept { operator delete(p); }
+
+// read the file with a JSON::Reader; returns the number of tokens
+static size_t Stream (std::string const &file)
+{
+    JSON::Reader rdr(file);
+    size_t n = 0;
+    JSON::Reader::Token tok;
+    while ((tok = rdr.next()) < JSON::Reader::T_EOF) {
+        n++;
+    }
+    if (tok == JSON::Reader::T_ERROR) {
+        std::cerr << "json-bench: " << rdr.errorMsg() << "\n";
+        exit (1);
+    }
+    return n;
+}
+
+static void Usage (int sts)
+{
+    std::cerr << "usage: json-bench [-passes n] <file.json>\n";
+    exit (sts);
+}
+
+// check that two trees are the same, comparing the fields of objects that have the
+// given labels
+static void Compare (
+    const JSON::Value *v, const JSON::Value *other, std::vector<std::string> const &labels)
+{
+    if (v->isObject()) {
+        const JSON::Object *obj = v->asObject();
+        const JSON::Object *otherObj = other->asObject();
+        if ((otherObj == nullptr) || (obj->size() != otherObj->size())) {
+            std::cerr << "json-bench: parse results differ\n";
+            exit (1);
+        }
+        for (auto it = labels.begin();  it != labels.end();  it++) {
+            const JSON::Value *fld = (*obj)[*it];
+            const JSON::Value *otherFld = (*otherObj)[it->c_str()];
+            if ((fld == nullptr) != (otherFld == nullptr)) {
+                std::cerr << "json-bench: parse results differ\n";
+                exit (1);
+            }
+            else if (fld != nullptr) {
+                Compare (fld, otherFld, labels);
+            }
+        }
+    }
+    else if (v->isArray()) {
+        const JSON::Array *arr = v->asArray();
+        const JSON::Array *otherArr = other->asArray();
+        if ((otherArr == nullptr) || (arr->length() != otherArr->length())) {
+            std::cerr << "json-bench: parse results differ\n";
+            exit (1);
+        }
+        for (int i = 0;  i < arr->length();  i++) {
+            Compare ((*arr)[i], (*otherArr)[i], labels);
+        }
+    }
+    else if (v->isString()) {
+        const JSON::String *otherStr = other->asString();
+        if ((otherStr == nullptr) || (v->asString()->value() != otherStr->value())) {
+            std::cerr << "json-bench: parse results differ\n";
+            exit (1);
+        }
+    }
+    else if (v->isNumber()) {
+        const JSON::Number *otherNum = other->asNumber();
+        if ((otherNum == nullptr) || (v->asNumber()->realVal() != otherNum->realVal())) {
+            std::cerr << "json-bench: parse results differ\n";
+            exit (1);
+        }
+    }
+}
+
+// look up the fields of the objects in the tree that have the given labels; returns
+// the number of fields found
+static size_t Lookup (const JSON::Value *v, std::vector<std::string> const &labels)
+{
+    size_t n = 0;
+    if (v->isObject()) {
+        const JSON::Object *obj = v->asObject();
+        for (auto it = labels.begin();  it != labels.end();  it++) {
+            const JSON::Value *fld = (*obj)[*it];
+            if (fld != nullptr) {
+                n += 1 + Lookup (fld, labels);
+            }
+        }
+    }
+    else if (v->isArray()) {
+        const JSON::Array *arr = v->asArray();
+        for (int i = 0;  i < arr->length();  i++) {
+            n += Lookup ((*arr)[i], labels);
+        }
+    }
+    return n;
+}
+
+int main (int argc, char **argv)
+{
+    int nPasses = 20;
+    int argi = 1;
+
+    for (;  (argi < argc) && (argv[argi][0] == '-');  argi++) {
+        if ((strcmp(argv[argi], "-passes") == 0) && (argi+1 < argc)) {
+            nPasses = atoi(argv[++argi]);
+        }
+        else if ((strcmp(argv[argi], "-h") == 0) || (strcmp(argv[argi], "-help") == 0)) {
+            Usage (0);
+        }
+        else {
+            Usage (1);
+        }
+    }
+    if ((argc - argi != 1) || (nPasses < 1)) {
+        Usage (1);
+    }
+    std::string file(argv[argi]);
+
+  // parse the file once in each mode to check that the results agree
+    JSON::Value *heapRoot = JSON::ParseFile (file);
+    JSON::Document *doc = JSON::ParseDocument (file);
+    if ((heapRoot == nullptr) || (doc == nullptr)) {
+        std::cerr << "json-bench: unable to parse \"" << file << "\"\n";
+        exit (1);
+    }
+    std::vector<std::string> labels = { "file", "pos", "frame", "color", "x", "y", "z",
+        "x-axis", "y-axis", "z-axis", "r", "g", "b", "name", "grid" };
+    Compare (doc->root(), heapRoot, labels);
+    std::clog << file << ": " << nPasses << " passes; document arena is "
+        << doc->arenaSize() << " bytes in " << doc->numBlocks() << " blocks\n";
+
+    const char *modes[3] = { "ParseFile:     ", "ParseDocument: ", "Reader:        " };
+    for (int mode = 0;  mode < 3;  mode++) {
+        size_t nAllocs = NumAllocs;
+        size_t baseBytes = LiveBytes;
+        PeakBytes = LiveBytes;
+        size_t arenaBytes = 0;
+        auto startT = std::chrono::steady_clock::now();
+        for (int i = 0;  i < nPasses;  i++) {
+            if (mode == 0) {
+                delete JSON::ParseFile (file);
+            }
+            else if (mode == 1) {
+              // the arena is allocated with malloc, so we add its size to the peak
+                JSON::Document *d = JSON::ParseDocument (file);
+                arenaBytes = d->arenaSize();
+                delete d;
+            }
+            else {
+                Stream (file);
+            }
+        }
+        std::chrono::duration<double, std::milli> parseT = std::chrono::steady_clock::now() - startT;
+        nAllocs = NumAllocs - nAllocs;
+        double peakMB = double(PeakBytes - baseBytes + arenaBytes) / (1024.0 * 1024.0);
+
+        std::clog << "  " << modes[mode]
+            << parseT.count() / nPasses << " ms/parse, "
+            << double(nAllocs) / nPasses << " allocations/parse, "
+            << peakMB << " MB peak";
+
+        if (mode < 2) {
+            const JSON::Value *root = (mode == 1) ? doc->root() : heapRoot;
+            startT = std::chrono::steady_clock::now();
+            size_t nLookups = 0;
+            for (int i = 0;  i < nPasses;  i++) {
+                nLookups += Lookup (root, labels);
+            }
+            std::chrono::duration<double, std::milli> lookupT =
+                std::chrono::steady_clock::now() - startT;
+            std::clog << ", " << (nLookups > 0 ? 1.0e6 * lookupT.count() / nLookups : 0.0)
+                << " ns/lookup";
+        }
+        std::clog << "\n";
+    }
+
+    delete heapRoot;
+    delete doc;
+
+    return 0;
+}
@@ -0,0 +1,175 @@
+/*! \file obj-bench.cxx
+ *
+ * A benchmark that measures how fast OBJ models are loaded.
+ *
+ * Usage: obj-bench [-passes n] [-threads n] [-tangent-tris n] [file.obj ...]
+ *
+ * For each file, the benchmark loads the model the given number of times using 1, 2,
+ * 4, ... threads up to the given maximum (which defaults to the number of hardware
+ * threads) and reports the average load time and the throughput in megabytes of OBJ
+ * text per second, along with the size of the resulting model (i.e., its vertex pool
+ * and index array).  The single-threaded loads use the serial reader.
+ *
+ * It then times OBJ::ComputeTangents on a generated grid mesh with the given number
+ * of millions of triangles (default 4), both without a pool and with the same thread
+ * counts, since the tangents are the most expensive part of compiling a large mesh.
+ *
+ * \author John Reppy
+ */
+
+/*
+ * COPYRIGHT (c) 2017 John Reppy (http://cs.uchicago.edu/~jhr)
+ * All rights reserved.
+ */
+
+#include "cs237.hxx"
+#include "obj.hxx"
+#include "obj-mesh.hxx"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <sys/stat.h>
+#include <vector>
+
+static void Usage (int sts)
+{
+    std::cerr << "usage: obj-bench [-passes n] [-threads n] [-tangent-tris n] [file.obj ...]\n";
+    exit (sts);
+}
+
+// time the tangent computation for a grid mesh with about nTris triangles.  The
+// vertices are numbered row by row, which is the order of their first use, as they are
+// in a compiled mesh.
+static void BenchTangents (size_t nTris, int nPasses, int maxThreads)
+{
+    uint32_t wid = 1024;
+    uint32_t ht = std::max(size_t(1), nTris / (2 * wid));
+    uint32_t nVerts = (wid + 1) * (ht + 1);
+    std::vector<cs237::vec3f> verts(nVerts), norms(nVerts);
+    std::vector<cs237::vec2f> txtCoords(nVerts);
+    for (uint32_t r = 0;  r <= ht;  r++) {
+        for (uint32_t c = 0;  c <= wid;  c++) {
+            uint32_t v = r * (wid + 1) + c;
+            float x = float(c), z = float(r);
+            verts[v] = cs237::vec3f(x, std::sin(0.1f * x) * std::cos(0.1f * z), z);
+            norms[v] = cs237::vec3f(0.0f, 1.0f, 0.0f);
+            txtCoords[v] = cs237::vec2f(x / float(wid), z / float(ht));
+        }
+    }
+    std::vector<uint32_t> indices;
+    indices.reserve (6 * size_t(wid) * ht);
+    for (uint32_t r = 0;  r < ht;  r++) {
+        for (uint32_t c = 0;  c < wid;  c++) {
+            uint32_t v = r * (wid + 1) + c;
+            uint32_t tri[6] = { v, v + wid + 1, v + 1, v + 1, v + wid + 1, v + wid + 2 };
+            indices.insert (indices.end(), tri, tri + 6);
+        }
+    }
+    std::vector<cs237::vec4f> tangents(nVerts);
+
+    std::clog << "tangents: " << nVerts << " vertices, " << indices.size() / 3
+        << " triangles\n";
+    double baseT = 0.0;
+    for (int nThreads = 0;  nThreads <= maxThreads;  nThreads = (nThreads ? 2 * nThreads : 1)) {
+        cs237::ThreadPool *pool = (nThreads > 0) ? new cs237::ThreadPool(nThreads) : nullptr;
+        auto startT = std::chrono::steady_clock::now();
+        for (int i = 0;  i < nPasses;  i++) {
+            OBJ::ComputeTangents (
+                nVerts, verts.data(), norms.data(), txtCoords.data(),
+                indices.size(), indices.data(), tangents.data(), pool);
+        }
+        std::chrono::duration<double> t = std::chrono::steady_clock::now() - startT;
+        delete pool;
+
+        double secs = t.count() / nPasses;
+        if (nThreads == 0) {
+            baseT = secs;
+            std::clog << "  no pool: ";
+        }
+        else {
+            std::clog << "  " << nThreads << " workers: ";
+        }
+        std::clog << 1000.0 * secs << " ms (" << baseT / secs << "x)\n";
+    }
+}
+
+int main (int argc, char **argv)
+{
+    int nPasses = 5;
+    int maxThreads = std::thread::hardware_concurrency();
+    size_t tangentTris = 4;
+    int argi = 1;
+
+    for (;  (argi < argc) && (argv[argi][0] == '-');  argi++) {
+        if ((strcmp(argv[argi], "-passes") == 0) && (argi+1 < argc)) {
+            nPasses = atoi(argv[++argi]);
+        }
+        else if ((strcmp(argv[argi], "-threads") == 0) && (argi+1 < argc)) {
+            maxThreads = atoi(argv[++argi]);
+        }
+        else if ((strcmp(argv[argi], "-tangent-tris") == 0) && (argi+1 < argc)) {
+            tangentTris = atol(argv[++argi]);
+        }
+        else if ((strcmp(argv[argi], "-h") == 0) || (strcmp(argv[argi], "-help") == 0)) {
+            Usage (0);
+        }
+        else {
+            Usage (1);
+        }
+    }
+    if ((nPasses < 1) || (maxThreads < 1) || (tangentTris < 1)) {
+        Usage (1);
+    }
+
+    for (;  argi < argc;  argi++) {
+        std::string file(argv[argi]);
+        struct stat st;
+        if (stat(file.c_str(), &st) < 0) {
+            std::cerr << "obj-bench: unable to open \"" << file << "\"\n";
+            exit (1);
+        }
+        double mb = double(st.st_size) / (1024.0 * 1024.0);
+
+      // load the model once to get its size
+        uint32_t nGroups, nVerts, nTris;
+        double meshMB;
+        {
+            OBJ::Model model(file);
+            nGroups = model.NumGroups();
+            nVerts = model.NumVerts();
+            nTris = model.NumIndices() / 3;
+            size_t vertSz = sizeof(cs237::vec3f);
+            if (model.Norms() != nullptr) vertSz += sizeof(cs237::vec3f);
+            if (model.TxtCoords() != nullptr) vertSz += sizeof(cs237::vec2f);
+            meshMB = double(nVerts * vertSz + model.NumIndices() * sizeof(uint32_t))
+                / (1024.0 * 1024.0);
+        }
+        std::clog << file << ": " << mb << " MB, " << nGroups << " groups, "
+            << nVerts << " vertices, " << nTris << " triangles, "
+            << meshMB << " MB of mesh data\n";
+
+        double baseT = 0.0;
+        for (int nThreads = 1;  nThreads <= maxThreads;  nThreads *= 2) {
+          // the calling thread also parses a chunk, so the pool only needs nThreads-1 workers
+            cs237::ThreadPool *pool = (nThreads > 1) ? new cs237::ThreadPool(nThreads - 1) : nullptr;
+            auto startT = std::chrono::steady_clock::now();
+            for (int i = 0;  i < nPasses;  i++) {
+                OBJ::Model model(file, pool);
+            }
+            std::chrono::duration<double> loadT = std::chrono::steady_clock::now() - startT;
+            delete pool;
+
+            double secs = loadT.count() / nPasses;
+            if (nThreads == 1) {
+                baseT = secs;
+            }
+            std::clog << "  " << nThreads << " threads: " << 1000.0 * secs << " ms/load, "
+                << mb / secs << " MB/s (" << baseT / secs << "x)\n";
+        }
+    }
+
+    BenchTangents (tangentTris * 1000000, nPasses, maxThreads);
+
+    return 0;
+}
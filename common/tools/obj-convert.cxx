@@ -0,0 +1,178 @@
+/*! \file obj-convert.cxx
+ *
+ * A tool for compiling OBJ models into the binary mesh format (see obj-mesh.hxx).
+ *
+ * Usage: obj-convert [-passes n] <file.obj> ...
+ *
+ * For each file, the tool writes the compiled mesh to "<file.obj>.mesh", which is
+ * where the renderer looks for it.  It reports the average cache miss ratio (ACMR) for
+ * a 16-entry FIFO vertex cache and the sizes of the vertex and index buffers before and
+ * after the mesh optimizations, and the number of triangles and the geometric error of
+ * each level of detail.  It also reports the cold load time (parsing the OBJ
+ * and MTL files, deduplicating the vertices, optimizing the mesh, and computing the
+ * tangents) and the warm load time (mapping the compiled mesh and reading its vertex
+ * and index data, as glBufferData would), averaged over the given number of passes.
+ *
+ * \author John Reppy
+ */
+
+/*
+ * COPYRIGHT (c) 2017 John Reppy (http://cs.uchicago.edu/~jhr)
+ * All rights reserved.
+ */
+
+#include "cs237.hxx"
+#include "obj.hxx"
+#include "obj-mesh.hxx"
+#include <chrono>
+#include <cstring>
+#include <sys/stat.h>
+
+static void Usage (int sts)
+{
+    std::cerr << "usage: obj-convert [-passes n] <file.obj> ...\n";
+    exit (sts);
+}
+
+// copy the vertex and index data of a mesh into a buffer; this is a stand-in for
+// uploading the data to the GPU.
+static void Upload (OBJ::MeshFile const *mesh, std::vector<uint8_t> &buf)
+{
+    buf.resize (mesh->DataSize());
+    size_t vertSz = size_t(mesh->NumVerts()) * mesh->VertexStride();
+    std::memcpy (buf.data(), mesh->VertexData(), vertSz);
+    std::memcpy (buf.data() + vertSz, mesh->Indices(), mesh->NumIndices() * mesh->IndexSize());
+}
+
+static double MB (size_t nBytes)
+{
+    return double(nBytes) / (1024.0 * 1024.0);
+}
+
+static double FileMB (std::string const &file)
+{
+    struct stat st;
+    if (stat(file.c_str(), &st) < 0) {
+        return 0.0;
+    }
+    return MB(st.st_size);
+}
+
+int main (int argc, char **argv)
+{
+    int nPasses = 3;
+    int argi = 1;
+
+    for (;  (argi < argc) && (argv[argi][0] == '-');  argi++) {
+        if ((strcmp(argv[argi], "-passes") == 0) && (argi+1 < argc)) {
+            nPasses = atoi(argv[++argi]);
+        }
+        else if ((strcmp(argv[argi], "-h") == 0) || (strcmp(argv[argi], "-help") == 0)) {
+            Usage (0);
+        }
+        else {
+            Usage (1);
+        }
+    }
+    if ((argi >= argc) || (nPasses < 1)) {
+        Usage (1);
+    }
+
+    std::vector<uint8_t> buf;
+    for (;  argi < argc;  argi++) {
+        std::string file(argv[argi]);
+        struct stat st;
+        if (stat(file.c_str(), &st) < 0) {
+            std::cerr << "obj-convert: unable to open \"" << file << "\"\n";
+            exit (1);
+        }
+
+      // cold load: parse and compile the model
+        OBJ::MeshFile *mesh = nullptr;
+        float acmr = 0.0f;
+        size_t vbSz = 0, ibSz = 0;
+        uint32_t nIndices = 0;
+        auto startT = std::chrono::steady_clock::now();
+        for (int i = 0;  i < nPasses;  i++) {
+            delete mesh;
+            OBJ::Model *model = new OBJ::Model (file, cs237::ThreadPool::Shared());
+            mesh = OBJ::MeshFile::Compile (model, cs237::ThreadPool::Shared());
+            if (i == 0) {
+              // the ACMR and buffer sizes of the unoptimized model, which has separate
+              // buffers for the attributes and 32-bit indices
+                acmr = OBJ::ACMR (model->NumVerts(), model->NumIndices(), model->Indices());
+                vbSz = size_t(model->NumVerts()) * mesh->VertexStride();
+                ibSz = model->NumIndices() * sizeof(uint32_t);
+                nIndices = model->NumIndices();
+            }
+            delete model;
+            Upload (mesh, buf);
+        }
+        std::chrono::duration<double, std::milli> coldT = std::chrono::steady_clock::now() - startT;
+
+        if (! mesh->Save()) {
+            std::cerr << "obj-convert: unable to write \""
+                << OBJ::MeshFile::MeshPath(file) << "\"\n";
+            exit (1);
+        }
+        std::clog << file << " (" << FileMB(file) << " MB) -> "
+            << OBJ::MeshFile::MeshPath(file) << " ("
+            << FileMB(OBJ::MeshFile::MeshPath(file)) << " MB): "
+            << mesh->NumGroups() << " groups, " << mesh->NumVerts() << " vertices, "
+            << nIndices / 3 << " triangles, " << 8 * mesh->IndexSize()
+            << "-bit indices" << (mesh->HasTangents() ? ", tangents\n" : "\n");
+        std::vector<uint32_t> indices(mesh->NumIndices());
+        for (uint32_t i = 0;  i < mesh->NumIndices();  i++) {
+            indices[i] = (mesh->IndexSize() == sizeof(uint16_t))
+                ? static_cast<const uint16_t *>(mesh->Indices())[i]
+                : static_cast<const uint32_t *>(mesh->Indices())[i];
+        }
+      // the ACMR is for the full-resolution mesh, which is at the start of the index array
+        std::clog << "  ACMR: " << acmr << " -> "
+            << OBJ::ACMR (mesh->NumVerts(), nIndices, indices.data())
+            << "; vertex buffer: " << MB(vbSz) << " MB -> "
+            << MB(size_t(mesh->NumVerts()) * mesh->VertexStride())
+            << " MB; index buffer: " << MB(ibSz) << " MB -> "
+            << MB(mesh->NumIndices() * mesh->IndexSize()) << " MB\n";
+      // the LOD errors are distances in model units, so they are checked against the
+      // diagonal of the model's bounding box
+        float diag = length(mesh->BBox().max() - mesh->BBox().min());
+        std::clog << "  LODs (bounding-box diagonal " << diag << "):";
+        bool badError = false;
+        for (int lod = 0;  lod < mesh->NumLODs();  lod++) {
+            uint32_t nTris = 0;
+            for (int g = 0;  g < mesh->NumGroups();  g++) {
+                nTris += mesh->GroupLOD(g, lod).nIndices / 3;
+            }
+            std::clog << (lod > 0 ? "; " : " ") << nTris << " triangles (error "
+                << mesh->LODError(lod) << ")";
+            badError = badError || (mesh->LODError(lod) > diag);
+        }
+        std::clog << "\n";
+        if (badError) {
+            std::cerr << "obj-convert: LOD error of \"" << file
+                << "\" exceeds its bounding-box diagonal\n";
+            exit (1);
+        }
+        delete mesh;
+
+      // warm load: map the compiled mesh
+        startT = std::chrono::steady_clock::now();
+        for (int i = 0;  i < nPasses;  i++) {
+            mesh = OBJ::MeshFile::Open (file);
+            if (mesh == nullptr) {
+                std::cerr << "obj-convert: unable to load \""
+                    << OBJ::MeshFile::MeshPath(file) << "\"\n";
+                exit (1);
+            }
+            Upload (mesh, buf);
+            delete mesh;
+        }
+        std::chrono::duration<double, std::milli> warmT = std::chrono::steady_clock::now() - startT;
+
+        std::clog << "  cold load: " << coldT.count() / nPasses << " ms; warm load: "
+            << warmT.count() / nPasses << " ms (" << coldT.count() / warmT.count() << "x)\n";
+    }
+
+    return 0;
+}
@@ -0,0 +1,276 @@
+/*! \file particle-bench.cxx
+ *
+ * A benchmark for the particle pool (cs237::ParticleSystem) that is used to simulate
+ * rain.
+ *
+ * Usage: particle-bench [-particles n] [-frames n]
+ *
+ * For each pool size (by default 10k, 100k, 1M, and 10M particles), the benchmark
+ * fills the pool with particles whose life spans are spread over 0.5 to 15 seconds
+ * and then simulates frames of 1/60 second, respawning the particles that die after
+ * each frame so that the pool stays full.  It reports the number of particles
+ * updated per second for an array-of-structs scalar loop (which is how the particles
+ * used to be stored), for the particle pool updated by one thread, and for the pool
+ * updated in parallel.  It also reports the time per frame to sort the particles
+ * into back-to-front order, both with a std::sort of the array of structs (which is
+ * how the particles used to be sorted) and with the pool's incremental sort.
+ * Finally, it measures the throughput of spawning and killing particles by killing 1%
+ * of the particles at random in each frame and spawning replacements, both by marking
+ * the array-of-structs entries as dead and scanning for dead entries (which is how
+ * the particles used to be allocated) and with the pool's Kill and Spawn operations.
+ * Only the updates, sorts, and spawning and killing are timed.
+ *
+ * \author John Reppy
+ */
+
+/*
+ * COPYRIGHT (c) 2017 John Reppy (http://cs.uchicago.edu/~jhr)
+ * All rights reserved.
+ */
+
+#include "cs237.hxx"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <vector>
+
+static void Usage (int sts)
+{
+    std::cerr << "usage: particle-bench [-particles n] [-frames n]\n";
+    exit (sts);
+}
+
+static const float kDt = 1.0f / 60.0f;
+static const cs237::vec3f kAccel(0.0f, -9.81f * 0.5f, 0.0f);
+
+// the array-of-structs representation, which is updated by testing every entry
+struct Particle {
+    float life;
+    cs237::vec3f pos;
+    cs237::vec3f vel;
+    float dist;
+
+    bool operator< (Particle const &that) const { return this->dist > that.dist; }
+};
+
+static void UpdateAoS (std::vector<Particle> &ps, float dt)
+{
+    for (size_t i = 0;  i < ps.size();  i++) {
+        Particle &p = ps[i];
+        if (p.life > 0.0f) {
+            p.life -= dt;
+            if (p.life > 0.0f) {
+                p.vel += kAccel * dt;
+                p.pos += p.vel * dt;
+                p.dist = p.pos.length();
+            }
+            else {
+                p.dist = -1.0f;
+            }
+        }
+    }
+}
+
+// find a dead entry by scanning from the last one that was found, wrapping around
+static size_t FindDead (std::vector<Particle> &ps, size_t &lastUsed)
+{
+    for (size_t i = lastUsed;  i < ps.size();  i++) {
+        if (ps[i].life < 0.0f) {
+            lastUsed = i;
+            return i;
+        }
+    }
+    for (size_t i = 0;  i < lastUsed;  i++) {
+        if (ps[i].life < 0.0f) {
+            lastUsed = i;
+            return i;
+        }
+    }
+    return 0;
+}
+
+static double Seconds (std::chrono::steady_clock::time_point startT)
+{
+    std::chrono::duration<double> t = std::chrono::steady_clock::now() - startT;
+    return t.count();
+}
+
+static void Report (const char *what, size_t nUpdates, double secs)
+{
+    std::clog << "    " << what << double(nUpdates) / secs / 1.0e6 << " M particles/sec\n";
+}
+
+static void ReportSort (const char *what, int nFrames, double secs)
+{
+    std::clog << "    " << what << 1000.0 * secs / nFrames << " ms/frame\n";
+}
+
+static void ReportOps (const char *what, size_t nOps, double secs)
+{
+    std::clog << "    " << what << double(nOps) / secs / 1.0e6 << " M spawns+kills/sec\n";
+}
+
+static void Bench (size_t n, int nFrames)
+{
+    std::mt19937 rng(23700);
+    std::uniform_real_distribution<float> life(0.5f, 15.0f);
+    std::uniform_real_distribution<float> pos(-50.0f, 50.0f);
+    cs237::vec3f eye(0.0f, 0.0f, 0.0f);
+
+  // the number of frames defaults to enough for about 100M particle updates
+    if (nFrames <= 0) {
+        nFrames = std::max(3, int(100000000 / n));
+    }
+    std::clog << n << " particles, " << nFrames << " frames:\n";
+
+  // array of structs
+    double aosUpdateT = 0.0, aosSortT = 0.0;
+    {
+        std::vector<Particle> ps(n);
+        for (size_t i = 0;  i < n;  i++) {
+            ps[i].life = life(rng);
+            ps[i].pos = cs237::vec3f(pos(rng), 100.0f, pos(rng));
+            ps[i].vel = cs237::vec3f(2.5f, 0.0f, 2.5f);
+        }
+        for (int f = 0;  f < nFrames;  f++) {
+            auto startT = std::chrono::steady_clock::now();
+            UpdateAoS (ps, kDt);
+            aosUpdateT += Seconds(startT);
+            startT = std::chrono::steady_clock::now();
+            std::sort (ps.begin(), ps.end());
+            aosSortT += Seconds(startT);
+            for (size_t i = 0;  i < n;  i++) {
+                if (ps[i].life <= 0.0f) {
+                    ps[i].life = life(rng);
+                    ps[i].pos = cs237::vec3f(pos(rng), 100.0f, pos(rng));
+                    ps[i].vel = cs237::vec3f(2.5f, 0.0f, 2.5f);
+                }
+            }
+        }
+    }
+
+  // the particle pool, first sequential and then parallel; the sequential run also
+  // sorts the particles
+    double poolUpdateT[2], poolSortT = 0.0;
+    size_t nUpdates[2];
+    for (int par = 0;  par < 2;  par++) {
+        cs237::ParticleSystem ps(n);
+        cs237::ThreadPool *pool = (par ? cs237::ThreadPool::Shared() : nullptr);
+        poolUpdateT[par] = 0.0;
+        nUpdates[par] = 0;
+        for (int f = 0;  f < nFrames;  f++) {
+            while (ps.Spawn (life(rng), cs237::vec3f(pos(rng), 100.0f, pos(rng)),
+                    cs237::vec3f(2.5f, 0.0f, 2.5f))) {
+                continue;
+            }
+            nUpdates[par] += ps.NumLive();
+            auto startT = std::chrono::steady_clock::now();
+            ps.Update (kDt, kAccel, pool);
+            poolUpdateT[par] += Seconds(startT);
+            if (! par) {
+                startT = std::chrono::steady_clock::now();
+                ps.SortByDistance (eye);
+                poolSortT += Seconds(startT);
+            }
+        }
+    }
+
+  // spawning and killing
+    size_t nKills = std::max(size_t(1), n / 100);
+    std::uniform_int_distribution<uint32_t> rand32;
+    std::vector<uint32_t> victims(nKills);
+    double aosOpsT = 0.0, poolOpsT = 0.0;
+    {
+        std::vector<Particle> ps(n);
+        for (size_t i = 0;  i < n;  i++) {
+            ps[i].life = life(rng);
+        }
+        size_t lastUsed = 0;
+        for (int f = 0;  f < nFrames;  f++) {
+            for (size_t k = 0;  k < nKills;  k++) {
+                victims[k] = rand32(rng) % n;
+            }
+            auto startT = std::chrono::steady_clock::now();
+            for (size_t k = 0;  k < nKills;  k++) {
+                ps[victims[k]].life = -1.0f;
+            }
+            for (size_t k = 0;  k < nKills;  k++) {
+                size_t i = FindDead (ps, lastUsed);
+                ps[i].life = 15.0f;
+                ps[i].pos = cs237::vec3f(0.0f, 100.0f, 0.0f);
+                ps[i].vel = cs237::vec3f(2.5f, 0.0f, 2.5f);
+            }
+            aosOpsT += Seconds(startT);
+        }
+    }
+    {
+        cs237::ParticleSystem ps(n);
+        while (ps.Spawn (life(rng), cs237::vec3f(pos(rng), 100.0f, pos(rng)),
+                cs237::vec3f(2.5f, 0.0f, 2.5f))) {
+            continue;
+        }
+        for (int f = 0;  f < nFrames;  f++) {
+            for (size_t k = 0;  k < nKills;  k++) {
+                victims[k] = rand32(rng);
+            }
+            auto startT = std::chrono::steady_clock::now();
+            for (size_t k = 0;  k < nKills;  k++) {
+                ps.Kill (victims[k] % ps.NumLive());
+            }
+            for (size_t k = 0;  k < nKills;  k++) {
+                ps.Spawn (15.0f, cs237::vec3f(0.0f, 100.0f, 0.0f), cs237::vec3f(2.5f, 0.0f, 2.5f));
+            }
+            poolOpsT += Seconds(startT);
+        }
+    }
+
+    std::clog << "  update:\n";
+    Report ("array of structs:  ", n * nFrames, aosUpdateT);
+    Report ("pool (sequential): ", nUpdates[0], poolUpdateT[0]);
+    Report ("pool (parallel):   ", nUpdates[1], poolUpdateT[1]);
+    std::clog << "  sort:\n";
+    ReportSort ("std::sort of structs: ", nFrames, aosSortT);
+    ReportSort ("pool (incremental):   ", nFrames, poolSortT);
+    std::clog << "  spawn/kill (" << nKills << " per frame):\n";
+    ReportOps ("scan for dead:     ", 2 * nKills * nFrames, aosOpsT);
+    ReportOps ("pool:              ", 2 * nKills * nFrames, poolOpsT);
+}
+
+int main (int argc, char **argv)
+{
+    size_t nParticles = 0;
+    int nFrames = 0;
+    int argi = 1;
+
+    for (;  (argi < argc) && (argv[argi][0] == '-');  argi++) {
+        if ((strcmp(argv[argi], "-particles") == 0) && (argi+1 < argc)) {
+            nParticles = atol(argv[++argi]);
+            if (nParticles < 1) Usage (1);
+        }
+        else if ((strcmp(argv[argi], "-frames") == 0) && (argi+1 < argc)) {
+            nFrames = atoi(argv[++argi]);
+            if (nFrames < 1) Usage (1);
+        }
+        else if ((strcmp(argv[argi], "-h") == 0) || (strcmp(argv[argi], "-help") == 0)) {
+            Usage (0);
+        }
+        else {
+            Usage (1);
+        }
+    }
+    if (argi != argc) {
+        Usage (1);
+    }
+
+    if (nParticles > 0) {
+        Bench (nParticles, nFrames);
+    }
+    else {
+        for (size_t n = 10000;  n <= 10000000;  n *= 10) {
+            Bench (n, nFrames);
+        }
+    }
+
+    return 0;
+}
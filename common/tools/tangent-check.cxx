@@ -0,0 +1,323 @@
+/*! \file tangent-check.cxx
+ *
+ * A differential test of the tangent computation (OBJ::ComputeTangents) that is used
+ * when compiling OBJ meshes.
+ *
+ * Usage: tangent-check [-seed n] [-v]
+ *
+ * The tool generates meshes and checks the tangents that OBJ::ComputeTangents
+ * computes for them against the scalar per-triangle loop that TriMesh originally used
+ * (with the y row of its edge matrix fixed to use v3.y - v1.y), which is written here
+ * as the reference.  The xyz components must agree to within a small tolerance and
+ * the handedness must be the same.  The meshes include grids that are large enough
+ * to be split into many chunks, grids whose vertex counts are not multiples of four,
+ * a torus, a grid with mirrored texture coordinates (which flips the tangents' handedness),
+ * and a grid whose vertices are randomly renumbered, so that the chunks' vertex ranges
+ * overlap.  The reference produces NaNs for triangles with degenerate texture
+ * coordinates, which ComputeTangents skips, so for a grid with such triangles the
+ * reference is run on the mesh without them.
+ *
+ * The tool also checks that the tangents are bit-for-bit identical without a thread
+ * pool and with pools of 1, 2, 3, and 7 workers.  Building the library with
+ * CS237_NO_SIMD checks the scalar orthogonalization against the same reference.
+ *
+ * The tool prints the first few mismatches and exits with status 1 if there are any.
+ *
+ * \author John Reppy
+ */
+
+/*
+ * COPYRIGHT (c) 2017 John Reppy (http://cs.uchicago.edu/~jhr)
+ * All rights reserved.
+ */
+
+#include "cs237.hxx"
+#include "obj-mesh.hxx"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <vector>
+
+static void Usage (int sts)
+{
+    std::cerr << "usage: tangent-check [-seed n] [-v]\n";
+    exit (sts);
+}
+
+// the maximum difference in the xyz components of a tangent
+static const float kTolerance = 1.0e-4f;
+// the maximum number of mismatches that are reported per mesh
+static const int kMaxReports = 5;
+
+static std::mt19937 Rng;
+static bool Verbose = false;
+static int NumFailures = 0;
+
+// a generated mesh
+struct Mesh {
+    std::string name;
+    std::vector<cs237::vec3f> verts;
+    std::vector<cs237::vec3f> norms;
+    std::vector<cs237::vec2f> txtCoords;
+    std::vector<uint32_t> indices;
+
+    uint32_t NumVerts () const { return this->verts.size(); }
+};
+
+// the scalar reference, which is TriMesh's original tangent loop with the y row of the
+// edge matrix fixed
+static void RefTangents (Mesh const &mesh, std::vector<cs237::vec4f> &tangents)
+{
+    uint32_t nVerts = mesh.NumVerts();
+    std::vector<cs237::vec3f> tan(nVerts), bitan(nVerts);
+    uint32_t nTris = mesh.indices.size() / 3;
+    for (uint32_t tri = 0;  tri < nTris;  tri++) {
+        uint32_t i1 = mesh.indices[3*tri + 0];
+        uint32_t i2 = mesh.indices[3*tri + 1];
+        uint32_t i3 = mesh.indices[3*tri + 2];
+        cs237::vec3f v1 = mesh.verts[i1];
+        cs237::vec3f v2 = mesh.verts[i2];
+        cs237::vec3f v3 = mesh.verts[i3];
+        cs237::vec2f vt1 = mesh.txtCoords[i1];
+        cs237::vec2f vt2 = mesh.txtCoords[i2];
+        cs237::vec2f vt3 = mesh.txtCoords[i3];
+      // the sides of the triangle as a 3x2 matrix
+        cs237::mat3x2f Q = cs237::mat3x2f(
+            v2.x - v1.x, v3.x - v1.x,   // column one
+            v2.y - v1.y, v3.y - v1.y,   // column two
+            v2.z - v1.z, v3.z - v1.z);  // column three
+      // the sides in tangent space as a 2x2 matrix
+        cs237::mat2x2f ST = cs237::mat2x2f (
+            vt2.x - vt1.x, vt3.x - vt1.x,       // first column
+            vt2.y - vt1.y, vt3.y - vt1.y);      // second column
+      // Q = ST * [T B]^T, so multiply Q by ST^{-1}
+        cs237::mat3x2f TB = ST.inverse() * Q;
+        cs237::vec3f t = cs237::vec3f(TB[0][0], TB[1][0], TB[2][0]);
+        cs237::vec3f b = cs237::vec3f(TB[0][1], TB[1][1], TB[2][1]);
+        tan[i1] += t;
+        tan[i2] += t;
+        tan[i3] += t;
+        bitan[i1] += b;
+        bitan[i2] += b;
+        bitan[i3] += b;
+    }
+    tangents.resize (nVerts);
+    for (uint32_t i = 0;  i < nVerts;  i++) {
+        cs237::vec3f n = mesh.norms[i];
+        cs237::vec3f t = normalize(tan[i] - n * dot(n, tan[i]));
+        float w = (dot(cross(n, t), bitan[i]) < 0.0f ? -1.0f : 1.0f);
+        tangents[i] = cs237::vec4f(t, w);
+    }
+}
+
+static void Tangents (Mesh const &mesh, cs237::ThreadPool *pool, std::vector<cs237::vec4f> &tangents)
+{
+    tangents.assign (mesh.NumVerts(), cs237::vec4f(0.0f));
+    OBJ::ComputeTangents (
+        mesh.NumVerts(), mesh.verts.data(), mesh.norms.data(), mesh.txtCoords.data(),
+        mesh.indices.size(), mesh.indices.data(), tangents.data(), pool);
+}
+
+static void Fail (std::string const &mesh, int &nReported, std::string const &msg)
+{
+    NumFailures++;
+    if (nReported++ < kMaxReports) {
+        std::cerr << mesh << ": " << msg << "\n";
+    }
+}
+
+static std::string Show (cs237::vec4f const &v)
+{
+    return "(" + std::to_string(v.x) + ", " + std::to_string(v.y) + ", "
+        + std::to_string(v.z) + ", " + std::to_string(v.w) + ")";
+}
+
+// check the tangents of a mesh against the reference tangents of refMesh, which has
+// the same vertices
+static void Check (Mesh const &mesh, Mesh const &refMesh)
+{
+    int nReported = 0;
+    std::vector<cs237::vec4f> expected, got;
+    RefTangents (refMesh, expected);
+    Tangents (mesh, nullptr, got);
+
+    float maxDiff = 0.0f;
+    for (uint32_t i = 0;  i < mesh.NumVerts();  i++) {
+        float diff = std::max(std::fabs(got[i].x - expected[i].x),
+            std::max(std::fabs(got[i].y - expected[i].y), std::fabs(got[i].z - expected[i].z)));
+        if (! (diff <= kTolerance) || (got[i].w != expected[i].w)) {
+            Fail (mesh.name, nReported, "vertex " + std::to_string(i) + " has tangent "
+                + Show(got[i]) + ", expected " + Show(expected[i]));
+        }
+        else {
+            maxDiff = std::max(maxDiff, diff);
+        }
+    }
+
+  // the results must not depend on the pool
+    for (int nWorkers : { 1, 2, 3, 7 }) {
+        cs237::ThreadPool pool(nWorkers);
+        std::vector<cs237::vec4f> par;
+        Tangents (mesh, &pool, par);
+        if (std::memcmp(par.data(), got.data(), got.size() * sizeof(cs237::vec4f)) != 0) {
+            Fail (mesh.name, nReported, "the tangents with " + std::to_string(nWorkers)
+                + " workers differ from the tangents without a pool");
+        }
+    }
+
+    if (Verbose) {
+        std::clog << mesh.name << ": " << mesh.NumVerts() << " vertices, "
+            << mesh.indices.size() / 3 << " triangles, max difference " << maxDiff << "\n";
+    }
+}
+
+// a wid x ht grid of quads over a wavy surface, with the vertices numbered row by row.
+// If mirror is true, then the u texture coordinate runs backwards, which flips the
+// handedness of the tangent frames.
+static Mesh Grid (uint32_t wid, uint32_t ht, bool mirror)
+{
+    Mesh mesh;
+    mesh.name = "grid " + std::to_string(wid) + "x" + std::to_string(ht)
+        + (mirror ? " (mirrored)" : "");
+    std::uniform_real_distribution<float> jitter(-0.2f, 0.2f);
+    for (uint32_t r = 0;  r <= ht;  r++) {
+        for (uint32_t c = 0;  c <= wid;  c++) {
+            float x = float(c) + jitter(Rng), z = float(r) + jitter(Rng);
+            float y = 0.5f * std::sin(0.3f * x) * std::cos(0.2f * z);
+          // the normal of the height field y = f(x, z)
+            float dydx = 0.15f * std::cos(0.3f * x) * std::cos(0.2f * z);
+            float dydz = -0.1f * std::sin(0.3f * x) * std::sin(0.2f * z);
+            mesh.verts.push_back (cs237::vec3f(x, y, z));
+            mesh.norms.push_back (normalize(cs237::vec3f(-dydx, 1.0f, -dydz)));
+            float u = x / float(wid);
+            mesh.txtCoords.push_back (cs237::vec2f(mirror ? 1.0f - u : u, z / float(ht)));
+        }
+    }
+    for (uint32_t r = 0;  r < ht;  r++) {
+        for (uint32_t c = 0;  c < wid;  c++) {
+            uint32_t v = r * (wid + 1) + c;
+            uint32_t tri[6] = { v, v + wid + 1, v + 1, v + 1, v + wid + 1, v + wid + 2 };
+            mesh.indices.insert (mesh.indices.end(), tri, tri + 6);
+        }
+    }
+    return mesh;
+}
+
+// a torus with a seam of duplicated vertices, as in an exported model
+static Mesh Torus (uint32_t n, uint32_t m)
+{
+    Mesh mesh;
+    mesh.name = "torus " + std::to_string(n) + "x" + std::to_string(m);
+    const float R = 3.0f, r = 1.0f, twoPi = 6.2831853f;
+    for (uint32_t i = 0;  i <= n;  i++) {
+        for (uint32_t j = 0;  j <= m;  j++) {
+            float u = twoPi * float(i) / float(n), v = twoPi * float(j) / float(m);
+            mesh.verts.push_back (cs237::vec3f(
+                (R + r * std::cos(v)) * std::cos(u), r * std::sin(v), (R + r * std::cos(v)) * std::sin(u)));
+            mesh.norms.push_back (cs237::vec3f(
+                std::cos(v) * std::cos(u), std::sin(v), std::cos(v) * std::sin(u)));
+            mesh.txtCoords.push_back (cs237::vec2f(float(i) / float(n), float(j) / float(m)));
+        }
+    }
+    for (uint32_t i = 0;  i < n;  i++) {
+        for (uint32_t j = 0;  j < m;  j++) {
+            uint32_t a = i * (m + 1) + j, b = a + m + 1;
+            uint32_t tri[6] = { a, b, b + 1, a, b + 1, a + 1 };
+            mesh.indices.insert (mesh.indices.end(), tri, tri + 6);
+        }
+    }
+    return mesh;
+}
+
+// renumber the vertices of a mesh randomly
+static Mesh Shuffle (Mesh const &mesh)
+{
+    std::vector<uint32_t> perm(mesh.NumVerts());
+    for (uint32_t i = 0;  i < perm.size();  i++) perm[i] = i;
+    std::shuffle (perm.begin(), perm.end(), Rng);
+    Mesh out = mesh;
+    out.name = mesh.name + " (shuffled)";
+    for (uint32_t i = 0;  i < perm.size();  i++) {
+        out.verts[perm[i]] = mesh.verts[i];
+        out.norms[perm[i]] = mesh.norms[i];
+        out.txtCoords[perm[i]] = mesh.txtCoords[i];
+    }
+    for (auto it = out.indices.begin();  it != out.indices.end();  it++) {
+        *it = perm[*it];
+    }
+    return out;
+}
+
+int main (int argc, char **argv)
+{
+    unsigned seed = 23700;
+    int argi = 1;
+
+    for (;  (argi < argc) && (argv[argi][0] == '-');  argi++) {
+        if ((strcmp(argv[argi], "-seed") == 0) && (argi+1 < argc)) {
+            seed = static_cast<unsigned>(atol(argv[++argi]));
+        }
+        else if (strcmp(argv[argi], "-v") == 0) {
+            Verbose = true;
+        }
+        else if ((strcmp(argv[argi], "-h") == 0) || (strcmp(argv[argi], "-help") == 0)) {
+            Usage (0);
+        }
+        else {
+            Usage (1);
+        }
+    }
+    if (argi != argc) {
+        Usage (1);
+    }
+
+    Rng.seed (seed);
+
+  // small grids, including vertex counts that are not multiples of four
+    for (uint32_t wid = 1;  wid <= 4;  wid++) {
+        for (uint32_t ht = 1;  ht <= 3;  ht++) {
+            Mesh mesh = Grid(wid, ht, false);
+            Check (mesh, mesh);
+        }
+    }
+  // large grids, which are split into many chunks and vertex ranges
+    {
+        Mesh mesh = Grid(400, 301, false);
+        Check (mesh, mesh);
+        Mesh mirrored = Grid(257, 129, true);
+        Check (mirrored, mirrored);
+        Mesh shuffled = Shuffle(Grid(200, 150, false));
+        Check (shuffled, shuffled);
+    }
+    {
+        Mesh mesh = Torus(200, 100);
+        Check (mesh, mesh);
+    }
+  // a grid with some degenerate triangles, which have repeated vertices and so
+  // degenerate texture coordinates; these do not contribute to the tangents, so the
+  // reference is the mesh without them
+    {
+        Mesh ref = Grid(64, 64, false);
+        Mesh mesh = ref;
+        mesh.name = "grid 64x64 (degenerate triangles)";
+        mesh.indices.clear();
+        for (size_t t = 0;  t < ref.indices.size();  t += 3) {
+            if (t % 21 == 0) {
+                uint32_t tri[3] = { ref.indices[t], ref.indices[t], ref.indices[t + 1] };
+                mesh.indices.insert (mesh.indices.end(), tri, tri + 3);
+            }
+            mesh.indices.insert (mesh.indices.end(), &ref.indices[t], &ref.indices[t] + 3);
+        }
+        Check (mesh, ref);
+    }
+
+    if (NumFailures == 0) {
+        std::clog << "tangent-check: all meshes match the reference\n";
+        return 0;
+    }
+    else {
+        std::clog << "tangent-check: " << NumFailures << " failures\n";
+        return 1;
+    }
+}
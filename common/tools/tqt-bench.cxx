@@ -0,0 +1,138 @@
+/*! \file tqt-bench.cxx
+ *
+ * A benchmark that measures how tile-decode throughput scales with the number of
+ * threads that are loading tiles from the same texture quadtree.
+ *
+ * Usage: tqt-bench [-passes n] [-threads n] <file.tqt>
+ *
+ * The benchmark decodes every tile in the tree (repeating the given number of passes)
+ * using 1, 2, 4, ... threads up to the given maximum (which defaults to the number of
+ * hardware threads) and reports tiles/second and megabytes of decoded pixels per second.
+ * Each configuration is run twice: once allocating a fresh image per tile and once
+ * decoding into a reused image per thread, which is the allocation-free path.
+ *
+ * \author John Reppy
+ */
+
+/*
+ * COPYRIGHT (c) 2017 John Reppy (http://cs.uchicago.edu/~jhr)
+ * All rights reserved.
+ */
+
+#include "cs237.hxx"
+#include "tqt.hxx"
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <vector>
+
+static void Usage (int sts)
+{
+    std::cerr << "usage: tqt-bench [-passes n] [-threads n] <file.tqt>\n";
+    exit (sts);
+}
+
+// a tile in the quadtree
+struct Node {
+    int level, row, col;
+};
+
+int main (int argc, char **argv)
+{
+    int nPasses = 4;
+    int maxThreads = std::thread::hardware_concurrency();
+    int argi = 1;
+
+    for (;  (argi < argc) && (argv[argi][0] == '-');  argi++) {
+        if ((strcmp(argv[argi], "-passes") == 0) && (argi+1 < argc)) {
+            nPasses = atoi(argv[++argi]);
+        }
+        else if ((strcmp(argv[argi], "-threads") == 0) && (argi+1 < argc)) {
+            maxThreads = atoi(argv[++argi]);
+        }
+        else if ((strcmp(argv[argi], "-h") == 0) || (strcmp(argv[argi], "-help") == 0)) {
+            Usage (0);
+        }
+        else {
+            Usage (1);
+        }
+    }
+    if ((argc - argi != 1) || (nPasses < 1) || (maxThreads < 1)) {
+        Usage (1);
+    }
+
+    TQT::TextureQTree tree (argv[argi]);
+
+    std::vector<Node> nodes;
+    for (int level = 0;  level < tree.Depth();  level++) {
+        for (int row = 0;  row < (1 << level);  row++) {
+            for (int col = 0;  col < (1 << level);  col++) {
+                nodes.push_back (Node{level, row, col});
+            }
+        }
+    }
+    size_t nTiles = nPasses * nodes.size();
+
+    std::clog << argv[argi] << ": " << nodes.size() << " " << tree.TileSize() << "x"
+        << tree.TileSize() << " tiles, " << nPasses << " passes\n";
+
+    double baseRate[2] = { 0.0, 0.0 };
+    for (int nThreads = 1;  nThreads <= maxThreads;  nThreads *= 2) {
+      // split the work into a few chunks per thread, so that the reuse mode decodes
+      // many tiles into each image
+        size_t grain = nTiles / (8 * nThreads);
+        if (grain < 1) grain = 1;
+        for (int reuse = 0;  reuse < 2;  reuse++) {
+            std::atomic<size_t> nBytes(0);
+            auto loadTiles = [&] (size_t lo, size_t hi) {
+                size_t n = 0;
+                cs237::image2d *img = nullptr;
+                for (size_t i = lo;  i < hi;  i++) {
+                    Node const &nd = nodes[i % nodes.size()];
+                    bool ok;
+                    if (reuse && (img != nullptr)) {
+                        ok = tree.LoadImage (nd.level, nd.row, nd.col, false, img);
+                    }
+                    else {
+                        img = tree.LoadImage (nd.level, nd.row, nd.col, false);
+                        ok = (img != nullptr);
+                    }
+                    if (! ok) {
+                        std::cerr << "tqt-bench: unable to load tile (" << nd.level << ", "
+                            << nd.row << ", " << nd.col << ")\n";
+                        exit (1);
+                    }
+                    n += img->nBytes();
+                    if (! reuse) {
+                        delete img;
+                        img = nullptr;
+                    }
+                }
+                delete img;
+                nBytes += n;
+            };
+
+            auto startT = std::chrono::steady_clock::now();
+            if (nThreads == 1) {
+                loadTiles (0, nTiles);
+            }
+            else {
+              // the calling thread also runs chunks, so the pool only needs nThreads-1 workers
+                cs237::ThreadPool pool (nThreads - 1);
+                pool.ParallelFor (nTiles, grain, loadTiles);
+            }
+            std::chrono::duration<double> secs = std::chrono::steady_clock::now() - startT;
+
+            double rate = double(nTiles) / secs.count();
+            if (nThreads == 1) {
+                baseRate[reuse] = rate;
+            }
+            std::clog << "  " << nThreads << " threads" << (reuse ? " (reuse): " : ":         ")
+                << rate << " tiles/s, "
+                << (double(nBytes) / (1024.0 * 1024.0)) / secs.count() << " MB/s ("
+                << rate / baseRate[reuse] << "x)\n";
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,167 @@
+/*! \file tqt-convert.cxx
+ *
+ * A tool for converting a PNG-based texture quadtree (e.g., a map cell's color.tqt or
+ * norm.tqt file) into a version 2 TQT file that holds block-compressed tiles.
+ *
+ * Usage: tqt-convert [-bc1 | -bc5] <input.tqt> <output.tqt>
+ *
+ * If neither format is specified, then BC5 is used for files whose name starts with
+ * "norm" and BC1 is used otherwise.  Since TextureQTree reads both versions of the
+ * format, the output can be used in place of the original file in a map's cell
+ * directory.
+ *
+ * \author John Reppy
+ */
+
+/*
+ * COPYRIGHT (c) 2017 John Reppy (http://cs.uchicago.edu/~jhr)
+ * All rights reserved.
+ */
+
+#include "cs237.hxx"
+#include "tqt.hxx"
+#include "tqt-compress.hxx"
+#include <chrono>
+#include <cstring>
+#include <vector>
+
+// the number of tiles that are converted before they are written out
+#define BATCH_SIZE      64
+
+static void Usage (int sts)
+{
+    std::cerr << "usage: tqt-convert [-bc1 | -bc5] <input.tqt> <output.tqt>\n";
+    exit (sts);
+}
+
+// a tile in the quadtree
+struct Node {
+    int level, row, col;
+};
+
+int main (int argc, char **argv)
+{
+    TQT::TileFormat fmt = TQT::TILE_PNG;
+    int argi = 1;
+
+    for (;  (argi < argc) && (argv[argi][0] == '-');  argi++) {
+        if (strcmp(argv[argi], "-bc1") == 0) {
+            fmt = TQT::TILE_BC1;
+        }
+        else if (strcmp(argv[argi], "-bc5") == 0) {
+            fmt = TQT::TILE_BC5;
+        }
+        else if ((strcmp(argv[argi], "-h") == 0) || (strcmp(argv[argi], "-help") == 0)) {
+            Usage (0);
+        }
+        else {
+            Usage (1);
+        }
+    }
+    if (argc - argi != 2) {
+        Usage (1);
+    }
+    std::string inFile(argv[argi]);
+    std::string outFile(argv[argi+1]);
+
+    if (fmt == TQT::TILE_PNG) {
+        size_t slash = inFile.rfind('/');
+        std::string base = (slash == std::string::npos) ? inFile : inFile.substr(slash+1);
+        fmt = (base.compare(0, 4, "norm") == 0) ? TQT::TILE_BC5 : TQT::TILE_BC1;
+    }
+
+    if (! TQT::TextureQTree::isTQTFile (inFile)) {
+        std::cerr << "tqt-convert: \"" << inFile << "\" is not a TQT file\n";
+        exit (1);
+    }
+    TQT::TextureQTree tree (inFile.c_str());
+    if (tree.Format() != TQT::TILE_PNG) {
+        std::cerr << "tqt-convert: \"" << inFile << "\" is already compressed\n";
+        exit (1);
+    }
+
+    std::ofstream outS (outFile, std::ofstream::out | std::ofstream::binary);
+    if (outS.fail()) {
+        std::cerr << "tqt-convert: unable to open \"" << outFile << "\"\n";
+        exit (1);
+    }
+
+    auto startT = std::chrono::steady_clock::now();
+
+    int depth = tree.Depth();
+    int tileSize = tree.TileSize();
+    TQT::TextureQTree::WriteHeader (outS, depth, tileSize, fmt);
+
+  // the nodes in the order that they appear in the file
+    std::vector<Node> nodes;
+    nodes.reserve (TQT::TextureQTree::NumNodes(depth));
+    for (int level = 0;  level < depth;  level++) {
+        for (int row = 0;  row < (1 << level);  row++) {
+            for (int col = 0;  col < (1 << level);  col++) {
+                assert (TQT::TextureQTree::NodeIndex(level, row, col) == nodes.size());
+                nodes.push_back (Node{level, row, col});
+            }
+        }
+    }
+
+  // convert the tiles in batches; the tiles in a batch are compressed in parallel
+    std::vector<cs237::image2d *> batch(BATCH_SIZE);
+    std::vector<double> sqErr(BATCH_SIZE);
+    double totalSqErr = 0.0;
+    size_t nBytesIn = 0;
+    for (size_t first = 0;  first < nodes.size();  first += BATCH_SIZE) {
+        size_t n = std::min(static_cast<size_t>(BATCH_SIZE), nodes.size() - first);
+        cs237::ThreadPool::Shared()->ParallelFor (n, 1, [&] (size_t lo, size_t hi) {
+            for (size_t i = lo;  i < hi;  i++) {
+                Node const &nd = nodes[first + i];
+                cs237::image2d *img = tree.LoadImage (nd.level, nd.row, nd.col, false);
+                if (img == nullptr) {
+                    std::cerr << "tqt-convert: unable to load tile (" << nd.level << ", "
+                        << nd.row << ", " << nd.col << ")\n";
+                    exit (1);
+                }
+                batch[i] = TQT::Compress (img, fmt);
+              // measure the error of the compressed tile (BC5 only keeps two channels)
+                cs237::image2d *dimg = TQT::Decompress (batch[i]);
+                const uint8_t *p = reinterpret_cast<const uint8_t *>(img->data());
+                const uint8_t *q = reinterpret_cast<const uint8_t *>(dimg->data());
+                int nChans = (fmt == TQT::TILE_BC5) ? 2 : 3;
+                double err = 0.0;
+                for (size_t j = 0;  j < img->nBytes();  j += 3) {
+                    for (int c = 0;  c < nChans;  c++) {
+                        double d = double(p[j+c]) - double(q[j+c]);
+                        err += d * d;
+                    }
+                }
+                sqErr[i] = err / double((img->nBytes() / 3) * nChans);
+                delete dimg;
+                delete img;
+            }
+        });
+        for (size_t i = 0;  i < n;  i++) {
+            outS.write (reinterpret_cast<const char *>(batch[i]->data()), batch[i]->nBytes());
+            totalSqErr += sqErr[i];
+            nBytesIn += 3 * tileSize * tileSize;
+            delete batch[i];
+        }
+    }
+
+    outS.close();
+    if (outS.fail()) {
+        std::cerr << "tqt-convert: error writing \"" << outFile << "\"\n";
+        exit (1);
+    }
+
+    std::chrono::duration<double> secs = std::chrono::steady_clock::now() - startT;
+    double mse = totalSqErr / double(nodes.size());
+    size_t nBytesOut = nodes.size() * TQT::CompressedSize(fmt, tileSize, tileSize);
+    std::clog << outFile << ": " << nodes.size() << " " << tileSize << "x" << tileSize
+        << ((fmt == TQT::TILE_BC1) ? " BC1" : " BC5") << " tiles in " << secs.count()
+        << " seconds\n"
+        << "  texture memory: " << nBytesIn << " bytes as RGB, " << nBytesOut
+        << " bytes compressed (" << double(nBytesIn) / double(nBytesOut) << ":1)\n"
+        << "  RMS error = " << std::sqrt(mse) << ", PSNR = "
+        << ((mse > 0.0) ? 10.0 * std::log10(255.0 * 255.0 / mse) : 99.0) << " dB\n";
+
+    return 0;
+}
@@ -0,0 +1,384 @@
+/*! \file tqt-compress.cxx
+ *
+ * CPU encoders and decoders for block-compressed TQT tiles.  The BC1 encoder fits the
+ * block's endpoints to the principal axis of its colors, which is fast and gives
+ * quality that is close to an exhaustive search for the smooth imagery found in
+ * terrain textures.
+ *
+ * \author John Reppy
+ */
+
+/*
+ * COPYRIGHT (c) 2017 John Reppy (http://cs.uchicago.edu/~jhr)
+ * All rights reserved.
+ */
+
+#include "cs237.hxx"
+#include "tqt-compress.hxx"
+#include <algorithm>
+
+/***** inline utility functions *****/
+
+//! pack an 8-bit per channel color as a 5:6:5 color
+inline uint16_t Pack565 (int r, int g, int b)
+{
+    return static_cast<uint16_t>(
+        (((r * 31 + 127) / 255) << 11) | (((g * 63 + 127) / 255) << 5) | ((b * 31 + 127) / 255));
+}
+
+//! expand a 5:6:5 color to 8-bits per channel
+inline void Unpack565 (uint16_t c, int rgb[3])
+{
+    int r = (c >> 11) & 31;
+    int g = (c >> 5) & 63;
+    int b = c & 31;
+    rgb[0] = (r << 3) | (r >> 2);
+    rgb[1] = (g << 2) | (g >> 4);
+    rgb[2] = (b << 3) | (b >> 2);
+}
+
+inline int Clamp255 (int x)
+{
+    return (x < 0) ? 0 : ((x > 255) ? 255 : x);
+}
+
+//! the BC1 palette for a pair of endpoints
+static void BC1Palette (uint16_t c0, uint16_t c1, int pal[4][3])
+{
+    Unpack565 (c0, pal[0]);
+    Unpack565 (c1, pal[1]);
+    for (int i = 0;  i < 3;  i++) {
+        if (c0 > c1) {
+            pal[2][i] = (2*pal[0][i] + pal[1][i] + 1) / 3;
+            pal[3][i] = (pal[0][i] + 2*pal[1][i] + 1) / 3;
+        }
+        else {
+            pal[2][i] = (pal[0][i] + pal[1][i] + 1) / 2;
+            pal[3][i] = 0;
+        }
+    }
+}
+
+//! the BC4 palette for a pair of endpoints
+static void BC4Palette (int r0, int r1, int pal[8])
+{
+    pal[0] = r0;
+    pal[1] = r1;
+    if (r0 > r1) {
+        for (int i = 1;  i < 7;  i++) {
+            pal[i+1] = ((7-i)*r0 + i*r1 + 3) / 7;
+        }
+    }
+    else {
+        for (int i = 1;  i < 5;  i++) {
+            pal[i+1] = ((5-i)*r0 + i*r1 + 2) / 5;
+        }
+        pal[6] = 0;
+        pal[7] = 255;
+    }
+}
+
+//! flip the rows of a BC1 block
+inline void FlipBC1Block (uint8_t *blk)
+{
+    std::swap (blk[4], blk[7]);
+    std::swap (blk[5], blk[6]);
+}
+
+//! flip the rows of a BC4 block; each row has four 3-bit indices
+inline void FlipBC4Block (uint8_t *blk)
+{
+    uint64_t bits = 0;
+    for (int i = 0;  i < 6;  i++) {
+        bits |= static_cast<uint64_t>(blk[2+i]) << (8*i);
+    }
+    uint64_t flipped = 0;
+    for (int r = 0;  r < 4;  r++) {
+        flipped |= ((bits >> (12*r)) & 0xfff) << (12*(3-r));
+    }
+    for (int i = 0;  i < 6;  i++) {
+        blk[2+i] = static_cast<uint8_t>(flipped >> (8*i));
+    }
+}
+
+namespace TQT {
+
+    GLenum GLFormat (TileFormat fmt)
+    {
+        switch (fmt) {
+          case TILE_BC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+          case TILE_BC5: return GL_COMPRESSED_RG_RGTC2;
+          default:
+            std::cerr << "TQT::GLFormat: " << fmt << " is not a compressed format\n";
+            exit (1);
+        }
+    }
+
+    size_t CompressedSize (TileFormat fmt, int wid, int ht)
+    {
+        size_t nBlocks = static_cast<size_t>(wid / 4) * static_cast<size_t>(ht / 4);
+        switch (fmt) {
+          case TILE_BC1: return 8 * nBlocks;
+          case TILE_BC5: return 16 * nBlocks;
+          default: return 0;
+        }
+    }
+
+    void EncodeBC1Block (const uint8_t *rgb, int stride, uint8_t blk[8])
+    {
+        int px[16][3];
+        float mean[3] = { 0.0f, 0.0f, 0.0f };
+        for (int y = 0;  y < 4;  y++) {
+            for (int x = 0;  x < 4;  x++) {
+                const uint8_t *p = rgb + y*stride + 3*x;
+                for (int i = 0;  i < 3;  i++) {
+                    px[4*y+x][i] = p[i];
+                    mean[i] += p[i];
+                }
+            }
+        }
+        for (int i = 0;  i < 3;  i++) {
+            mean[i] *= (1.0f / 16.0f);
+        }
+
+      // covariance of the colors
+        float cov[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+        for (int j = 0;  j < 16;  j++) {
+            float r = px[j][0] - mean[0];
+            float g = px[j][1] - mean[1];
+            float b = px[j][2] - mean[2];
+            cov[0] += r*r;  cov[1] += r*g;  cov[2] += r*b;
+            cov[3] += g*g;  cov[4] += g*b;  cov[5] += b*b;
+        }
+
+      // principal axis by power iteration
+        float axis[3] = { 1.0f, 1.0f, 1.0f };
+        for (int iter = 0;  iter < 4;  iter++) {
+            float a0 = cov[0]*axis[0] + cov[1]*axis[1] + cov[2]*axis[2];
+            float a1 = cov[1]*axis[0] + cov[3]*axis[1] + cov[4]*axis[2];
+            float a2 = cov[2]*axis[0] + cov[4]*axis[1] + cov[5]*axis[2];
+            float len = std::max(std::fabs(a0), std::max(std::fabs(a1), std::fabs(a2)));
+            if (len < 1.0e-6f) {
+                break;  // all of the colors are (nearly) the same
+            }
+            axis[0] = a0 / len;  axis[1] = a1 / len;  axis[2] = a2 / len;
+        }
+
+      // the extreme colors along the axis are the endpoints
+        int lo = 0, hi = 0;
+        float tLo = 0.0f, tHi = 0.0f;
+        for (int j = 0;  j < 16;  j++) {
+            float t = (px[j][0] - mean[0]) * axis[0]
+                + (px[j][1] - mean[1]) * axis[1]
+                + (px[j][2] - mean[2]) * axis[2];
+            if ((j == 0) || (t < tLo)) { tLo = t; lo = j; }
+            if ((j == 0) || (t > tHi)) { tHi = t; hi = j; }
+        }
+
+      // inset the endpoints slightly, since the extremes are rarely used
+        int e0[3], e1[3];
+        for (int i = 0;  i < 3;  i++) {
+            int inset = (px[hi][i] - px[lo][i]) / 16;
+            e0[i] = Clamp255(px[hi][i] - inset);
+            e1[i] = Clamp255(px[lo][i] + inset);
+        }
+        uint16_t c0 = Pack565(e0[0], e0[1], e0[2]);
+        uint16_t c1 = Pack565(e1[0], e1[1], e1[2]);
+        if (c0 < c1) {
+            std::swap (c0, c1);
+        }
+
+        blk[0] = static_cast<uint8_t>(c0);
+        blk[1] = static_cast<uint8_t>(c0 >> 8);
+        blk[2] = static_cast<uint8_t>(c1);
+        blk[3] = static_cast<uint8_t>(c1 >> 8);
+
+        if (c0 == c1) {
+          // a single color; index 0 selects c0
+            blk[4] = blk[5] = blk[6] = blk[7] = 0;
+            return;
+        }
+
+      // pick the closest palette entry for each pixel
+        int pal[4][3];
+        BC1Palette (c0, c1, pal);
+        for (int y = 0;  y < 4;  y++) {
+            uint8_t row = 0;
+            for (int x = 0;  x < 4;  x++) {
+                int *p = px[4*y+x];
+                int best = 0, bestDist = 0;
+                for (int k = 0;  k < 4;  k++) {
+                    int dr = p[0] - pal[k][0];
+                    int dg = p[1] - pal[k][1];
+                    int db = p[2] - pal[k][2];
+                    int d = dr*dr + dg*dg + db*db;
+                    if ((k == 0) || (d < bestDist)) {
+                        best = k;
+                        bestDist = d;
+                    }
+                }
+                row |= static_cast<uint8_t>(best << (2*x));
+            }
+            blk[4+y] = row;
+        }
+    }
+
+    void DecodeBC1Block (const uint8_t blk[8], uint8_t *rgb, int stride)
+    {
+        uint16_t c0 = static_cast<uint16_t>(blk[0] | (blk[1] << 8));
+        uint16_t c1 = static_cast<uint16_t>(blk[2] | (blk[3] << 8));
+        int pal[4][3];
+        BC1Palette (c0, c1, pal);
+        for (int y = 0;  y < 4;  y++) {
+            for (int x = 0;  x < 4;  x++) {
+                int k = (blk[4+y] >> (2*x)) & 3;
+                uint8_t *p = rgb + y*stride + 3*x;
+                p[0] = static_cast<uint8_t>(pal[k][0]);
+                p[1] = static_cast<uint8_t>(pal[k][1]);
+                p[2] = static_cast<uint8_t>(pal[k][2]);
+            }
+        }
+    }
+
+    void EncodeBC4Block (const uint8_t *src, int pixStride, int rowStride, uint8_t blk[8])
+    {
+        int v[16];
+        int vMin = 255, vMax = 0;
+        for (int y = 0;  y < 4;  y++) {
+            for (int x = 0;  x < 4;  x++) {
+                int c = src[y*rowStride + x*pixStride];
+                v[4*y+x] = c;
+                vMin = std::min(vMin, c);
+                vMax = std::max(vMax, c);
+            }
+        }
+
+        blk[0] = static_cast<uint8_t>(vMax);
+        blk[1] = static_cast<uint8_t>(vMin);
+        uint64_t bits = 0;
+        if (vMax > vMin) {
+          // eight-value mode: position k along [vMax..vMin] maps to code 0, 2..7, 1
+            int range = vMax - vMin;
+            for (int i = 0;  i < 16;  i++) {
+                int k = (14 * (vMax - v[i]) + range) / (2 * range);
+                int code = (k == 0) ? 0 : ((k == 7) ? 1 : k+1);
+                bits |= static_cast<uint64_t>(code) << (3*i);
+            }
+        }
+        // else a single value, which is selected by code 0
+        for (int i = 0;  i < 6;  i++) {
+            blk[2+i] = static_cast<uint8_t>(bits >> (8*i));
+        }
+    }
+
+    void DecodeBC4Block (const uint8_t blk[8], uint8_t *dst, int pixStride, int rowStride)
+    {
+        int pal[8];
+        BC4Palette (blk[0], blk[1], pal);
+        uint64_t bits = 0;
+        for (int i = 0;  i < 6;  i++) {
+            bits |= static_cast<uint64_t>(blk[2+i]) << (8*i);
+        }
+        for (int y = 0;  y < 4;  y++) {
+            for (int x = 0;  x < 4;  x++) {
+                int code = (bits >> (3*(4*y+x))) & 7;
+                dst[y*rowStride + x*pixStride] = static_cast<uint8_t>(pal[code]);
+            }
+        }
+    }
+
+    cs237::image2d *Compress (cs237::image2d *img, TileFormat fmt)
+    {
+        assert ((img->format() == GL_RGB) && (img->type() == GL_UNSIGNED_BYTE));
+        int wid = img->width();
+        int ht = img->height();
+        assert (((wid & 3) == 0) && ((ht & 3) == 0));
+
+        cs237::image2d *cimg = new cs237::image2d (wid, ht, GLFormat(fmt));
+        const uint8_t *src = reinterpret_cast<const uint8_t *>(img->data());
+        uint8_t *dst = reinterpret_cast<uint8_t *>(cimg->data());
+        int stride = 3 * wid;
+        int nBlkCols = wid / 4;
+
+      // each task encodes a range of block rows
+        cs237::ThreadPool::Shared()->ParallelFor (ht / 4, 4, [=] (size_t lo, size_t hi) {
+            for (size_t by = lo;  by < hi;  by++) {
+                for (int bx = 0;  bx < nBlkCols;  bx++) {
+                    const uint8_t *p = src + 4*by*stride + 3*4*bx;
+                    size_t blkIdx = by*nBlkCols + bx;
+                    if (fmt == TILE_BC1) {
+                        EncodeBC1Block (p, stride, dst + 8*blkIdx);
+                    }
+                    else {
+                        EncodeBC4Block (p, 3, stride, dst + 16*blkIdx);
+                        EncodeBC4Block (p + 1, 3, stride, dst + 16*blkIdx + 8);
+                    }
+                }
+            }
+        });
+
+        return cimg;
+    }
+
+    cs237::image2d *Decompress (cs237::image2d *img)
+    {
+        int wid = img->width();
+        int ht = img->height();
+        cs237::image2d *dimg = new cs237::image2d (wid, ht, GL_RGB, GL_UNSIGNED_BYTE);
+        const uint8_t *src = reinterpret_cast<const uint8_t *>(img->data());
+        uint8_t *dst = reinterpret_cast<uint8_t *>(dimg->data());
+        int stride = 3 * wid;
+        int nBlkCols = wid / 4;
+
+        for (int by = 0;  by < ht / 4;  by++) {
+            for (int bx = 0;  bx < nBlkCols;  bx++) {
+                uint8_t *p = dst + 4*by*stride + 3*4*bx;
+                size_t blkIdx = by*nBlkCols + bx;
+                if (img->format() == GL_COMPRESSED_RGB_S3TC_DXT1_EXT) {
+                    DecodeBC1Block (src + 8*blkIdx, p, stride);
+                }
+                else {
+                    assert (img->format() == GL_COMPRESSED_RG_RGTC2);
+                    DecodeBC4Block (src + 16*blkIdx, p, 3, stride);
+                    DecodeBC4Block (src + 16*blkIdx + 8, p + 1, 3, stride);
+                  // reconstruct the third component of the unit vector
+                    for (int y = 0;  y < 4;  y++) {
+                        for (int x = 0;  x < 4;  x++) {
+                            uint8_t *q = p + y*stride + 3*x;
+                            float u = q[0] * (2.0f / 255.0f) - 1.0f;
+                            float v = q[1] * (2.0f / 255.0f) - 1.0f;
+                            float w = std::sqrt(std::max(0.0f, 1.0f - u*u - v*v));
+                            q[2] = static_cast<uint8_t>(Clamp255(int((w + 1.0f) * 127.5f + 0.5f)));
+                        }
+                    }
+                }
+            }
+        }
+
+        return dimg;
+    }
+
+    void FlipBlocks (TileFormat fmt, int wid, int ht, uint8_t *data)
+    {
+        size_t blkSz = (fmt == TILE_BC1) ? 8 : 16;
+        int nBlkRows = ht / 4;
+        size_t rowSz = (wid / 4) * blkSz;
+
+      // reverse the order of the block rows
+        cs237::FlipRows (data, rowSz, nBlkRows);
+
+      // reverse the order of the pixel rows in each block
+        size_t nBlks = static_cast<size_t>(nBlkRows) * (wid / 4);
+        for (size_t i = 0;  i < nBlks;  i++) {
+            uint8_t *blk = data + i*blkSz;
+            if (fmt == TILE_BC1) {
+                FlipBC1Block (blk);
+            }
+            else {
+                FlipBC4Block (blk);
+                FlipBC4Block (blk + 8);
+            }
+        }
+    }
+
+} // namespace TQT
@@ -2,7 +2,8 @@
  *
  * Implementation of texture quadtrees.  This implementation is based on the public-domain
  * implementation by Thatcher Ulrich.  The main difference is that we use PNG files to
- * represent the texture data.
+ * represent the texture data.  Version 2 of the format also supports tiles that are
+ * stored as block-compressed texture data (see tqt-compress.hxx).
  *
  * \author John Reppy
  */
@@ -14,6 +15,13 @@
 
 #include "cs237.hxx"
 #include "tqt.hxx"
+#include "tqt-compress.hxx"
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 /***** inline utility functions *****/
 
@@ -35,28 +43,20 @@ inline uint32_t NodeIndex (uint32_t level, uint32_t row, uint32_t col)
     return FullSize(level) + (row << level) + col;
 }
 
-inline bool ReadUI32 (std::ifstream *inS, uint32_t &v)
+//! read a 32-bit word from the mapped file
+inline uint32_t GetUI32 (const uint8_t *p)
 {
-    if (inS->read(reinterpret_cast<char *>(&v), sizeof(v)).fail()) {
-#ifndef NDEBUG
-        std::cerr << "TextureQTree::loadImage: error reading file" << std::endl;
-#endif
-        return false;
-    }
-    else
-        return true;
+    uint32_t v;
+    std::memcpy (&v, p, sizeof(v));
+    return v;
 }
 
-inline bool ReadUI64 (std::ifstream *inS, uint64_t &v)
+//! read a 64-bit word from the mapped file
+inline uint64_t GetUI64 (const uint8_t *p)
 {
-    if (inS->read(reinterpret_cast<char *>(&v), sizeof(v)).fail()) {
-#ifndef NDEBUG
-        std::cerr << "TextureQTree::loadImage: error reading file" << std::endl;
-#endif
-        return false;
-    }
-    else
-        return true;
+    uint64_t v;
+    std::memcpy (&v, p, sizeof(v));
+    return v;
 }
 
 namespace TQT {
@@ -67,25 +67,46 @@ namespace TQT {
         uint32_t        version;        // file format version
         uint32_t        depth;          // tree depth
         uint32_t        tileSize;       // width of tiles; should be power of 2
+        uint32_t        format;         // tile format (version 2 only)
     };
 
     #define TQT_MAGIC   0x00545154      // "TQT\0" in little-endian order
-    #define TQT_VERSION 1
+    #define TQT_VERSION 2               // the current version
+    #define TQT_PNG_VERSION 1           // the version that only supports PNG tiles
 
-    static bool ReadHeader (std::ifstream *inS, Hdr &hdr)
+  // parse the header from the first nBytes of the file; the size of the header is
+  // returned in hdrSz.
+    static bool ReadHeader (const uint8_t *bytes, size_t nBytes, Hdr &hdr, size_t &hdrSz)
     {
       // read header data
-        if ((! ReadUI32(inS, hdr.magic))
-        ||  (! ReadUI32(inS, hdr.version))
-        ||  (! ReadUI32(inS, hdr.depth))
-        ||  (! ReadUI32(inS, hdr.tileSize))) {
+        if (nBytes < 4*sizeof(uint32_t)) {
             return false;
         }
+        hdr.magic = GetUI32(bytes);
+        hdr.version = GetUI32(bytes + 4);
+        hdr.depth = GetUI32(bytes + 8);
+        hdr.tileSize = GetUI32(bytes + 12);
+        hdrSz = 16;
 
       // check data
-        if ((hdr.magic != TQT_MAGIC) || (hdr.version != TQT_VERSION)) {
+        if ((hdr.magic != TQT_MAGIC)
+        || ((hdr.version != TQT_VERSION) && (hdr.version != TQT_PNG_VERSION))) {
             return false;
         }
+
+        if (hdr.version == TQT_PNG_VERSION) {
+            hdr.format = TILE_PNG;
+        }
+        else if (nBytes < 5*sizeof(uint32_t)) {
+            return false;
+        }
+        else {
+            hdr.format = GetUI32(bytes + 16);
+            hdrSz = 20;
+            if ((hdr.format != TILE_PNG) && (hdr.format != TILE_BC1) && (hdr.format != TILE_BC5)) {
+                return false;
+            }
+        }
 // FIXME: should also check that depth is reasonable and tileSize is power of 2
 
         return true;
@@ -94,71 +115,126 @@ namespace TQT {
     /***** class TextureQuadTree member functions *****/
 
     TextureQTree::TextureQTree (const char* filename)
-        : _source(nullptr)
+        : _base(nullptr), _size(0)
     {
         Hdr hdr;
+        size_t hdrSz;
 
-        std::ifstream *inS = new std::ifstream(filename);
-        if (inS->fail()) {
+      // map the file into memory
+        int fd = open (filename, O_RDONLY);
+        struct stat st;
+        if ((fd < 0) || (fstat(fd, &st) < 0)) {
 #ifndef NDEBUG
             std::cerr << "TextureQTree::TextureQTree: unable to open \""
                 << filename << "\"\n";
-            delete inS;
 #endif
             exit (1);
         }
-        else if (! ReadHeader(inS, hdr)) {
+        size_t size = static_cast<size_t>(st.st_size);
+        void *base = mmap (nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close (fd);
+        if (base == MAP_FAILED) {
+#ifndef NDEBUG
+            std::cerr << "TextureQTree::TextureQTree: unable to map \""
+                << filename << "\"\n";
+#endif
+            exit (1);
+        }
+        const uint8_t *bytes = reinterpret_cast<const uint8_t *>(base);
+
+        if (! ReadHeader(bytes, size, hdr, hdrSz)) {
 #ifndef NDEBUG
             std::cerr << "TextureQTree::TextureQTree: file \"" << filename
                 << "\" has bogus header\n";
-            delete inS;
 #endif
             exit (1);
         }
-        else {
-            this->_depth = hdr.depth;
-            this->_tileSize = hdr.tileSize;
-            int nTiles = FullSize(hdr.depth);
-            this->_toc.resize(nTiles, 0);
-            this->_source = inS;
-          // read the TOC
-            for (int i = 0;  i < nTiles;  i++) {
-                uint64_t offset;
-                if (! ReadUI64(inS, offset)) {
+
+        this->_depth = hdr.depth;
+        this->_tileSize = hdr.tileSize;
+        this->_format = static_cast<TileFormat>(hdr.format);
+        this->_base = bytes;
+        this->_size = size;
+
+      // read the TOC, which gives the starting offset of each tile
+        uint32_t nTiles = FullSize(hdr.depth);
+        if (hdrSz + nTiles * sizeof(uint64_t) > size) {
+#ifndef NDEBUG
+            std::cerr << "TextureQTree::TextureQTree: file \"" << filename
+                << "\" has bogus TOC\n";
+#endif
+            exit (1);
+        }
+        std::vector<uint64_t> offsets(nTiles);
+        for (uint32_t i = 0;  i < nTiles;  i++) {
+            offsets[i] = GetUI64(bytes + hdrSz + i * sizeof(uint64_t));
+            if (offsets[i] > size) {
 #ifndef NDEBUG
-                    std::cerr << "TextureQTree::TextureQTree: file \"" << filename
-                        << "\" has bogus TOC\n";
+                std::cerr << "TextureQTree::TextureQTree: file \"" << filename
+                    << "\" has bogus TOC\n";
 #endif
-                    this->_source = nullptr;
-                    inS->close();
-                    delete inS;
-                    exit (1);
-                }
-                this->_toc[i] = static_cast<std::streamoff>(offset);
+                exit (1);
             }
         }
+
+      // a tile extends to the start of the next tile in the file (or to the end of
+      // the file), so we sort the offsets to compute the byte ranges
+        std::vector<uint64_t> sorted(offsets);
+        std::sort (sorted.begin(), sorted.end());
+        sorted.push_back (size);
+        this->_toc.resize (nTiles);
+        for (uint32_t i = 0;  i < nTiles;  i++) {
+            uint64_t end = *std::upper_bound(sorted.begin(), sorted.end() - 1, offsets[i]);
+            this->_toc[i].data = bytes + offsets[i];
+            this->_toc[i].nBytes = static_cast<size_t>(end - offsets[i]);
+        }
     }
 
     TextureQTree::~TextureQTree ()
     {
-        if (this->_source != nullptr) {
-            this->_source->close();
-            delete this->_source;
+        if (this->_base != nullptr) {
+            munmap (const_cast<uint8_t *>(this->_base), this->_size);
         }
     }
 
+    TextureQTree::ByteRange TextureQTree::TileBytes (int level, int row, int col) const
+    {
+        assert (level < this->_depth);
+
+        uint32_t index = NodeIndex(level, row, col);
+        assert (index < this->_toc.size());
+
+        return this->_toc[index];
+    }
+
     cs237::image2d *TextureQTree::LoadImage (int level, int row, int col, bool flip)
     {
         if (! this->isValid()) {
             return nullptr;
         }
-        assert (level < this->_depth);
 
-        uint32_t index = NodeIndex(level, row, col);
-        assert (index < this->_toc.size());
+        ByteRange tile = this->TileBytes (level, row, col);
 
-        this->_source->seekg(this->_toc[index]);
-        cs237::image2d *img = new cs237::image2d (*(this->_source), flip);
+        if (this->_format != TILE_PNG) {
+          // compressed tiles are stored as raw blocks, so we just copy them
+            cs237::image2d *img = new cs237::image2d (
+                this->_tileSize, this->_tileSize, GLFormat(this->_format));
+            if (tile.nBytes < img->nBytes()) {
+#ifndef NDEBUG
+                std::cerr << "TextureQTree::LoadImage: compressed tile is truncated" << std::endl;
+#endif
+                delete img;
+                return nullptr;
+            }
+            std::memcpy (img->data(), tile.data, img->nBytes());
+            if (flip) {
+                FlipBlocks (this->_format, this->_tileSize, this->_tileSize,
+                    reinterpret_cast<uint8_t *>(img->data()));
+            }
+            return img;
+        }
+
+        cs237::image2d *img = new cs237::image2d (tile.data, tile.nBytes, flip);
         if ((img->width() != this->_tileSize)
         ||  (img->height() != this->_tileSize)
         ||  (img->format () != GL_RGB)) {
@@ -170,6 +246,35 @@ namespace TQT {
         }
     }
 
+    bool TextureQTree::LoadImage (int level, int row, int col, bool flip, cs237::image2d *img)
+    {
+        if (! this->isValid()) {
+            return false;
+        }
+
+        ByteRange tile = this->TileBytes (level, row, col);
+
+        if (this->_format != TILE_PNG) {
+            if ((img->format() != GLFormat(this->_format))
+            ||  (img->width() != this->_tileSize)
+            ||  (img->height() != this->_tileSize)
+            ||  (tile.nBytes < img->nBytes())) {
+                return false;
+            }
+            std::memcpy (img->data(), tile.data, img->nBytes());
+            if (flip) {
+                FlipBlocks (this->_format, this->_tileSize, this->_tileSize,
+                    reinterpret_cast<uint8_t *>(img->data()));
+            }
+            return true;
+        }
+
+        return img->Decode (tile.data, tile.nBytes, flip)
+            && (img->width() == this->_tileSize)
+            && (img->height() == this->_tileSize)
+            && (img->format () == GL_RGB);
+    }
+
   // Return true if the given file looks like a .tqt file of our
   // appropriate version.  Do this by attempting to read the header.
     /* static */ bool TextureQTree::isTQTFile (std::string const &filename)
@@ -178,10 +283,42 @@ namespace TQT {
         if (inS.fail()) {
             return false;
         }
-        Hdr hdr;
-        bool sts = ReadHeader (&inS, hdr);
+        uint8_t bytes[5*sizeof(uint32_t)];
+        inS.read (reinterpret_cast<char *>(bytes), sizeof(bytes));
+        size_t nBytes = inS.gcount();
         inS.close();
-        return sts;
+        Hdr hdr;
+        size_t hdrSz;
+        return ReadHeader (bytes, nBytes, hdr, hdrSz);
+    }
+
+    /* static */ bool TextureQTree::WriteHeader (
+        std::ofstream &outS, int depth, int tileSize, TileFormat fmt)
+    {
+        assert (fmt != TILE_PNG);
+
+        uint32_t hdr[5] = { TQT_MAGIC, TQT_VERSION, uint32_t(depth), uint32_t(tileSize), uint32_t(fmt) };
+        outS.write (reinterpret_cast<const char *>(hdr), sizeof(hdr));
+
+      // the tiles follow the TOC in node order and they all have the same size
+        uint32_t nTiles = FullSize(depth);
+        uint64_t tileBytes = CompressedSize(fmt, tileSize, tileSize);
+        uint64_t offset = sizeof(hdr) + nTiles * sizeof(uint64_t);
+        for (uint32_t i = 0;  i < nTiles;  i++, offset += tileBytes) {
+            outS.write (reinterpret_cast<const char *>(&offset), sizeof(offset));
+        }
+
+        return ! outS.fail();
+    }
+
+    /* static */ uint32_t TextureQTree::NumNodes (int depth)
+    {
+        return FullSize(depth);
+    }
+
+    /* static */ uint32_t TextureQTree::NodeIndex (int level, int row, int col)
+    {
+        return ::NodeIndex(level, row, col);
     }
 
 } // namespace TQT
@@ -0,0 +1,105 @@
+/*! \file asset-loader.cxx
+ *
+ * \author John Reppy
+ */
+
+/* CMSC23700 Final Project sample code (Autumn 2017)
+ *
+ * COPYRIGHT (c) 2017 John Reppy (http://cs.uchicago.edu/~jhr)
+ * All rights reserved.
+ */
+
+#include "asset-loader.hxx"
+
+AssetLoader::AssetLoader ()
+    : _t0(Clock::now()), _nPending(0), _waitT(0.0)
+{ }
+
+AssetLoader::~AssetLoader ()
+{
+    std::unique_lock<std::mutex> guard(this->_lock);
+    while (this->_nPending > 0) {
+        this->_ready.wait (guard);
+    }
+    for (auto it = this->_assets.begin();  it != this->_assets.end();  it++) {
+        delete it->_img;
+    }
+}
+
+int AssetLoader::Request (std::string const &file, bool flip, bool rgba)
+{
+    int id;
+    {
+        std::lock_guard<std::mutex> guard(this->_lock);
+        id = this->_assets.size();
+        this->_assets.push_back (Asset{file, nullptr, false, 0.0, 0.0});
+        this->_nPending++;
+    }
+
+    cs237::ThreadPool::Shared()->Enqueue ([this, id, file, flip, rgba] () {
+        double startT = this->_Now();
+        cs237::image2d *img = new cs237::image2d (file, flip);
+        if (rgba && (img->format() == GL_RGB) && (img->type() == GL_UNSIGNED_BYTE)) {
+            cs237::image2d *rgbaImg = new cs237::image2d (
+                img->width(), img->height(), GL_RGBA, GL_UNSIGNED_BYTE);
+            cs237::ExpandRGBToRGBA (
+                reinterpret_cast<const uint8_t *>(img->data()),
+                reinterpret_cast<uint8_t *>(rgbaImg->data()),
+                size_t(img->width()) * img->height());
+            delete img;
+            img = rgbaImg;
+        }
+        double endT = this->_Now();
+        std::lock_guard<std::mutex> guard(this->_lock);
+        Asset &asset = this->_assets[id];
+        asset._img = img;
+        asset._done = true;
+        asset._startT = startT;
+        asset._endT = endT;
+        this->_nPending--;
+        this->_ready.notify_all();
+    });
+
+    return id;
+}
+
+cs237::image2d *AssetLoader::Take (int id)
+{
+    double startT = this->_Now();
+    std::unique_lock<std::mutex> guard(this->_lock);
+    assert ((0 <= id) && (id < static_cast<int>(this->_assets.size())));
+    while (! this->_assets[id]._done) {
+        this->_ready.wait (guard);
+    }
+    cs237::image2d *img = this->_assets[id]._img;
+    this->_assets[id]._img = nullptr;
+    this->_waitT += this->_Now() - startT;
+
+    return img;
+}
+
+void AssetLoader::ReportTimes (std::ostream &outS)
+{
+    std::lock_guard<std::mutex> guard(this->_lock);
+    double decodeT = 0.0, readyT = 0.0;
+    outS << "asset loader:\n";
+    for (auto it = this->_assets.begin();  it != this->_assets.end();  it++) {
+        if (it->_done) {
+            outS << "  " << it->_file << ": " << (it->_endT - it->_startT)
+                << " ms to decode, ready at " << it->_endT << " ms\n";
+            decodeT += it->_endT - it->_startT;
+            if (it->_endT > readyT) readyT = it->_endT;
+        }
+        else {
+            outS << "  " << it->_file << ": pending\n";
+        }
+    }
+    outS << "  " << this->_assets.size() << " images: " << decodeT
+        << " ms of decoding, all ready at " << readyT << " ms; main thread waited " << this->_waitT << " ms\n";
+}
+
+double AssetLoader::_Now () const
+{
+    std::chrono::duration<double, std::milli> t = Clock::now() - this->_t0;
+    return t.count();
+}
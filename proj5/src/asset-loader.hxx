@@ -0,0 +1,79 @@
+/*! \file asset-loader.hxx
+ *
+ * \author John Reppy
+ *
+ * Support for decoding the images that the viewer needs at startup (e.g., the
+ * skybox faces and the detail texture) on worker threads, so that the decoding
+ * overlaps with the setup of the OpenGL context and the compilation of shaders.
+ */
+
+/* CMSC23700 Final Project sample code (Autumn 2017)
+ *
+ * COPYRIGHT (c) 2017 John Reppy (http://cs.uchicago.edu/~jhr)
+ * All rights reserved.
+ */
+
+#ifndef _ASSET_LOADER_HXX_
+#define _ASSET_LOADER_HXX_
+
+#include "cs237.hxx"
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//! A loader that decodes image files in the background.  Images are requested
+//! up front and then claimed (in any order) once the main thread is ready to upload
+//! them to OpenGL.  The loader records how long each image took to decode, so that
+//! cold-start latency can be tracked.
+class AssetLoader {
+  public:
+
+  //! create a loader that runs its decode jobs on the shared thread pool
+    AssetLoader ();
+
+  //! the destructor waits for any outstanding decodes and frees unclaimed images
+    ~AssetLoader ();
+
+  //! request that an image file be decoded
+  //! \param file the name of the PNG file
+  //! \param flip should the image be flipped vertically to match OpenGL
+  //! \param rgba should an RGB image be expanded to RGBA (e.g., so that it can be
+  //!        copied directly into a GL_RGBA texture)
+  //! \return the ID of the request, which is used to claim the image
+    int Request (std::string const &file, bool flip = true, bool rgba = false);
+
+  //! claim a decoded image, blocking until it is available
+  //! \param id the ID returned by Request
+  //! \return the image; the caller is responsible for its storage
+    cs237::image2d *Take (int id);
+
+  //! log the decode time of each image and the time that the main thread spent
+  //! waiting in Take
+    void ReportTimes (std::ostream &outS);
+
+  private:
+    typedef std::chrono::steady_clock Clock;
+
+  //! the state of a requested image
+    struct Asset {
+        std::string     _file;          //!< the image file
+        cs237::image2d  *_img;          //!< the decoded image (nullptr until done)
+        bool            _done;          //!< true once the image has been decoded
+        double          _startT;        //!< when decoding started (ms since creation)
+        double          _endT;          //!< when decoding finished (ms since creation)
+    };
+
+    Clock::time_point   _t0;            //!< when the loader was created
+    std::mutex          _lock;          //!< protects _assets
+    std::condition_variable _ready;     //!< signaled when an image has been decoded
+    std::vector<Asset>  _assets;        //!< the requested images
+    int                 _nPending;      //!< number of decodes that have not finished
+    double              _waitT;         //!< total time spent waiting in Take (ms)
+
+  //! the time in milliseconds since the loader was created
+    double _Now () const;
+};
+
+#endif // !_ASSET_LOADER_HXX_
@@ -0,0 +1,146 @@
+/*! \file compiled-file.cxx
+ *
+ * \author John Reppy
+ */
+
+/* CMSC23700 Final Project sample code (Autumn 2017)
+ *
+ * COPYRIGHT (c) 2017 John Reppy (http://cs.uchicago.edu/~jhr)
+ * All rights reserved.
+ */
+
+#include "compiled-file.hxx"
+#include <cstdio>
+#include <fstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//! the version of the compiled-file format; this should be incremented whenever the
+//! layout of the header or of a payload changes
+static const uint32_t kVersion = 2;
+
+//! the magic number at the start of a compiled file
+static const char kMagic[8] = { 'c', 's', '2', '3', '7', 'b', 'i', 'n' };
+
+//! the header of a compiled file; the payload follows the header
+struct Header {
+    char        magic[8];       //!< kMagic
+    uint32_t    version;        //!< kVersion
+    uint32_t    kind;           //!< the kind of payload
+    uint32_t    byteOrder;      //!< 0x01020304 in the writer's byte order
+    uint32_t    pad;
+    int64_t     srcMTime;       //!< modification time of the source file (seconds)
+    int64_t     srcMTimeNSec;   //!< nanosecond part of the modification time, which
+                                //!< catches edits within the same second
+    int64_t     srcSize;        //!< size of the source file
+    uint64_t    payloadSize;    //!< size of the payload in bytes
+};
+
+static std::string CompiledPath (std::string const &src)
+{
+    return src + ".bin";
+}
+
+// initialize a header for the source file; returns false if the source does not exist
+static bool InitHeader (std::string const &src, CompiledFile::Kind kind, Header &hdr)
+{
+    struct stat st;
+    if (stat(src.c_str(), &st) < 0) {
+        return false;
+    }
+    std::memset (&hdr, 0, sizeof(hdr));
+    std::memcpy (hdr.magic, kMagic, sizeof(kMagic));
+    hdr.version = kVersion;
+    hdr.kind = kind;
+    hdr.byteOrder = 0x01020304;
+    hdr.srcMTime = static_cast<int64_t>(st.st_mtime);
+#ifdef __APPLE__
+    hdr.srcMTimeNSec = static_cast<int64_t>(st.st_mtimespec.tv_nsec);
+#else
+    hdr.srcMTimeNSec = static_cast<int64_t>(st.st_mtim.tv_nsec);
+#endif
+    hdr.srcSize = static_cast<int64_t>(st.st_size);
+    return true;
+}
+
+CompiledFile *CompiledFile::Open (std::string const &src, Kind kind)
+{
+    Header expected;
+    if (! InitHeader (src, kind, expected)) {
+        return nullptr;
+    }
+
+  // map the compiled file into memory
+    int fd = open (CompiledPath(src).c_str(), O_RDONLY);
+    if (fd < 0) {
+        return nullptr;
+    }
+    struct stat st;
+    if ((fstat(fd, &st) < 0) || (static_cast<size_t>(st.st_size) < sizeof(Header))) {
+        close (fd);
+        return nullptr;
+    }
+    size_t mapSz = static_cast<size_t>(st.st_size);
+    void *base = mmap (nullptr, mapSz, PROT_READ, MAP_PRIVATE, fd, 0);
+    close (fd);
+    if (base == MAP_FAILED) {
+        return nullptr;
+    }
+
+  // check that the compiled file matches the source
+    const Header *hdr = reinterpret_cast<const Header *>(base);
+    if ((std::memcmp(hdr->magic, kMagic, sizeof(kMagic)) != 0)
+    ||  (hdr->version != expected.version)
+    ||  (hdr->kind != expected.kind)
+    ||  (hdr->byteOrder != expected.byteOrder)
+    ||  (hdr->srcMTime != expected.srcMTime)
+    ||  (hdr->srcMTimeNSec != expected.srcMTimeNSec)
+    ||  (hdr->srcSize != expected.srcSize)
+    ||  (hdr->payloadSize != mapSz - sizeof(Header))) {
+        munmap (base, mapSz);
+        return nullptr;
+    }
+
+    return new CompiledFile (
+        base, mapSz,
+        reinterpret_cast<const uint8_t *>(base) + sizeof(Header),
+        static_cast<size_t>(hdr->payloadSize));
+}
+
+bool CompiledFile::Write (std::string const &src, Kind kind, std::vector<uint8_t> const &payload)
+{
+    Header hdr;
+    if (! InitHeader (src, kind, hdr)) {
+        return false;
+    }
+    hdr.payloadSize = payload.size();
+
+    std::string dst = CompiledPath(src);
+    std::string tmp = dst + "." + std::to_string(getpid());
+    {
+        std::ofstream outS(tmp, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (outS.fail()) {
+            return false;
+        }
+        outS.write (reinterpret_cast<const char *>(&hdr), sizeof(hdr));
+        outS.write (reinterpret_cast<const char *>(payload.data()), payload.size());
+        if (outS.fail()) {
+            outS.close();
+            std::remove (tmp.c_str());
+            return false;
+        }
+    }
+    if (std::rename (tmp.c_str(), dst.c_str()) != 0) {
+        std::remove (tmp.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+CompiledFile::~CompiledFile ()
+{
+    munmap (this->_base, this->_mapSz);
+}
@@ -0,0 +1,172 @@
+/*! \file compiled-file.hxx
+ *
+ * \author John Reppy
+ *
+ * Support for compiled (binary) sidecars of the JSON files that describe a map.  The
+ * compiled form of a file "foo.json" is stored in "foo.json.bin" next to it.  It
+ * records the version of the format and the modification time (to the nanosecond)
+ * and size of the JSON file, so that it is ignored (and rewritten) when the JSON file
+ * changes.  A valid
+ * compiled file is memory mapped, so loading it does not require any text parsing.
+ */
+
+/* CMSC23700 Final Project sample code (Autumn 2017)
+ *
+ * COPYRIGHT (c) 2017 John Reppy (http://cs.uchicago.edu/~jhr)
+ * All rights reserved.
+ */
+
+#ifndef _COMPILED_FILE_HXX_
+#define _COMPILED_FILE_HXX_
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+//! a read-only, memory-mapped compiled file
+class CompiledFile {
+  public:
+
+  //! the kinds of compiled files
+    enum Kind {
+        MAP = 1,        //!< the parameters and grid of a map.json file
+        OBJECTS = 2     //!< the instances of an objects.json file
+    };
+
+  //! map the compiled form of a JSON file
+  //! \param src the JSON file
+  //! \param kind the kind of data in the compiled file
+  //! \return the compiled file, or nullptr if it is missing, has the wrong version or
+  //!         kind, or is out of date with respect to src
+    static CompiledFile *Open (std::string const &src, Kind kind);
+
+  //! write the compiled form of a JSON file.  The file is written to a temporary and
+  //! then renamed, so readers never see a partial file.
+  //! \param src the JSON file
+  //! \param kind the kind of data in the compiled file
+  //! \param payload the contents of the compiled file
+  //! \return false if the file could not be written (e.g., the directory is read only)
+    static bool Write (std::string const &src, Kind kind, std::vector<uint8_t> const &payload);
+
+    ~CompiledFile ();
+
+  //! the payload of the file
+    const uint8_t *Data () const { return this->_data; }
+
+  //! the size of the payload in bytes
+    size_t Size () const { return this->_size; }
+
+  private:
+    void        *_base;         //!< the base address of the mapping
+    size_t      _mapSz;         //!< the size of the mapping
+    const uint8_t *_data;       //!< the payload
+    size_t      _size;          //!< the size of the payload
+
+    CompiledFile (void *base, size_t mapSz, const uint8_t *data, size_t size)
+        : _base(base), _mapSz(mapSz), _data(data), _size(size)
+    { }
+};
+
+//! helper class for building the payload of a compiled file.  Values are stored in
+//! the host's byte order.
+class CompiledWriter {
+  public:
+    CompiledWriter () : _bytes() { }
+
+  //! append a plain-old-data value
+    template <typename T>
+    void Put (T const &v)
+    {
+        const uint8_t *p = reinterpret_cast<const uint8_t *>(&v);
+        this->_bytes.insert (this->_bytes.end(), p, p + sizeof(T));
+    }
+
+  //! append an array of plain-old-data values; the array is aligned to its element size
+    template <typename T>
+    void PutArray (const T *v, size_t n)
+    {
+        this->Align (alignof(T));
+        const uint8_t *p = reinterpret_cast<const uint8_t *>(v);
+        this->_bytes.insert (this->_bytes.end(), p, p + n * sizeof(T));
+    }
+
+  //! append a string
+    void PutString (std::string const &s)
+    {
+        this->Put (static_cast<uint32_t>(s.size()));
+        this->_bytes.insert (this->_bytes.end(), s.begin(), s.end());
+    }
+
+  //! pad the payload to a multiple of n bytes
+    void Align (size_t n)
+    {
+        while (this->_bytes.size() % n != 0) {
+            this->_bytes.push_back (0);
+        }
+    }
+
+  //! the payload
+    std::vector<uint8_t> const &Bytes () const { return this->_bytes; }
+
+  private:
+    std::vector<uint8_t> _bytes;
+};
+
+//! helper class for reading the payload of a compiled file.  All reads are bounds
+//! checked; once a read fails, all further reads fail.
+class CompiledReader {
+  public:
+    CompiledReader (CompiledFile const *file)
+        : _base(file->Data()), _pos(0), _size(file->Size()), _ok(true)
+    { }
+
+  //! read a plain-old-data value
+    template <typename T>
+    bool Get (T &v)
+    {
+        if (! this->_check (sizeof(T))) return false;
+        std::memcpy (&v, this->_base + this->_pos, sizeof(T));
+        this->_pos += sizeof(T);
+        return true;
+    }
+
+  //! get a pointer to an array of plain-old-data values in the file
+  //! \return the array or nullptr on error
+    template <typename T>
+    const T *GetArray (size_t n)
+    {
+        this->_pos = (this->_pos + alignof(T) - 1) & ~(alignof(T) - 1);
+        if ((n > this->_size) || ! this->_check (n * sizeof(T))) return nullptr;
+        const T *p = reinterpret_cast<const T *>(this->_base + this->_pos);
+        this->_pos += n * sizeof(T);
+        return p;
+    }
+
+  //! read a string
+    bool GetString (std::string &s)
+    {
+        uint32_t len;
+        if (! this->Get(len) || ! this->_check(len)) return false;
+        s.assign (reinterpret_cast<const char *>(this->_base + this->_pos), len);
+        this->_pos += len;
+        return true;
+    }
+
+  //! return true if all reads have succeeded
+    bool ok () const { return this->_ok; }
+
+  private:
+    const uint8_t       *_base;
+    size_t              _pos;
+    size_t              _size;
+    bool                _ok;
+
+    bool _check (size_t n)
+    {
+        this->_ok = this->_ok && (this->_pos <= this->_size) && (n <= this->_size - this->_pos);
+        return this->_ok;
+    }
+};
+
+#endif // !_COMPILED_FILE_HXX_
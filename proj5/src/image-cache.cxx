@@ -0,0 +1,144 @@
+/*! \file image-cache.cxx
+ *
+ * \author John Reppy
+ */
+
+/* CMSC23700 Final Project sample code (Autumn 2017)
+ *
+ * COPYRIGHT (c) 2017 John Reppy (http://cs.uchicago.edu/~jhr)
+ * All rights reserved.
+ */
+
+#include "image-cache.hxx"
+
+// the maximum number of evicted images that are kept for reuse
+#define MAX_FREE_IMAGES         32
+
+ImageCache::ImageCache (size_t budget)
+    : _budget(budget), _size(0), _nFree(0), _freeSize(0), _nHits(0), _nMisses(0), _nEvictions(0),
+      _nRecycled(0)
+{ }
+
+ImageCache::~ImageCache ()
+{ }
+
+ImageCache::Image ImageCache::Get (TQT::TextureQTree *tree, int level, int row, int col)
+{
+    Key key(tree, level, row, col);
+    Image img;
+
+    {
+        std::lock_guard<std::mutex> guard(this->_lock);
+        auto got = this->_entryTbl.find(key);
+        if (got != this->_entryTbl.end()) {
+          // move the entry to the front of the LRU list
+            this->_lru.splice (this->_lru.begin(), this->_lru, got->second);
+            this->_nHits++;
+            return got->second->_img;
+        }
+        this->_nMisses++;
+      // grab an evicted image from the same tree to decode into
+        auto fl = this->_free.find(tree);
+        if ((fl != this->_free.end()) && (! fl->second.empty())) {
+            img = fl->second.back();
+            fl->second.pop_back();
+            this->_nFree--;
+            this->_freeSize -= img->nBytes();
+        }
+    }
+
+  // read the image without holding the lock, since decoding a tile is expensive
+  // and TextureQTree::LoadImage is reentrant
+    if ((img != nullptr) && tree->LoadImage (level, row, col, false, img.get())) {
+        std::lock_guard<std::mutex> guard(this->_lock);
+        this->_nRecycled++;
+    }
+    else {
+        img.reset (tree->LoadImage (level, row, col, false));
+        if (img == nullptr) {
+            return img;
+        }
+    }
+
+    std::lock_guard<std::mutex> guard(this->_lock);
+    auto got = this->_entryTbl.find(key);
+    if (got != this->_entryTbl.end()) {
+      // another thread loaded the same tile while we were decoding it, so we
+      // use its image and discard ours.
+        this->_lru.splice (this->_lru.begin(), this->_lru, got->second);
+        return got->second->_img;
+    }
+    this->_lru.push_front (Entry{key, img});
+    this->_entryTbl.insert (std::pair<Key,LRUList::iterator>(key, this->_lru.begin()));
+    this->_size += img->nBytes();
+    this->_Trim ();
+
+    return img;
+
+}
+
+size_t ImageCache::Size ()
+{
+    std::lock_guard<std::mutex> guard(this->_lock);
+    return this->_size + this->_freeSize;
+}
+
+uint64_t ImageCache::NumHits ()
+{
+    std::lock_guard<std::mutex> guard(this->_lock);
+    return this->_nHits;
+}
+
+uint64_t ImageCache::NumMisses ()
+{
+    std::lock_guard<std::mutex> guard(this->_lock);
+    return this->_nMisses;
+}
+
+uint64_t ImageCache::NumEvictions ()
+{
+    std::lock_guard<std::mutex> guard(this->_lock);
+    return this->_nEvictions;
+}
+
+uint64_t ImageCache::NumRecycled ()
+{
+    std::lock_guard<std::mutex> guard(this->_lock);
+    return this->_nRecycled;
+}
+
+// discard free images and then evict images from the back of the LRU list until we
+// are within budget.  Holders of an evicted image keep it alive, so it is safe to evict
+// an image that is in use, but only images that no one else holds can go on the free
+// list, and only when there is room for them in the budget.
+void ImageCache::_Trim ()
+{
+    while (this->_size + this->_freeSize > this->_budget) {
+        if (this->_nFree > 0) {
+            for (auto fl = this->_free.begin();  fl != this->_free.end();  fl++) {
+                if (! fl->second.empty()) {
+                    this->_freeSize -= fl->second.back()->nBytes();
+                    fl->second.pop_back();
+                    this->_nFree--;
+                    break;
+                }
+            }
+            continue;
+        }
+        if (this->_lru.empty()) {
+            break;
+        }
+        Entry &victim = this->_lru.back();
+        size_t nb = victim._img->nBytes();
+        this->_size -= nb;
+        if ((victim._img.use_count() == 1) && (this->_nFree < MAX_FREE_IMAGES)
+        && (this->_size + nb <= this->_budget)) {
+            this->_free[victim._key._tree].push_back (victim._img);
+            this->_nFree++;
+            this->_freeSize += nb;
+        }
+        this->_entryTbl.erase (victim._key);
+        this->_lru.pop_back();
+        this->_nEvictions++;
+    }
+}
@@ -0,0 +1,132 @@
+/*! \file image-cache.hxx
+ *
+ * \author John Reppy
+ *
+ * A CPU-side cache of decoded TQT tiles.  This cache sits between the texture
+ * quadtree files and the OpenGL texture cache, so that a tile whose texture has
+ * been evicted from OpenGL can be made resident again without reading and decoding
+ * its image a second time.
+ */
+
+/* CMSC23700 Final Project sample code (Autumn 2017)
+ *
+ * COPYRIGHT (c) 2017 John Reppy (http://cs.uchicago.edu/~jhr)
+ * All rights reserved.
+ */
+
+#ifndef _IMAGE_CACHE_HXX_
+#define _IMAGE_CACHE_HXX_
+
+#include "tqt.hxx"
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+//! A byte-budgeted LRU cache of tile images that is keyed by (tree, level, row, col).
+//! A single cache can be shared by any number of texture quadtrees (e.g., both the
+//! color and normal-map trees of every cell) and it is safe to access it from
+//! multiple threads.  Images are returned as shared pointers, so an image that is
+//! evicted while another thread is still using it stays live until it is released.
+//! Evicted images that are no longer in use are kept on a small free list and their
+//! storage is reused when decoding another tile from the same tree; the free list
+//! counts against the cache's budget.
+class ImageCache {
+  public:
+
+  //! an image held by the cache
+    typedef std::shared_ptr<cs237::image2d> Image;
+
+  //! create an image cache
+  //! \param budget the upper bound on the number of bytes of image data in the cache
+    explicit ImageCache (size_t budget);
+    ~ImageCache ();
+
+  //! get the image for a tile, reading it from its TQT file if it is not in the cache
+  //! \param tree the texture quadtree that holds the tile
+  //! \param level the level of the tile
+  //! \param row the row of the tile
+  //! \param col the column of the tile
+  //! \return the tile's image, or nullptr if it could not be loaded
+    Image Get (TQT::TextureQTree *tree, int level, int row, int col);
+
+  //! the upper bound on the number of bytes of image data in the cache
+    size_t Budget () const { return this->_budget; }
+
+  //! the number of bytes of image data in the cache, including the free list
+    size_t Size ();
+
+  //! the number of requests that were satisfied from memory
+    uint64_t NumHits ();
+
+  //! the number of requests that required reading the TQT file
+    uint64_t NumMisses ();
+
+  //! the number of images that were evicted to stay within the budget
+    uint64_t NumEvictions ();
+
+  //! the number of misses that decoded into the storage of an evicted image
+    uint64_t NumRecycled ();
+
+  private:
+  //! keys for hashing tiles
+    struct Key {
+        TQT::TextureQTree       *_tree; //!< the texture quadtree that holds the tile
+        int                     _level; //!< the TQT level of the tile
+        int                     _row;   //!< the TQT row of the tile
+        int                     _col;   //!< the TQT column of the tile
+
+        Key (TQT::TextureQTree *t, int l, int r, int c)
+            : _tree(t), _level(l), _row(r), _col(c)
+        { }
+    };
+  //! hashing keys
+    struct Hash {
+        std::size_t operator() (Key const &k) const
+        {
+            return static_cast<std::size_t>(
+                reinterpret_cast<std::size_t>(k._tree) +
+                (static_cast<int>(k._level) << 5) * 101 +
+                (static_cast<int>(k._row) << 10) * 101 +
+                static_cast<int>(k._col));
+        }
+    };
+  //! equality test on keys
+    struct Equal {
+        bool operator()(Key const &k1, Key const &k2) const
+        {
+            return (k1._tree == k2._tree) && (k1._level == k2._level)
+                && (k1._row == k2._row) && (k1._col == k2._col);
+        }
+    };
+
+  //! a cached image; the front of the LRU list is the most-recently used entry
+    struct Entry {
+        Key             _key;   //!< the tile
+        Image           _img;   //!< the tile's image
+    };
+    typedef std::list<Entry> LRUList;
+    typedef std::unordered_map<Key,LRUList::iterator,Hash,Equal> EntryTbl;
+
+    std::mutex  _lock;          //!< protects the following fields
+    size_t      _budget;        //!< upper bound on the size of the cached images
+    size_t      _size;          //!< the total size of the cached images
+    LRUList     _lru;           //!< the cached images in LRU order
+    EntryTbl    _entryTbl;      //!< mapping from tiles to their entries
+    std::unordered_map<TQT::TextureQTree *, std::vector<Image>> _free;
+                                //!< evicted images that are available for reuse,
+                                //!  grouped by the tree that they came from
+    int         _nFree;         //!< the number of images on the free lists
+    size_t      _freeSize;      //!< the total size of the images on the free lists
+    uint64_t    _nHits;         //!< number of requests found in the cache
+    uint64_t    _nMisses;       //!< number of requests that read the TQT file
+    uint64_t    _nEvictions;    //!< number of images evicted
+    uint64_t    _nRecycled;     //!< number of misses that reused an evicted image
+
+  //! discard free images and evict least-recently-used images until the cache and
+  //! its free list fit within the budget; the cache must be locked.
+    void _Trim ();
+};
+
+#endif // !_IMAGE_CACHE_HXX_
@@ -0,0 +1,84 @@
+/*! \file instance-batch.cxx
+ *
+ * \author John Reppy
+ */
+
+/* CMSC23700 Final Project sample code (Autumn 2017)
+ *
+ * COPYRIGHT (c) 2017 John Reppy (http://cs.uchicago.edu/~jhr)
+ * All rights reserved.
+ */
+
+#include "instance-batch.hxx"
+#include "map-objects.hxx"
+
+void InstanceBatches::Clear ()
+{
+    this->_index.clear();
+    this->_batches.clear();
+    this->_batchOf.clear();
+    this->_added.clear();
+    this->_data.clear();
+}
+
+void InstanceBatches::Add (
+    CellObjects const &objs,
+    uint32_t inst,
+    int lod,
+    cs237::vec3f const &origin)
+{
+    InstanceData data;
+
+  // the model matrix maps to the cell's coordinates and then translates by the cell's
+  // camera-relative origin
+    data.modelMat = objs.ToCell(inst);
+    data.modelMat[3] = data.modelMat[3] + cs237::vec4f(origin, 0.0f);
+    cs237::mat3f const &normMat = objs.NormToWorld(inst);
+    for (int i = 0;  i < 3;  i++) {
+        data.normMat[i] = cs237::vec4f(normMat[i], 0.0f);
+    }
+    data.color = cs237::color4f(objs.Color(inst));
+
+    const GObject *meshes = objs.Meshes(inst);
+    for (auto it = meshes->begin();  it != meshes->end();  it++) {
+        this->Add (*it, lod, data);
+    }
+}
+
+void InstanceBatches::Add (TriMesh *mesh, int lod, InstanceData const &data)
+{
+    Key key = { mesh, lod };
+    auto it = this->_index.find(key);
+    uint32_t b;
+    if (it == this->_index.end()) {
+        b = this->_batches.size();
+        this->_batches.push_back (Batch{mesh, lod, 0, 0});
+        this->_index.insert (std::pair<Key, uint32_t>(key, b));
+    }
+    else {
+        b = it->second;
+    }
+    this->_batches[b].count++;
+    this->_batchOf.push_back (b);
+    this->_added.push_back (data);
+}
+
+void InstanceBatches::Finish ()
+{
+  // assign the ranges of the batches
+    uint32_t first = 0;
+    for (auto it = this->_batches.begin();  it != this->_batches.end();  it++) {
+        it->first = first;
+        first += it->count;
+    }
+
+  // copy the instances into their batches' ranges
+    std::vector<uint32_t> next(this->_batches.size());
+    for (size_t b = 0;  b < this->_batches.size();  b++) {
+        next[b] = this->_batches[b].first;
+    }
+    this->_data.resize (this->_added.size());
+    for (size_t i = 0;  i < this->_added.size();  i++) {
+        this->_data[next[this->_batchOf[i]]++] = this->_added[i];
+    }
+}
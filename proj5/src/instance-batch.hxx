@@ -0,0 +1,108 @@
+/*! \file instance-batch.hxx
+ *
+ * Support for instanced rendering of map objects.  The visible instances of a frame
+ * are grouped into batches, one per mesh and level of detail, and their per-instance
+ * attributes are packed into one array, so that each batch can be drawn with a single
+ * glDrawElementsInstanced call.  This code does not make any OpenGL calls, so it can
+ * be used without a GL context.
+ *
+ * \author John Reppy
+ */
+
+/* CMSC23700 Final Project sample code (Autumn 2017)
+ *
+ * COPYRIGHT (c) 2017 John Reppy (http://cs.uchicago.edu/~jhr)
+ * All rights reserved.
+ */
+
+#ifndef _INSTANCE_BATCH_HXX_
+#define _INSTANCE_BATCH_HXX_
+
+#include "cs237.hxx"
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+class TriMesh;  // defined in mesh.hxx
+class CellObjects;  // defined in map-objects.hxx
+
+//! the per-instance vertex attributes of a mesh instance.  The layout must match the
+//! instance attributes that are set up by TriMesh::DrawInstanced.
+struct InstanceData {
+    cs237::mat4f        modelMat;       //!< maps object space to camera-relative world space
+    cs237::vec4f        normMat[3];     //!< the columns of the matrix that maps object-space
+                                        //!  normals to world space (the w components are 0)
+    cs237::color4f      color;          //!< the instance's color
+};
+
+//! the instances of a frame grouped by mesh and level of detail
+class InstanceBatches {
+  public:
+
+  //! a batch of instances of a mesh at one level of detail
+    struct Batch {
+        TriMesh         *mesh;          //!< the mesh
+        int             lod;            //!< the level of detail
+        uint32_t        first;          //!< the index of the first instance in Data()
+        uint32_t        count;          //!< the number of instances
+    };
+
+    InstanceBatches () { }
+
+  //! remove all of the instances and batches
+    void Clear ();
+
+  //! add the meshes of an object instance
+  //! \param objs the objects of the instance's cell
+  //! \param inst the index of the instance in objs
+  //! \param lod the level of detail to draw the instance at
+  //! \param origin the position of the NW corner of the instance's cell relative to
+  //!        the camera
+    void Add (CellObjects const &objs, uint32_t inst, int lod, cs237::vec3f const &origin);
+
+  //! add an instance of a mesh
+  //! \param mesh the mesh
+  //! \param lod the level of detail to draw the instance at
+  //! \param data the per-instance attributes
+    void Add (TriMesh *mesh, int lod, InstanceData const &data);
+
+  //! pack the instance data so that the instances of each batch are contiguous.  The
+  //! batches are in the order of their first instance and the instances of a batch are
+  //! in the order that they were added.
+    void Finish ();
+
+  //! the number of batches (i.e., draw calls)
+    int NumBatches () const { return this->_batches.size(); }
+  //! get a batch
+    Batch const &GetBatch (int i) const { return this->_batches[i]; }
+  //! iterator for looping over the batches
+    std::vector<Batch>::const_iterator begin () const { return this->_batches.begin(); }
+  //! terminator for looping over the batches
+    std::vector<Batch>::const_iterator end () const { return this->_batches.end(); }
+
+  //! the number of mesh instances
+    size_t NumInstances () const { return this->_added.size(); }
+  //! the packed per-instance attributes; this is only valid after Finish has been called
+    const InstanceData *Data () const { return this->_data.data(); }
+
+  private:
+    struct Key {
+        const TriMesh   *mesh;
+        int             lod;
+        bool operator== (Key const &k) const { return (this->mesh == k.mesh) && (this->lod == k.lod); }
+    };
+    struct KeyHash {
+        size_t operator() (Key const &k) const
+        {
+            return std::hash<const TriMesh *>()(k.mesh) ^ (size_t(k.lod) * 0x9e3779b9);
+        }
+    };
+
+    std::unordered_map<Key, uint32_t, KeyHash> _index;  //!< map from keys to batches
+    std::vector<Batch>          _batches;       //!< the batches
+    std::vector<uint32_t>       _batchOf;       //!< the batch of each added instance
+    std::vector<InstanceData>   _added;         //!< the instances in the order added
+    std::vector<InstanceData>   _data;          //!< the instances grouped by batch
+};
+
+#endif // !_INSTANCE_BATCH_HXX_
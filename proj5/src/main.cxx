@@ -14,6 +14,8 @@
 #include "map-cell.hxx"
 #include "view.hxx"
 #include <unistd.h>
+#include <chrono>
+#include <cstring>
 
 /***** callbacks *****
  *
@@ -86,14 +88,33 @@ int main (int argc, const char **argv)
     Map map;
 
 
-  // get the mapfile
-    if (argc < 2) {
-        std::cerr << "usage: proj5 <map-dir>\n";
+  // get the mapfile; the "-no-cache" option forces the JSON and OBJ files to be parsed
+  // instead of loading their compiled forms and the "-droplets" option sets the maximum
+  // number of rain droplets
+    const char *usage = "usage: proj5 [-no-cache] [-droplets n] <map-dir>\n";
+    bool useCache = true;
+    int argi = 1;
+    for (;  (argi < argc) && (argv[argi][0] == '-');  argi++) {
+        if (strcmp(argv[argi], "-no-cache") == 0) {
+            useCache = false;
+        }
+        else if ((strcmp(argv[argi], "-droplets") == 0) && (argi+1 < argc)
+        && (atoi(argv[argi+1]) > 0)) {
+            map.SetMaxDroplets (atoi(argv[++argi]));
+        }
+        else {
+            std::cerr << usage;
+            return 1;
+        }
+    }
+    if (argc - argi != 1) {
+        std::cerr << usage;
         return 1;
     }
-    std::string mapDir(argv[1]);
+    std::string mapDir(argv[argi]);
     std::clog << "loading " << mapDir << std::endl;
-    if (! map.LoadMap (mapDir)) {
+    auto startT = std::chrono::steady_clock::now();
+    if (! map.LoadMap (mapDir, true, useCache)) {
         return 1;
     }
 
@@ -103,6 +124,9 @@ int main (int argc, const char **argv)
             map.Cell(r, c)->Load();
         }
     }
+    std::chrono::duration<double, std::milli> loadT = std::chrono::steady_clock::now() - startT;
+    std::clog << "map loaded in " << loadT.count() << " ms"
+        << (useCache ? "" : " (without compiled files)") << "\n";
 
     std::clog << "initializing view\n";
     View *view = new View (&map);
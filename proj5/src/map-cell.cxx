@@ -172,13 +172,21 @@ void Cell::Load ()
 
 }
 
-// load objects for a cell
+// request that the objects of the cell be loaded in the background
 //
-void Cell::LoadObjects ()
+void Cell::RequestObjects ()
 {
-    if (this->_map->_objects->LoadObjects (this->_stem, this->_objects)) {
-        std::cerr << "Cell::load: error loading objects for cell\n";
-        exit (1);
+    if (this->_map->hasObjects()) {
+        this->_map->_objects->Request (this);
+    }
+}
+
+// release the objects of the cell
+//
+void Cell::ReleaseObjects ()
+{
+    if (this->_map->hasObjects()) {
+        this->_map->_objects->Release (this);
     }
 }
 
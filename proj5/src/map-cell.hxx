@@ -27,9 +27,9 @@
 #include "qtree-util.hxx"
 #include "tqt.hxx"
 #include "buffer-cache.hxx"
+#include "map-objects.hxx"
 
 class Tile;
-struct Instance; // defined in map-objects.hxx
 
 class Cell {
   public:
@@ -74,8 +74,16 @@ class Cell {
   //! initialize the textures for the cell
     void InitTextures (class View *view);
 
-  //! load any objects that are in the cell
-    void LoadObjects ();
+  //! request that the objects in the cell be loaded.  The objects are loaded in the
+  //! background and become available in some later frame (see Objects::NewFrame).
+    void RequestObjects ();
+
+  //! release the objects in the cell (or cancel a pending request)
+    void ReleaseObjects ();
+
+  //! the objects that are in the cell (empty until they have been loaded)
+    CellObjects &Objects () { return this->_objects; }
+    CellObjects const &Objects () const { return this->_objects; }
 
   //! the color texture-quad-tree for this cell (nullptr if not present)
     TQT::TextureQTree *ColorTQT () const { return this->_colorTQT; }
@@ -98,7 +106,7 @@ class Cell {
                                 //! not present)
     TQT::TextureQTree *_normTQT; //!< texture quadtree for the cell's normal map (nullptr if
                                 //! not present)
-    std::vector<Instance *> _objects; //!< the objects (if any) that are on this map cell
+    CellObjects _objects;       //!< the objects (if any) that are on this map cell
 
     class Tile *LoadTile (int id);
 
@@ -183,14 +191,18 @@ class Tile {
   // render specific vao's
     void Draw(View* view, float dt);
 
+  // bind the tile's textures (or those of its nearest resident ancestor); returns
+  // false if no textures are resident
+    bool BindTextures(View* view);
+
   // return true if a point is behind a given plane
-    bool isBehind(cs237::vec3d pt, cs237::vec3d norm, double distance);
+    static bool isBehind(cs237::vec3d pt, cs237::vec3d norm, double distance);
 
  // return true the computed error metric is tolerable
     bool ErrorCheck(View* view);
 
   // return true if an AABB is within the frustum
-    bool FrustumCheck(View* view, cs237::AABBd bbox);
+    static bool FrustumCheck(View* view, cs237::AABBd bbox);
 
     void Release(View* view, int Status);
 
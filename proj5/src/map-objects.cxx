@@ -1,6 +1,6 @@
 /*! \file map-objects.cxx
  *
- * Implementation of the Objects class.
+ * Implementation of the Objects and CellObjects classes.
  *
  * \author John Reppy
  */
@@ -14,249 +14,779 @@
 #include "map.hxx"
 #include "map-cell.hxx"
 #include "mesh.hxx"
-#include "json.hxx"
+#include "camera.hxx"
+#include "json-reader.hxx"
+#include "compiled-file.hxx"
+#include <algorithm>
+#include <memory>
+#include <unordered_map>
 #include <unistd.h>
 
+//! the maximum number of models that are uploaded to OpenGL per frame
+#define UPLOADS_PER_FRAME       4
+
+//! the number of threads that run the cell load jobs.  The jobs spend most of their
+//! time waiting for file I/O or for other jobs, since the CPU-heavy parts (parsing and
+//! compiling OBJ files) are run on the shared pool, so a couple of threads are enough.
+//! The jobs are not run on the shared pool itself, because blocked jobs would tie up
+//! the workers that the render thread's parallel loops rely on.  A job only waits for
+//! a model or texture whose loading has been started by another job that is already
+//! running, and a job never waits while it is loading a texture, so the jobs cannot
+//! deadlock however few threads there are.
+#define LOADER_THREADS          2
+
 /* helper functions to make extracting values from the JSON easier */
 
-//! load a vec3f from a JSON object.
+//! read an object of three numeric fields (e.g., "x", "y", and "z") from a JSON
+//! reader; fields with other labels are ignored.
 //! \return false if okay, true if there is an error.
-bool LoadVec3 (JSON::Object const *jv, cs237::vec3f &vec)
+static bool ReadTriple (JSON::Reader &rdr, const char *labels[3], float v[3])
 {
-    if (jv == nullptr) {
+    if (rdr.next() != JSON::Reader::T_BEGIN_OBJECT) {
         return true;
     }
 
-    const JSON::Number *x = jv->fieldAsNumber("x");
-    const JSON::Number *y = jv->fieldAsNumber("y");
-    const JSON::Number *z = jv->fieldAsNumber("z");
-    if ((x == nullptr) || (y == nullptr) || (z == nullptr)) {
-        return true;
+    int found = 0;
+    while (rdr.next() == JSON::Reader::T_KEY) {
+        int i = 0;
+        while ((i < 3) && (rdr.string() != labels[i])) {
+            i++;
+        }
+        if (i < 3) {
+            rdr.next();
+            if (! rdr.isNumber()) {
+                return true;
+            }
+            v[i] = static_cast<float>(rdr.realVal());
+            found |= (1 << i);
+        }
+        else if (! rdr.skipValue()) {
+            return true;
+        }
     }
 
-    vec = cs237::vec3f (
-        static_cast<float>(x->realVal()),
-        static_cast<float>(y->realVal()),
-        static_cast<float>(z->realVal()));
+    return (rdr.token() != JSON::Reader::T_END_OBJECT) || (found != 7);
+}
 
+//! read a vec3f from a JSON reader.
+//! \return false if okay, true if there is an error.
+static bool ReadVec3 (JSON::Reader &rdr, cs237::vec3f &vec)
+{
+    static const char *labels[3] = { "x", "y", "z" };
+    float v[3];
+    if (ReadTriple (rdr, labels, v)) {
+        return true;
+    }
+    vec = cs237::vec3f (v[0], v[1], v[2]);
     return false;
 }
 
-//! load a color3f from a JSON object.
+//! read a color3f from a JSON reader.
 //! \return false if okay, true if there is an error.
-bool LoadColor (JSON::Object const *jv, cs237::color3f &color)
+static bool ReadColor (JSON::Reader &rdr, cs237::color3f &color)
 {
-    if (jv == nullptr) {
+    static const char *labels[3] = { "r", "g", "b" };
+    float v[3];
+    if (ReadTriple (rdr, labels, v)) {
         return true;
     }
+    color = cs237::color3f (v[0], v[1], v[2]);
+    return false;
+}
+
+//! read the "frame" field of an object instance from a JSON reader.
+//! \return false if okay, true if there is an error.
+static bool ReadFrame (JSON::Reader &rdr, cs237::vec3f axes[3])
+{
+    static const char *labels[3] = { "x-axis", "y-axis", "z-axis" };
 
-    const JSON::Number *r = jv->fieldAsNumber("r");
-    const JSON::Number *g = jv->fieldAsNumber("g");
-    const JSON::Number *b = jv->fieldAsNumber("b");
-    if ((r == nullptr) || (g == nullptr) || (b == nullptr)) {
+    if (rdr.next() != JSON::Reader::T_BEGIN_OBJECT) {
         return true;
     }
 
-    color = cs237::color3f (
-        static_cast<float>(r->realVal()),
-        static_cast<float>(g->realVal()),
-        static_cast<float>(b->realVal()));
+    int found = 0;
+    while (rdr.next() == JSON::Reader::T_KEY) {
+        int i = 0;
+        while ((i < 3) && (rdr.string() != labels[i])) {
+            i++;
+        }
+        if (i < 3) {
+            if (ReadVec3 (rdr, axes[i])) {
+                return true;
+            }
+            found |= (1 << i);
+        }
+        else if (! rdr.skipValue()) {
+            return true;
+        }
+    }
 
-    return false;
+    return (rdr.token() != JSON::Reader::T_END_OBJECT) || (found != 7);
 }
 
 /***** class Objects member functions *****/
 
 Objects::Objects (const Map *map)
-  : _map(map), _objsDir(map->_path + "objects/"), _objs(), _texs()
+  : _map(map), _objsDir(map->_path + "objects/"), _loader(new cs237::ThreadPool(LOADER_THREADS)),
+    _uploadLimit(UPLOADS_PER_FRAME), _objs(), _texs()
 { }
 
-// load the objects instances for a map cell
+Objects::~Objects ()
+{
+  // stop the workers first, so that no job is running while we free the loads
+    delete this->_loader;
+
+    while (! this->_cells.empty()) {
+        CellLoad *load = this->_cells.begin()->second;
+        this->_cells.erase (this->_cells.begin());
+        this->_FreeLoad (load);
+    }
+}
+
+// request the objects of a cell; the request is satisfied in the background
 //
-bool Objects::LoadObjects (std::string const &cell, std::vector<Instance *> &objs)
+void Objects::Request (Cell *cell)
 {
-    std::string objsFile = cell + "/objects.json";
+    auto it = this->_cells.find (cell);
+    if (it != this->_cells.end()) {
+      // the cell may have been released while its job was running, in which case we
+      // can just use the job's results
+        it->second->cancelled = false;
+        return;
+    }
 
-  // make sure that objs is empty
-    objs.clear();
+    CellLoad *load = new CellLoad;
+    load->cell = cell;
+    load->done = false;
+    load->failed = false;
+    load->cancelled = false;
+    load->installed = false;
+    this->_cells.insert (std::pair<const Cell *, CellLoad *>(cell, load));
 
-  // if the objects.json file does not exist, then we return the empty
-  // vector
-    if (access(objsFile.c_str(), F_OK) != 0) {
-        return false;
+    this->_loader->Enqueue ([this, load] () { this->_LoadCell (load); });
+}
+
+// release the objects of a cell
+//
+void Objects::Release (Cell *cell)
+{
+    auto it = this->_cells.find (cell);
+    if (it == this->_cells.end()) {
+        return;
     }
+    CellLoad *load = it->second;
 
-  // load the objects list
-    JSON::Value *root = JSON::ParseFile(objsFile);
+    if (load->installed) {
+        cell->Objects().Clear();
+    }
+    else {
+        std::lock_guard<std::mutex> guard(this->_lock);
+        if (! load->done) {
+          // the job still owns the load, so NewFrame frees it once the job is done
+            load->cancelled = true;
+            return;
+        }
+    }
+
+    this->_cells.erase (it);
+    this->_FreeLoad (load);
+}
+
+bool Objects::isPending (const Cell *cell) const
+{
+    auto it = this->_cells.find (cell);
+    return (it != this->_cells.end()) && (! it->second->installed);
+}
+
+// upload the models that have been loaded since the last frame and install the objects
+// of the cells whose models are resident
+//
+void Objects::NewFrame ()
+{
+    std::vector<ModelEntry *> ready;
+    std::vector<CellLoad *> finished;
+    {
+        std::lock_guard<std::mutex> guard(this->_lock);
+        size_t n = this->_toUpload.size();
+        if (n > static_cast<size_t>(this->_uploadLimit)) {
+            n = this->_uploadLimit;
+        }
+        ready.assign (this->_toUpload.begin(), this->_toUpload.begin() + n);
+        this->_toUpload.erase (this->_toUpload.begin(), this->_toUpload.begin() + n);
+        for (auto it = this->_cells.begin();  it != this->_cells.end();  it++) {
+            if (it->second->done && !it->second->installed) {
+                finished.push_back (it->second);
+            }
+        }
+    }
+
+    for (auto it = ready.begin();  it != ready.end();  it++) {
+        this->_Upload (*it);
+    }
+
+    for (auto it = finished.begin();  it != finished.end();  it++) {
+        CellLoad *load = *it;
+        if (load->failed) {
+            std::cerr << "Objects::NewFrame: error loading objects for cell\n";
+            exit (1);
+        }
+        if (load->cancelled) {
+            this->_cells.erase (load->cell);
+            this->_FreeLoad (load);
+            continue;
+        }
+        bool resident = true;
+        for (auto mIt = load->models.begin();  resident && (mIt != load->models.end());  mIt++) {
+            resident = (*mIt)->resident;
+        }
+        if (resident) {
+            load->cell->Objects() = std::move(load->objs);
+            load->installed = true;
+        }
+    }
+}
+
+struct Objects::PackedInstance {
+    float       pos[3];         //!< the position of the instance in the cell
+    float       axes[3][3];     //!< the X, Y, and Z axes of the instance's frame
+    float       color[3];       //!< the instance's color
+    uint32_t    model;          //!< the index of the instance's model
+};
+
+// the background job that loads the objects instances for a map cell
+//
+void Objects::_LoadCell (CellLoad *load)
+{
+    std::string objsFile = load->cell->Datafile("/objects.json");
+    bool failed = false;
+
+  // if the objects.json file does not exist, then the cell has no objects
+    if (access(objsFile.c_str(), F_OK) == 0) {
+        failed = this->_LoadObjects (objsFile, load);
+    }
+
+    std::lock_guard<std::mutex> guard(this->_lock);
+    load->failed = failed;
+    load->done = true;
+}
+
+// load the objects instances from a cell's objects list
+//
+bool Objects::_LoadObjects (std::string const &objsFile, CellLoad *load)
+{
+    std::vector<std::string> models;
+
+  // if there is an up-to-date compiled form of the objects list, then we can
+  // use the instances in it directly
+    if (this->_map->_useCache) {
+        std::unique_ptr<CompiledFile> cf(CompiledFile::Open(objsFile, CompiledFile::OBJECTS));
+        if (cf != nullptr) {
+            CompiledReader rdr(cf.get());
+            uint32_t nModels, nInsts;
+            if (rdr.Get(nModels)) {
+                models.resize (nModels);
+                for (uint32_t i = 0;  i < nModels;  i++) {
+                    rdr.GetString (models[i]);
+                }
+            }
+            const PackedInstance *insts = nullptr;
+            if (rdr.Get(nInsts)) {
+                insts = rdr.GetArray<PackedInstance>(nInsts);
+            }
+            if (rdr.ok() && (insts != nullptr)) {
+                this->_MakeInstances (models, insts, nInsts, load);
+                return false;
+            }
+          // otherwise, the compiled file is bogus and we fall back to the JSON file
+            models.clear();
+        }
+    }
+
+    std::vector<PackedInstance> insts;
+    if (this->_ParseObjects (objsFile, models, insts)) {
+        return true;
+    }
+
+    if (this->_map->_useCache) {
+        CompiledWriter wr;
+        wr.Put (static_cast<uint32_t>(models.size()));
+        for (auto it = models.begin();  it != models.end();  it++) {
+            wr.PutString (*it);
+        }
+        wr.Put (static_cast<uint32_t>(insts.size()));
+        wr.PutArray (insts.data(), insts.size());
+      // failing to write the compiled file is not an error
+        CompiledFile::Write (objsFile, CompiledFile::OBJECTS, wr.Bytes());
+    }
+
+    this->_MakeInstances (models, insts.data(), insts.size(), load);
+
+    return false;
+}
+
+bool Objects::_ParseObjects (
+    std::string const &objsFile,
+    std::vector<std::string> &models,
+    std::vector<PackedInstance> &insts)
+{
+  // we stream through the objects list, so that we do not need to build a JSON tree
+  // for the whole file
+    JSON::Reader rdr(objsFile);
 
   // check for errors
-    if (root == nullptr) {
+    if (! rdr.isOpen()) {
         std::cerr << "Unable to load objects list \"" << objsFile << "\"\n";
         return true;
-    } else if (! root->isArray()) {
+    } else if (rdr.next() != JSON::Reader::T_BEGIN_ARRAY) {
         std::cerr << "Invalid object list in \"" << objsFile
             << "\"; root is not an array\n";
         return true;
     }
-    const JSON::Array *rootObj = root->asArray();
 
-    if (rootObj->length() != 0) {
-      // allocate space for the objects in the scene
-        objs.reserve(rootObj->length());
-
-      // load the object instances in the cell
-        for (int i = 0;  i < rootObj->length();  i++) {
-            JSON::Object const *object = (*rootObj)[i]->asObject();
-            if (object == nullptr) {
-                std::cerr << "Expected array of JSON objects in \""
-                    << objsFile << "\"\n";
-                return true;
+  // mapping from model files to their index in models
+    std::unordered_map<std::string, uint32_t> modelIds;
+
+  // load the object instances in the cell
+    while (rdr.next() == JSON::Reader::T_BEGIN_OBJECT) {
+        cs237::vec3f pos, axes[3];
+        cs237::color3f color;
+        uint32_t model = 0;
+        int found = 0;
+        while (rdr.next() == JSON::Reader::T_KEY) {
+            std::string const &key = rdr.string();
+            bool err;
+            if (key == "file") {
+                err = (rdr.next() != JSON::Reader::T_STRING);
+                if (! err) {
+                    auto ins = modelIds.insert (
+                        std::pair<std::string, uint32_t>(rdr.string(), models.size()));
+                    if (ins.second) {
+                        models.push_back (rdr.string());
+                    }
+                    model = ins.first->second;
+                }
+                found |= 1;
             }
-            JSON::String const *file = object->fieldAsString("file");
-            JSON::Object const *frame = object->fieldAsObject("frame");
-            cs237::vec3f pos, xAxis, yAxis, zAxis;
-            cs237::color3f color;
-            if ((file == nullptr) || (frame == nullptr)
-            ||  LoadVec3 (object->fieldAsObject("pos"), pos)
-            ||  LoadVec3 (frame->fieldAsObject("x-axis"), xAxis)
-            ||  LoadVec3 (frame->fieldAsObject("y-axis"), yAxis)
-            ||  LoadVec3 (frame->fieldAsObject("z-axis"), zAxis)
-            ||  LoadColor (object->fieldAsObject("color"), color)) {
-                std::cerr << "Invalid object description in \"" << objsFile << "\"\n";
-                return true;
+            else if (key == "pos") {
+                err = ReadVec3 (rdr, pos);
+                found |= 2;
+            }
+            else if (key == "frame") {
+                err = ReadFrame (rdr, axes);
+                found |= 4;
+            }
+            else if (key == "color") {
+                err = ReadColor (rdr, color);
+                found |= 8;
+            }
+            else {
+                err = ! rdr.skipValue();
+            }
+            if (err) {
+                break;
             }
-            Instance *inst = this->_MakeInstance(
-                file->value(),
-                cs237::mat4f (
-                    cs237::vec4f (xAxis, 0.0f),
-                    cs237::vec4f (yAxis, 0.0f),
-                    cs237::vec4f (zAxis, 0.0f),
-                    cs237::vec4f (pos, 1.0f)),
-                color);
-          // add to objs vector
-            objs.push_back (inst);
         }
-
+        if ((rdr.token() != JSON::Reader::T_END_OBJECT) || (found != 15)) {
+            std::cerr << "Invalid object description in \"" << objsFile << "\"\n";
+            return true;
+        }
+        PackedInstance inst;
+        for (int i = 0;  i < 3;  i++) {
+            inst.pos[i] = pos[i];
+            inst.axes[0][i] = axes[0][i];
+            inst.axes[1][i] = axes[1][i];
+            inst.axes[2][i] = axes[2][i];
+            inst.color[i] = color[i];
+        }
+        inst.model = model;
+        insts.push_back (inst);
+    }
+    if (rdr.token() != JSON::Reader::T_END_ARRAY) {
+        if (rdr.token() == JSON::Reader::T_ERROR) {
+            std::cerr << rdr.errorMsg() << "\n";
+        }
+        std::cerr << "Expected array of JSON objects in \""
+            << objsFile << "\"\n";
+        return true;
     }
 
     return false;
 }
 
-// load an OBJ model from a file
+void Objects::_MakeInstances (
+    std::vector<std::string> const &models,
+    const PackedInstance *insts,
+    size_t nInsts,
+    CellLoad *load)
+{
+    CellObjects &objs = load->objs;
+
+  // resolve each model once, instead of once per instance.  The models' meshes are
+  // not resident yet, but their GObject vectors will not move, so the instances can
+  // refer to them.
+    for (size_t i = 0;  i < models.size();  i++) {
+        ModelEntry *model = this->_AcquireModel (models[i]);
+        load->models.push_back (model);
+        objs.AddModel (&model->gObj, model->bbox);
+    }
+
+    for (size_t i = 0;  i < nInsts;  i++) {
+        PackedInstance const &pi = insts[i];
+        if (pi.model >= models.size()) {
+            std::cerr << "Invalid model index in compiled objects list\n";
+            exit (1);
+        }
+        objs.AddInstance (
+            pi.model,
+            cs237::mat4f (
+                cs237::vec4f (cs237::vec3f(pi.axes[0][0], pi.axes[0][1], pi.axes[0][2]), 0.0f),
+                cs237::vec4f (cs237::vec3f(pi.axes[1][0], pi.axes[1][1], pi.axes[1][2]), 0.0f),
+                cs237::vec4f (cs237::vec3f(pi.axes[2][0], pi.axes[2][1], pi.axes[2][2]), 0.0f),
+                cs237::vec4f (cs237::vec3f(pi.pos[0], pi.pos[1], pi.pos[2]), 1.0f)),
+            cs237::color3f(pi.color[0], pi.color[1], pi.color[2]));
+    }
+
+  // build the spatial index
+    objs.Finish ();
+}
+
+// get a reference to a model, loading it if necessary
 //
-GObject *Objects::LoadModel (
-    std::string const &dir,
-    std::string const &file,
-    cs237::AABBf &bbox)
+Objects::ModelEntry *Objects::_AcquireModel (std::string const &file)
 {
-    GObject *gObj;
-    auto it = this->_objs.find (file);
-    if (it == this->_objs.end()) {
-      // load the model from the OBJ file
-        OBJ::Model *model = new OBJ::Model (dir + file);
-        bbox = model->BBox();
-      // preload any textures in the materials of the model
-        for (auto grpIt = model->beginGroups();  grpIt != model->endGroups();  grpIt++) {
-            const OBJ::Material *mat = &model->Material((*grpIt).material);
-            /* we ignore the ambient map */
-            this->_LoadTexture (dir, mat->emissiveMap, true);
-            this->_LoadTexture (dir, mat->diffuseMap, true);
-            this->_LoadTexture (dir, mat->specularMap, true);
-            this->_LoadTexture (dir, mat->normalMap, false);
-        }
-      // create the meshes
-        gObj = new std::vector<TriMesh *>();
-        gObj->reserve(model->NumGroups());
-        for (auto git = model->beginGroups();  git != model->endGroups();  git++) {
-            TriMesh *mesh = new TriMesh (this, model, *git);
-            gObj->push_back(mesh);
-        }
-      // cache the meshes
-        this->_objs[file] = std::pair<cs237::AABBf, GObject *>(bbox, gObj);
-      // we can release the storage for the model
-        delete model;
+    ModelEntry *model;
+    {
+        std::unique_lock<std::mutex> lck(this->_lock);
+        auto it = this->_objs.find (file);
+        if (it != this->_objs.end()) {
+          // another job has loaded, or is loading, the model
+            model = it->second;
+            model->nRefs++;
+            this->_loaded.wait (lck, [model] () { return model->loaded; });
+            return model;
+        }
+        model = new ModelEntry;
+        model->file = file;
+        model->mesh = nullptr;
+        model->loaded = false;
+        model->resident = false;
+        model->nRefs = 1;
+        this->_objs.insert (std::pair<std::string, ModelEntry *>(file, model));
     }
-    else {
-        bbox = it->second.first;
-        gObj = it->second.second;
+
+  // use the compiled form of the model if it is up to date; otherwise we load the
+  // model from the OBJ file (large files are parsed in parallel) and compile it
+    std::string objFile = this->_objsDir + file;
+    OBJ::MeshFile *mesh = this->_map->_useCache ? OBJ::MeshFile::Open (objFile) : nullptr;
+    if (mesh == nullptr) {
+        OBJ::Model *obj = new OBJ::Model (objFile, cs237::ThreadPool::Shared());
+        mesh = OBJ::MeshFile::Compile (obj, cs237::ThreadPool::Shared());
+        delete obj;
+        if (this->_map->_useCache) {
+          // failing to write the compiled file is not an error
+            mesh->Save ();
+        }
+    }
+    model->mesh = mesh;
+    model->bbox = mesh->BBox();
+
+  // decode the textures in the materials of the model
+    for (auto grpIt = mesh->beginGroups();  grpIt != mesh->endGroups();  grpIt++) {
+        const OBJ::Material *mat = &mesh->Material((*grpIt).material);
+        /* we ignore the ambient map */
+        TexEntry *texs[4] = {
+                this->_AcquireTexture (mat->emissiveMap, true),
+                this->_AcquireTexture (mat->diffuseMap, true),
+                this->_AcquireTexture (mat->specularMap, true),
+                this->_AcquireTexture (mat->normalMap, false)
+            };
+        for (int i = 0;  i < 4;  i++) {
+            if (texs[i] != nullptr) {
+                model->texs.push_back (texs[i]);
+            }
+        }
     }
 
-    return gObj;
+  // the model is ready to be uploaded by the render thread
+    {
+        std::lock_guard<std::mutex> guard(this->_lock);
+        model->loaded = true;
+        this->_toUpload.push_back (model);
+    }
+    this->_loaded.notify_all();
+
+    return model;
 }
 
-// helper function for making instances of objects
-Instance *Objects::_MakeInstance (
-    std::string const &file,
-    cs237::mat4f const &toCell,
-    cs237::color3f const &color)
+// get a reference to a texture, decoding its image if necessary
+//
+Objects::TexEntry *Objects::_AcquireTexture (std::string const &name, bool genMipmaps)
 {
-  // first we need to get the GObject and bounding box for the file
-    cs237::AABBf bbox;
-    GObject *gObj = this->LoadModel (this->_objsDir, file, bbox);
-
-  // create the instance
-    Instance *inst = new Instance;
-    inst->meshes = gObj;
-    inst->toCell = toCell;
-    inst->normToWorld = toCell.normalMatrix();
-    inst->normFromWorld = inst->normToWorld.transpose();
-    inst->color = color;
+    if (name.empty()) {
+        return nullptr;
+    }
 
-  // compute the bounding box after transformation to cell coordinates
-    inst->bbox.clear();
-    for (int j = 0;   j < 8;  j++) {
-        cs237::vec3f pt =
-            cs237::vec3f(inst->toCell * cs237::vec4f(bbox.corner(j), 1));
-        inst->bbox.addPt(pt);
+    TexEntry *tex;
+    {
+        std::unique_lock<std::mutex> lck(this->_lock);
+        auto it = this->_texs.find (name);
+        if (it != this->_texs.end()) {
+            tex = it->second;
+            tex->nRefs++;
+            this->_loaded.wait (lck, [tex] () { return tex->loaded; });
+            return tex;
+        }
+        tex = new TexEntry;
+        tex->name = name;
+        tex->img = nullptr;
+        tex->txt = nullptr;
+        tex->mipmaps = genMipmaps;
+        tex->loaded = false;
+        tex->nRefs = 1;
+        this->_texs.insert (std::pair<std::string, TexEntry *>(name, tex));
     }
 
-    return inst;
+  // load the image data; the texture is created when the model is uploaded
+    cs237::image2d *img = new cs237::image2d(this->_objsDir + name);
+    if (img == nullptr) {
+        std::cerr << "Unable to find texture-image file \"" << this->_objsDir + name << "\"\n";
+        exit (1);
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(this->_lock);
+        tex->img = img;
+        tex->loaded = true;
+    }
+    this->_loaded.notify_all();
 
+    return tex;
 }
 
-// return the pointer to a pre-loaded 2D texture
+// upload a model's textures and meshes; this is called from the render thread
+//
+void Objects::_Upload (ModelEntry *model)
+{
+    assert (model->loaded && !model->resident);
+
+  // create the textures that have not been created for some other model
+    for (auto it = model->texs.begin();  it != model->texs.end();  it++) {
+        TexEntry *tex = *it;
+        if (tex->txt != nullptr) {
+            continue;
+        }
+        cs237::texture2D *txt = new cs237::texture2D(GL_TEXTURE_2D, tex->img);
+        txt->Parameter (GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        if (tex->mipmaps) {
+            txt->LoadMipmaps (tex->img);
+            txt->Parameter (GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        }
+        else {
+            txt->Parameter (GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        }
+      // free image
+        delete tex->img;
+        tex->img = nullptr;
+        tex->txt = txt;
+    }
+
+  // upload the model's vertex pool, which is shared by the meshes
+    OBJ::MeshFile *mesh = model->mesh;
+    std::shared_ptr<MeshBuffers> bufs = std::make_shared<MeshBuffers>(mesh);
+  // create the meshes
+    model->gObj.reserve(mesh->NumGroups());
+    for (int grp = 0;  grp < mesh->NumGroups();  grp++) {
+        TriMesh *tm = new TriMesh (this, mesh, grp, bufs);
+        model->gObj.push_back(tm);
+    }
+  // we can release the compiled model, since its data has been uploaded
+    delete mesh;
+    model->mesh = nullptr;
+    model->resident = true;
+}
+
+// release the models of a cell load and free it; this is called from the render thread
+//
+void Objects::_FreeLoad (CellLoad *load)
+{
+    for (auto it = load->models.begin();  it != load->models.end();  it++) {
+        this->_ReleaseModel (*it);
+    }
+    delete load;
+}
+
+void Objects::_ReleaseModel (ModelEntry *model)
+{
+    {
+        std::lock_guard<std::mutex> guard(this->_lock);
+        if (--model->nRefs > 0) {
+            return;
+        }
+        this->_objs.erase (model->file);
+      // the model may be waiting to be uploaded
+        auto it = std::find(this->_toUpload.begin(), this->_toUpload.end(), model);
+        if (it != this->_toUpload.end()) {
+            this->_toUpload.erase (it);
+        }
+    }
+
+  // the meshes share the model's buffers, which are freed with the last mesh
+    for (auto it = model->gObj.begin();  it != model->gObj.end();  it++) {
+        delete *it;
+    }
+    delete model->mesh;
+    for (auto it = model->texs.begin();  it != model->texs.end();  it++) {
+        this->_ReleaseTexture (*it);
+    }
+    delete model;
+}
+
+void Objects::_ReleaseTexture (TexEntry *tex)
+{
+    {
+        std::lock_guard<std::mutex> guard(this->_lock);
+        if (--tex->nRefs > 0) {
+            return;
+        }
+        this->_texs.erase (tex->name);
+    }
+    delete tex->txt;
+    delete tex->img;
+    delete tex;
+}
+
+// return the pointer to a resident 2D texture
 //
 cs237::texture2D *Objects::LoadTexture2D (std::string const &name) const
 {
     if (! name.empty()) {
+        std::lock_guard<std::mutex> guard(this->_lock);
         auto it = this->_texs.find(name);
         if (it != this->_texs.end()) {
-            return it->second;
+            return it->second->txt;
         }
     }
     return nullptr;
 
 }
 
-// helper function for loading textures
-//
-void Objects::_LoadTexture (std::string path, std::string name, bool genMipmaps)
+/***** class CellObjects member functions *****/
+
+// reorder the elements of a vector by a permutation
+template <typename T>
+static void Permute (std::vector<T> &v, std::vector<uint32_t> const &order)
 {
-    if (name.empty()) {
-        return;
+    std::vector<T> tmp(order.size());
+    for (size_t i = 0;  i < order.size();  i++) {
+        tmp[i] = v[order[i]];
     }
-  // have we already loaded this texture?
-    if (this->_texs.find(name) != this->_texs.end()) {
-        return;
+    v.swap (tmp);
+}
+
+void CellObjects::Clear ()
+{
+    this->_models.clear();
+    this->_model.clear();
+    this->_toCell.clear();
+    this->_normToWorld.clear();
+    this->_color.clear();
+    this->_scale.clear();
+    this->_lod.clear();
+    this->_bboxes.clear();
+    this->_index.Clear();
+}
+
+uint32_t CellObjects::AddModel (const GObject *gObj, cs237::AABBf const &bbox)
+{
+    this->_models.push_back (ModelInfo{gObj, bbox});
+    return this->_models.size() - 1;
+}
+
+void CellObjects::AddInstance (
+    uint32_t model,
+    cs237::mat4f const &toCell,
+    cs237::color3f const &color)
+{
+    this->_model.push_back (model);
+    this->_toCell.push_back (toCell);
+    this->_normToWorld.push_back (toCell.normalMatrix());
+    this->_color.push_back (color);
+    this->_scale.push_back (std::max(
+        cs237::vec3f(toCell[0]).length(),
+        std::max(cs237::vec3f(toCell[1]).length(), cs237::vec3f(toCell[2]).length())));
+    this->_lod.push_back (0);
+
+  // compute the bounding box after transformation to cell coordinates
+    cs237::AABBf const &bbox = this->_models[model].bbox;
+    cs237::AABBf cellBBox;
+    for (int j = 0;   j < 8;  j++) {
+        cellBBox.addPt (cs237::vec3f(toCell * cs237::vec4f(bbox.corner(j), 1)));
     }
-  // load the image data;
-    cs237::image2d *img = new cs237::image2d(path + name);
-    if (img == nullptr) {
-        std::cerr << "Unable to find texture-image file \"" << path+name << "\"\n";
-        exit (1);
+    this->_bboxes.push_back (cellBBox);
+}
+
+void CellObjects::Finish ()
+{
+    std::vector<uint32_t> order;
+    this->_index.Build (this->_bboxes.size(), this->_bboxes.data(), order);
+
+  // store the instances in the order of the index, so that the instances in a subtree
+  // are contiguous
+    Permute (this->_model, order);
+    Permute (this->_toCell, order);
+    Permute (this->_normToWorld, order);
+    Permute (this->_color, order);
+    Permute (this->_scale, order);
+    Permute (this->_lod, order);
+
+  // the index holds the bounding boxes
+    std::vector<cs237::AABBf>().swap (this->_bboxes);
+}
+
+void CellObjects::FrustumQuery (
+    Frustum const *frustum,
+    cs237::vec3d const &nwCorner,
+    std::vector<uint32_t> &insts) const
+{
+  // map the planes to cell coordinates: for a point p in the cell,
+  // dot(n, nwCorner + p) + d = dot(n, p) + (d + dot(n, nwCorner))
+    cs237::vec3f norms[6];
+    float dists[6];
+    for (int i = 0;  i < 6;  i++) {
+        cs237::vec3d const &n = frustum->normals[i];
+        norms[i] = cs237::vec3f(float(n[0]), float(n[1]), float(n[2]));
+        dists[i] = float(frustum->distances[i] + cs237::__detail::dot(n, nwCorner));
     }
-    cs237::texture2D *txt = new cs237::texture2D(GL_TEXTURE_2D, img);
-    txt->Parameter (GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    if (genMipmaps) {
-        CS237_CHECK( glGenerateMipmap(GL_TEXTURE_2D) );
-        txt->Parameter (GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    this->_index.FrustumQuery (6, norms, dists, insts);
+}
+
+int CellObjects::SelectLOD (
+    uint32_t i,
+    Camera const &cam,
+    cs237::vec3f const &camPos,
+    float errLimit,
+    float hysteresis)
+{
+    const GObject *meshes = this->Meshes(i);
+    const TriMesh *mesh = meshes->empty() ? nullptr : (*meshes)[0];
+    float dist = this->BBox(i).distanceToPt(camPos);
+    if ((mesh == nullptr) || (dist <= 0.0f)) {
+        this->_lod[i] = 0;
+        return 0;
     }
-    else {
-        txt->Parameter (GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+
+  // the levels of detail of the meshes of a model have the same errors, which increase
+  // with the level, so we search from the coarsest level
+    int lod = 0;
+    for (int l = mesh->NumLODs() - 1;  l > 0;  l--) {
+        float limit = (l > this->_lod[i]) ? (1.0f - hysteresis) * errLimit : errLimit;
+        if (cam.screenError(dist, this->_scale[i] * mesh->LODError(l)) <= limit) {
+            lod = l;
+            break;
+        }
     }
-  // add to _texs map
-    this->_texs.insert (std::pair<std::string, cs237::texture2D *>(name, txt));
-  // free image
-    delete img;
+    this->_lod[i] = lod;
+
+    return lod;
 
 }
@@ -3,7 +3,8 @@
  * Support for loading OBJ objects with supporting textures.  The Objects class
  * is a singleton class that is embedded in the Map object.  It is meant to support
  * both loading renderer-specific objects from the 'data' directory as well as
- * map-specific objects from the map's 'objects' directory.
+ * map-specific objects from the map's 'objects' directory.  The objects of a cell
+ * are loaded in the background when the cell is requested.
  *
  * Note that names used for objects and textures need to be globally unique.
  *
@@ -20,30 +21,125 @@
 
 #include "cs237.hxx"
 #include "obj.hxx"
-#include <map>
+#include "obj-mesh.hxx"
+#include <condition_variable>
 #include <functional>
+#include <map>
+#include <mutex>
+#include <vector>
 
 class TriMesh;  // defined in "mesh.hxx"
 class Map; // defined in map.hxx
+class Cell; // defined in map-cell.hxx
+class Camera; // defined in camera.hxx
+class Frustum; // defined in camera.hxx
 
 //! one or more meshes that define an object.  These correspond
 //! to the groups in the OBJ file
 typedef std::vector<TriMesh *> GObject;
 
-//! An instance of a graphical object in a map cell
-struct Instance {
-    const GObject       *meshes;        //!< the mesh data
-    cs237::mat4f        toCell;         //!< affine transform from object space to cell space
-    cs237::mat3f        normToWorld;    //!< linear transform that maps object-space normals
-                                        //!  to world-space normals
-    cs237::mat3f        normFromWorld;  //!< linear transform that maps world-space normals
-                                        //!  to object-space normals (e.g., light)
-    cs237::AABBf        bbox;           //!< the bounding box around the transformed mesh
-                                        //!< in map-cell coordinates
-    cs237::color3f      color;          //!< the color of the object for wireframe
-                                        //!< rendering
+//! The graphical-object instances of a map cell.  The instances are stored in
+//! structure-of-arrays form, in the order of the leaves of a bounding-volume
+//! hierarchy over their bounding boxes, which is used for culling and spatial
+//! queries.  Instances are identified by their index in this order.
+class CellObjects {
+  public:
+
+    CellObjects () { }
+
+  //! remove all of the models and instances
+    void Clear ();
+
+  //! add a model that is used by the instances of the cell
+  //! \param gObj the model's meshes
+  //! \param bbox the model's bounding box in object space
+  //! \return the model's ID
+    uint32_t AddModel (const GObject *gObj, cs237::AABBf const &bbox);
+
+  //! add an instance of a model; the instances are not available until Finish is called
+  //! \param model the ID of the instance's model
+  //! \param toCell affine transform from object space to cell space
+  //! \param color the color of the object for wireframe rendering
+    void AddInstance (uint32_t model, cs237::mat4f const &toCell, cs237::color3f const &color);
+
+  //! build the spatial index over the instances and put the instances in its order
+    void Finish ();
+
+  //! the number of instances
+    uint32_t NumInstances () const { return this->_model.size(); }
+  //! the ID of an instance's model
+    uint32_t Model (uint32_t i) const { return this->_model[i]; }
+  //! the meshes of an instance
+    const GObject *Meshes (uint32_t i) const { return this->_models[this->_model[i]].meshes; }
+  //! affine transform from object space to cell space of an instance
+    cs237::mat4f const &ToCell (uint32_t i) const { return this->_toCell[i]; }
+  //! linear transform that maps object-space normals to world-space normals
+    cs237::mat3f const &NormToWorld (uint32_t i) const { return this->_normToWorld[i]; }
+  //! the color of an instance for wireframe rendering
+    cs237::color3f const &Color (uint32_t i) const { return this->_color[i]; }
+  //! the bounding box of an instance in cell coordinates
+    cs237::AABBf BBox (uint32_t i) const { return this->_index.ItemBBox(i); }
+  //! the spatial index over the instances' bounding boxes (in cell coordinates)
+    cs237::BVH const &Index () const { return this->_index; }
+
+  //! find the instances that are inside or intersect the view frustum
+  //! \param frustum the view frustum in world coordinates
+  //! \param nwCorner the world coordinates of the cell's NW corner
+  //! \param[out] insts the indices of the visible instances are added to this vector
+    void FrustumQuery (
+        Frustum const *frustum,
+        cs237::vec3d const &nwCorner,
+        std::vector<uint32_t> &insts) const;
+
+  //! select the level of detail for rendering an instance, which is the coarsest level
+  //! whose screen-space error is within the limit.  To avoid popping between levels
+  //! when the error is close to the limit, the instance only switches to a coarser
+  //! level when its error is within (1 - hysteresis) * errLimit.
+  //! \param i the instance
+  //! \param cam the camera
+  //! \param camPos the camera's position in the coordinate system of the cell
+  //! \param errLimit the screen-space error limit in pixels
+  //! \param hysteresis the fraction of errLimit used for hysteresis (0 for none)
+  //! \return the selected level, which is recorded for the next frame
+    int SelectLOD (
+        uint32_t i,
+        Camera const &cam,
+        cs237::vec3f const &camPos,
+        float errLimit,
+        float hysteresis = 0.25f);
+
+  private:
+    struct ModelInfo {
+        const GObject   *meshes;        //!< the mesh data
+        cs237::AABBf    bbox;           //!< the model's bounding box in object space
+    };
+
+    std::vector<ModelInfo>      _models;        //!< the models used in the cell
+    std::vector<uint32_t>       _model;         //!< the model ID of each instance
+    std::vector<cs237::mat4f>   _toCell;        //!< the object-to-cell transforms
+    std::vector<cs237::mat3f>   _normToWorld;   //!< the normal transforms
+    std::vector<cs237::color3f> _color;         //!< the wireframe colors
+    std::vector<float>          _scale;         //!< the largest scaling factor of each
+                                                //!  transform, which maps object-space
+                                                //!  errors to cell space
+    std::vector<int>            _lod;           //!< the level of detail that was selected
+                                                //!  for each instance in the previous frame
+    std::vector<cs237::AABBf>   _bboxes;        //!< the instance bounding boxes; only used
+                                                //!  until Finish is called
+    cs237::BVH                  _index;         //!< the spatial index, which also holds
+                                                //!  the instance bounding boxes
 };
 
+//! The repository of the models and textures used by the objects of a map.  The
+//! objects of a cell are loaded on demand by background jobs: a job reads the cell's
+//! objects list, loads the models and texture images that the list uses, and builds
+//! the cell's CellObjects.  OpenGL calls are only made on the render thread, so the
+//! meshes and textures are uploaded by NewFrame, which installs the cell's objects
+//! once all of its models are resident.
+//!
+//! Models and textures are reference counted, so a model or texture that is shared by
+//! several cells is loaded once and is freed when the last cell that uses it is
+//! released.
 class Objects {
   public:
 
@@ -53,49 +149,146 @@ class Objects {
 
     ~Objects ();
 
-    //! load the objects instances for a map cell
-    //! \param cell the path to the cell's subdirectory
-    //! \param objs the vector of object instances that is filled from the objects list
-    //! \return true if there is an error, false otherwise
-    bool LoadObjects (std::string const &cell, std::vector<Instance *> &objs);
-
-    //! load an OBJ model from a file
-    //! \param[in] dir the name of the directory holding the model and supporting files
-    //! \param[in] file the name of the OBJ file
-    //! \param[out] bbox is set to the model's AABB on exit
-    //! \return the meshes representing the object
-    GObject *LoadModel (
-        std::string const &dir,
-        std::string const &file,
-        cs237::AABBf &bbox);
+    //! request that the objects of a cell be loaded.  The cell's objects become
+    //! available in some later frame (see NewFrame); this is a no-op if they are
+    //! already loaded or pending.
+    //! \param cell the cell
+    void Request (Cell *cell);
+
+    //! release the objects of a cell, which cancels a pending request.  Models and
+    //! textures that are no longer used by any cell are freed.  This must be called
+    //! from the render thread.
+    //! \param cell the cell
+    void Release (Cell *cell);
+
+    //! is a request for the objects of a cell pending?
+    bool isPending (const Cell *cell) const;
 
-    //! return the pointer to a pre-loaded 2D texture
+    //! upload (some of) the models that have been loaded since the last frame and
+    //! install the objects of the cells whose models are all resident.  This must be
+    //! called from the render thread.
+    void NewFrame ();
+
+    //! return the pointer to a resident 2D texture
     //! \param name the name of the texture source image file relative to the
     //!             map's objects directory
     //! \returns a pointer to the texture object or nullptr if the file is not found
     cs237::texture2D *LoadTexture2D (std::string const &name) const;
 
   private:
+    //! a texture used by the materials of the models
+    struct TexEntry {
+        std::string     name;           //!< the name of the image file
+        cs237::image2d  *img;           //!< the decoded image (until it is uploaded)
+        cs237::texture2D *txt;          //!< the texture (nullptr until it is uploaded)
+        bool            mipmaps;        //!< should mipmaps be generated?
+        bool            loaded;         //!< true once the image has been decoded
+        int             nRefs;          //!< number of models that use the texture
+    };
+
+    //! a model, which may be shared by the instances of several cells
+    struct ModelEntry {
+        std::string     file;           //!< the name of the OBJ file
+        OBJ::MeshFile   *mesh;          //!< the compiled model (until it is uploaded)
+        std::vector<TexEntry *> texs;   //!< the textures used by the model's materials
+        GObject         gObj;           //!< the meshes (empty until they are uploaded)
+        cs237::AABBf    bbox;           //!< the model's bounding box
+        bool            loaded;         //!< true once the model has been loaded
+        bool            resident;       //!< true once the meshes have been uploaded
+        int             nRefs;          //!< number of cells (or jobs) that use the model
+    };
+
+    //! the state of a request for the objects of a cell
+    struct CellLoad {
+        Cell            *cell;          //!< the cell
+        CellObjects     objs;           //!< the cell's objects (moved into the cell once
+                                        //!  its models are resident)
+        std::vector<ModelEntry *> models; //!< the models used by the cell
+        bool            done;           //!< true once the job has finished
+        bool            failed;         //!< true if the job failed
+        bool            cancelled;      //!< true if the cell was released while the job
+                                        //!  was running
+        bool            installed;      //!< true once the objects are in the cell
+    };
+
     const Map *_map;                    //!< the map
     std::string _objsDir;               //!< the 'objects' directory that holds OBJ, MTL,
                                         //!  and texture files.
-    std::map<std::string, std::pair<cs237::AABBf, GObject *> > _objs;
-                                        //!< object-mesh cache
-    std::map<std::string, cs237::texture2D *> _texs;
+    cs237::ThreadPool *_loader;         //!< the threads that run the load jobs (see
+                                        //!  LOADER_THREADS in map-objects.cxx)
+    int         _uploadLimit;           //!< maximum number of models uploaded per frame
+    mutable std::mutex _lock;           //!< protects the following fields and the loaded
+                                        //!  and nRefs fields of the entries
+    std::condition_variable _loaded;    //!< signaled when a model or texture is loaded
+    std::map<std::string, ModelEntry *> _objs;
+                                        //!< model cache
+    std::map<std::string, TexEntry *> _texs;
                                         //!< texture cache
+    std::vector<ModelEntry *> _toUpload; //!< loaded models that are waiting to be uploaded
+    std::map<const Cell *, CellLoad *> _cells;
+                                        //!< the cells whose objects are loaded or pending;
+                                        //!  only accessed by the render thread
+
+    //! the representation of an instance in the compiled form of an objects.json file
+    struct PackedInstance;
 
-    //! helper function for creating instances
-    Instance *_MakeInstance (
+    //! the background job that loads the objects of a cell
+    void _LoadCell (CellLoad *load);
+
+    //! load the instances in a cell's objects list, along with the models that they use
+    //! \param objsFile the cell's objects.json file
+    //! \param load the cell load, whose models and objects are set
+    //! \return true if there is an error, false otherwise
+    bool _LoadObjects (std::string const &objsFile, CellLoad *load);
+
+    //! parse an objects.json file
+    //! \param file the objects.json file
+    //! \param[out] models the OBJ files used by the instances
+    //! \param[out] insts the instances
+    //! \return true if there is an error, false otherwise
+    bool _ParseObjects (
         std::string const &file,
-        cs237::mat4f const &toCell,
-        cs237::color3f const &color);
-
-    //! helper function for pre-loading textures for materials
-    //! \param path the name of the directory holding the texture
-    //! \param name the name of the texture source image file relative to path
-    //! \param genMipmaps if true, then glGenerateMipmap is called to generated
-    //!                   mipmaps and the sampling mode is set to LINEAR_MIPMAP_LINEAR
-    void _LoadTexture (std::string path, std::string name, bool genMipmaps = false);
+        std::vector<std::string> &models,
+        std::vector<PackedInstance> &insts);
+
+    //! helper function for creating the instances of a cell
+    //! \param models the OBJ files used by the instances
+    //! \param insts the instances
+    //! \param nInsts the number of instances
+    //! \param[out] load the cell load, whose models and objects are set
+    void _MakeInstances (
+        std::vector<std::string> const &models,
+        const PackedInstance *insts,
+        size_t nInsts,
+        CellLoad *load);
+
+    //! get a reference to a model, loading the model if it is not in the cache.  If
+    //! another job is loading the model, then this function waits for it to finish.
+    //! This function is called by the load jobs.
+    //! \param file the name of the OBJ file
+    //! \return the model's entry
+    ModelEntry *_AcquireModel (std::string const &file);
+
+    //! get a reference to a texture, decoding its image if it is not in the cache.
+    //! If another job is decoding the image, then this function waits for it to finish.
+    //! \param name the name of the texture source image file relative to the
+    //!        objects directory
+    //! \param genMipmaps if true, then the texture will have mipmaps and use
+    //!        LINEAR_MIPMAP_LINEAR sampling
+    //! \return the texture's entry or nullptr if name is empty
+    TexEntry *_AcquireTexture (std::string const &name, bool genMipmaps);
+
+    //! upload a model's textures and meshes to OpenGL
+    void _Upload (ModelEntry *model);
+
+    //! release the references held by a cell load and free it
+    void _FreeLoad (CellLoad *load);
+
+    //! drop a reference to a model and free it if it is no longer used
+    void _ReleaseModel (ModelEntry *model);
+
+    //! drop a reference to a texture and free it if it is no longer used
+    void _ReleaseTexture (TexEntry *tex);
 };
 
 #endif //! _MAP_OBJECTS_HXX_
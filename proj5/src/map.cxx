@@ -16,14 +16,22 @@
 #include "map.hxx"
 #include "map-cell.hxx"
 #include "map-objects.hxx"
+#include "compiled-file.hxx"
 #include <unistd.h>
+#include <memory>
 
 /***** class Map member functions *****/
 
-Map::Map () : _grid(nullptr) { }
+Map::Map ()
+    : _grid(nullptr), _objects(nullptr), _useCache(true),
+      _rain(DEFAULT_MAX_DROPLETS), _rainVAO(0), _rainVBuf(0), _rainPosBuf(0)
+{ }
 
 Map::~Map ()
 {
+  // the objects go first, since their load jobs may refer to the cells
+    delete this->_objects;
+
     if (this->_grid != nullptr) {
         for (int i = 0;  i < this->_nCells();  i++) {
             if (this->_grid[i] != nullptr)
@@ -34,6 +42,13 @@ Map::~Map ()
 
 }
 
+void Map::UpdateObjects ()
+{
+    if (this->_objects != nullptr) {
+        this->_objects->NewFrame ();
+    }
+}
+
 static void error (std::string file, std::string msg)
 {
     std::cerr << "error reading map file \"" << file << "\": " << msg << "\n";
@@ -64,7 +79,7 @@ static bool GetThreeFloats (const JSON::Array *arr, float out[3])
     return false;
 }
 
-bool Map::LoadMap (std::string const &mapName, bool verbose)
+bool Map::LoadMap (std::string const &mapName, bool verbose, bool useCache)
 {
     if (this->_grid != nullptr) {
       // map file has already been loaded, so return false
@@ -72,9 +87,93 @@ bool Map::LoadMap (std::string const &mapName, bool verbose)
     }
 
     this->_path = mapName + "/";
+    this->_useCache = useCache;
+
+    std::string mapFile = this->_path + "map.json";
+    std::vector<std::string> grid;
+    if (! useCache || ! this->_LoadCompiled (mapFile, grid)) {
+        if (! this->_ParseMap (mapName, mapFile, grid)) {
+            return false;
+        }
+        if (useCache) {
+            this->_SaveCompiled (mapFile, grid);
+        }
+    }
+
+  // are there any objects?
+    {
+        std::string objectsDir = this->_path + "objects";
+        if (access(objectsDir.c_str(), F_OK) == 0) {
+            this->_objects = new Objects (this);
+        }
+    }
+
+  // compute and check other map info
+    int cellShft = ilog2(this->_cellSize);
+    if ((cellShft < 0)
+    || (this->_cellSize < Map::MIN_CELL_SIZE)
+    || (Map::MAX_CELL_SIZE < this->_cellSize)) {
+        error (mapName, "cellSize must be power of 2 in range");
+        return false;
+    }
+
+    this->_nRows = this->_height >> cellShft;
+    this->_nCols = this->_width >> cellShft;
+    if ((this->_nRows << cellShft) != this->_height) {
+        error (mapName, "map height must be multiple of cell size");
+        return false;
+    }
+    if ((this->_nCols << cellShft) != this->_width) {
+        error (mapName, "map width must be multiple of cell size");
+        return false;
+    }
+
+    if (verbose) {
+        std::clog << "name = " << this->_name << "\n";
+        std::clog << "h-scale = " << this->_hScale << "\n";
+        std::clog << "v-scale = " << this->_vScale << "\n";
+        std::clog << "base-elev = " << this->_baseElev << "\n";
+        std::clog << "min-elev = " << this->_minElev << "\n";
+        std::clog << "max-elev = " << this->_maxElev << "\n";
+        std::clog << "min-sky = " << this->_minSky << "\n";
+        std::clog << "max-sky = " << this->_maxSky << "\n";
+        std::clog << "width = " << this->_width
+            << " (" << this->_nCols << " cols)\n";
+        std::clog << "height = " << this->_height
+            << " (" << this->_nRows << " rows)\n";
+        std::clog << "cell-size = " << this->_cellSize << "\n";
+        std::clog << "sun-dir = " << this->_sunDir << "\n";
+        std::clog << "sun-intensity = " << this->_sunI << "\n";
+        std::clog << "ambient = " << this->_ambI << "\n";
+        std::clog << "fog-color = " << this->_fogColor << "\n";
+        std::clog << "fog-density = " << this->_fogDensity << "\n";
+    }
 
-    JSON::Value *map = JSON::ParseFile(this->_path + "map.json");
-    const JSON::Object *root = (map != nullptr) ? map->asObject() : nullptr;
+  // create the cells
+    if (grid.size() != this->_nCells()) {
+        error (mapName, "incorrect number of cells in grid field");
+        return false;
+    }
+    this->_grid = new class Cell*[this->_nCells()];
+    for (int r = 0;  r < this->_nRows;  r++) {
+        for (int c = 0;  c < this->_nCols;  c++) {
+            int i = this->_cellIdx(r, c);
+            this->_grid[i] = new class Cell(this, r, c, this->_path + grid[i]);
+        }
+    }
+
+    return true;
+
+}
+
+bool Map::_ParseMap (
+    std::string const &mapName,
+    std::string const &file,
+    std::vector<std::string> &grid)
+{
+  // the document (and thus the JSON tree) is freed on return
+    std::unique_ptr<JSON::Document> map(JSON::ParseDocument(file));
+    const JSON::Object *root = (map != nullptr) ? map->root()->asObject() : nullptr;
 
     if (root == nullptr) {
         std::cerr << "error reading map file\n";
@@ -264,78 +363,117 @@ bool Map::LoadMap (std::string const &mapName, bool verbose)
         this->_fogDensity = 0;
     }
 
-  // are there any objects?
-    {
-        std::string objectsDir = this->_path + "objects";
-        if (access(objectsDir.c_str(), F_OK) == 0) {
-            this->_objects = new Objects (this);
+  // get array of grid filenames
+    const JSON::Array *gridArr = root->fieldAsArray("grid");
+    if (gridArr == nullptr) {
+        error (mapName, "missing/bogus grid field");
+        return false;
+    }
+    grid.resize (gridArr->length());
+    for (int i = 0;  i < gridArr->length();  i++) {
+        const JSON::String *s = (*gridArr)[i]->asString();
+        if (s == nullptr) {
+            error (mapName, "bogus grid item");
+            return false;
         }
+        grid[i] = s->value();
     }
 
-  // compute and check other map info
-    int cellShft = ilog2(this->_cellSize);
-    if ((cellShft < 0)
-    || (this->_cellSize < Map::MIN_CELL_SIZE)
-    || (Map::MAX_CELL_SIZE < this->_cellSize)) {
-        error (mapName, "cellSize must be power of 2 in range");
+    return true;
+
+}
+
+//! the map parameters that are stored in the compiled form of a map.json file
+struct MapParams {
+    float       hScale, vScale;
+    float       baseElev, minElev, maxElev;
+    float       minSky, maxSky;
+    uint32_t    width, height, cellSize;
+    uint32_t    hasColor, hasNormals, hasWater, hasFog;
+    float       sunDir[3], sunI[3], ambI[3];
+    float       fogColor[3], fogDensity;
+};
+
+bool Map::_LoadCompiled (std::string const &file, std::vector<std::string> &grid)
+{
+    std::unique_ptr<CompiledFile> cf(CompiledFile::Open(file, CompiledFile::MAP));
+    if (cf == nullptr) {
         return false;
     }
 
-    this->_nRows = this->_height >> cellShft;
-    this->_nCols = this->_width >> cellShft;
-    if ((this->_nRows << cellShft) != this->_height) {
-        error (mapName, "map height must be multiple of cell size");
+    CompiledReader rdr(cf.get());
+    MapParams params;
+    uint32_t nCells;
+    if (! rdr.Get(params) || ! rdr.GetString(this->_name) || ! rdr.Get(nCells)) {
         return false;
     }
-    if ((this->_nCols << cellShft) != this->_width) {
-        error (mapName, "map width must be multiple of cell size");
-        return false;
+    grid.resize (nCells);
+    for (uint32_t i = 0;  i < nCells;  i++) {
+        if (! rdr.GetString(grid[i])) {
+            return false;
+        }
     }
 
-    if (verbose) {
-        std::clog << "name = " << this->_name << "\n";
-        std::clog << "h-scale = " << this->_hScale << "\n";
-        std::clog << "v-scale = " << this->_vScale << "\n";
-        std::clog << "base-elev = " << this->_baseElev << "\n";
-        std::clog << "min-elev = " << this->_minElev << "\n";
-        std::clog << "max-elev = " << this->_maxElev << "\n";
-        std::clog << "min-sky = " << this->_minSky << "\n";
-        std::clog << "max-sky = " << this->_maxSky << "\n";
-        std::clog << "width = " << this->_width
-            << " (" << this->_nCols << " cols)\n";
-        std::clog << "height = " << this->_height
-            << " (" << this->_nRows << " rows)\n";
-        std::clog << "cell-size = " << this->_cellSize << "\n";
-        std::clog << "sun-dir = " << this->_sunDir << "\n";
-        std::clog << "sun-intensity = " << this->_sunI << "\n";
-        std::clog << "ambient = " << this->_ambI << "\n";
-        std::clog << "fog-color = " << this->_fogColor << "\n";
-        std::clog << "fog-density = " << this->_fogDensity << "\n";
-    }
+    this->_hScale = params.hScale;
+    this->_vScale = params.vScale;
+    this->_baseElev = params.baseElev;
+    this->_minElev = params.minElev;
+    this->_maxElev = params.maxElev;
+    this->_minSky = params.minSky;
+    this->_maxSky = params.maxSky;
+    this->_width = params.width;
+    this->_height = params.height;
+    this->_cellSize = params.cellSize;
+    this->_hasColor = (params.hasColor != 0);
+    this->_hasNormals = (params.hasNormals != 0);
+    this->_hasWater = (params.hasWater != 0);
+    this->_hasFog = (params.hasFog != 0);
+    this->_sunDir = cs237::vec3f(params.sunDir[0], params.sunDir[1], params.sunDir[2]);
+    this->_sunI = cs237::color3f(params.sunI[0], params.sunI[1], params.sunI[2]);
+    this->_ambI = cs237::color3f(params.ambI[0], params.ambI[1], params.ambI[2]);
+    this->_fogColor = cs237::color3f(params.fogColor[0], params.fogColor[1], params.fogColor[2]);
+    this->_fogDensity = params.fogDensity;
 
-  // get array of grid filenames
-    const JSON::Array *grid = root->fieldAsArray("grid");
-    if (num == nullptr) {
-        error (mapName, "missing/bogus h-scale field");
-        return false;
-    }
-    else if (grid->length() != this->_nCells()) {
-        error (mapName, "incorrect number of cells in grid field");
-        return false;
+    return true;
+
+}
+
+void Map::_SaveCompiled (std::string const &file, std::vector<std::string> const &grid)
+{
+    MapParams params;
+    params.hScale = this->_hScale;
+    params.vScale = this->_vScale;
+    params.baseElev = this->_baseElev;
+    params.minElev = this->_minElev;
+    params.maxElev = this->_maxElev;
+    params.minSky = this->_minSky;
+    params.maxSky = this->_maxSky;
+    params.width = this->_width;
+    params.height = this->_height;
+    params.cellSize = this->_cellSize;
+    params.hasColor = this->_hasColor;
+    params.hasNormals = this->_hasNormals;
+    params.hasWater = this->_hasWater;
+    params.hasFog = this->_hasFog;
+    for (int i = 0;  i < 3;  i++) {
+        params.sunDir[i] = this->_sunDir[i];
+        params.sunI[i] = this->_sunI[i];
+        params.ambI[i] = this->_ambI[i];
+        params.fogColor[i] = this->_fogColor[i];
     }
-    this->_grid = new class Cell*[this->_nCells()];
-    for (int r = 0;  r < this->_nRows;  r++) {
-        for (int c = 0;  c < this->_nCols;  c++) {
-            int i = this->_cellIdx(r, c);
-            const JSON::String *s = (*grid)[i]->asString();
-            if (s == nullptr) {
-                error (mapName, "bogus grid item");
-            }
-            this->_grid[i] = new class Cell(this, r, c, this->_path + s->value());
-        }
+    params.fogDensity = this->_fogDensity;
+
+    CompiledWriter wr;
+    wr.Put (params);
+    wr.PutString (this->_name);
+    wr.Put (static_cast<uint32_t>(grid.size()));
+    for (auto it = grid.begin();  it != grid.end();  it++) {
+        wr.PutString (*it);
     }
 
-    return true;
+  // failing to write the compiled file is not an error; we just parse the JSON
+  // file the next time
+    CompiledFile::Write (file, CompiledFile::MAP, wr.Bytes());
 
 }
 
@@ -344,160 +482,93 @@ bool Map::LoadMap (std::string const &mapName, bool verbose)
 //NOTE: The particle system I used is based off of the following tutorial:
 // http://www.opengl-tutorial.org/intermediate-tutorials/billboards-particles/particles-instancing/
 
-// sort droplets based on distance from camera
-void Map::sortDroplets(){
-  std::sort(&particles_container[0], &particles_container[MAX_DROPLETS]);
-}
+// kills all of the droplets and allocates the GL objects used to draw them
+void Map::initParticles(){
+  this->_rain.Clear();
+  this->_rainPos.resize(3 * this->_rain.Capacity());
 
-// find the index of a dead droplet
-int Map::FindDeadDroplet(){
-
-  // loop through the latter fraction of particles
-  int i;
-	for(i = lastUsed; i < MAX_DROPLETS; i++){
-		if (particles_container[i].lifeSpan < 0){
-			lastUsed = i;
-			return i;
-		}
-	}
-
-  // loop through the first fraction of particles
-  int j;
-	for(j = 0; j < lastUsed; j++){
-		if (particles_container[j].lifeSpan < 0){
-			lastUsed = j;
-			return j;
-		}
-	}
-
-  // default to first particle if all are alive
-	return 0;
-}
+  // the vertex array and buffers are reused from frame to frame
+  if (this->_rainVAO == 0) {
+    CS237_CHECK( glGenVertexArrays(1, &this->_rainVAO));
+    CS237_CHECK( glBindVertexArray(this->_rainVAO));
 
-// iniitializes all particle characteristics to be "dead"
-void Map::initParticles(){
-  int i;
-  for(i = 0; i < MAX_DROPLETS; i++){
-    this->particles_container[i].lifeSpan = -1.0f;
-    this->particles_container[i].cameraDist = -1.0f;
+    //vertices
+    CS237_CHECK( glGenBuffers(1, &this->_rainVBuf));
+    CS237_CHECK( glBindBuffer(GL_ARRAY_BUFFER, this->_rainVBuf));
+    CS237_CHECK( glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW));
+    CS237_CHECK( glEnableVertexAttribArray(0));
+    CS237_CHECK( glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void *)0));
+
+    //positions
+    CS237_CHECK( glGenBuffers(1, &this->_rainPosBuf));
+    CS237_CHECK( glBindBuffer(GL_ARRAY_BUFFER, this->_rainPosBuf));
+    CS237_CHECK( glBufferData(GL_ARRAY_BUFFER, this->_rainPos.size() * sizeof(GLfloat), NULL, GL_STREAM_DRAW));
+    CS237_CHECK( glEnableVertexAttribArray(1));
+    CS237_CHECK( glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (void *)0));
+
+    //settings for instanced drawing
+    CS237_CHECK( glVertexAttribDivisor(0, 0)); // model vertices are reused
+    CS237_CHECK( glVertexAttribDivisor(1, 1)); // one "position" per streak
+
+    CS237_CHECK( glBindBuffer (GL_ARRAY_BUFFER, 0));
+    CS237_CHECK( glBindVertexArray (0));
   }
 }
 
 // render the rain
 void Map::drawRain(Camera *cam, float dt){
 
-    // array holding all the position data
-    GLfloat* position_data = new GLfloat[MAX_DROPLETS * 3];
-
-
-    //vao
-    GLuint vaoId;
-  	CS237_CHECK( glGenVertexArrays(1, &vaoId));
-  	CS237_CHECK( glBindVertexArray(vaoId));
-
-    //vertices
-    GLuint vBufId;
-    CS237_CHECK( glGenBuffers(1, &vBufId));
-	  CS237_CHECK( glBindBuffer(GL_ARRAY_BUFFER, vBufId));
-	  CS237_CHECK( glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW));
-
-    //positions
-    GLuint posBufId;
-    CS237_CHECK( glGenBuffers(1, &posBufId));
-	  CS237_CHECK( glBindBuffer(GL_ARRAY_BUFFER, posBufId));
-	  CS237_CHECK(  glBufferData(GL_ARRAY_BUFFER, MAX_DROPLETS * 3 * sizeof(GLfloat), NULL, GL_STREAM_DRAW));
-
-  // Generate new droplets (with an upper limit)
-    int lim = (int)(0.016f*10000.0);
-    int new_droplets = (int)(dt*10000.0f);
+  // Generate new droplets (with an upper limit); the rate scales with the maximum number
+  // of droplets
+    float rate = (float)this->_rain.Capacity();
+    int lim = (int)(0.016f*rate);
+    int new_droplets = (int)(dt*rate);
 
     if(new_droplets > lim)
       new_droplets = lim;
 
     int i;
     for(i = 0; i < new_droplets; i++){
-      int index = FindDeadDroplet();
-      // raindrops will live for 15 seconds
-      particles_container[index].lifeSpan = 15.0f;
       // spawn the raindrop in a random position (within a range around the camera)
-      particles_container[index].pos = cs237::vec3f((float)((rand() % 100 + 1) - 50),
-                                                    (float)(rand() % 10 + 100),
-                                                    (float)((rand() % 100 + 1) - 50));
+      cs237::vec3f pos((float)((rand() % 100 + 1) - 50),
+                       (float)(rand() % 10 + 100),
+                       (float)((rand() % 100 + 1) - 50));
 
       // randomize a wind effect
       float windx = (float)((rand() % 10)/ 70) + 2.5f;
       float windz = (float)((rand() % 10)/ 70) + 2.5f;
-      particles_container[index].velocity = cs237::vec3f(windx, -0.0f, windz);
-    }
-
-
-  // main simulation block
-    int count = 0;
-
-    int j;
-    for(j = 0; j < MAX_DROPLETS; j++){
-      particles& droplet = particles_container[i];
 
-      // droplet is alive
-      if(droplet.lifeSpan > 0.0f){
-
-        // decay
-        droplet.lifeSpan -= dt;
-
-        // raindrop is still alive
-        if(droplet.lifeSpan > 0.0f){
-          // update droplet characteristics
-          droplet.velocity += cs237::vec3f(0.0f, -9.81f, 0.0f) * dt * 0.5f;
-          droplet.pos += droplet.velocity * dt;
-          droplet.cameraDist = droplet.pos.length();
-
-          // fill buffer
-          position_data[3 * count] = droplet.pos[0];
-          position_data[3 * count + 1] = droplet.pos[1];
-          position_data[3 * count + 2] = droplet.pos[2];
-
-        }
-        else // droplet just died
-          droplet.cameraDist = -1.0f;
-
-        count++; // only incrementing count for live droplets
-      }
+      // raindrops will live for 15 seconds; when all of the droplets are alive, the
+      // new ones are dropped
+      if (! this->_rain.Spawn (15.0f, pos, cs237::vec3f(windx, -0.0f, windz)))
+        break;
     }
 
-    // need to sort droplets to handle opaqueness and blending
-    sortDroplets();
+  // main simulation block; the droplets fall at half the acceleration of gravity
+    this->_rain.Update (dt, cs237::vec3f(0.0f, -9.81f * 0.5f, 0.0f), cs237::ThreadPool::Shared());
 
+    // need to sort droplets to handle opaqueness and blending; the droplet positions
+    // are relative to the camera
+    this->_rain.SortByDistance (cs237::vec3f(0.0f, 0.0f, 0.0f));
 
+    int count = (int)this->_rain.PackPositions (this->_rainPos.data());
 
   /** setup and draw particles **/
 
-  CS237_CHECK( glBindBuffer(GL_ARRAY_BUFFER, posBufId));
-  CS237_CHECK( glBufferData(GL_ARRAY_BUFFER, MAX_DROPLETS * 3 * sizeof(GLfloat), NULL, GL_STREAM_DRAW));
-  CS237_CHECK( glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(GLfloat) * 3, position_data));
+  CS237_CHECK( glBindVertexArray(this->_rainVAO));
+  CS237_CHECK( glBindBuffer(GL_ARRAY_BUFFER, this->_rainPosBuf));
+  // orphan the previous frame's positions, so that we do not wait for the GPU to finish with them
+  CS237_CHECK( glBufferData(GL_ARRAY_BUFFER, this->_rainPos.size() * sizeof(GLfloat), NULL, GL_STREAM_DRAW));
+  CS237_CHECK( glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(GLfloat) * 3, this->_rainPos.data()));
 
   CS237_CHECK( glEnable(GL_BLEND));
-	CS237_CHECK( glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA));
+  CS237_CHECK( glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA));
 
   CS237_CHECK( glEnable(GL_DEPTH_TEST));
   CS237_CHECK( glDepthFunc(GL_LESS));
 
-  // vertex buffer
-  CS237_CHECK( glEnableVertexAttribArray(0));
-  CS237_CHECK( glBindBuffer(GL_ARRAY_BUFFER, vBufId));
-  CS237_CHECK( glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void *)0));
-
-  // position buffer
-  CS237_CHECK( glEnableVertexAttribArray(1));
-  CS237_CHECK( glBindBuffer(GL_ARRAY_BUFFER, posBufId));
-  CS237_CHECK( glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (void *)0));
-
-
-  //settings for instanced drawing
-  CS237_CHECK( glVertexAttribDivisor(0, 0)); // model vertices are reused
-  CS237_CHECK( glVertexAttribDivisor(1, 1)); // one "position" per streak
-
   //draw!
-  CS237_CHECK( glDrawArraysInstanced(GL_LINES, 0, 3, count));
+  CS237_CHECK( glDrawArraysInstanced(GL_LINES, 0, 2, count));
 
 
   //clean up
@@ -20,8 +20,6 @@
 class Cell; // cells in the map grid
 class Objects; // objects on the map
 
-#define MAX_DROPLETS 10000
-
 //! Information about a heightfield map.
 class Map {
   public:
@@ -29,25 +27,16 @@ class Map {
     Map ();
     ~Map ();
 
-  // particle struct
-    struct particles{
-        float lifeSpan; // alive if > 0
-        cs237::vec3f pos; // position
-        cs237::vec3f velocity; // downward velocity
-        float cameraDist; // unsigned distance from the particle to the camera
-
-        bool operator<(const particles& that) const{
-            return this->cameraDist > that.cameraDist;
-        }
-    };
-
   //! \brief load a map
   //! \param path the name of the directory that contains that map
   //! \param verbose when true (the default), the loader prints information about
   //!        the map to \c std::clog.
+  //! \param useCache when true (the default), the map and objects files and the OBJ
+  //!        models are loaded from their compiled forms when those are up to date (and
+  //!        the compiled forms are written when they are not).
   //! \return true if there are no errors, false if there was an error
   //!         reading the map.
-    bool LoadMap (std::string const &path, bool verbose=true);
+    bool LoadMap (std::string const &path, bool verbose=true, bool useCache=true);
 
   // return the descriptive name of the map
     std::string Name () const { return this->_name; }
@@ -96,6 +85,9 @@ class Map {
     float FogDensity () const { return this->_fogDensity; }
   //! does a map have an 'objects' directory?
     bool hasObjects () const { return (this->_objects != nullptr); }
+  //! upload the cell objects that have been loaded in the background since the last
+  //! frame; this must be called from the render thread once per frame.
+    void UpdateObjects ();
 
   //! return the cell at grid cell (row, col)
     class Cell *Cell (uint32_t row, uint32_t col) const;
@@ -125,14 +117,14 @@ class Map {
     static const uint32_t MIN_CELL_SIZE = (1 << 8);
   //! the maximum cell width
     static const uint32_t MAX_CELL_SIZE = (1 << 14);
+  //! the default maximum number of rain droplets
+    static const uint32_t DEFAULT_MAX_DROPLETS = 10000;
 
-  // sorts the droplets based on their distance from the camera
-    void sortDroplets();
+  //! set the maximum number of rain droplets; this must be called before the view is
+  //! initialized
+    void SetMaxDroplets (uint32_t n) { this->_rain.SetCapacity (n); }
 
-  // returns the index of the next deap droplet
-    int FindDeadDroplet();
-
-  // initializes particle characteristics to be "dead" (lifeSpan = -1, cameraDist = -1)
+  // kills all of the droplets and allocates the GL buffers for drawing them
     void initParticles();
 
   // draws the rain particles
@@ -169,10 +161,15 @@ class Map {
     float       _fogDensity;    //!< the density factor for the fog; will be 0 for no fog
     Objects     *_objects;      //!< repository of object meshes and materials that
                                 //!< are placed on the map
+    bool        _useCache;      //!< true if compiled forms of the JSON and OBJ files
+                                //!< are used
 
   //! rain variables
-    particles particles_container[MAX_DROPLETS]; //!< array of all the droplets
-    int lastUsed = 0; //! < index of the last used droplet
+    cs237::ParticleSystem _rain;        //!< the droplets; positions are relative to the camera
+    std::vector<float> _rainPos;        //!< staging buffer for the droplet positions
+    GLuint      _rainVAO;               //!< vertex array for drawing the droplets
+    GLuint      _rainVBuf;              //!< buffer for the droplet's line segment
+    GLuint      _rainPosBuf;            //!< buffer for the per-droplet positions
 
     float verts[6] = { //!< vertices for a droplet
         0.0f, 0.0f, 0.0f,
@@ -185,6 +182,20 @@ class Map {
   //! the index of the cell at the given row and column
     uint32_t _cellIdx (uint32_t row, uint32_t col) const { return this->_nCols * row + col; }
 
+  //! parse the map.json file
+  //! \param mapName the name of the map (for error messages)
+  //! \param file the map.json file
+  //! \param[out] grid the paths (relative to the map directory) of the cells
+  //! \return true if there are no errors
+    bool _ParseMap (std::string const &mapName, std::string const &file, std::vector<std::string> &grid);
+
+  //! load the map parameters and grid from the compiled form of the map.json file
+  //! \return true if there is an up-to-date compiled file
+    bool _LoadCompiled (std::string const &file, std::vector<std::string> &grid);
+
+  //! write the compiled form of the map.json file
+    void _SaveCompiled (std::string const &file, std::vector<std::string> const &grid);
+
     friend class Cell;
     friend class Objects;
 };
@@ -14,6 +14,8 @@
 #include "cs237.hxx"
 #include "mesh.hxx"
 #include "map-objects.hxx"
+#include "instance-batch.hxx"
+#include <cstddef>
 
 //  Helper function to enable attribute locations
 //
@@ -28,12 +30,87 @@ static inline void InitAttributeLoc (bool enable, GLuint loc)
 
 }
 
+//  Helper function to set up a per-instance float attribute
+//
+static inline void SetInstanceAttr (GLuint loc, GLint size, GLsizei stride, size_t offset)
+{
+    CS237_CHECK( glVertexAttribPointer (loc, size, GL_FLOAT, GL_FALSE, stride,
+        reinterpret_cast<const GLvoid *>(offset)) );
+    CS237_CHECK( glVertexAttribDivisor (loc, 1) );
+    CS237_CHECK( glEnableVertexAttribArray (loc) );
+
+}
+
+/***** struct MeshBuffers member functions *****/
+
+MeshBuffers::MeshBuffers (OBJ::MeshFile const *mesh)
+  : _vaoId(0), _vBufId(0), _eBufId(0),
+    _indexType((mesh->IndexSize() == sizeof(uint16_t)) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT),
+    _hasNorms(mesh->HasNorms()),
+    _hasTxtCoords(mesh->HasTxtCoords()),
+    _hasTans(mesh->HasTangents())
+{
+    GLsizei stride = mesh->VertexStride();
+
+  // generate the vertex array object for the model
+    CS237_CHECK( glGenVertexArrays (1, &(this->_vaoId)) );
+    CS237_CHECK( glBindVertexArray (this->_vaoId) );
+
+  // vertex buffer initialization; the attributes are interleaved in one buffer
+    CS237_CHECK( glGenBuffers (1, &this->_vBufId) );
+    CS237_CHECK( glBindBuffer (GL_ARRAY_BUFFER, this->_vBufId) );
+    CS237_CHECK( glBufferData (
+            GL_ARRAY_BUFFER,
+            mesh->NumVerts()*stride,
+            mesh->VertexData(),
+            GL_STATIC_DRAW)
+        );
+    CS237_CHECK( glVertexAttribPointer (TriMesh::CoordAttrLoc, 3, GL_FLOAT, GL_FALSE, stride, 0) );
+    CS237_CHECK( glEnableVertexAttribArray (TriMesh::CoordAttrLoc) );
+    if (this->_hasNorms) {
+        CS237_CHECK( glVertexAttribPointer (TriMesh::NormAttrLoc, 3, GL_FLOAT, GL_FALSE, stride,
+            reinterpret_cast<const GLvoid *>(size_t(mesh->NormOffset()))) );
+    }
+    if (this->_hasTxtCoords) {
+        CS237_CHECK( glVertexAttribPointer (TriMesh::TexCoordAttrLoc, 2, GL_FLOAT, GL_FALSE, stride,
+            reinterpret_cast<const GLvoid *>(size_t(mesh->TxtCoordOffset()))) );
+    }
+  // the tangents are computed when the model is compiled
+    if (this->_hasTans) {
+        CS237_CHECK( glVertexAttribPointer (TriMesh::TanAttrLoc, 4, GL_FLOAT, GL_FALSE, stride,
+            reinterpret_cast<const GLvoid *>(size_t(mesh->TangentOffset()))) );
+    }
+
+  // index-array buffer initialization
+    CS237_CHECK( glGenBuffers (1, &this->_eBufId) );
+    CS237_CHECK( glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, this->_eBufId) );
+    CS237_CHECK( glBufferData (
+            GL_ELEMENT_ARRAY_BUFFER,
+            mesh->NumIndices()*mesh->IndexSize(),
+            mesh->Indices(),
+            GL_STATIC_DRAW)
+        );
+
+  // cleanup
+    CS237_CHECK( glBindBuffer (GL_ARRAY_BUFFER, 0) );
+    CS237_CHECK( glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, 0) );
+    CS237_CHECK( glBindVertexArray (0) );
+
+}
+
+MeshBuffers::~MeshBuffers ()
+{
+    GLuint bufs[2] = { this->_vBufId, this->_eBufId };
+    CS237_CHECK( glDeleteBuffers (2, bufs) );
+    CS237_CHECK( glDeleteVertexArrays (1, &this->_vaoId) );
+}
+
 /***** struct TriMesh member functions *****/
 
 //! create a TriMesh object by initializing its buffer Ids.  The buffer data is
 //! loaded separately.
 TriMesh::TriMesh (GLenum p)
-  : _vaoId(0), _prim(p), _nIndices(0),
+  : _vaoId(0), _indexType(GL_UNSIGNED_INT), _prim(p), _bufs(), _firstIndex(0), _nIndices(0),
     _hasEmissive(false), _hasSpecular(false),
     _eMap(nullptr), _dMap(nullptr), _sMap(nullptr), _nMap(nullptr)
 {
@@ -41,20 +118,39 @@ TriMesh::TriMesh (GLenum p)
     CS237_CHECK( glGenVertexArrays (1, &(this->_vaoId)) );
 }
 
-//! create a TriMesh object by initializing its buffer Ids.  The buffer data is
-//! loaded separately.
-TriMesh::TriMesh (const Objects *mapObjs, OBJ::Model const *model, OBJ::Group const &grp)
-  : _vaoId(0), _prim(GL_TRIANGLES), _nIndices(grp.nIndices),
+//! create a TriMesh object for a group of a model whose vertex pool and index array
+//! have been loaded into shared buffers.  The vertex attributes are interleaved in
+//! one buffer, so the attribute buffer IDs are all the same.
+TriMesh::TriMesh (
+    const Objects *mapObjs,
+    OBJ::MeshFile const *mesh,
+    int grpIdx,
+    std::shared_ptr<MeshBuffers> const &bufs)
+  : _vaoId(bufs->_vaoId), _vBufId(bufs->_vBufId), _nBufId(bufs->_vBufId),
+    _tcBufId(bufs->_vBufId), _tanBufId(bufs->_vBufId), _eBufId(bufs->_eBufId),
+    _indexType(bufs->_indexType), _prim(GL_TRIANGLES), _bufs(bufs),
+    _firstIndex(mesh->Group(grpIdx).firstIndex), _nIndices(mesh->Group(grpIdx).nIndices),
     _hasEmissive(false), _hasSpecular(false),
     _eMap(nullptr), _dMap(nullptr), _sMap(nullptr), _nMap(nullptr)
 {
+    OBJ::Group const &grp = mesh->Group(grpIdx);
+
+  // the levels of detail of the group, which are in the same element buffer
+    if (mesh->NumLODs() > 1) {
+        this->_lods.resize (mesh->NumLODs());
+        for (int lod = 0;  lod < mesh->NumLODs();  lod++) {
+            this->_lods[lod].range = mesh->GroupLOD(grpIdx, lod);
+            this->_lods[lod].error = mesh->LODError(lod);
+        }
+    }
+
   // get the material for the group
     const OBJ::Material *mtl;
     if (grp.material < 0) {
         mtl = nullptr;
     }
     else {
-        mtl = &model->Material(grp.material);
+        mtl = &mesh->Material(grp.material);
     }
 
   /***** get the material properties for the group *****/
@@ -90,159 +186,63 @@ TriMesh::TriMesh (const Objects *mapObjs, OBJ::Model const *model, OBJ::Group co
   // normal map
     this->_nMap = mapObjs->LoadTexture2D(mtl->normalMap);
 
-  // generate the vertex array object for the mesh
-    CS237_CHECK( glGenVertexArrays (1, &(this->_vaoId)) );
-    CS237_CHECK( glBindVertexArray (this->_vaoId) );
+  // the vertex data is in the model's shared buffers; tangents are only used when
+  // the mesh has a normal map
+    this->_hasNorms = bufs->_hasNorms;
+    this->_hasTxtCoords = bufs->_hasTxtCoords;
+    this->_hasTans = bufs->_hasTans && (this->_nMap != nullptr);
 
-  // assign the vertex-buffer ID
-    CS237_CHECK( glGenBuffers (1, &this->_vBufId) );
+}
 
-  // assign the normal-buffer ID (if needed)
-    if (grp.norms != nullptr) {
-        this->_hasNorms = true;
-        CS237_CHECK( glGenBuffers (1, &this->_nBufId) );
-    }
-    else {
-        this->_hasNorms = false;
-    }
+TriMesh::~TriMesh ()
+{
+    /* TODO */
+}
 
-  // assign the texture-coordinate-buffer ID (if needed)
-    if (grp.txtCoords != nullptr) {
-        this->_hasTxtCoords = true;
-        CS237_CHECK( glGenBuffers (1, &this->_tcBufId) );
-    }
-    else {
-        this->_hasTxtCoords = false;
+void TriMesh::Draw (bool enableNorms, bool enableTexs, bool enableTans, int lod)
+{
+    assert ((0 <= lod) && (lod < this->NumLODs()));
+    int firstIndex = this->_firstIndex;
+    int nIndices = this->_nIndices;
+    if (lod > 0) {
+        firstIndex = this->_lods[lod].range.firstIndex;
+        nIndices = this->_lods[lod].range.nIndices;
     }
 
-  // assign the tangent-buffer ID (if needed)
-    if (this->_hasNorms && (this->_nMap != nullptr)) {
-        this->_hasTans = true;
-        CS237_CHECK( glGenBuffers (1, &this->_tanBufId) );
-    }
-    else {
-        this->_hasTans = false;
-    }
+    CS237_CHECK( glBindVertexArray (this->_vaoId) );
 
-  // assign the element-buffer ID
-    CS237_CHECK( glGenBuffers (1, &this->_eBufId) );
+  // bind the indices array
+    CS237_CHECK( glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, this->_eBufId) );
 
-  // vertex buffer initialization
-    CS237_CHECK( glBindBuffer (GL_ARRAY_BUFFER, this->_vBufId) );
-    CS237_CHECK( glBufferData (
-            GL_ARRAY_BUFFER,
-            grp.nVerts*sizeof(cs237::vec3f),
-            grp.verts,
-            GL_STATIC_DRAW)
-        );
-    CS237_CHECK( glVertexAttribPointer (CoordAttrLoc, 3, GL_FLOAT, GL_FALSE, 0, 0) );
+  // enable attribute buffers
     CS237_CHECK( glEnableVertexAttribArray (CoordAttrLoc) );
+    InitAttributeLoc (this->_hasNorms && enableNorms, NormAttrLoc);
+    InitAttributeLoc (this->_hasTxtCoords && enableTexs, TexCoordAttrLoc);
+    InitAttributeLoc (this->_hasTans && enableTans, TanAttrLoc);
 
-  // normal buffer initialization
-    if (this->_hasNorms) {
-        CS237_CHECK( glBindBuffer (GL_ARRAY_BUFFER, this->_nBufId) );
-        CS237_CHECK( glBufferData (
-                GL_ARRAY_BUFFER,
-                grp.nVerts*sizeof(cs237::vec3f),
-                grp.norms,
-                GL_STATIC_DRAW)
-            );
-        CS237_CHECK( glVertexAttribPointer (NormAttrLoc, 3, GL_FLOAT, GL_FALSE, 0, 0) );
-    }
-
-  // texture-coordinate buffer initialization
-    if (this->_hasTxtCoords) {
-        CS237_CHECK( glBindBuffer (GL_ARRAY_BUFFER, this->_tcBufId) );
-        CS237_CHECK( glBufferData (
-                GL_ARRAY_BUFFER,
-                grp.nVerts*sizeof(cs237::vec2f),
-                grp.txtCoords,
-                GL_STATIC_DRAW)
-            );
-        CS237_CHECK( glVertexAttribPointer (TexCoordAttrLoc, 2, GL_FLOAT, GL_FALSE, 0, 0) );
-    }
-
-  // tangent-vector buffer initialization
-    if (this->_hasTans) {
-        cs237::vec3f *tan = new cs237::vec3f[grp.nVerts];
-        cs237::vec3f *bitan = new cs237::vec3f[grp.nVerts];
-        for (int i = 0;  i < grp.nVerts;  i++) {  // clear arrays
-            tan[i] = cs237::vec3f();
-            bitan[i] = cs237::vec3f();
-        }
-        cs237::vec4f *tangents = new cs237::vec4f[grp.nVerts];
-        uint32_t nTris = grp.nIndices / 3;
-        assert (nTris * 3 == grp.nIndices);
-        for (int tri = 0;  tri < nTris;  tri++) {
-          // get the indices for the triangle
-            uint32_t i1 = grp.indices[3*tri + 0];
-            uint32_t i2 = grp.indices[3*tri + 1];
-            uint32_t i3 = grp.indices[3*tri + 2];
-          // get the vertices for the triangle
-            cs237::vec3f v1 = grp.verts[i1];
-            cs237::vec3f v2 = grp.verts[i2];
-            cs237::vec3f v3 = grp.verts[i3];
-          // get the texture coordinates for the triangle
-            cs237::vec2f vt1 = grp.txtCoords[i1];
-            cs237::vec2f vt2 = grp.txtCoords[i2];
-            cs237::vec2f vt3 = grp.txtCoords[i3];
-          // the sides of the triangle as a 3x2 matrix
-            cs237::mat3x2f Q = cs237::mat3x2f(
-                v2.x - v1.x, v3.x - v1.x,   // column one
-                v2.y - v1.y, v3.y - v2.y,   // column two
-                v2.z - v1.z, v3.z - v1.z);  // column three
-          // the sides in tangent space as a 2x2 matrix
-            cs237::mat2x2f ST = cs237::mat2x2f (
-                vt2.x - vt1.x, vt3.x - vt1.x,       // first column
-                vt2.y - vt1.y, vt3.y - vt1.y);      // second column
-          // Q = ST * [T B]^T, so multiply Q by ST^{-1}
-            cs237::mat3x2f TB = ST.inverse() * Q;
-          // extract rows T and B
-            cs237::vec3f t = cs237::vec3f(TB[0][0], TB[1][0], TB[2][0]);
-            cs237::vec3f b = cs237::vec3f(TB[0][1], TB[1][1], TB[2][1]);
-          // add to vector sums
-            tan[i1] += t;
-            tan[i2] += t;
-            tan[i3] += t;
-            bitan[i1] += b;
-            bitan[i2] += b;
-            bitan[i3] += b;
-        }
-      // compute extended tangents for vertices
-        for (int i = 0;  i < grp.nVerts;  i++) {
-            cs237::vec3f n = grp.norms[i];
-            cs237::vec3f t = tan[i];
-          // orthogonalize
-            t = normalize(t - n * dot(n, t));
-            float w = (dot(cross(n, t), bitan[i]) < 0.0f ? -1.0f : 1.0f);
-            tangents[i] = cs237::vec4f(t, w);
-        }
-        CS237_CHECK( glBindBuffer (GL_ARRAY_BUFFER, this->_tanBufId) );
-        CS237_CHECK( glBufferData (GL_ARRAY_BUFFER, grp.nVerts*sizeof(cs237::vec4f), tangents, GL_STATIC_DRAW) );
-        CS237_CHECK( glVertexAttribPointer (TanAttrLoc, 4, GL_FLOAT, GL_FALSE, 0, 0) );
-        delete[] tan;
-        delete[] bitan;
-        delete[] tangents;
-    }
-
-  // index-array buffer initialization
-    CS237_CHECK( glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, this->_eBufId) );
-    CS237_CHECK( glBufferData (GL_ELEMENT_ARRAY_BUFFER, grp.nIndices*sizeof(uint32_t), grp.indices, GL_STATIC_DRAW) );
+  // render
+    size_t indexSz = (this->_indexType == GL_UNSIGNED_SHORT) ? sizeof(uint16_t) : sizeof(uint32_t);
+    CS237_CHECK( glDrawElements (this->_prim, nIndices, this->_indexType,
+        reinterpret_cast<const GLvoid *>(firstIndex * indexSz)) );
 
   // cleanup
-    CS237_CHECK( glBindBuffer (GL_ARRAY_BUFFER, 0) );
     CS237_CHECK( glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, 0) );
     CS237_CHECK( glBindVertexArray (0) );
 
 }
 
-TriMesh::~TriMesh ()
+void TriMesh::DrawInstanced (
+    bool enableNorms, bool enableTexs, bool enableTans, int lod,
+    GLuint instBufId, uint32_t firstInst, uint32_t nInsts)
 {
-    /* TODO */
-}
+    assert ((0 <= lod) && (lod < this->NumLODs()));
+    int firstIndex = this->_firstIndex;
+    int nIndices = this->_nIndices;
+    if (lod > 0) {
+        firstIndex = this->_lods[lod].range.firstIndex;
+        nIndices = this->_lods[lod].range.nIndices;
+    }
 
-void TriMesh::Draw (bool enableNorms, bool enableTexs, bool enableTans)
-{
     CS237_CHECK( glBindVertexArray (this->_vaoId) );
 
   // bind the indices array
@@ -254,10 +254,32 @@ void TriMesh::Draw (bool enableNorms, bool enableTexs, bool enableTans)
     InitAttributeLoc (this->_hasTxtCoords && enableTexs, TexCoordAttrLoc);
     InitAttributeLoc (this->_hasTans && enableTans, TanAttrLoc);
 
+  // point the per-instance attributes at the batch's instances; matrices take one
+  // attribute location per column
+    GLsizei stride = sizeof(InstanceData);
+    size_t base = firstInst * sizeof(InstanceData);
+    CS237_CHECK( glBindBuffer (GL_ARRAY_BUFFER, instBufId) );
+    for (int i = 0;  i < 4;  i++) {
+        SetInstanceAttr (ModelMatAttrLoc + i, 4, stride,
+            base + offsetof(InstanceData, modelMat) + i * sizeof(cs237::vec4f));
+    }
+    for (int i = 0;  i < 3;  i++) {
+        SetInstanceAttr (NormMatAttrLoc + i, 3, stride,
+            base + offsetof(InstanceData, normMat) + i * sizeof(cs237::vec4f));
+    }
+    SetInstanceAttr (InstColorAttrLoc, 4, stride, base + offsetof(InstanceData, color));
+    CS237_CHECK( glBindBuffer (GL_ARRAY_BUFFER, 0) );
+
   // render
-    CS237_CHECK( glDrawElements (this->_prim, this->_nIndices, GL_UNSIGNED_INT, 0) );
+    size_t indexSz = (this->_indexType == GL_UNSIGNED_SHORT) ? sizeof(uint16_t) : sizeof(uint32_t);
+    CS237_CHECK( glDrawElementsInstanced (this->_prim, nIndices, this->_indexType,
+        reinterpret_cast<const GLvoid *>(firstIndex * indexSz), nInsts) );
 
-  // cleanup
+  // cleanup; the VAO is shared with non-instanced draws, so we disable the per-instance
+  // attributes
+    for (GLint loc = ModelMatAttrLoc;  loc <= InstColorAttrLoc;  loc++) {
+        CS237_CHECK( glDisableVertexAttribArray (loc) );
+    }
     CS237_CHECK( glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, 0) );
     CS237_CHECK( glBindVertexArray (0) );
 
@@ -15,7 +15,9 @@
 #define _MESH_HXX_
 
 #include "cs237.hxx"
-#include "obj.hxx"
+#include "obj-mesh.hxx"
+#include <algorithm>
+#include <memory>
 
 class Objects;  // defined in map-objects.hxx
 
@@ -27,6 +29,28 @@ enum {
     MAX_NUM_TEXS = 3    //!< max number of textures (not all textures are present for all skins)
 };
 
+//! The OpenGL buffers that hold the vertex pool and index array of a compiled OBJ
+//! model.  The meshes for the groups of a model share one MeshBuffers object (and its
+//! VAO), so each vertex of the model is uploaded once.
+struct MeshBuffers {
+    GLuint      _vaoId;         //!< vertex-array-object ID
+    GLuint      _vBufId;        //!< buffer ID for the interleaved vertex attributes
+    GLuint      _eBufId;        //!< buffer ID for the index array
+    GLenum      _indexType;     //!< the type of the indices (GL_UNSIGNED_SHORT or
+                                //!  GL_UNSIGNED_INT)
+    bool        _hasNorms;      //!< does the pool have vertex normals?
+    bool        _hasTxtCoords;  //!< does the pool have texture coordinates?
+    bool        _hasTans;       //!< does the pool have tangent vectors?
+
+  //! upload the vertex pool and index array of a compiled model; the tangent-vector
+  //! buffer is present when the compiled model has tangents
+  //! \param mesh the compiled model
+    MeshBuffers (OBJ::MeshFile const *mesh);
+
+  //! destructor: deletes the buffers and VAO
+    ~MeshBuffers ();
+};
+
 //! the information needed to render a mesh
 class TriMesh {
   public:
@@ -34,20 +58,31 @@ class TriMesh {
     //! The locations of the standard mesh attributes.  The layout directives
     //! in the shaders should match these values.
     //
-    const GLint     CoordAttrLoc = 0;       //!< location of vertex coordinates attribute
-    const GLint     NormAttrLoc = 1;        //!< location of normal-vector attribute
-    const GLint     TexCoordAttrLoc = 2;    //!< location of texture coordinates attribute
-    const GLint     TanAttrLoc = 3;         //!< location of extended tangent vector
+    static const GLint CoordAttrLoc = 0;    //!< location of vertex coordinates attribute
+    static const GLint NormAttrLoc = 1;     //!< location of normal-vector attribute
+    static const GLint TexCoordAttrLoc = 2; //!< location of texture coordinates attribute
+    static const GLint TanAttrLoc = 3;      //!< location of extended tangent vector
+    static const GLint ModelMatAttrLoc = 4; //!< location of the per-instance model matrix
+                                            //!  (uses locations 4-7)
+    static const GLint NormMatAttrLoc = 8;  //!< location of the per-instance normal matrix
+                                            //!  (uses locations 8-10)
+    static const GLint InstColorAttrLoc = 11; //!< location of the per-instance color
 
   //! create a TriMesh object for an group in an OBJ model
   //! \param mapObjs the map-objects manager
-  //! \param model the model that the group is part of
-  //! \param grp the OBJ Group used to initialize the vertex buffers
+  //! \param mesh the compiled model that the group is part of
+  //! \param grp the index of the OBJ Group that the mesh renders
+  //! \param bufs the buffers holding the model's vertex pool and index array
   //!
-  //! The vertex buffers for the mesh are initialized from the \arg grp, while
-  //! the material properties are taken from the group's material in the model.
+  //! The mesh renders the group's ranges of the model's index array (one per level of
+  //! detail) from the shared buffers, while the material properties are taken from the
+  //! group's material in the model.
   //
-    TriMesh (const Objects *mapObjs, OBJ::Model const *model, OBJ::Group const &grp);
+    TriMesh (
+        const Objects *mapObjs,
+        OBJ::MeshFile const *mesh,
+        int grp,
+        std::shared_ptr<MeshBuffers> const &bufs);
 
   //! destructor
     virtual ~TriMesh ();
@@ -137,14 +172,45 @@ class TriMesh {
         this->_nMap->Bind();
     }
 
+  /***** Level-of-detail operations *****/
+
+  //! the number of levels of detail of the mesh (level 0 is the full-resolution mesh)
+    int NumLODs () const { return std::max(1, int(this->_lods.size())); }
+
+  //! the geometric error (in object space) of a level of detail
+    float LODError (int lod) const { return (lod > 0) ? this->_lods[lod].error : 0.0f; }
+
+  //! the number of triangles at a level of detail
+    int NumTris (int lod) const
+    {
+        return ((lod > 0) ? this->_lods[lod].range.nIndices : this->_nIndices) / 3;
+    }
+
   //! draw the mesh using a glDrawElements call
   //! \param enableNorms   when true, we enable the normal-vector attribute buffer
   //! \param enableTxts    when true, we enable the texture-coordinate attribute buffer
   //! \param enableTans    when true, we wnable the tangent-vector attribute buffer
+  //! \param lod           the level of detail to draw
+  //
+  //! We assume that the shader uniforms have been set
+  //
+    void Draw (bool enableNorms, bool enableTxts, bool enableTans, int lod = 0);
+
+  //! draw instances of the mesh using a glDrawElementsInstanced call
+  //! \param enableNorms   when true, we enable the normal-vector attribute buffer
+  //! \param enableTxts    when true, we enable the texture-coordinate attribute buffer
+  //! \param enableTans    when true, we wnable the tangent-vector attribute buffer
+  //! \param lod           the level of detail to draw
+  //! \param instBufId     the buffer that holds the per-instance attributes (an array of
+  //!                      InstanceData values)
+  //! \param firstInst     the index of the first instance in the buffer
+  //! \param nInsts        the number of instances to draw
   //
   //! We assume that the shader uniforms have been set
   //
-    void Draw (bool enableNorms, bool enableTxts, bool enableTans);
+    void DrawInstanced (
+        bool enableNorms, bool enableTxts, bool enableTans, int lod,
+        GLuint instBufId, uint32_t firstInst, uint32_t nInsts);
 
   protected:
 
@@ -160,9 +226,20 @@ class TriMesh {
                                         //! is present when there are normals and a normal
                                         //! map.
     GLuint              _eBufId;        //!< buffer ID for the index array
+    GLenum              _indexType;     //!< the type of the indices
     GLenum              _prim;          //!< the primitive type for rendering the mesh
                                         //!  (e.g., GL_TRIANGLES, GL_TRIANGLE_FAN, etc.)
+    std::shared_ptr<MeshBuffers> _bufs; //!< the shared buffers of the mesh's model (or
+                                        //!  nullptr for meshes that have their own buffers)
+    int                 _firstIndex;    //!< the position of the mesh's first index in the
+                                        //!  element buffer
     int                 _nIndices;      //!< the number of vertex indices
+    struct LOD {
+        OBJ::LODRange   range;          //!< the triangles of the level in the element buffer
+        float           error;          //!< the geometric error of the level
+    };
+    std::vector<LOD>    _lods;          //!< the levels of detail of the mesh; this vector
+                                        //!  is empty for meshes that have only one level
     bool                _hasNorms;      //!< does this mesh have vertex normals?
     bool                _hasTxtCoords;  //!< does this mesh have texture coordinates?
     bool                _hasTans;       //!< does this mesh have tangent-vectors?
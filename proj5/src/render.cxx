@@ -16,6 +16,8 @@
 #include "view.hxx"
 #include "camera.hxx"
 #include "map-cell.hxx"
+#include "map-objects.hxx"
+#include "mesh.hxx"
 #include "buffer-cache.hxx"
 #include "texture-cache.hxx"
 
@@ -485,12 +487,9 @@ void Tile::Draw(View* view, float dt){
                                                      view->Map()->vScale() * this->_currentT));
 
     cs237::setUniform(view->tViewMatLoc, view->Camera().viewTransform());
-    cs237::setUniform(view->tTileWidthLoc, (int)this->Width());
-    cs237::setUniform(view->tColLoc, (int) this->NWCol());
-    cs237::setUniform(view->tRowLoc, (int) this->NWRow());
 
-    this->_texture->Use(0);
-    this->_nmap->Use(1);
+    if(!this->BindTextures(view))
+      return;
 
   }
 
@@ -498,6 +497,40 @@ void Tile::Draw(View* view, float dt){
 
 }
 
+// select the color and normal textures for a tile.  Texture images are decoded in the
+// background, so if the tile's own textures are not resident yet we use the textures of
+// the nearest ancestor for which both are resident.  The texture coordinates are remapped
+// to the ancestor's sub-region by setting the tile origin and width uniforms to those
+// of the ancestor.
+bool Tile::BindTextures(View* view){
+  Texture *txt = this->_texture;
+  Texture *nmap = this->_nmap;
+  int lod = this->LOD();
+  uint32_t row = this->NWRow()/this->Width();
+  uint32_t col = this->NWCol()/this->Width();
+
+  while(!(txt->isResident() && nmap->isResident())){
+    if(lod == 0)
+      return false;
+    lod--;
+    row >>= 1;
+    col >>= 1;
+    txt = view->TxtCache()->Make(txt->Tree(), lod, row, col);
+    nmap = view->TxtCache()->Make(nmap->Tree(), lod, row, col);
+  }
+
+  uint32_t width = this->_cell->Width() >> lod;
+  cs237::setUniform(view->tTileWidthLoc, (int)width);
+  cs237::setUniform(view->tColLoc, (int)(col * width));
+  cs237::setUniform(view->tRowLoc, (int)(row * width));
+
+  // the texture arrays are bound once per frame, so we only need to pick the layers
+  cs237::setUniform(view->tMapLayerLoc, txt->Use());
+  cs237::setUniform(view->normMapLayerLoc, nmap->Use());
+
+  return true;
+}
+
 //NOTE: The code used to handle the skybox was based off this tutorial:
 //      http://antongerdelan.net/opengl/cubemaps.html
 void View::drawSky(){
@@ -599,6 +632,113 @@ void View::drawSky(){
     CS237_CHECK( glBindVertexArray (0) );
 }
 
+//! the objects of a cell are requested when the cell is within this factor of the
+//! far-plane distance and released when it is beyond OBJ_RELEASE_DIST times the distance;
+//! the gap keeps cells near the boundary from being repeatedly loaded and released.
+#define OBJ_REQUEST_DIST        1.0
+#define OBJ_RELEASE_DIST        1.5
+
+// render the objects of the map.  The visible instances are grouped by mesh and level
+// of detail and each group is drawn with one instanced draw call, so the number of draw
+// calls depends on the number of distinct meshes, instead of the number of instances.
+void View::RenderObjects ()
+{
+    if (! this->_map->hasObjects())
+        return;
+
+  // request the objects of cells that are near the camera and release the objects of
+  // cells that are far away; requested objects are loaded in the background and
+  // appear in a later frame.
+    cs237::vec3d camPos = this->_cam.position();
+    cs237::vec3d cellSize = this->_map->CellSize();
+    double requestDist = OBJ_REQUEST_DIST * this->_cam.far();
+    double releaseDist = OBJ_RELEASE_DIST * this->_cam.far();
+    for (int i = 0;  i < this->_map->nRows();  i++) {
+        for (int j = 0;  j < this->_map->nCols();  j++) {
+          // the horizontal distance from the camera to the cell
+            cs237::vec3d nwCorner = this->_map->NWCellCorner(i, j);
+            double dx = std::max(0.0, std::max(nwCorner.x - camPos.x, camPos.x - (nwCorner.x + cellSize.x)));
+            double dz = std::max(0.0, std::max(nwCorner.z - camPos.z, camPos.z - (nwCorner.z + cellSize.z)));
+            double dist = sqrt(dx*dx + dz*dz);
+            if (dist <= requestDist) {
+                this->_map->Cell(i, j)->RequestObjects();
+            }
+            else if (dist > releaseDist) {
+                this->_map->Cell(i, j)->ReleaseObjects();
+            }
+        }
+    }
+    this->_map->UpdateObjects();
+
+  // collect the visible instances
+    this->_objBatches.Clear();
+    std::vector<uint32_t> visible;
+    for (int i = 0;  i < this->_map->nRows();  i++) {
+        for (int j = 0;  j < this->_map->nCols();  j++) {
+            cs237::vec3d nwCorner = this->_map->NWCellCorner(i, j);
+            cs237::vec3d origin = this->_cam.translate(nwCorner);
+            cs237::vec3f floatOrigin = cs237::vec3f(
+                (float)origin[0], (float)origin[1], (float)origin[2]);
+            cs237::vec3d camInCell = camPos - nwCorner;
+            cs237::vec3f floatCamInCell = cs237::vec3f(
+                (float)camInCell[0], (float)camInCell[1], (float)camInCell[2]);
+            CellObjects &objs = this->_map->Cell(i, j)->Objects();
+            visible.clear();
+            objs.FrustumQuery (this->_frustum, nwCorner, visible);
+            for (auto it = visible.begin();  it != visible.end();  it++) {
+                int lod = objs.SelectLOD(*it, this->_cam, floatCamInCell, this->_errorLimit);
+                this->_objBatches.Add (objs, *it, lod, floatOrigin);
+            }
+        }
+    }
+    if (this->_objBatches.NumInstances() == 0)
+        return;
+    this->_objBatches.Finish();
+
+  // upload the per-instance attributes
+    CS237_CHECK( glBindBuffer (GL_ARRAY_BUFFER, this->_instBufId) );
+    CS237_CHECK( glBufferData (GL_ARRAY_BUFFER,
+        this->_objBatches.NumInstances() * sizeof(InstanceData),
+        this->_objBatches.Data(),
+        GL_STREAM_DRAW) );
+    CS237_CHECK( glBindBuffer (GL_ARRAY_BUFFER, 0) );
+
+    this->objshader->Use();
+    cs237::setUniform(this->objViewMatLoc, this->_cam.viewTransform());
+    cs237::setUniform(this->objProjMatLoc, this->_cam.projTransform());
+    cs237::setUniform(this->objLDirLoc, this->_map->SunDirection());
+    cs237::setUniform(this->objLAmbLoc, this->_map->AmbientIntensity());
+    cs237::setUniform(this->objLIntLoc, this->_map->SunIntensity());
+    cs237::setUniform(this->objNoLightLoc, this->_noLight ? GL_TRUE : GL_FALSE);
+    cs237::setUniform(this->objNoFogLoc,
+        (this->_noFog || !this->_map->hasFog()) ? GL_TRUE : GL_FALSE);
+    cs237::setUniform(this->objFogColorLoc, this->_map->FogColor());
+    cs237::setUniform(this->objFogDensityLoc, this->_map->FogDensity());
+    cs237::setUniform(this->objWireframeLoc, this->wireframeMode() ? GL_TRUE : GL_FALSE);
+    cs237::setUniform(this->objDiffuseMapLoc, 4);
+
+  // the object meshes may have 16-bit indices that are equal to the restart index
+    glDisable(GL_PRIMITIVE_RESTART);
+    bool wireframe = this->wireframeMode();
+    for (auto it = this->_objBatches.begin();  it != this->_objBatches.end();  it++) {
+        TriMesh *mesh = it->mesh;
+        bool hasMap = !wireframe && mesh->hasDiffuseMap();
+        cs237::setUniform(this->objDiffuseColorLoc, mesh->DiffuseColor());
+        cs237::setUniform(this->objHasDiffuseMapLoc, hasMap ? GL_TRUE : GL_FALSE);
+        if (hasMap) {
+          // use GL_TEXTURE4 because 0-3 are taken by the terrain and skybox textures
+            mesh->BindDiffuseMap (GL_TEXTURE4);
+        }
+        mesh->DrawInstanced (!wireframe, hasMap, false, it->lod, this->_instBufId, it->first, it->count);
+    }
+    glEnable(GL_PRIMITIVE_RESTART);
+
+    if (wireframe)
+        this->wfshader->Use();
+    else
+        this->textureshader->Use();
+}
+
 void View::Render (float dt)
 {
     if (! this->_isVis)
@@ -606,6 +746,9 @@ void View::Render (float dt)
 
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+    // upload any texture images that were decoded since the last frame
+    this->_tCache->NewFrame();
+
     //resource pass
     for(int i = 0; i < this->_map->nRows(); i++){
         for(int j = 0; j < this->_map->nCols(); j++){
@@ -615,8 +758,16 @@ void View::Render (float dt)
         }
     }
 
-    // set up detail textures
+    // set up the terrain and detail textures
     if(!this->wireframeMode()){
+      // the color and normal textures of every tile live in two texture arrays
+      this->_tCache->BindArray(TextureCache::COLOR, 0);
+      this->_tCache->BindArray(TextureCache::NORMAL, 1);
+      // two-channel (BC5) normal maps only store the x and z components
+      if(this->_tCache->Format(TextureCache::NORMAL) == GL_COMPRESSED_RG_RGTC2)
+        cs237::setUniform(this->normMapRGLoc, GL_TRUE);
+      else
+        cs237::setUniform(this->normMapRGLoc, GL_FALSE);
       // use GL_TEXTURE2 because 0 and 1 are taken by color and normal textures
       CS237_CHECK(glActiveTexture(GL_TEXTURE2));
       //add detail textures
@@ -647,6 +798,9 @@ void View::Render (float dt)
         }
     }
 
+    //draw the objects
+    this->RenderObjects();
+
     //draw skybox
     if(!this->wireframeMode()){
       glDepthMask(GL_FALSE);
@@ -688,4 +842,15 @@ void Cell::InitTextures (View *view)
     }
 #endif
 
+  // the root textures are loaded up front, since they are the fallback for tiles whose
+  // textures have not been decoded yet
+    if (this->_colorTQT != nullptr) {
+        view->TxtCache()->AddTree(this->_colorTQT, TextureCache::COLOR);
+        view->TxtCache()->Make(this->_colorTQT, 0, 0, 0)->Load();
+    }
+    if (this->_normTQT != nullptr) {
+        view->TxtCache()->AddTree(this->_normTQT, TextureCache::NORMAL);
+        view->TxtCache()->Make(this->_normTQT, 0, 0, 0)->Load();
+    }
+
 }
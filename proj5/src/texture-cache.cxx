@@ -10,22 +10,58 @@
  */
 
 #include "texture-cache.hxx"
+#include <algorithm>
 #include <utility>
 
 #define ONE_MEG         (1024*1024)
 #define ONE_GIG         (1024*ONE_MEG)
 
+// the number of decoded images that we upload to OpenGL per frame
+#define UPLOADS_PER_FRAME       8
+
+// the minimum number of layers in a texture array; this takes precedence over the
+// resident limit, since the fallback textures must fit
+#define MIN_LAYERS_PER_ARRAY    16
+
+// the budget for decoded tile images held in RAM
+#define IMAGE_CACHE_BUDGET      (256*ONE_MEG)
+
 // initialize the texture cache
 TextureCache::TextureCache ()
-    : _residentLimit(ONE_GIG), _residentSzb(0), _clock(0)
+    : _residentLimit(ONE_GIG), _residentSzb(0), _clock(0),
+      _uploadLimit(UPLOADS_PER_FRAME), _decoder(new cs237::ThreadPool()),
+      _images(new ImageCache(IMAGE_CACHE_BUDGET)), _nGLHits(0),
+      detail(nullptr)
 { }
 
+TextureCache::~TextureCache ()
+{
+  // shut down the decoder first, since its jobs refer to the textures
+    delete this->_decoder;
+    this->_done.clear();
+    delete this->_images;
+    for (auto it = this->_textureTbl.begin();  it != this->_textureTbl.end();  it++) {
+        delete it->second;
+    }
+    for (int k = 0;  k < NUM_KINDS;  k++) {
+        delete this->_arrays[k]._txt;
+    }
+    delete this->detail;
+}
+
+void TextureCache::AddTree (TQT::TextureQTree *tree, Kind kind)
+{
+    this->_treeKind[tree] = kind;
+}
+
 Texture *TextureCache::Make (TQT::TextureQTree *tree, int level, int row, int col)
 {
     TextureCache::Key key(tree, level, row, col);
     TextureCache::TextureTbl::const_iterator got = this->_textureTbl.find(key);
     if (got == this->_textureTbl.end()) {
-        Texture *txt = new Texture(this, tree, level, row, col);
+        auto kind = this->_treeKind.find(tree);
+        assert (kind != this->_treeKind.end());
+        Texture *txt = new Texture(this, tree, kind->second, level, row, col);
         this->_textureTbl.insert(std::pair<TextureCache::Key,Texture *>(key, txt));
         return txt;
     }
@@ -40,13 +76,7 @@ void TextureCache::_MakeActive (Texture *txt)
 {
     assert (! txt->_active);
     if (txt->_activeIdx >= 0) {
-        assert (this->_inactive[txt->_activeIdx] == txt);
-
-      // first remove txt from the inactive list by moving the last element to where it is
-        Texture *last = this->_inactive.back();
-        this->_inactive[txt->_activeIdx] = last;
-        this->_inactive.pop_back();
-        last->_activeIdx = txt->_activeIdx;
+        this->_RemoveInactive (txt);
     }
     // else txt did not have a texture associated with it, so it is not on the inactive list
 
@@ -73,9 +103,217 @@ void TextureCache::_Release (Texture *txt)
     this->_inactive.push_back(txt);
 }
 
+// remove a texture from the inactive list by moving the last element to where it is
+void TextureCache::_RemoveInactive (Texture *txt)
+{
+    assert (! txt->_active);
+    assert (this->_inactive[txt->_activeIdx] == txt);
+
+    Texture *last = this->_inactive.back();
+    this->_inactive[txt->_activeIdx] = last;
+    this->_inactive.pop_back();
+    last->_activeIdx = txt->_activeIdx;
+    txt->_activeIdx = -1;
+}
+
+// queue a request to decode the image for a texture.  The image comes from the image
+// cache, which only reads the TQT file on a miss, and is added to the _done list,
+// which is processed by NewFrame.
+void TextureCache::_RequestImage (Texture *txt)
+{
+    assert (! txt->_pending);
+    txt->_pending = true;
+    this->_decoder->Enqueue ([this, txt] () {
+        ImageCache::Image img = this->_images->Get (txt->_tree, txt->_level, txt->_row, txt->_col);
+        std::lock_guard<std::mutex> guard(this->_doneLock);
+        this->_done.push_back (TextureCache::Decoded{txt, img});
+    });
+}
+
+// start a new frame: advance the clock and upload (some of) the images that have been
+// decoded since the last frame.
+void TextureCache::NewFrame ()
+{
+    this->_clock++;
+
+    std::vector<Decoded> ready;
+    {
+        std::lock_guard<std::mutex> guard(this->_doneLock);
+        size_t n = this->_done.size();
+        if (n > static_cast<size_t>(this->_uploadLimit)) {
+            n = this->_uploadLimit;
+        }
+        ready.assign (this->_done.begin(), this->_done.begin() + n);
+        this->_done.erase (this->_done.begin(), this->_done.begin() + n);
+    }
+
+    std::vector<Decoded> stalled;
+    for (auto it = ready.begin();  it != ready.end();  it++) {
+        Texture *txt = it->_txt;
+        if (it->_img == nullptr) {
+            std::cerr << "TextureCache: unable to load texture (" << txt->_level << ", "
+                << txt->_row << ", " << txt->_col << ")\n";
+            exit (1);
+        }
+        assert (txt->_pending && (txt->_layer < 0));
+        if (this->_AllocLayer (txt, it->_img.get())) {
+            txt->_pending = false;
+        }
+        else {
+          // all of the layers are in use, so try again in a later frame
+            stalled.push_back (*it);
+        }
+    }
+
+    if (! stalled.empty()) {
+        std::lock_guard<std::mutex> guard(this->_doneLock);
+        this->_done.insert (this->_done.end(), stalled.begin(), stalled.end());
+    }
+}
+
+// copy the texture's image into a layer of the texture array for its kind
+bool TextureCache::_AllocLayer (Texture *txt, cs237::image2d *img)
+{
+    TileArray *arr = &(this->_arrays[txt->_kind]);
+
+    if (arr->_txt == nullptr) {
+      // allocate the storage for the array, which is sized by the first image.  Each
+      // kind gets an equal share of the resident limit, so the number of layers is
+      // the number of images that fit in that share.
+        GLint maxLayers;
+        CS237_CHECK( glGetIntegerv (GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers) );
+        uint64_t bytesPerLayer = img->nBytes();
+        uint64_t share = this->_residentLimit / NUM_KINDS;
+        int nLayers = static_cast<int>(std::min(share / bytesPerLayer, uint64_t(maxLayers)));
+        if (nLayers < MIN_LAYERS_PER_ARRAY) {
+            nLayers = std::min(MIN_LAYERS_PER_ARRAY, int(maxLayers));
+        }
+      // for compressed images, the external format and type are ignored, since there is no data
+        GLenum fmt = img->isCompressed() ? GL_RGB : img->format();
+        GLenum ty = img->isCompressed() ? GL_UNSIGNED_BYTE : img->type();
+        arr->_txt = new cs237::texture2DArray (
+            img->format(), img->width(), img->height(), nLayers, fmt, ty);
+        arr->_format = img->format();
+        arr->_txt->Parameter (GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        arr->_txt->Parameter (GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        arr->_txt->Parameter (GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        arr->_txt->Parameter (GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        arr->_owner.assign (nLayers, nullptr);
+      // the storage is resident from now on, whether or not the layers are in use
+        this->_residentSzb += uint64_t(nLayers) * bytesPerLayer;
+      // free layers are taken from the back, so push them in reverse order
+        arr->_free.reserve (nLayers);
+        for (int i = nLayers-1;  i >= 0;  i--) {
+            arr->_free.push_back (i);
+        }
+    }
+    else if ((static_cast<GLenum>(img->width()) != arr->_txt->width())
+    || (static_cast<GLenum>(img->height()) != arr->_txt->height())
+    || (img->format() != arr->_format)) {
+        std::cerr << "TextureCache: texture (" << txt->_level << ", " << txt->_row << ", "
+            << txt->_col << ") has size " << img->width() << "x" << img->height()
+            << " and format " << img->format() << ", but expected " << arr->_txt->width()
+            << "x" << arr->_txt->height() << " and format " << arr->_format << "\n";
+        exit (1);
+    }
+
+    if (arr->_free.empty()) {
+      // evict the least-recently used inactive texture of the same kind
+        Texture *victim = nullptr;
+        for (auto it = this->_inactive.begin();  it != this->_inactive.end();  it++) {
+            Texture *t = *it;
+            if ((t->_kind == txt->_kind) && (t->_layer >= 0) && (! t->_pinned)
+            && ((victim == nullptr) || (t->_lastUsed < victim->_lastUsed))) {
+                victim = t;
+            }
+        }
+        if (victim == nullptr) {
+            arr->_nStalls++;
+            return false;
+        }
+        this->_RemoveInactive (victim);
+        arr->_owner[victim->_layer] = nullptr;
+        arr->_free.push_back (victim->_layer);
+        victim->_layer = -1;
+        arr->_nEvictions++;
+    }
+
+  // fresh layers are handed out in increasing order, so a layer below the high-water
+  // mark has held some other texture's image
+    int layer = arr->_free.back();
+    arr->_free.pop_back();
+    if (layer < arr->_highWater) {
+        arr->_nReuses++;
+    }
+    else {
+        arr->_highWater = layer+1;
+    }
+    arr->_txt->Upload (layer, img);
+    arr->_owner[layer] = txt;
+    txt->_layer = layer;
+
+    return true;
+}
+
+// return the format of the images in the texture array for the given kind of texture
+GLenum TextureCache::Format (Kind kind) const
+{
+    return this->_arrays[kind]._format;
+}
+
+// bind the texture array for the given kind of texture
+void TextureCache::BindArray (Kind kind, int txtUnit)
+{
+    TileArray *arr = &(this->_arrays[kind]);
+    if (arr->_txt != nullptr) {
+        CS237_CHECK( glActiveTexture (GL_TEXTURE0 + txtUnit) );
+        arr->_txt->Bind();
+    }
+}
+
+// print statistics about the occupancy of the texture arrays
+void TextureCache::ReportStats (std::ostream &outS)
+{
+    static const char *kindName[NUM_KINDS] = { "color", "normal" };
+
+    outS << "texture cache: frame " << this->_clock << ", "
+        << (this->_residentSzb / ONE_MEG) << "Mb resident\n";
+    for (int k = 0;  k < NUM_KINDS;  k++) {
+        TileArray *arr = &(this->_arrays[k]);
+        if (arr->_txt == nullptr) {
+            outS << "  " << kindName[k] << ": not allocated\n";
+            continue;
+        }
+        int nLayers = arr->_owner.size();
+        int nUsed = nLayers - arr->_free.size();
+        int nActive = 0, nPinned = 0;
+        for (auto it = arr->_owner.begin();  it != arr->_owner.end();  it++) {
+            if (*it != nullptr) {
+                if ((*it)->_active) nActive++;
+                if ((*it)->_pinned) nPinned++;
+            }
+        }
+        outS << "  " << kindName[k] << ": " << nUsed << "/" << nLayers << " layers in use ("
+            << nActive << " active, " << nPinned << " pinned, " << (nUsed - nActive)
+            << " inactive); " << arr->_nEvictions << " evictions, " << arr->_nStalls
+            << " stalled uploads\n";
+        outS << "    " << arr->_highWater << " layers allocated, " << arr->_nReuses
+            << " uploads reused an evicted layer\n";
+    }
+    uint64_t nRAMHits = this->_images->NumHits();
+    uint64_t nDiskReads = this->_images->NumMisses();
+    uint64_t nRequests = this->_nGLHits + nRAMHits + nDiskReads;
+    double scale = (nRequests > 0) ? 100.0 / double(nRequests) : 0.0;
+    outS << "  " << nRequests << " tile requests: " << double(this->_nGLHits) * scale
+        << "% GL, " << double(nRAMHits) * scale << "% RAM, " << double(nDiskReads) * scale
+        << "% disk\n";
+    outS << "  image cache: " << (this->_images->Size() / ONE_MEG) << "/"
+        << (this->_images->Budget() / ONE_MEG) << "Mb, " << this->_images->NumEvictions()
+        << " evictions, " << this->_images->NumRecycled() << " recycled images\n";
+}
+
 cs237::texture2D *TextureCache::_AllocTex2D (cs237::image2d *img)
 {
-/* FIXME: eventually, we should reuse inactive textures to reduce GPU memory pressure */
     cs237::texture2D *txt = new cs237::texture2D (GL_TEXTURE_2D, img);
     txt->Parameter (GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     txt->Parameter (GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -86,6 +324,7 @@ cs237::texture2D *TextureCache::_AllocTex2D (cs237::image2d *img)
 }
 
 void TextureCache::_SetDetailTex(cs237::image2d *img){
+  delete this->detail;
   this->detail = this->_AllocTex2D(img);
 }
 
@@ -95,27 +334,29 @@ cs237::texture2D *TextureCache::_GetDetailTex(){
 
 /***** class Texture member functions *****/
 
-Texture::Texture (TextureCache *cache, TQT::TextureQTree *tree, int level, int row, int col)
-    : _txt(nullptr), _cache(cache), _tree(tree), _level(level), _row(row), _col(col),
-      _lastUsed(0), _activeIdx(-1), _active(false)
+Texture::Texture (TextureCache *cache, TQT::TextureQTree *tree, int kind, int level, int row, int col)
+    : _cache(cache), _tree(tree), _level(level), _row(row), _col(col),
+      _lastUsed(0), _kind(kind), _layer(-1), _activeIdx(-1), _active(false), _pending(false),
+      _pinned(false)
 { }
 
 Texture::~Texture ()
 {
 /* FIXME: remove from cache data structures as needed */
-    if (this->_txt != nullptr)
-        delete this->_txt;
 }
 
 // preload the texture data into OpenGL; this operation is a hint to the texture
-// cache that the texture cache that the texture is going to be used soon.
+// cache that the texture cache that the texture is going to be used soon.  The image
+// is decoded by a worker thread and uploaded by a later call to NewFrame, so the
+// renderer must check isResident() before using the texture.
 void Texture::Activate ()
 {
     assert (! this->_active);
-    if (this->_txt == nullptr) {
-      // load the image data from the TQT and create a texture for it
-        cs237::image2d *img = this->_tree->LoadImage (this->_level, this->_row, this->_col, false);
-        this->_txt = this->_cache->_AllocTex2D (img);
+    if (this->_layer >= 0) {
+        this->_cache->_nGLHits++;
+    }
+    else if (! this->_pending) {
+        this->_cache->_RequestImage (this);
     }
 
     this->_cache->_MakeActive (this);
@@ -123,6 +364,38 @@ void Texture::Activate ()
 
 }
 
+// load the image data from the TQT into the texture array on the calling thread
+void Texture::Load ()
+{
+    this->_pinned = true;
+    if (this->_layer >= 0) {
+        return;
+    }
+  // fallback textures are loaded before they are ever activated, so there cannot
+  // be a pending decode request for this texture
+    assert (! this->_pending);
+    ImageCache::Image img = this->_cache->_images->Get (this->_tree, this->_level, this->_row, this->_col);
+    if (img == nullptr) {
+        std::cerr << "Texture::Load: unable to load texture (" << this->_level << ", "
+            << this->_row << ", " << this->_col << ")\n";
+        exit (1);
+    }
+    if (! this->_cache->_AllocLayer (this, img.get())) {
+        std::cerr << "Texture::Load: no free layer for texture (" << this->_level << ", "
+            << this->_row << ", " << this->_col << ")\n";
+        exit (1);
+    }
+
+}
+
+// record the use of this texture in the current frame and return its layer
+int Texture::Use ()
+{
+    assert (this->_layer >= 0);
+    this->_lastUsed = this->_cache->_clock;
+    return this->_layer;
+}
+
 // hint to the texture cache that this texture is not needed.
 void Texture::Release ()
 {
@@ -15,8 +15,10 @@
 #define _TEXTURE_CACHE_
 
 #include "tqt.hxx"
+#include "image-cache.hxx"
 #include <unordered_map>
 #include <vector>
+#include <mutex>
 
 class TextureCache;
 
@@ -27,62 +29,117 @@ class Texture {
   //! is this texture active?
     bool isActive () const { return this->_active; }
 
+  //! is the texture's image loaded into OpenGL?
+    bool isResident () const { return (this->_layer >= 0); }
+
   //! activate the texture; this operation is a hint to the texture
-  //! cache that the texture is going to be used soon.
+  //! cache that the texture is going to be used soon.  If the texture is not
+  //! resident, then a request to decode its image is queued and the texture
+  //! becomes resident in some later frame.
     void Activate ();
 
-  //! bind this texture to the given texture unit (0 based)
-    void Use (int txtUnit)
-    {
-        if (! this->_active) {
-            this->Activate();
-        }
-        CS237_CHECK( glActiveTexture (GL_TEXTURE0 + txtUnit) );
-        this->_txt->Bind();
-    }
+  //! load the texture's image synchronously.  This operation is meant for
+  //! textures that are used as fallbacks (e.g., the roots of the quadtrees), so
+  //! the texture is pinned and never evicted from the cache.
+    void Load ();
+
+  //! record that the texture is used in the current frame and return the index of its
+  //! layer in the cache's texture array for its kind; the texture must be resident.
+    int Use ();
 
   //! hint to the texture cache that this texture is not needed.
     void Release ();
 
+  //! the texture quadtree from which this texture comes
+    TQT::TextureQTree *Tree () const { return this->_tree; }
+
   private:
-    cs237::texture2D    *_txt;          //!< the OpenGL texture (or nullptr, if not resident)
     TextureCache        *_cache;        //!< the cache that this belongs to
     TQT::TextureQTree   *_tree;         //!< the texture quadtree from which this texture comes
     uint32_t            _level;         //!< the TQT level of this texture
     uint32_t            _row;           //!< the TQT row of this texture
     uint32_t            _col;           //!< the TQT column of this texture
     uint32_t            _lastUsed;      //!< the last frame that this texture was used
+    int                 _kind;          //!< the kind of texture (color or normal map)
+    int                 _layer;         //!< the layer that holds this texture's image
+                                        //!  (or -1, if not resident)
     int                 _activeIdx;     //!< index of this texture in the cache's _active vector
     bool                _active;        //!< true when this texture is in use
+    bool                _pending;       //!< true while a decode request for this
+                                        //!  texture is queued or running
+    bool                _pinned;        //!< true for textures that are never evicted
 
-    Texture (TextureCache *cache, TQT::TextureQTree *tree, int level, int row, int col);
+    Texture (TextureCache *cache, TQT::TextureQTree *tree, int kind, int level, int row, int col);
 
     friend class TextureCache;
     friend struct TxtCompare;
 };
 
-//! A cache of OpenGL textures that is backed by texture-quad-trees
+//! A cache of OpenGL textures that is backed by texture-quad-trees.  All of the tiles
+//! of a given kind (color or normal map) are stored as layers of a single 2D array
+//! texture, so a tile is identified by its layer index and switching tiles does not
+//! require binding a different texture.
+//!
+//! Tile images are obtained through a shared ImageCache, so there are three tiers of
+//! storage for a tile: the TQT file on disk, a decoded image in RAM, and a layer in
+//! an OpenGL texture array.
 class TextureCache {
   public:
 
+  //! the kinds of texture that the cache holds; each kind has its own texture array
+    enum Kind { COLOR = 0, NORMAL = 1, NUM_KINDS = 2 };
+
     TextureCache();
     ~TextureCache();
 
+  //! register a texture quadtree with the cache; this must be done before any
+  //! textures are made from the tree.
+  //! \param tree the texture quadtree
+  //! \param kind the kind of images in the tree
+    void AddTree (TQT::TextureQTree *tree, Kind kind);
+
   //! make a texture handle for the specified quad in the texture quad tree
     Texture *Make (TQT::TextureQTree *tree, int level, int row, int col);
 
+  //! bind the texture array for the given kind of texture to a texture unit (0 based)
+    void BindArray (Kind kind, int txtUnit);
+
+  //! the format of the images in the texture array for the given kind of texture;
+  //! this is either an uncompressed format (e.g., GL_RGB) or the compressed format of
+  //! the TQT tiles (e.g., GL_COMPRESSED_RG_RGTC2).  It is 0 if no images of the kind
+  //! have been loaded.
+    GLenum Format (Kind kind) const;
+
+  //! print statistics about the occupancy of the texture arrays and the hit rates of
+  //! the GL, RAM, and disk tiers
+    void ReportStats (std::ostream &outS);
+
   //! mark the beginning of a new frame; the texture cache uses this information to
-  //! track LRU information
-    void NewFrame () { this->_clock++; }
+  //! track LRU information.  This method also uploads images that have been decoded
+  //! since the last frame, so it must be called from the render thread.
+    void NewFrame ();
 
     void _SetDetailTex(cs237::image2d *img);
 
     cs237::texture2D *_GetDetailTex();
 
   private:
-    uint64_t    _residentLimit; //!< soft upper bound on the size of GL resident textures
-    uint64_t    _residentSzb;   //!< estimate of the size of GL resident textures
+    uint64_t    _residentLimit; //!< upper bound on the size of the texture arrays, which
+                                //!  determines how many layers they have
+    uint64_t    _residentSzb;   //!< the size of the allocated texture arrays
     uint32_t    _clock;         //!< counts number of frames
+    int         _uploadLimit;   //!< maximum number of textures uploaded per frame
+    cs237::ThreadPool *_decoder; //!< worker threads that decode TQT images
+    ImageCache  *_images;       //!< decoded tile images shared by all kinds
+    uint64_t    _nGLHits;       //!< number of activations of resident textures
+
+  //! a decoded image that is waiting to be uploaded to OpenGL
+    struct Decoded {
+        Texture         *_txt;  //!< the texture that requested the image
+        ImageCache::Image _img; //!< the image (nullptr on error)
+    };
+    std::mutex  _doneLock;      //!< protects _done
+    std::vector<Decoded> _done; //!< decoded images in order of completion
 
   //! keys for hashing texture specifications
     struct Key {
@@ -115,6 +172,27 @@ class TextureCache {
         }
     };
 
+  //! a 2D array texture that holds the resident textures of one kind, along with
+  //! the bookkeeping for its layers.  The storage is allocated when the first image
+  //! of the kind is uploaded, since that is when we know the tile size.
+    struct TileArray {
+        cs237::texture2DArray   *_txt;          //!< the array (nullptr until first upload)
+        GLenum                  _format;        //!< the format of the layers
+        std::vector<Texture *>  _owner;         //!< the texture in each layer (or nullptr)
+        std::vector<int>        _free;          //!< the free layers
+        int                     _highWater;     //!< layers at or above this index have
+                                                //!  never held an image
+        uint64_t                _nEvictions;    //!< number of textures evicted to free a layer
+        uint64_t                _nStalls;       //!< number of uploads deferred for lack of
+                                                //!  a free layer
+        uint64_t                _nReuses;       //!< number of uploads into a layer that
+                                                //!  previously held another texture
+
+        TileArray ()
+            : _txt(nullptr), _format(0), _highWater(0), _nEvictions(0), _nStalls(0), _nReuses(0)
+        { }
+    };
+
   // for ordering textures by timestamp
     struct TxtCompare {
         bool operator() (const Texture &lhs, const Texture &rhs) const
@@ -126,6 +204,8 @@ class TextureCache {
     typedef std::unordered_map<Key,Texture *,Hash,Equal> TextureTbl;
 
     TextureTbl _textureTbl;             //!< mapping from TQT spec to Texture
+    std::unordered_map<TQT::TextureQTree *, Kind> _treeKind; //!< the kind of each registered tree
+    TileArray _arrays[NUM_KINDS];       //!< the texture arrays indexed by kind
     std::vector<Texture *> _active;     //!< active textures
     std::vector<Texture *> _inactive;   //!< inactive textures that are loaded, but may be reused.
     cs237::texture2D *detail;           //!< detail texture
@@ -136,7 +216,18 @@ class TextureCache {
   //! record that the given texture is now inactive
     void _Release (Texture *txt);
 
-  //! allocate an OpenGL texture, either by reusing a free texture or by creating a new one.
+  //! queue a request to decode the image for the given texture
+    void _RequestImage (Texture *txt);
+
+  //! copy a texture's image into a free layer of the array for its kind, evicting the
+  //! least-recently used inactive texture if there is no free layer.
+  //! \return false if every layer is held by an active or pinned texture
+    bool _AllocLayer (Texture *txt, cs237::image2d *img);
+
+  //! remove a texture from the inactive list
+    void _RemoveInactive (Texture *txt);
+
+  //! allocate a stand-alone OpenGL texture that holds the given image
     cs237::texture2D *_AllocTex2D (cs237::image2d *img);
 
     friend class Texture;
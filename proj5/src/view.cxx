@@ -16,10 +16,24 @@
 #include "map-cell.hxx"
 #include "buffer-cache.hxx"
 #include "texture-cache.hxx"
+#include "asset-loader.hxx"
 #include <map>
 
 static void Error (int err, const char *msg);
 static GLFWwindow *InitGLFW (int wid, int ht, const char *title);
+static GLuint InitSkybox (AssetLoader &loader, const int faces[6]);
+
+// the faces of the skyboxes in the order N, W, E, S, U, D
+static const char *SunnyFaces[6] = {
+        "../../maps/Sunny/NSunny.png", "../../maps/Sunny/WSunny.png",
+        "../../maps/Sunny/ESunny.png", "../../maps/Sunny/SSunny.png",
+        "../../maps/Sunny/USunny.png", "../../maps/Sunny/DSunny.png"
+    };
+static const char *CloudyFaces[6] = {
+        "../../maps/cloudy/NCloudy.png", "../../maps/cloudy/WCloudy.png",
+        "../../maps/cloudy/ECloudy.png", "../../maps/cloudy/SCloudy.png",
+        "../../maps/cloudy/UCloudy.png", "../../maps/cloudy/DCloudy.png"
+    };
 
 
 /***** class View member functions *****/
@@ -32,6 +46,25 @@ View::View (class Map *map)
 
 void View::Init (int wid, int ht)
 {
+  // start decoding the startup images on worker threads; they are uploaded to
+  // OpenGL after the window has been created and the shaders have been compiled.
+  // The skybox faces are expanded to RGBA, which is the format of the cube maps.
+    AssetLoader loader;
+    int detailId;
+    if(/*this->_map->Name() == "Grand Canyon"*/ true){
+      detailId = loader.Request ("../data/detail.png");
+    }
+    else{
+      detailId = loader.Request ("../data/noise.png");
+    }
+    int sunnyIds[6], cloudyIds[6];
+    for (int i = 0;  i < 6;  i++) {
+        sunnyIds[i] = loader.Request (SunnyFaces[i], false, true);
+    }
+    for (int i = 0;  i < 6;  i++) {
+        cloudyIds[i] = loader.Request (CloudyFaces[i], false, true);
+    }
+
     this->_window = InitGLFW(wid, ht, this->_map->Name().c_str());
 
   // attach the view to the window so we can get it from callbacks
@@ -83,16 +116,6 @@ void View::Init (int wid, int ht)
 
     glClearColor(0.2f, 0.2f, 0.4f, 1.0f);
 
-  // initialize detail texture
-    if(/*this->_map->Name() == "Grand Canyon"*/ true){
-      cs237::image2d detail = cs237::image2d::image2d("../data/detail.png");
-      this->_tCache->_SetDetailTex(&detail);
-    }
-    else{
-      cs237::image2d detail = cs237::image2d::image2d("../data/noise.png");
-      this->_tCache->_SetDetailTex(&detail);
-    }
-
   /** initialize shaders **/
 
   // Wireframe Mode
@@ -125,6 +148,9 @@ void View::Init (int wid, int ht)
     this->tTileWidthLoc = this->textureshader->UniformLocation("tileWidth");
     this->tMapLoc = this->textureshader->UniformLocation("tMap");  // will always set to 1
     this->normMapLoc = this->textureshader->UniformLocation("normMap"); //will always set to 1
+    this->tMapLayerLoc = this->textureshader->UniformLocation("tMapLayer");
+    this->normMapLayerLoc = this->textureshader->UniformLocation("normMapLayer");
+    this->normMapRGLoc = this->textureshader->UniformLocation("normMapRG");
     this->lDirLoc = this->textureshader->UniformLocation("direction");
     this->lAmbLoc = this->textureshader->UniformLocation("ambient");
     this->lIntLoc = this->textureshader->UniformLocation("intensity");
@@ -149,7 +175,24 @@ void View::Init (int wid, int ht)
   this->skyProjMatLoc = this->skyboxshader->UniformLocation("projMat");
   this->cubeMapLoc = this->skyboxshader->UniformLocation("cubeMap");
 
-  // Initialize Cell textures
+  // Object Shader
+    this->objshader = LoadShader("../shaders/objects");
+    this->objViewMatLoc = this->objshader->UniformLocation("viewMat");
+    this->objProjMatLoc = this->objshader->UniformLocation("projMat");
+    this->objDiffuseColorLoc = this->objshader->UniformLocation("diffuseColor");
+    this->objDiffuseMapLoc = this->objshader->UniformLocation("diffuseMap");
+    this->objHasDiffuseMapLoc = this->objshader->UniformLocation("hasDiffuseMap");
+    this->objLDirLoc = this->objshader->UniformLocation("direction");
+    this->objLAmbLoc = this->objshader->UniformLocation("ambient");
+    this->objLIntLoc = this->objshader->UniformLocation("intensity");
+    this->objNoLightLoc = this->objshader->UniformLocation("noLight");
+    this->objNoFogLoc = this->objshader->UniformLocation("noFog");
+    this->objFogDensityLoc = this->objshader->UniformLocation("fogDensity");
+    this->objFogColorLoc = this->objshader->UniformLocation("fogColor");
+    this->objWireframeLoc = this->objshader->UniformLocation("wireframe");
+    CS237_CHECK( glGenBuffers (1, &this->_instBufId) );
+
+  // Initialize Cell textures; the cell objects are loaded on demand (see RenderObjects)
     for(int i = 0; i < this->_map->nRows(); i++){
         for(int j = 0; j < this->_map->nCols(); j++){
             this->_map->Cell(i, j)->InitTextures(this);
@@ -166,93 +209,40 @@ void View::Init (int wid, int ht)
   // Initialize animation state
     this->_lastStep = glfwGetTime();
 
-    //initializing sunny skybox textures
-    glGenTextures(1, &this->sunnyTexture);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, this->sunnyTexture);
-
-    cs237::image2d *NSunnyImage = new cs237::image2d("../../maps/Sunny/NSunny.png", false);
-    cs237::image2d *WSunnyImage = new cs237::image2d("../../maps/Sunny/WSunny.png", false);
-    cs237::image2d *ESunnyImage = new cs237::image2d("../../maps/Sunny/ESunny.png", false);
-    cs237::image2d *SSunnyImage = new cs237::image2d("../../maps/Sunny/SSunny.png", false);
-    cs237::image2d *USunnyImage = new cs237::image2d("../../maps/Sunny/USunny.png", false);
-    cs237::image2d *DSunnyImage = new cs237::image2d("../../maps/Sunny/DSunny.png", false);
-
-    glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_Z, 0, GL_RGBA,
-                 NSunnyImage->width(), NSunnyImage->height(), 0,
-                 NSunnyImage->format(), NSunnyImage->type(),
-                 NSunnyImage->data());
-
-    glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X, 0, GL_RGBA,
-                 WSunnyImage->width(), WSunnyImage->height(), 0,
-                 WSunnyImage->format(), WSunnyImage->type(),
-                 WSunnyImage->data());
-
-    glTexImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_X, 0, GL_RGBA,
-                 ESunnyImage->width(), ESunnyImage->height(), 0,
-                 ESunnyImage->format(), ESunnyImage->type(),
-                 ESunnyImage->data());
-
-    glTexImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_Z, 0, GL_RGBA,
-                 SSunnyImage->width(), SSunnyImage->height(), 0,
-                 SSunnyImage->format(), SSunnyImage->type(),
-                 SSunnyImage->data());
-
-    glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_Y, 0, GL_RGBA,
-                 USunnyImage->width(), USunnyImage->height(), 0,
-                 USunnyImage->format(), USunnyImage->type(),
-                 USunnyImage->data());
-
-    glTexImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_Y, 0, GL_RGBA,
-                 DSunnyImage->width(), DSunnyImage->height(), 0,
-                 DSunnyImage->format(), DSunnyImage->type(),
-                 DSunnyImage->data());
+  // initialize detail texture
+    cs237::image2d *detail = loader.Take (detailId);
+    this->_tCache->_SetDetailTex(detail);
+    delete detail;
 
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  // initialize sunny and cloudy (for rain mode) skybox textures
+    this->sunnyTexture = InitSkybox (loader, sunnyIds);
+    this->cloudyTexture = InitSkybox (loader, cloudyIds);
 
-    //initialize cloudy skybox textures
-    glGenTextures(1, &this->cloudyTexture);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, this->cloudyTexture);
-
-    cs237::image2d *NCloudyImage = new cs237::image2d("../../maps/cloudy/NCloudy.png", false);
-    cs237::image2d *WCloudyImage = new cs237::image2d("../../maps/cloudy/WCloudy.png", false);
-    cs237::image2d *ECloudyImage = new cs237::image2d("../../maps/cloudy/ECloudy.png", false);
-    cs237::image2d *SCloudyImage = new cs237::image2d("../../maps/cloudy/SCloudy.png", false);
-    cs237::image2d *UCloudyImage = new cs237::image2d("../../maps/cloudy/UCloudy.png", false);
-    cs237::image2d *DCloudyImage = new cs237::image2d("../../maps/cloudy/DCloudy.png", false);
-
-    glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_Z, 0, GL_RGBA,
-                 NCloudyImage->width(), NCloudyImage->height(), 0,
-                 NCloudyImage->format(), NCloudyImage->type(),
-                 NCloudyImage->data());
-
-    glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X, 0, GL_RGBA,
-                 WCloudyImage->width(), WCloudyImage->height(), 0,
-                 WCloudyImage->format(), WCloudyImage->type(),
-                 WCloudyImage->data());
-
-    glTexImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_X, 0, GL_RGBA,
-                 ECloudyImage->width(), ECloudyImage->height(), 0,
-                 ECloudyImage->format(), ECloudyImage->type(),
-                 ECloudyImage->data());
-
-    glTexImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_Z, 0, GL_RGBA,
-                 SCloudyImage->width(), SCloudyImage->height(), 0,
-                 SCloudyImage->format(), SCloudyImage->type(),
-                 SCloudyImage->data());
-
-    glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_Y, 0, GL_RGBA,
-                 UCloudyImage->width(), UCloudyImage->height(), 0,
-                 UCloudyImage->format(), UCloudyImage->type(),
-                 UCloudyImage->data());
-
-    glTexImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_Y, 0, GL_RGBA,
-                 DCloudyImage->width(), DCloudyImage->height(), 0,
-                 DCloudyImage->format(), DCloudyImage->type(),
-                 DCloudyImage->data());
+    loader.ReportTimes (std::clog);
+}
+
+// create a cube-map texture from the six decoded faces of a skybox
+static GLuint InitSkybox (AssetLoader &loader, const int faces[6])
+{
+  // the cube-map targets for the N, W, E, S, U, and D faces
+    static const GLenum targets[6] = {
+            GL_TEXTURE_CUBE_MAP_POSITIVE_Z, GL_TEXTURE_CUBE_MAP_POSITIVE_X,
+            GL_TEXTURE_CUBE_MAP_NEGATIVE_X, GL_TEXTURE_CUBE_MAP_NEGATIVE_Z,
+            GL_TEXTURE_CUBE_MAP_POSITIVE_Y, GL_TEXTURE_CUBE_MAP_NEGATIVE_Y
+        };
+
+    GLuint txt;
+    glGenTextures(1, &txt);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, txt);
+
+    for (int i = 0;  i < 6;  i++) {
+        cs237::image2d *img = loader.Take (faces[i]);
+        glTexImage2D(targets[i], 0, GL_RGBA,
+                     img->width(), img->height(), 0,
+                     img->format(), img->type(),
+                     img->data());
+        delete img;
+    }
 
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -261,6 +251,8 @@ void View::Init (int wid, int ht)
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
     glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+    return txt;
 }
 
 #define SQRT_2                  1.41421356237f
@@ -341,6 +333,10 @@ void View::HandleKey (int key, int mods)
       case GLFW_KEY_R: // toggle rain
         this->_rainMode = !this->_rainMode;
       break;
+      case GLFW_KEY_S: // print texture-cache statistics
+        if (mods == 0)
+          this->_tCache->ReportStats(std::clog);
+      break;
       case GLFW_KEY_EQUAL:
         if (mods == GLFW_MOD_SHIFT) { // shift+'=' is '+'
           // decrease error tolerance
@@ -15,6 +15,7 @@
 #include "cs237.hxx"
 #include "map.hxx"
 #include "camera.hxx"
+#include "instance-batch.hxx"
 #include <vector>
 
 // animation time step (100Hz)
@@ -90,6 +91,9 @@ class View {
   //! renders the skybox
     void drawSky();
 
+  //! renders the objects in the map's cells using instanced rendering
+    void RenderObjects();
+
   //! returns a pointer to the map
     class Map* Map() { return this->_map; }
 
@@ -122,6 +126,9 @@ class View {
     int noFogLoc; // boolean signifying if the scene is being rendered with fog
     int fogDensityLoc; // fog density
     int fogColorLoc; // fog color
+    int tMapLayerLoc; // layer of the tile in the color texture array
+    int normMapLayerLoc; // layer of the tile in the normal-map texture array
+    int normMapRGLoc; // boolean signifying that the normal map only has x and z components
     int tColLoc; // column number
     int tRowLoc; // row number
     int tskyboxLoc; // boolean signifying that the skybox is being drawn
@@ -133,6 +140,22 @@ class View {
     int rViewMatLoc; // view matrix
     int rProjMatLoc; // projection matrix
 
+  //! object shader and uniform locations
+    cs237::ShaderProgram *objshader;
+    int objViewMatLoc; // view matrix
+    int objProjMatLoc; // projection matrix
+    int objDiffuseColorLoc; // uniform diffuse color of the mesh
+    int objDiffuseMapLoc; // diffuse-color map
+    int objHasDiffuseMapLoc; // boolean signifying that the mesh has a diffuse-color map
+    int objLDirLoc; // light direction
+    int objLAmbLoc; // ambient light intensity
+    int objLIntLoc; // directional light intensity
+    int objNoLightLoc; // boolean signifying if the scene is being rendered with light
+    int objNoFogLoc; // boolean signifying if the scene is being rendered with fog
+    int objFogDensityLoc; // fog density
+    int objFogColorLoc; // fog color
+    int objWireframeLoc; // boolean signifying wireframe mode
+
   //! skybox shader and unifomr locations
     cs237::ShaderProgram *skyboxshader;
     int skyViewMatLoc; // view matrix
@@ -163,6 +186,10 @@ class View {
 
   // view frustum
     class Frustum       *_frustum;      //!< contains 6 normals and signed distances
+
+  // object rendering
+    InstanceBatches     _objBatches;    //!< the visible object instances grouped by mesh
+    GLuint              _instBufId;     //!< buffer for the per-instance attributes
 };
 
 //! \brief Load, compile, and link a shader program.